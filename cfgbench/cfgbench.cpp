@@ -0,0 +1,307 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  cfgbench - startup time of the port list, from the registry and from a
+*  snapshot.
+*  It runs the monitor's own CPortList::LoadFromRegistry against the mock
+*  registry of mockspl, filled with the given number of ports. The registry
+*  path starts without a snapshot: the monitor walks every port key, builds
+*  the ports, decrypts their passwords and writes the snapshot, as at the
+*  first start. The snapshot path starts from that snapshot, with the same
+*  ConfigGeneration, as at every start after it. Each registry call can be
+*  given a cost, to stand for the trip through the spooler into the
+*  registry. The snapshot goes where the monitor puts it (MFM_SYSTEMDIR on
+*  POSIX). Builds on Windows and, through the POSIX backend, on Linux.
+*
+*  usage: cfgbench [-l ns] [-r runs] [ports...]
+*    -l ns        cost of every registry call (default 0)
+*    -r runs      runs per measurement, the best one is reported (default 3)
+*    ports        port counts to measure (default 100 5000 50000)
+*/
+
+#include "../monitor/stdafx.h"
+#include "../monitor/portlist.h"
+#include "../common/cfgsnap.h"
+#include "../mockspl/mockspl.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static CMockRegistry g_registry;
+static LPMONITOR2 g_pMonitor = NULL;
+static BYTE g_pwBlob[MAX_PWBLOB];
+static DWORD g_cbBlob = 0;
+static ULONGLONG g_ullLatency = 0;
+static ULONGLONG g_ullFreq = 0;
+static BOOL g_bFirst = TRUE;
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG Now()
+{
+	LARGE_INTEGER li;
+
+	if (g_ullFreq == 0)
+	{
+		QueryPerformanceFrequency(&li);
+		g_ullFreq = static_cast<ULONGLONG>(li.QuadPart);
+	}
+	QueryPerformanceCounter(&li);
+
+	//nanoseconds
+	return static_cast<ULONGLONG>(li.QuadPart) / g_ullFreq * 1000000000ULL +
+		static_cast<ULONGLONG>(li.QuadPart) % g_ullFreq * 1000000000ULL / g_ullFreq;
+}
+
+//-------------------------------------------------------------------------------------
+static LPCWSTR SnapshotFileName(LPWSTR szPath, size_t cchPath)
+{
+	//where CPortList writes it
+	GetSystemDirectoryW(szPath, static_cast<UINT>(cchPath));
+	wcscat_s(szPath, cchPath, L"\\mfilemon.snap");
+	return szPath;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL MakePasswordBlob()
+{
+	//a password as the monitor stores it: let it save a port, then take the blob
+	LPPORTCONFIG pConfig = new PORTCONFIG;
+
+	ZeroMemory(pConfig, sizeof(*pConfig));
+	wcscpy_s(pConfig->szPortName, LENGTHOF(pConfig->szPortName), L"CFGBENCH:");
+	GetTempPathW(LENGTHOF(pConfig->szOutputPath), pConfig->szOutputPath);
+	wcscpy_s(pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern), L"file%i.prn");
+	wcscpy_s(pConfig->szUser, LENGTHOF(pConfig->szUser), L"svc-print");
+	wcscpy_s(pConfig->szDomain, LENGTHOF(pConfig->szDomain), L"CORP");
+	wcscpy_s(pConfig->szPassword, LENGTHOF(pConfig->szPassword), L"Spool-2023!");
+	pConfig->bHideProcess = TRUE;
+
+	DWORD dwRet = MockAddPort(g_pMonitor, pConfig);
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	delete pConfig;
+
+	HANDLE hKey = g_registry.FindKey(g_registry.Root(), L"CFGBENCH:");
+	g_cbBlob = sizeof(g_pwBlob);
+
+	if (dwRet != ERROR_SUCCESS || !hKey || !g_registry.GetValue(hKey, L"Password", g_pwBlob, &g_cbBlob) ||
+		g_cbBlob == 0)
+	{
+		fprintf(stderr, "cfgbench: can't save a port with a password (%u)\n", dwRet);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static void FillRegistry(DWORD nPorts)
+{
+	g_registry.Clear();
+
+	HANDLE hRoot = g_registry.Root();
+	g_registry.SetDword(hRoot, L"LogLevel", 1);
+	g_registry.SetDword(hRoot, L"ConfigGeneration", 42);
+
+	//what a large print server looks like: one port per department or
+	//per user, a few of them running a command under another account
+	for (DWORD n = 0; n < nPorts; n++)
+	{
+		WCHAR szBuf[MAX_PATH + 1];
+
+		swprintf_s(szBuf, LENGTHOF(szBuf), L"MFM%05u:", n);
+		HANDLE hKey = g_registry.CreateKey(hRoot, szBuf);
+
+		swprintf_s(szBuf, LENGTHOF(szBuf), L"D:\\spool\\out\\dept%04u\\queue%u", n / 8, n % 8);
+		g_registry.SetString(hKey, L"OutputPath", szBuf);
+		g_registry.SetString(hKey, L"FilePattern", (n % 3) ? L"%Y%m%d\\%u-%j-%6i.pdf" : L"file%i.prn");
+		g_registry.SetDword(hKey, L"Overwrite", 0);
+		if (n % 10 == 0)
+		{
+			g_registry.SetString(hKey, L"UserCommand", L"\"C:\\Program Files\\gs\\bin\\gswin64c.exe\" "
+				L"-sDEVICE=pdfwrite -sOutputFile=\"%p\\%f.pdf\" -");
+			g_registry.SetString(hKey, L"ExecPath", L"C:\\Program Files\\gs\\bin");
+		}
+		else
+		{
+			g_registry.SetString(hKey, L"UserCommand", L"");
+			g_registry.SetString(hKey, L"ExecPath", L"");
+		}
+		g_registry.SetDword(hKey, L"WaitTermination", n % 10 == 0);
+		g_registry.SetDword(hKey, L"WaitTimeout", 30);
+		g_registry.SetDword(hKey, L"PipeData", n % 10 == 0);
+		g_registry.SetDword(hKey, L"HideProcess", 1);
+		g_registry.SetDword(hKey, L"ArchiveMode", 0);
+		g_registry.SetDword(hKey, L"ArchiveMaxSize", 0);
+		g_registry.SetDword(hKey, L"ArchiveMaxAge", 0);
+		g_registry.SetDword(hKey, L"ArchiveMaxJobs", 0);
+		g_registry.SetString(hKey, L"User", (n % 10 == 0) ? L"svc-print" : L"");
+		g_registry.SetString(hKey, L"Domain", (n % 10 == 0) ? L"CORP" : L"");
+		g_registry.SetValue(hKey, L"Password", REG_BINARY, g_pwBlob, (n % 10 == 0) ? g_cbBlob : 0);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG Load(ULONGLONG* pullCalls)
+{
+	//the spooler's start: a new port list, then LoadFromRegistry
+	CPortList* pList = new CPortList(szMonitorName, szDescription);
+
+	g_registry.SetLatency(g_ullLatency);
+	g_registry.ResetCalls();
+
+	ULONGLONG ullStart = Now();
+	pList->LoadFromRegistry();
+	ULONGLONG ullElapsed = Now() - ullStart;
+
+	*pullCalls = g_registry.Calls();
+	g_registry.SetLatency(0);
+
+	delete pList;
+
+	return ullElapsed;
+}
+
+//-------------------------------------------------------------------------------------
+static void Report(const char* szName, DWORD nPorts, ULONGLONG ullCalls, DWORD cbSnapshot, ULONGLONG ullBest)
+{
+	printf("%s{\"name\":\"%s\",\"ports\":%u,\"calls\":%llu,\"bytes\":%u,\"ms\":%.3f,\"us_per_port\":%.3f}",
+		g_bFirst ? "" : ",\n", szName, nPorts, static_cast<unsigned long long>(ullCalls), cbSnapshot,
+		ullBest / 1e6, nPorts ? ullBest / 1e3 / nPorts : 0.0);
+	fflush(stdout);
+
+	g_bFirst = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL Measure(DWORD nPorts, DWORD nRuns)
+{
+	FillRegistry(nPorts);
+
+	WCHAR szFileName[MAX_PATH + 1];
+	SnapshotFileName(szFileName, LENGTHOF(szFileName));
+
+	ULONGLONG ullBest = 0, ullCalls = 0;
+
+	for (DWORD n = 0; n < nRuns; n++)
+	{
+		DeleteFileW(szFileName);
+
+		ULONGLONG ullElapsed = Load(&ullCalls);
+		if (n == 0 || ullElapsed < ullBest)
+			ullBest = ullElapsed;
+	}
+
+	//what the registry path left behind, for the next start
+	CConfigSnapshot* pSnapshot = new CConfigSnapshot;
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	DWORD cbSnapshot = 0, nLoaded = 0, cbBlob;
+
+	if (pSnapshot->ReadFromFile(szFileName) && pSnapshot->Generation() == 42)
+	{
+		cbSnapshot = pSnapshot->Size();
+		while (pSnapshot->Next(pConfig, pwBlob, &cbBlob))
+			nLoaded++;
+	}
+
+	SecureZeroMemory(pConfig, sizeof(*pConfig));
+	delete[] pwBlob;
+	delete pConfig;
+	delete pSnapshot;
+
+	if (nLoaded != nPorts)
+	{
+		fprintf(stderr, "cfgbench: %u ports in the snapshot, %u expected\n", nLoaded, nPorts);
+		return FALSE;
+	}
+
+	Report("startup/registry", nPorts, ullCalls, 0, ullBest);
+
+	for (DWORD n = 0; n < nRuns; n++)
+	{
+		ULONGLONG ullElapsed = Load(&ullCalls);
+		if (n == 0 || ullElapsed < ullBest)
+			ullBest = ullElapsed;
+	}
+
+	Report("startup/snapshot", nPorts, ullCalls, cbSnapshot, ullBest);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	static const DWORD defaultPorts[] = { 100, 5000, 50000 };
+	DWORD ports[16];
+	DWORD nPortCounts = 0;
+	DWORD nRuns = 3;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			g_ullLatency = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			nRuns = static_cast<DWORD>(atoi(argv[++i]));
+		else if (argv[i][0] != '-' && atoi(argv[i]) > 0 && nPortCounts < LENGTHOF(ports))
+			ports[nPortCounts++] = static_cast<DWORD>(atoi(argv[i]));
+		else
+		{
+			fprintf(stderr, "usage: cfgbench [-l ns] [-r runs] [ports...]\n");
+			return 1;
+		}
+	}
+
+	if (nPortCounts == 0)
+	{
+		for (size_t n = 0; n < LENGTHOF(defaultPorts); n++)
+			ports[nPortCounts++] = defaultPorts[n];
+	}
+
+	if (nRuns == 0)
+		nRuns = 1;
+
+	g_pMonitor = MockMonitorStart(&g_registry);
+	if (!g_pMonitor)
+	{
+		fprintf(stderr, "cfgbench: can't start the monitor\n");
+		return 1;
+	}
+
+	int nRet = MakePasswordBlob() ? 0 : 1;
+
+	printf("[\n");
+
+	for (DWORD n = 0; n < nPortCounts && nRet == 0; n++)
+	{
+		if (!Measure(ports[n], nRuns))
+			nRet = 1;
+	}
+
+	printf("\n]\n");
+
+	MockMonitorStop(g_pMonitor);
+
+	WCHAR szFileName[MAX_PATH + 1];
+	DeleteFileW(SnapshotFileName(szFileName, LENGTHOF(szFileName)));
+
+	return nRet;
+}
@@ -19,7 +19,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 class CAutoCriticalSection
 {
@@ -0,0 +1,620 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "blog.h"
+#include <string.h>
+
+const char* const BlogTypeNames[BLOG_TYPE_MAX + 1] =
+{
+	"NONE",
+	"DEBUG",
+	"INFO",
+	"DONE",
+	"WARN",
+	"ERROR",
+	"CRITICAL"
+};
+
+//-------------------------------------------------------------------------------------
+void BlogPutU16(unsigned char* p, unsigned int value)
+{
+	p[0] = static_cast<unsigned char>(value);
+	p[1] = static_cast<unsigned char>(value >> 8);
+}
+
+//-------------------------------------------------------------------------------------
+void BlogPutU64(unsigned char* p, unsigned long long value)
+{
+	for (int i = 0; i < 8; i++, value >>= 8)
+		p[i] = static_cast<unsigned char>(value);
+}
+
+//-------------------------------------------------------------------------------------
+unsigned int BlogGetU16(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+//-------------------------------------------------------------------------------------
+unsigned int BlogGetU32(const unsigned char* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+}
+
+//-------------------------------------------------------------------------------------
+unsigned long long BlogGetU64(const unsigned char* p)
+{
+	return BlogGetU32(p) | (static_cast<unsigned long long>(BlogGetU32(p + 4)) << 32);
+}
+
+//-------------------------------------------------------------------------------------
+size_t BlogPutString(unsigned char* pBuf, size_t cbBuf, const wchar_t* szString)
+{
+	if (cbBuf < 2)
+		return 0;
+
+	//the string is cut short if it doesn't fit
+	size_t maxUnits = (cbBuf - 2) / 2;
+	size_t n = 0;
+
+	for (; *szString && n < maxUnits && n < 0xFFFF; szString++)
+	{
+		unsigned long ch = static_cast<unsigned long>(*szString);
+
+		if (ch > 0xFFFF)
+		{
+			//wchar_t is UTF-32 on this platform: emit a surrogate pair
+			if (n + 2 > maxUnits || n + 2 > 0xFFFF)
+				break;
+			ch -= 0x10000;
+			BlogPutU16(pBuf + 2 + n++ * 2, 0xD800 + (ch >> 10));
+			BlogPutU16(pBuf + 2 + n++ * 2, 0xDC00 + (ch & 0x3FF));
+		}
+		else
+			BlogPutU16(pBuf + 2 + n++ * 2, ch);
+	}
+
+	BlogPutU16(pBuf, static_cast<unsigned int>(n));
+
+	return 2 + n * 2;
+}
+
+//-------------------------------------------------------------------------------------
+static size_t PutInt(unsigned char* pBuf, size_t cbBuf, unsigned long long value, bool b64)
+{
+	size_t cb = b64 ? 9 : 5;
+
+	if (cbBuf < cb)
+		return 0;
+
+	pBuf[0] = b64 ? BLOG_ARG_I64 : BLOG_ARG_I32;
+	BlogPutU16(pBuf + 1, static_cast<unsigned int>(value & 0xFFFF));
+	BlogPutU16(pBuf + 3, static_cast<unsigned int>((value >> 16) & 0xFFFF));
+	if (b64)
+	{
+		BlogPutU16(pBuf + 5, static_cast<unsigned int>((value >> 32) & 0xFFFF));
+		BlogPutU16(pBuf + 7, static_cast<unsigned int>(value >> 48));
+	}
+
+	return cb;
+}
+
+//-------------------------------------------------------------------------------------
+size_t BlogPackArgs(unsigned char* pBuf, size_t cbBuf, const wchar_t* szFormat, va_list args)
+{
+	//the argument count goes first, then the arguments as consumed by szFormat
+	if (cbBuf < 1)
+		return 0;
+
+	size_t pos = 1;
+	unsigned int argc = 0;
+	bool bFull = false;
+
+	for (const wchar_t* p = szFormat; *p && !bFull && argc < 255; p++)
+	{
+		if (*p != L'%')
+			continue;
+
+		p++;
+
+		if (*p == L'%')
+			continue;
+
+		//flags
+		while (*p == L'-' || *p == L'+' || *p == L' ' || *p == L'#' || *p == L'0')
+			p++;
+
+		//width and precision, either of them may come from the arguments
+		for (int i = 0; i < 2; i++)
+		{
+			if (i == 1)
+			{
+				if (*p != L'.')
+					break;
+				p++;
+			}
+
+			if (*p == L'*')
+			{
+				size_t cb = PutInt(pBuf + pos, cbBuf - pos, static_cast<unsigned int>(va_arg(args, int)), false);
+				if (cb == 0)
+				{
+					bFull = true;
+					break;
+				}
+				pos += cb;
+				argc++;
+				p++;
+			}
+			else
+			{
+				while (*p >= L'0' && *p <= L'9')
+					p++;
+			}
+		}
+
+		if (bFull)
+			break;
+
+		//size: 0 = int, 1 = short/char, 2 = long, 3 = 64 bit, 4 = pointer sized, 5 = long double
+		int size = 0;
+		bool bWide = false;
+		bool bNarrow = false;
+
+		if (*p == L'h')
+		{
+			size = 1;
+			bNarrow = true;
+			p++;
+			if (*p == L'h')
+				p++;
+		}
+		else if (*p == L'l')
+		{
+			size = 2;
+			bWide = true;
+			p++;
+			if (*p == L'l')
+			{
+				size = 3;
+				p++;
+			}
+		}
+		else if (*p == L'w')
+		{
+			bWide = true;
+			p++;
+		}
+		else if (*p == L'L')
+		{
+			size = 5;
+			p++;
+		}
+		else if (*p == L'z' || *p == L'j' || *p == L't')
+		{
+			size = (*p == L'j') ? 3 : 4;
+			p++;
+		}
+		else if (*p == L'I')
+		{
+			p++;
+			if (p[0] == L'6' && p[1] == L'4')
+			{
+				size = 3;
+				p += 2;
+			}
+			else if (p[0] == L'3' && p[1] == L'2')
+				p += 2;
+			else
+				size = 4;
+		}
+
+		size_t cb = 0;
+
+		switch (*p)
+		{
+		case L'\0':
+			p--; //let the loop see the terminator
+			continue;
+
+		case L'd': case L'i': case L'u': case L'x': case L'X': case L'o': case L'c': case L'C':
+			if (size == 3)
+				cb = PutInt(pBuf + pos, cbBuf - pos, va_arg(args, unsigned long long), true);
+			else if (size == 2)
+				cb = PutInt(pBuf + pos, cbBuf - pos, va_arg(args, unsigned long), sizeof(long) > 4);
+			else if (size == 4)
+				cb = PutInt(pBuf + pos, cbBuf - pos, va_arg(args, size_t), sizeof(size_t) > 4);
+			else
+				cb = PutInt(pBuf + pos, cbBuf - pos, va_arg(args, unsigned int), false);
+			break;
+
+		case L'p':
+			cb = PutInt(pBuf + pos, cbBuf - pos, reinterpret_cast<size_t>(va_arg(args, void*)), true);
+			break;
+
+		case L'e': case L'E': case L'f': case L'F': case L'g': case L'G': case L'a': case L'A':
+			if (cbBuf - pos >= 9)
+			{
+				double value = (size == 5) ? static_cast<double>(va_arg(args, long double)) : va_arg(args, double);
+				unsigned long long bits;
+				memcpy(&bits, &value, sizeof(bits));
+				pBuf[pos] = BLOG_ARG_F64;
+				BlogPutU64(pBuf + pos + 1, bits);
+				cb = 9;
+			}
+			break;
+
+		case L's': case L'S':
+			//Microsoft semantics: in a wide format %s is a wide string, %S a narrow one
+			if ((*p == L's' && !bNarrow) || (*p == L'S' && bWide))
+			{
+				const wchar_t* szArg = va_arg(args, const wchar_t*);
+
+				if (!szArg)
+				{
+					if (cbBuf - pos >= 1)
+					{
+						pBuf[pos] = BLOG_ARG_NULL;
+						cb = 1;
+					}
+				}
+				else if (cbBuf - pos >= 3)
+				{
+					pBuf[pos] = BLOG_ARG_WSTR;
+					cb = 1 + BlogPutString(pBuf + pos + 1, cbBuf - pos - 1, szArg);
+				}
+			}
+			else
+			{
+				const char* szArg = va_arg(args, const char*);
+
+				if (!szArg)
+				{
+					if (cbBuf - pos >= 1)
+					{
+						pBuf[pos] = BLOG_ARG_NULL;
+						cb = 1;
+					}
+				}
+				else if (cbBuf - pos >= 3)
+				{
+					size_t len = strlen(szArg);
+					if (len > cbBuf - pos - 3)
+						len = cbBuf - pos - 3;
+					if (len > 0xFFFF)
+						len = 0xFFFF;
+					pBuf[pos] = BLOG_ARG_STR;
+					BlogPutU16(pBuf + pos + 1, static_cast<unsigned int>(len));
+					memcpy(pBuf + pos + 3, szArg, len);
+					cb = 3 + len;
+				}
+			}
+			break;
+
+		case L'n':
+			//never written to
+			va_arg(args, void*);
+			continue;
+
+		default:
+			//unknown conversion, no argument
+			continue;
+		}
+
+		if (cb == 0)
+			break; //no more room, the decoder shows the missing arguments
+
+		pos += cb;
+		argc++;
+	}
+
+	pBuf[0] = static_cast<unsigned char>(argc);
+
+	return pos;
+}
+
+//-------------------------------------------------------------------------------------
+size_t BlogDefinition(unsigned char* pBuf, size_t cbBuf, int nType, unsigned int nId, const wchar_t* szString)
+{
+	if (cbBuf < BLOG_HDRLEN + 2 + 2)
+		return 0;
+
+	if (cbBuf > BLOG_MAXRECORD)
+		cbBuf = BLOG_MAXRECORD;
+
+	size_t cb = BLOG_HDRLEN + 2;
+	cb += BlogPutString(pBuf + cb, cbBuf - cb, szString);
+
+	BlogPutU16(pBuf, static_cast<unsigned int>(cb));
+	pBuf[2] = static_cast<unsigned char>(nType);
+	pBuf[3] = 0;
+	BlogPutU16(pBuf + BLOG_HDRLEN, nId);
+
+	return cb;
+}
+
+//-------------------------------------------------------------------------------------
+typedef struct tagBLOGARG
+{
+	int tag;
+	unsigned long long value;
+	const unsigned char* pData;	//strings: count followed by the units or bytes
+} BLOGARG;
+
+//-------------------------------------------------------------------------------------
+static bool ReadArg(const unsigned char** pp, const unsigned char* pEnd, unsigned int* pArgc, BLOGARG* pArg)
+{
+	const unsigned char* p = *pp;
+
+	if (*pArgc == 0 || p >= pEnd)
+		return false;
+
+	pArg->tag = *p++;
+	pArg->pData = p;
+
+	size_t cbLeft = pEnd - p;
+	size_t cb = 0;
+
+	switch (pArg->tag)
+	{
+	case BLOG_ARG_I32:
+		cb = 4;
+		if (cbLeft >= cb)
+			pArg->value = BlogGetU32(p);
+		break;
+
+	case BLOG_ARG_I64:
+	case BLOG_ARG_F64:
+		cb = 8;
+		if (cbLeft >= cb)
+			pArg->value = BlogGetU64(p);
+		break;
+
+	case BLOG_ARG_WSTR:
+		cb = (cbLeft >= 2) ? 2 + BlogGetU16(p) * 2 : 2;
+		break;
+
+	case BLOG_ARG_STR:
+		cb = (cbLeft >= 2) ? 2 + BlogGetU16(p) : 2;
+		break;
+
+	case BLOG_ARG_NULL:
+		break;
+
+	default:
+		return false;
+	}
+
+	if (cb > cbLeft)
+		return false;
+
+	*pp = p + cb;
+	(*pArgc)--;
+
+	return true;
+}
+
+//-------------------------------------------------------------------------------------
+static size_t PutPadded(wchar_t* szOut, size_t cchOut, const BLOGARG* pArg, int width, int prec, bool bLeft)
+{
+	//strings are copied by hand: their encoding is known from the tag, not from the format
+	static const wchar_t szNull[] = L"(null)";
+	size_t n;
+
+	if (pArg->tag == BLOG_ARG_WSTR || pArg->tag == BLOG_ARG_STR)
+		n = BlogGetU16(pArg->pData);
+	else
+		n = 6;
+
+	if (prec >= 0 && n > static_cast<size_t>(prec))
+		n = prec;
+
+	size_t pad = (width > 0 && static_cast<size_t>(width) > n) ? width - n : 0;
+	size_t len = 0;
+
+	for (; !bLeft && pad > 0 && len < cchOut; pad--)
+		szOut[len++] = L' ';
+
+	for (size_t i = 0; i < n && len < cchOut; i++)
+	{
+		if (pArg->tag == BLOG_ARG_WSTR)
+			szOut[len++] = static_cast<wchar_t>(BlogGetU16(pArg->pData + 2 + i * 2));
+		else if (pArg->tag == BLOG_ARG_STR)
+			szOut[len++] = static_cast<wchar_t>(pArg->pData[2 + i]);
+		else
+			szOut[len++] = szNull[i];
+	}
+
+	for (; pad > 0 && len < cchOut; pad--)
+		szOut[len++] = L' ';
+
+	return len;
+}
+
+//-------------------------------------------------------------------------------------
+size_t BlogFormat(wchar_t* szOut, size_t cchOut, const wchar_t* szFormat, const unsigned char* pArgs, size_t cbArgs)
+{
+	//the reverse of BlogPackArgs: arguments are taken from the packed buffer
+	if (cchOut == 0)
+		return 0;
+
+	const unsigned char* p = pArgs;
+	const unsigned char* pEnd = pArgs + cbArgs;
+	unsigned int argc = (p < pEnd) ? *p++ : 0;
+	size_t len = 0;
+	size_t cchMax = cchOut - 1;
+
+	for (const wchar_t* f = szFormat; *f && len < cchMax; f++)
+	{
+		if (*f != L'%')
+		{
+			szOut[len++] = *f;
+			continue;
+		}
+
+		f++;
+
+		if (*f == L'%')
+		{
+			szOut[len++] = L'%';
+			continue;
+		}
+
+		//rebuild the conversion, resolving * from the arguments
+		wchar_t szSpec[64];
+		size_t cchSpec = 0;
+		int width = 0;
+		int prec = -1;
+		bool bLeft = false;
+		BLOGARG arg;
+
+		szSpec[cchSpec++] = L'%';
+
+		while ((*f == L'-' || *f == L'+' || *f == L' ' || *f == L'#' || *f == L'0') && cchSpec < 8)
+		{
+			bLeft = bLeft || *f == L'-';
+			szSpec[cchSpec++] = *f++;
+		}
+
+		for (int i = 0; i < 2; i++)
+		{
+			int value = 0;
+			bool bGiven = true;
+
+			if (i == 1)
+			{
+				if (*f != L'.')
+					break;
+				szSpec[cchSpec++] = *f++;
+			}
+
+			if (*f == L'*')
+			{
+				f++;
+				if (ReadArg(&p, pEnd, &argc, &arg) && arg.tag == BLOG_ARG_I32)
+					value = static_cast<int>(static_cast<unsigned int>(arg.value));
+			}
+			else if (*f >= L'0' && *f <= L'9')
+			{
+				while (*f >= L'0' && *f <= L'9')
+					value = value * 10 + (*f++ - L'0');
+			}
+			else
+				bGiven = (i == 1); //a lone dot means precision 0
+
+			if (!bGiven)
+				continue;
+
+			if (value < 0)
+				value = 0;
+			else if (value > 100)
+				value = 100;
+
+			if (i == 0)
+				width = value;
+			else
+				prec = value;
+
+			cchSpec += swprintf(szSpec + cchSpec, 8, L"%d", value);
+		}
+
+		//size modifiers are implied by the argument tag
+		if ((f[0] == L'h' && f[1] == L'h') || (f[0] == L'l' && f[1] == L'l'))
+			f += 2;
+		else if (*f == L'h' || *f == L'l' || *f == L'w' || *f == L'L' ||
+			*f == L'z' || *f == L'j' || *f == L't')
+			f++;
+		else if (*f == L'I')
+		{
+			f++;
+			if ((f[0] == L'6' && f[1] == L'4') || (f[0] == L'3' && f[1] == L'2'))
+				f += 2;
+		}
+
+		wchar_t conv = *f;
+
+		if (!conv)
+			break;
+
+		if (!wcschr(L"diuxXocCpeEfFgGaAsS", conv))
+			continue;
+
+		if (!ReadArg(&p, pEnd, &argc, &arg))
+		{
+			for (const wchar_t* m = L"<?>"; *m && len < cchMax; m++)
+				szOut[len++] = *m;
+			continue;
+		}
+
+		//numbers go through a scratch buffer, so that a long one is cut rather than lost
+		wchar_t szNum[512];
+		int cch = 0;
+
+		switch (conv)
+		{
+		case L'd': case L'i': case L'u': case L'x': case L'X': case L'o':
+			if (arg.tag == BLOG_ARG_I64)
+			{
+				szSpec[cchSpec++] = L'l';
+				szSpec[cchSpec++] = L'l';
+				szSpec[cchSpec++] = conv;
+				szSpec[cchSpec] = L'\0';
+				cch = swprintf(szNum, 512, szSpec, arg.value);
+			}
+			else if (arg.tag == BLOG_ARG_I32)
+			{
+				szSpec[cchSpec++] = conv;
+				szSpec[cchSpec] = L'\0';
+				cch = swprintf(szNum, 512, szSpec, static_cast<unsigned int>(arg.value));
+			}
+			break;
+
+		case L'c': case L'C':
+			if (arg.tag == BLOG_ARG_I32 && len < cchMax)
+				szOut[len++] = static_cast<wchar_t>(arg.value);
+			break;
+
+		case L'p':
+			cch = swprintf(szNum, 512, (sizeof(void*) > 4) ? L"%016llX" : L"%08llX", arg.value);
+			break;
+
+		case L'e': case L'E': case L'f': case L'F': case L'g': case L'G': case L'a': case L'A':
+			if (arg.tag == BLOG_ARG_F64)
+			{
+				double value;
+				memcpy(&value, &arg.value, sizeof(value));
+				szSpec[cchSpec++] = conv;
+				szSpec[cchSpec] = L'\0';
+				cch = swprintf(szNum, 512, szSpec, value);
+			}
+			break;
+
+		case L's': case L'S':
+			len += PutPadded(szOut + len, cchMax - len, &arg, width, prec, bLeft);
+			break;
+		}
+
+		for (int i = 0; i < cch && len < cchMax; i++)
+			szOut[len++] = szNum[i];
+	}
+
+	szOut[len] = L'\0';
+
+	return len;
+}
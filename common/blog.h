@@ -0,0 +1,86 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+/*
+*  binary log format, shared by the monitor (writer) and logdump (reader).
+*  This file and blog.cpp don't depend on Windows headers, so that the
+*  format can be produced and decoded on any platform.
+*
+*  The file starts with BLOG_MAGIC, followed by records. All integers are
+*  little endian. Every record starts with
+*    u16 size (whole record, header included), u8 type, u8 level
+*  followed by
+*    BLOG_REC_FORMAT   u16 id, string      a format string used by messages
+*    BLOG_REC_PORT     u16 id, string      a port name
+*    BLOG_REC_MESSAGE  u64 time, u16 port, u16 format, u8 argc, args
+*  where time is UTC in 100ns units since 1601-01-01 (a FILETIME), port 0 means
+*  no port, and strings are u16 count followed by that many UTF-16 units.
+*  Ids are valid from their definition on; the writer defines them again in
+*  every new file, and a later definition replaces an earlier one.
+*  Each argument is a tag byte followed by its value.
+*/
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <wchar.h>
+
+#define BLOG_MAGIC			"MFMBLOG1"
+#define BLOG_MAGICLEN		8
+
+#define BLOG_REC_FORMAT		1
+#define BLOG_REC_PORT		2
+#define BLOG_REC_MESSAGE	3
+
+#define BLOG_HDRLEN			4
+#define BLOG_MSGHDRLEN		(BLOG_HDRLEN + 8 + 2 + 2 + 1)
+#define BLOG_FORMATOFFSET	(BLOG_HDRLEN + 8 + 2)	//where the writer patches the format id
+#define BLOG_MAXRECORD		0xFFFF
+
+//argument tags
+#define BLOG_ARG_I32		1	//u32
+#define BLOG_ARG_I64		2	//u64
+#define BLOG_ARG_WSTR		3	//string
+#define BLOG_ARG_STR		4	//u16 count, bytes
+#define BLOG_ARG_F64		5	//IEEE double
+#define BLOG_ARG_NULL		6	//NULL string pointer
+
+//message types, in the order used by the log
+#define BLOG_TYPE_NONE		0
+#define BLOG_TYPE_DEBUG		1
+#define BLOG_TYPE_INFO		2
+#define BLOG_TYPE_DONE		3
+#define BLOG_TYPE_WARN		4
+#define BLOG_TYPE_ERROR		5
+#define BLOG_TYPE_CRITICAL	6
+#define BLOG_TYPE_MAX		BLOG_TYPE_CRITICAL
+
+extern const char* const BlogTypeNames[BLOG_TYPE_MAX + 1];
+
+void BlogPutU16(unsigned char* p, unsigned int value);
+void BlogPutU64(unsigned char* p, unsigned long long value);
+unsigned int BlogGetU16(const unsigned char* p);
+unsigned int BlogGetU32(const unsigned char* p);
+unsigned long long BlogGetU64(const unsigned char* p);
+
+size_t BlogPutString(unsigned char* pBuf, size_t cbBuf, const wchar_t* szString);
+size_t BlogPackArgs(unsigned char* pBuf, size_t cbBuf, const wchar_t* szFormat, va_list args);
+size_t BlogDefinition(unsigned char* pBuf, size_t cbBuf, int nType, unsigned int nId, const wchar_t* szString);
+size_t BlogFormat(wchar_t* szOut, size_t cchOut, const wchar_t* szFormat, const unsigned char* pArgs, size_t cbArgs);
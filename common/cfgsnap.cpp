@@ -0,0 +1,362 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stdafx.h"
+#include "cfgsnap.h"
+
+//-------------------------------------------------------------------------------------
+CConfigSnapshot::CConfigSnapshot()
+{
+	m_pBuf = NULL;
+	m_cbBuf = 0;
+	m_cbUsed = 0;
+	m_pHeader = NULL;
+	m_pRead = NULL;
+	m_pEnd = NULL;
+	m_nRead = 0;
+}
+
+//-------------------------------------------------------------------------------------
+CConfigSnapshot::~CConfigSnapshot()
+{
+	Free();
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::Free()
+{
+	if (m_pBuf)
+	{
+		//encrypted passwords, but still
+		SecureZeroMemory(m_pBuf, m_cbBuf);
+		delete[] m_pBuf;
+	}
+
+	m_pBuf = NULL;
+	m_cbBuf = 0;
+	m_cbUsed = 0;
+	m_pHeader = NULL;
+	m_pRead = NULL;
+	m_pEnd = NULL;
+	m_nRead = 0;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CConfigSnapshot::Checksum(LPBYTE pData, DWORD cbData)
+{
+	//FNV-1a
+	DWORD dwHash = 2166136261U;
+
+	for (DWORD n = 0; n < cbData; n++)
+	{
+		dwHash ^= pData[n];
+		dwHash *= 16777619U;
+	}
+
+	return dwHash;
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::Reserve(DWORD cbMore)
+{
+	if (m_cbUsed + cbMore <= m_cbBuf)
+		return;
+
+	DWORD cbNew = m_cbBuf ? m_cbBuf : 4096;
+	while (cbNew < m_cbUsed + cbMore)
+		cbNew *= 2;
+
+	LPBYTE pNew = new BYTE[cbNew];
+	if (m_pBuf)
+	{
+		memcpy(pNew, m_pBuf, m_cbUsed);
+		SecureZeroMemory(m_pBuf, m_cbBuf);
+		delete[] m_pBuf;
+	}
+
+	m_pBuf = pNew;
+	m_cbBuf = cbNew;
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::PutBytes(LPCVOID pData, DWORD cbData)
+{
+	Reserve(cbData);
+	memcpy(m_pBuf + m_cbUsed, pData, cbData);
+	m_cbUsed += cbData;
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::PutString(LPCWSTR szString)
+{
+	WORD cch = static_cast<WORD>(wcslen(szString));
+	PutBytes(&cch, sizeof(cch));
+	PutBytes(szString, cch * sizeof(WCHAR));
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::PutDword(DWORD dwValue)
+{
+	PutBytes(&dwValue, sizeof(dwValue));
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::Begin(DWORD dwGeneration)
+{
+	Free();
+
+	CFGSNAPHEADER hdr;
+	ZeroMemory(&hdr, sizeof(hdr));
+	hdr.dwMagic = CFGSNAP_MAGIC;
+	hdr.wVersion = CFGSNAP_VERSION;
+	hdr.cbChar = sizeof(WCHAR);
+	hdr.dwGeneration = dwGeneration;
+
+	PutBytes(&hdr, sizeof(hdr));
+}
+
+//-------------------------------------------------------------------------------------
+void CConfigSnapshot::Add(LPPORTCONFIG2 pConfig, LPBYTE pwBlob, DWORD cbBlob)
+{
+	_ASSERTE(m_cbUsed >= sizeof(CFGSNAPHEADER));
+
+	PutString(pConfig->szPortName);
+	PutString(pConfig->szOutputPath);
+	PutString(pConfig->szFilePattern);
+	PutDword(pConfig->bOverwrite);
+	PutString(pConfig->szUserCommandPattern);
+	PutString(pConfig->szExecPath);
+	PutDword(pConfig->bWaitTermination);
+	PutDword(pConfig->dwWaitTimeout);
+	PutDword(pConfig->bPipeData);
+	PutDword(pConfig->bHideProcess);
+	PutString(pConfig->szUser);
+	PutString(pConfig->szDomain);
+	PutDword(pConfig->dwArchiveMode);
+	PutDword(pConfig->dwArchiveMaxSize);
+	PutDword(pConfig->dwArchiveMaxAge);
+	PutDword(pConfig->dwArchiveMaxJobs);
+
+	WORD cb = static_cast<WORD>(cbBlob);
+	PutBytes(&cb, sizeof(cb));
+	PutBytes(pwBlob, cb);
+
+	reinterpret_cast<LPCFGSNAPHEADER>(m_pBuf)->nPorts++;
+}
+
+//-------------------------------------------------------------------------------------
+LPBYTE CConfigSnapshot::Data()
+{
+	_ASSERTE(m_cbUsed >= sizeof(CFGSNAPHEADER));
+
+	//seal it
+	LPCFGSNAPHEADER pHeader = reinterpret_cast<LPCFGSNAPHEADER>(m_pBuf);
+	pHeader->cbData = m_cbUsed - sizeof(CFGSNAPHEADER);
+	pHeader->dwChecksum = Checksum(m_pBuf + sizeof(CFGSNAPHEADER), pHeader->cbData);
+
+	return m_pBuf;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::WriteToFile(LPCWSTR szFileName)
+{
+	//write aside, then replace: a reader never sees half a snapshot
+	WCHAR szTemp[MAX_PATH + 1];
+	swprintf_s(szTemp, LENGTHOF(szTemp), L"%s.tmp", szFileName);
+
+	HANDLE hFile = CreateFileW(szTemp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	LPBYTE pData = Data();
+	DWORD wri;
+	BOOL bRet = WriteFile(hFile, pData, m_cbUsed, &wri, NULL) && wri == m_cbUsed;
+
+	CloseHandle(hFile);
+
+	if (!bRet || !MoveFileExW(szTemp, szFileName, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(szTemp);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::ReadFromFile(LPCWSTR szFileName)
+{
+	Free();
+
+	HANDLE hFile = CreateFileW(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	LARGE_INTEGER liSize;
+	BOOL bRet = GetFileSizeEx(hFile, &liSize) &&
+		liSize.QuadPart >= static_cast<LONGLONG>(sizeof(CFGSNAPHEADER)) &&
+		liSize.QuadPart < 0x40000000;
+
+	if (bRet)
+	{
+		//the whole snapshot in one read
+		DWORD cbData = static_cast<DWORD>(liSize.QuadPart);
+		DWORD rd;
+
+		Reserve(cbData);
+		bRet = ReadFile(hFile, m_pBuf, cbData, &rd, NULL) && rd == cbData;
+		m_cbUsed = bRet ? cbData : 0;
+	}
+
+	CloseHandle(hFile);
+
+	return bRet && Open(m_pBuf, m_cbUsed);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::Open(LPBYTE pData, DWORD cbData)
+{
+	m_pHeader = NULL;
+
+	if (cbData < sizeof(CFGSNAPHEADER))
+		return FALSE;
+
+	LPCFGSNAPHEADER pHeader = reinterpret_cast<LPCFGSNAPHEADER>(pData);
+
+	if (pHeader->dwMagic != CFGSNAP_MAGIC ||
+		pHeader->wVersion != CFGSNAP_VERSION ||
+		pHeader->cbChar != sizeof(WCHAR) ||
+		pHeader->cbData != cbData - sizeof(CFGSNAPHEADER) ||
+		pHeader->dwChecksum != Checksum(pData + sizeof(CFGSNAPHEADER), pHeader->cbData))
+	{
+		return FALSE;
+	}
+
+	m_pHeader = pHeader;
+	m_pRead = pData + sizeof(CFGSNAPHEADER);
+	m_pEnd = pData + cbData;
+	m_nRead = 0;
+
+	//walk the records once, so that a reader that got TRUE here never
+	//stops halfway with part of the ports already set up
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	DWORD cbBlob;
+
+	while (Next(pConfig, pwBlob, &cbBlob))
+		;
+
+	BOOL bRet = m_pHeader != NULL && m_pRead == m_pEnd;
+
+	delete[] pwBlob;
+	delete pConfig;
+
+	if (!bRet)
+	{
+		m_pHeader = NULL;
+		return FALSE;
+	}
+
+	m_pRead = pData + sizeof(CFGSNAPHEADER);
+	m_nRead = 0;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::GetBytes(LPVOID pData, DWORD cbData)
+{
+	if (static_cast<DWORD>(m_pEnd - m_pRead) < cbData)
+		return FALSE;
+
+	memcpy(pData, m_pRead, cbData);
+	m_pRead += cbData;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::GetString(LPWSTR szString, size_t cchString)
+{
+	WORD cch;
+
+	if (!GetBytes(&cch, sizeof(cch)) || cch >= cchString ||
+		!GetBytes(szString, cch * sizeof(WCHAR)))
+	{
+		return FALSE;
+	}
+
+	szString[cch] = L'\0';
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::GetDword(LPDWORD pdwValue)
+{
+	return GetBytes(pdwValue, sizeof(*pdwValue));
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CConfigSnapshot::Next(LPPORTCONFIG2 pConfig, LPBYTE pwBlob, LPDWORD pcbBlob)
+{
+	if (!m_pHeader || m_nRead >= m_pHeader->nPorts)
+		return FALSE;
+
+	DWORD dwOverwrite, dwWaitTermination, dwPipeData, dwHideProcess;
+	WORD cb;
+
+	//a record that doesn't fit means a bad snapshot, even with a good checksum
+	if (!GetString(pConfig->szPortName, LENGTHOF(pConfig->szPortName)) ||
+		!GetString(pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath)) ||
+		!GetString(pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern)) ||
+		!GetDword(&dwOverwrite) ||
+		!GetString(pConfig->szUserCommandPattern, LENGTHOF(pConfig->szUserCommandPattern)) ||
+		!GetString(pConfig->szExecPath, LENGTHOF(pConfig->szExecPath)) ||
+		!GetDword(&dwWaitTermination) ||
+		!GetDword(&pConfig->dwWaitTimeout) ||
+		!GetDword(&dwPipeData) ||
+		!GetDword(&dwHideProcess) ||
+		!GetString(pConfig->szUser, LENGTHOF(pConfig->szUser)) ||
+		!GetString(pConfig->szDomain, LENGTHOF(pConfig->szDomain)) ||
+		!GetDword(&pConfig->dwArchiveMode) ||
+		!GetDword(&pConfig->dwArchiveMaxSize) ||
+		!GetDword(&pConfig->dwArchiveMaxAge) ||
+		!GetDword(&pConfig->dwArchiveMaxJobs) ||
+		!GetBytes(&cb, sizeof(cb)) ||
+		cb > MAX_PWBLOB ||
+		!GetBytes(pwBlob, cb))
+	{
+		m_pHeader = NULL;
+		return FALSE;
+	}
+
+	pConfig->bOverwrite = dwOverwrite;
+	pConfig->bWaitTermination = dwWaitTermination;
+	pConfig->bPipeData = dwPipeData;
+	pConfig->bHideProcess = dwHideProcess;
+	*pConfig->szPassword = L'\0';
+	*pcbBlob = cb;
+
+	m_nRead++;
+
+	return TRUE;
+}
@@ -0,0 +1,100 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#include "config.h"
+
+/*
+*  CConfigSnapshot
+*  all the port settings in one binary blob, so that the monitor can start
+*  with a single file read instead of a dozen registry calls per port.
+*  The registry stays the source of truth: the snapshot records the value of
+*  the ConfigGeneration counter it was built from, and it is only used while
+*  the counter in the registry still has that value.
+*
+*  Layout: a CFGSNAPHEADER, then one record per port. Records hold, in this
+*  order, the port name, output path, file pattern, overwrite, user command,
+*  exec path, wait termination, wait timeout, pipe data, hide process, user,
+*  domain, archive mode, max size, max age, max jobs and the encrypted
+*  password, exactly as stored in the registry (empty when there's none).
+*  Strings are a u16 count followed by that many characters of cbChar bytes,
+*  DWORDs are stored as they are, the password is a u16 size and the bytes.
+*  The checksum is FNV-1a over everything after the header.
+*
+*  The same layout, with generation 0, is the batch that the AddPorts,
+*  SetConfigs and GetConfigs Xcv commands exchange. In a batch the password
+*  field holds the password in clear (UTF-16, no terminator), as in SetConfig.
+*/
+
+#define CFGSNAP_MAGIC		0x534D464DUL	//"MFMS"
+#define CFGSNAP_VERSION		1
+
+typedef struct tagCFGSNAPHEADER
+{
+	DWORD dwMagic;
+	WORD wVersion;
+	WORD cbChar;
+	DWORD dwGeneration;
+	DWORD nPorts;
+	DWORD cbData;
+	DWORD dwChecksum;
+} CFGSNAPHEADER, *LPCFGSNAPHEADER;
+
+class CConfigSnapshot
+{
+public:
+	CConfigSnapshot();
+	virtual ~CConfigSnapshot();
+
+public:
+	//writing
+	void Begin(DWORD dwGeneration);
+	void Add(LPPORTCONFIG2 pConfig, LPBYTE pwBlob, DWORD cbBlob);
+	BOOL WriteToFile(LPCWSTR szFileName);
+	LPBYTE Data();
+	DWORD Size() const { return m_cbUsed; }
+	//reading
+	BOOL ReadFromFile(LPCWSTR szFileName);
+	BOOL Open(LPBYTE pData, DWORD cbData);
+	BOOL Next(LPPORTCONFIG2 pConfig, LPBYTE pwBlob, LPDWORD pcbBlob);
+	DWORD Generation() const { return m_pHeader ? m_pHeader->dwGeneration : 0; }
+	DWORD Ports() const { return m_pHeader ? m_pHeader->nPorts : 0; }
+
+private:
+	static DWORD Checksum(LPBYTE pData, DWORD cbData);
+	void Reserve(DWORD cbMore);
+	void PutBytes(LPCVOID pData, DWORD cbData);
+	void PutString(LPCWSTR szString);
+	void PutDword(DWORD dwValue);
+	BOOL GetBytes(LPVOID pData, DWORD cbData);
+	BOOL GetString(LPWSTR szString, size_t cchString);
+	BOOL GetDword(LPDWORD pdwValue);
+	void Free();
+
+private:
+	LPBYTE m_pBuf;
+	DWORD m_cbBuf;
+	DWORD m_cbUsed;
+	LPCFGSNAPHEADER m_pHeader;
+	LPBYTE m_pRead;
+	LPBYTE m_pEnd;
+	DWORD m_nRead;
+};
@@ -0,0 +1,167 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stdafx.h"
+#include "cfgtlv.h"
+#include <stddef.h>
+
+typedef struct tagCFGFIELD
+{
+	WORD wTag;
+	size_t nOffset;
+	size_t cchString;	//0 for a DWORD
+} CFGFIELD;
+
+#define STRFIELD(tag, member) { tag, offsetof(PORTCONFIG2, member), LENGTHOF(((LPPORTCONFIG2)0)->member) }
+#define DWFIELD(tag, member) { tag, offsetof(PORTCONFIG2, member), 0 }
+
+static const CFGFIELD Fields[] = {
+	STRFIELD(CFGTAG_PORTNAME, szPortName),
+	STRFIELD(CFGTAG_OUTPUTPATH, szOutputPath),
+	STRFIELD(CFGTAG_FILEPATTERN, szFilePattern),
+	DWFIELD(CFGTAG_OVERWRITE, bOverwrite),
+	STRFIELD(CFGTAG_USERCOMMAND, szUserCommandPattern),
+	STRFIELD(CFGTAG_EXECPATH, szExecPath),
+	DWFIELD(CFGTAG_WAITTERMINATION, bWaitTermination),
+	DWFIELD(CFGTAG_WAITTIMEOUT, dwWaitTimeout),
+	DWFIELD(CFGTAG_PIPEDATA, bPipeData),
+	DWFIELD(CFGTAG_HIDEPROCESS, bHideProcess),
+	DWFIELD(CFGTAG_LOGLEVEL, nLogLevel),
+	STRFIELD(CFGTAG_USER, szUser),
+	STRFIELD(CFGTAG_DOMAIN, szDomain),
+	STRFIELD(CFGTAG_PASSWORD, szPassword),
+	DWFIELD(CFGTAG_ARCHIVEMODE, dwArchiveMode),
+	DWFIELD(CFGTAG_ARCHIVEMAXSIZE, dwArchiveMaxSize),
+	DWFIELD(CFGTAG_ARCHIVEMAXAGE, dwArchiveMaxAge),
+	DWFIELD(CFGTAG_ARCHIVEMAXJOBS, dwArchiveMaxJobs),
+};
+
+//-------------------------------------------------------------------------------------
+static DWORD PutEntry(LPBYTE pData, DWORD cbData, DWORD cbUsed, WORD wTag, LPCVOID pValue, WORD cbValue)
+{
+	//entries past the end of the buffer are only counted
+	if (cbUsed + sizeof(WORD) * 2 + cbValue <= cbData)
+	{
+		memcpy(pData + cbUsed, &wTag, sizeof(WORD));
+		memcpy(pData + cbUsed + sizeof(WORD), &cbValue, sizeof(WORD));
+		memcpy(pData + cbUsed + sizeof(WORD) * 2, pValue, cbValue);
+	}
+
+	return cbUsed + sizeof(WORD) * 2 + cbValue;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD EncodePortConfig(LPPORTCONFIG2 pConfig, LPBYTE pData, DWORD cbData)
+{
+	DWORD cbUsed = sizeof(CFGTLVHEADER);
+
+	if (pData == NULL)
+		cbData = 0;
+
+	for (size_t n = 0; n < LENGTHOF(Fields); n++)
+	{
+		LPBYTE pValue = reinterpret_cast<LPBYTE>(pConfig) + Fields[n].nOffset;
+		WORD cbValue = Fields[n].cchString
+			? static_cast<WORD>(wcsnlen(reinterpret_cast<LPCWSTR>(pValue), Fields[n].cchString - 1) * sizeof(WCHAR))
+			: static_cast<WORD>(sizeof(DWORD));
+
+		cbUsed = PutEntry(pData, cbData, cbUsed, Fields[n].wTag, pValue, cbValue);
+	}
+
+	if (cbUsed <= cbData)
+	{
+		CFGTLVHEADER hdr;
+		hdr.dwMagic = CFGTLV_MAGIC;
+		hdr.wVersion = CFGTLV_VERSION;
+		hdr.cbChar = sizeof(WCHAR);
+		hdr.cbData = cbUsed - sizeof(CFGTLVHEADER);
+		memcpy(pData, &hdr, sizeof(hdr));
+	}
+
+	return cbUsed;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL DecodePortConfig(LPBYTE pData, DWORD cbData, LPPORTCONFIG2 pConfig)
+{
+	CFGTLVHEADER hdr;
+
+	if (pData == NULL || cbData < sizeof(hdr))
+		return FALSE;
+
+	memcpy(&hdr, pData, sizeof(hdr));
+
+	if (hdr.dwMagic != CFGTLV_MAGIC ||
+		hdr.wVersion != CFGTLV_VERSION ||
+		hdr.cbChar != sizeof(WCHAR) ||
+		hdr.cbData != cbData - sizeof(hdr))
+	{
+		return FALSE;
+	}
+
+	LPBYTE pRead = pData + sizeof(hdr);
+	LPBYTE pEnd = pData + cbData;
+
+	while (pRead < pEnd)
+	{
+		WORD wTag, cbValue;
+
+		if (static_cast<size_t>(pEnd - pRead) < sizeof(WORD) * 2)
+			return FALSE;
+
+		memcpy(&wTag, pRead, sizeof(WORD));
+		memcpy(&cbValue, pRead + sizeof(WORD), sizeof(WORD));
+		pRead += sizeof(WORD) * 2;
+
+		if (static_cast<size_t>(pEnd - pRead) < cbValue)
+			return FALSE;
+
+		for (size_t n = 0; n < LENGTHOF(Fields); n++)
+		{
+			if (Fields[n].wTag != wTag)
+				continue;
+
+			LPBYTE pValue = reinterpret_cast<LPBYTE>(pConfig) + Fields[n].nOffset;
+
+			if (Fields[n].cchString)
+			{
+				//a string must fit, with its terminator, in the PORTCONFIG2 member
+				if (cbValue % sizeof(WCHAR) != 0 || cbValue / sizeof(WCHAR) >= Fields[n].cchString)
+					return FALSE;
+
+				memcpy(pValue, pRead, cbValue);
+				reinterpret_cast<LPWSTR>(pValue)[cbValue / sizeof(WCHAR)] = L'\0';
+			}
+			else
+			{
+				if (cbValue != sizeof(DWORD))
+					return FALSE;
+
+				memcpy(pValue, pRead, sizeof(DWORD));
+			}
+
+			break;
+		}
+
+		pRead += cbValue;
+	}
+
+	return TRUE;
+}
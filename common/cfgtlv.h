@@ -0,0 +1,71 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#include "config.h"
+
+/*
+*  Port settings on the wire, for the GetConfigEx and SetConfigEx Xcv commands.
+*  A CFGTLVHEADER, then one entry per setting: a u16 tag, a u16 length in bytes
+*  and the value. Strings are cbChar bytes per character, without terminator;
+*  flags and numbers are DWORDs. Only what is used travels, instead of the
+*  whole PORTCONFIG, which stays for the legacy GetConfig and SetConfig;
+*  the settings PORTCONFIG has no room for (PORTCONFIG2) travel only here.
+*  A reader skips the tags it doesn't know and leaves alone the settings whose
+*  tag is missing, so a setting can be added without a new version: the
+*  version changes only when an existing tag changes meaning.
+*/
+
+#define CFGTLV_MAGIC		0x434D464DUL	//"MFMC"
+#define CFGTLV_VERSION		1
+
+#define CFGTAG_PORTNAME			1
+#define CFGTAG_OUTPUTPATH		2
+#define CFGTAG_FILEPATTERN		3
+#define CFGTAG_OVERWRITE		4
+#define CFGTAG_USERCOMMAND		5
+#define CFGTAG_EXECPATH			6
+#define CFGTAG_WAITTERMINATION	7
+#define CFGTAG_WAITTIMEOUT		8
+#define CFGTAG_PIPEDATA			9
+#define CFGTAG_HIDEPROCESS		10
+#define CFGTAG_LOGLEVEL			11
+#define CFGTAG_USER				12
+#define CFGTAG_DOMAIN			13
+#define CFGTAG_PASSWORD			14
+#define CFGTAG_ARCHIVEMODE		15
+#define CFGTAG_ARCHIVEMAXSIZE	16
+#define CFGTAG_ARCHIVEMAXAGE	17
+#define CFGTAG_ARCHIVEMAXJOBS	18
+
+typedef struct tagCFGTLVHEADER
+{
+	DWORD dwMagic;
+	WORD wVersion;
+	WORD cbChar;
+	DWORD cbData;
+} CFGTLVHEADER, *LPCFGTLVHEADER;
+
+//returns the size of the encoded settings, written to pData only if they fit in cbData
+DWORD EncodePortConfig(LPPORTCONFIG2 pConfig, LPBYTE pData, DWORD cbData);
+
+//FALSE if the data is malformed; pConfig may then be partly updated
+BOOL DecodePortConfig(LPBYTE pData, DWORD cbData, LPPORTCONFIG2 pConfig);
@@ -19,11 +19,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <LMCons.h>
+#endif
+#include <stddef.h>
 #include "defs.h"
 
 //structure to transfer data between monitor DLL
-//and user interface DLL
+//and user interface DLL; GetConfig and SetConfig exchange it
+//as it is, so its layout must not change
 typedef struct tagPORTCONFIG
 {
 	WCHAR szPortName[MAX_PATH + 1];
@@ -41,3 +45,30 @@ typedef struct tagPORTCONFIG
 	WCHAR szDomain[MAX_DOMAIN];
 	WCHAR szPassword[MAX_PASSWORD];
 } PORTCONFIG, *LPPORTCONFIG;
+
+//all the settings of a port: a PORTCONFIG, member for member, followed
+//by the ones added since, which only travel tagged (cfgtlv.h, cfgsnap.h)
+typedef struct tagPORTCONFIG2
+{
+	WCHAR szPortName[MAX_PATH + 1];
+	WCHAR szOutputPath[MAX_PATH + 1];
+	WCHAR szFilePattern[MAX_PATH + 1];
+	BOOL bOverwrite;
+	WCHAR szUserCommandPattern[MAX_USERCOMMMAND];
+	WCHAR szExecPath[MAX_PATH + 1];
+	BOOL bWaitTermination;
+	DWORD dwWaitTimeout;
+	BOOL bPipeData;
+	BOOL bHideProcess;
+	int nLogLevel;
+	WCHAR szUser[MAX_USER];
+	WCHAR szDomain[MAX_DOMAIN];
+	WCHAR szPassword[MAX_PASSWORD];
+	DWORD dwArchiveMode;
+	DWORD dwArchiveMaxSize;
+	DWORD dwArchiveMaxAge;
+	DWORD dwArchiveMaxJobs;
+} PORTCONFIG2, *LPPORTCONFIG2;
+
+static_assert(offsetof(PORTCONFIG2, szPassword) == offsetof(PORTCONFIG, szPassword) &&
+	offsetof(PORTCONFIG2, dwArchiveMode) == sizeof(PORTCONFIG), "PORTCONFIG2 must start with a PORTCONFIG");
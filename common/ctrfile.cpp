@@ -0,0 +1,229 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stdafx.h"
+#include "ctrfile.h"
+
+//-------------------------------------------------------------------------------------
+CCounterFile::CCounterFile()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_dwLastTry = 0;
+	m_bTried = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+CCounterFile::~CCounterFile()
+{
+	Detach();
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCounterFile::Attach(LPCWSTR szDirectory)
+{
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		return TRUE;
+
+	//most directories have no counter: don't look for it on every job
+	if (m_bTried && GetTickCount() - m_dwLastTry < CTRFILE_RETRY)
+		return FALSE;
+
+	m_bTried = TRUE;
+	m_dwLastTry = GetTickCount();
+
+	WCHAR szPath[MAX_PATH + 1];
+	size_t len = wcslen(szDirectory);
+
+	if (len + 1 + wcslen(CTRFILE_NAME) >= LENGTHOF(szPath))
+		return FALSE;
+
+	wcscpy_s(szPath, LENGTHOF(szPath), szDirectory);
+	if (len > 0 && szPath[len - 1] != L'\\' && szPath[len - 1] != L'/')
+		wcscat_s(szPath, LENGTHOF(szPath), L"\\");
+	wcscat_s(szPath, LENGTHOF(szPath), CTRFILE_NAME);
+
+	//never created here: its presence is what turns the service on
+	m_hFile = CreateFileW(szPath, GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+
+	return m_hFile != INVALID_HANDLE_VALUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CCounterFile::Detach()
+{
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	//look for it again on the next Attach
+	m_bTried = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CCounterFile::Take(LPDWORD pdwValue)
+{
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return ERROR_INVALID_HANDLE;
+
+	if (!Lock())
+		return ERROR_LOCK_VIOLATION;
+
+	CTRFILERECORD rec;
+	DWORD dwRet = ERROR_SUCCESS;
+
+	if (!Read(&rec))
+		dwRet = ERROR_FILE_INVALID;
+	else if (!Write(rec.dwNext + 1))
+		dwRet = ERROR_WRITE_FAULT;
+	else
+		*pdwValue = rec.dwNext;
+
+	Unlock();
+
+	//an I/O error most likely means the share went away: reopen it later
+	if (dwRet == ERROR_WRITE_FAULT)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	return dwRet;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CCounterFile::Store(DWORD dwNext, BOOL bForce)
+{
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return ERROR_INVALID_HANDLE;
+
+	if (!Lock())
+		return ERROR_LOCK_VIOLATION;
+
+	CTRFILERECORD rec;
+	DWORD dwRet = ERROR_SUCCESS;
+
+	//somebody else may have gone further meanwhile: never move it back, unless
+	//the numbering wrapped around
+	if (bForce || !Read(&rec) || rec.dwNext < dwNext)
+	{
+		if (!Write(dwNext))
+			dwRet = ERROR_WRITE_FAULT;
+	}
+
+	Unlock();
+
+	if (dwRet == ERROR_WRITE_FAULT)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	return dwRet;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCounterFile::Lock()
+{
+	OVERLAPPED ov;
+
+	//held for a read and a write only; a peer that holds it longer than
+	//this is hung, and we'd rather probe than hang with it
+	for (int n = 0; n < CTRFILE_LOCKTRIES; n++)
+	{
+		ZeroMemory(&ov, sizeof(ov));
+
+		if (LockFileEx(m_hFile, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0,
+			sizeof(CTRFILERECORD), 0, &ov))
+		{
+			return TRUE;
+		}
+
+		if (GetLastError() != ERROR_LOCK_VIOLATION)
+			return FALSE;
+
+		Sleep(1);
+	}
+
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+void CCounterFile::Unlock()
+{
+	OVERLAPPED ov;
+	ZeroMemory(&ov, sizeof(ov));
+
+	UnlockFileEx(m_hFile, 0, sizeof(CTRFILERECORD), 0, &ov);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCounterFile::Read(LPCTRFILERECORD pRecord)
+{
+	OVERLAPPED ov;
+	DWORD rd = 0;
+
+	ZeroMemory(&ov, sizeof(ov));
+
+	//an empty file, as created by hand, reads short: not set up yet
+	if (!ReadFile(m_hFile, pRecord, sizeof(*pRecord), &rd, &ov) || rd != sizeof(*pRecord))
+		return FALSE;
+
+	return pRecord->dwMagic == CTRFILE_MAGIC &&
+		pRecord->wVersion == CTRFILE_VERSION &&
+		pRecord->dwChecksum == Checksum(pRecord);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCounterFile::Write(DWORD dwNext)
+{
+	CTRFILERECORD rec;
+	OVERLAPPED ov;
+	DWORD wri = 0;
+
+	ZeroMemory(&rec, sizeof(rec));
+	rec.dwMagic = CTRFILE_MAGIC;
+	rec.wVersion = CTRFILE_VERSION;
+	rec.dwNext = dwNext;
+	rec.dwChecksum = Checksum(&rec);
+
+	ZeroMemory(&ov, sizeof(ov));
+
+	return WriteFile(m_hFile, &rec, sizeof(rec), &wri, &ov) && wri == sizeof(rec);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CCounterFile::Checksum(LPCTRFILERECORD pRecord)
+{
+	//FNV-1a
+	LPBYTE pData = reinterpret_cast<LPBYTE>(pRecord);
+	DWORD dwHash = 2166136261U;
+
+	for (size_t n = 0; n < offsetof(CTRFILERECORD, dwChecksum); n++)
+	{
+		dwHash ^= pData[n];
+		dwHash *= 16777619U;
+	}
+
+	return dwHash;
+}
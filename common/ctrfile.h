@@ -0,0 +1,81 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+/*
+*  CCounterFile
+*  a counter shared by every port, and every monitor, writing into one output
+*  directory, so that %i numbering doesn't have them all probe and collide on
+*  the same names. The counter lives in a small file in the output directory
+*  and is read and bumped under an exclusive byte-range lock, which works
+*  across processes and across machines on an SMB share.
+*
+*  The service is optional: it's used for a directory only when an
+*  administrator creates the file there (an empty file will do, it's set up by
+*  the first job). The value is a hint and not a guarantee: the output file is
+*  still created with CREATE_NEW, and whenever the file is missing, corrupt,
+*  stale or locked for too long, the caller goes back to probing and tells
+*  the counter the value it ended up with.
+*
+*  Layout: a CTRFILERECORD at offset 0, the checksum is FNV-1a over the
+*  fields before it.
+*/
+
+#define CTRFILE_NAME		L"mfilemon.ctr"
+#define CTRFILE_MAGIC		0x434D464DUL	//"MFMC"
+#define CTRFILE_VERSION		1
+#define CTRFILE_RETRY		60000	//ms before looking for a missing file again
+#define CTRFILE_LOCKTRIES	50		//1 ms apart, then we probe instead
+
+typedef struct tagCTRFILERECORD
+{
+	DWORD dwMagic;
+	WORD wVersion;
+	WORD wReserved;
+	DWORD dwNext;
+	DWORD dwChecksum;
+} CTRFILERECORD, *LPCTRFILERECORD;
+
+class CCounterFile
+{
+public:
+	CCounterFile();
+	virtual ~CCounterFile();
+
+public:
+	BOOL Attach(LPCWSTR szDirectory);
+	void Detach();
+	BOOL IsAttached() const { return m_hFile != INVALID_HANDLE_VALUE; }
+	DWORD Take(LPDWORD pdwValue);
+	DWORD Store(DWORD dwNext, BOOL bForce);
+
+private:
+	BOOL Lock();
+	void Unlock();
+	BOOL Read(LPCTRFILERECORD pRecord);
+	BOOL Write(DWORD dwNext);
+	static DWORD Checksum(LPCTRFILERECORD pRecord);
+
+private:
+	HANDLE m_hFile;
+	DWORD m_dwLastTry;
+	BOOL m_bTried;
+};
@@ -19,7 +19,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <LMCons.h>
+#endif
 
 //maximum command line for CreateProcessW
 #define MAX_COMMAND 32768
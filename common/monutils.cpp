@@ -19,7 +19,51 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "stdafx.h"
 #include "monutils.h"
+#ifdef _WIN32
 #include <VersionHelpers.h>
+#endif
+
+//SSE2 is the baseline of every target we build for (x64, and x86 since VS2012)
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#include <wchar.h>
+#define MFM_SSE2
+#if WCHAR_MAX > 0xFFFF
+#define WCHAR_CMPEQ(a, b) _mm_cmpeq_epi32((a), (b))
+#define WCHAR_SET1(c) _mm_set1_epi32(c)
+#else
+#define WCHAR_CMPEQ(a, b) _mm_cmpeq_epi16((a), (b))
+#define WCHAR_SET1(c) _mm_set1_epi16(static_cast<short>(c))
+#endif
+#endif
+
+//the vector scan reads whole aligned blocks, possibly past the terminator:
+//safe, since an aligned block never crosses a page, but not for ASan
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+#endif
+#ifndef NO_SANITIZE_ADDRESS
+#define NO_SANITIZE_ADDRESS
+#endif
+
+#define ISBLANK(c) ((c) == L' ' || (c) == L'\t' || (c) == L'\r' || (c) == L'\n')
+
+//-------------------------------------------------------------------------------------
+static inline BOOL IsInvalidFileChar(WCHAR c)
+{
+	switch (c)
+	{
+	case L'\\': case L'/': case L':': case L'*': case L'?':
+	case L'"': case L'<': case L'>': case L'|':
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
 
 //-------------------------------------------------------------------------------------
 BOOL FileExists(LPCWSTR szFileName)
@@ -69,32 +113,89 @@ BOOL DirectoryExists(LPCWSTR szDirName)
 void Trim(LPWSTR szString)
 {
 	LPWSTR pStart = szString;
+
+	while (ISBLANK(*pStart))
+		pStart++;
+
+	//single pass: move the string down and remember where the last non blank ends
 	LPWSTR pDest = szString;
+	LPWSTR pEnd = szString;
 
-	while (*pStart == L'\r' ||
-		*pStart == L'\n' ||
-		*pStart == L' ' ||
-		*pStart == L'\t')
+	while (*pStart)
 	{
-		pStart++;
+		WCHAR c = *pStart++;
+		*pDest++ = c;
+		if (!ISBLANK(c))
+			pEnd = pDest;
 	}
 
-	if (pStart > szString)
+	*pEnd = L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+NO_SANITIZE_ADDRESS size_t ReplaceInvalidFileChars(LPWSTR szString, WCHAR cReplace)
+{
+	LPWSTR pPos = szString;
+
+#ifdef MFM_SSE2
+	//scalar up to the first aligned block
+	while ((reinterpret_cast<size_t>(pPos) & 15) != 0)
 	{
-		while (*pStart)
-			*pDest++ = *pStart++;
-		*pDest = L'\0';
+		if (*pPos == L'\0')
+			return pPos - szString;
+		if (IsInvalidFileChar(*pPos))
+			*pPos = cReplace;
+		pPos++;
 	}
 
-	pStart = szString + wcslen(szString) - 1;
-	while (pStart >= szString && (
-		*pStart == L'\r' ||
-		*pStart == L'\n' ||
-		*pStart == L' ' ||
-		*pStart == L'\t'))
+	const __m128i vZero = _mm_setzero_si128();
+	const __m128i vBackslash = WCHAR_SET1(L'\\');
+	const __m128i vSlash = WCHAR_SET1(L'/');
+	const __m128i vColon = WCHAR_SET1(L':');
+	const __m128i vStar = WCHAR_SET1(L'*');
+	const __m128i vQuestion = WCHAR_SET1(L'?');
+	const __m128i vQuote = WCHAR_SET1(L'"');
+	const __m128i vLess = WCHAR_SET1(L'<');
+	const __m128i vGreater = WCHAR_SET1(L'>');
+	const __m128i vPipe = WCHAR_SET1(L'|');
+	const size_t nLanes = sizeof(__m128i) / sizeof(WCHAR);
+
+	for (;;)
+	{
+		__m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(pPos));
+		__m128i vHit = _mm_or_si128(
+			_mm_or_si128(
+				_mm_or_si128(WCHAR_CMPEQ(v, vZero), WCHAR_CMPEQ(v, vBackslash)),
+				_mm_or_si128(WCHAR_CMPEQ(v, vSlash), WCHAR_CMPEQ(v, vColon))),
+			_mm_or_si128(
+				_mm_or_si128(
+					_mm_or_si128(WCHAR_CMPEQ(v, vStar), WCHAR_CMPEQ(v, vQuestion)),
+					_mm_or_si128(WCHAR_CMPEQ(v, vQuote), WCHAR_CMPEQ(v, vLess))),
+				_mm_or_si128(WCHAR_CMPEQ(v, vGreater), WCHAR_CMPEQ(v, vPipe))));
+
+		if (_mm_movemask_epi8(vHit) != 0)
+		{
+			//terminator or invalid character somewhere in this block
+			for (size_t n = 0; n < nLanes; n++, pPos++)
+			{
+				if (*pPos == L'\0')
+					return pPos - szString;
+				if (IsInvalidFileChar(*pPos))
+					*pPos = cReplace;
+			}
+		}
+		else
+			pPos += nLanes;
+	}
+#else
+	for (; *pPos; pPos++)
 	{
-		*pStart-- = L'\0';
+		if (IsInvalidFileChar(*pPos))
+			*pPos = cReplace;
 	}
+
+	return pPos - szString;
+#endif
 }
 
 //-------------------------------------------------------------------------------------
@@ -135,6 +236,7 @@ void GetFileParent(LPCWSTR szFile, LPWSTR szParent, size_t count)
 		szParent[0] = L'\0'; //should never occur...
 }
 
+#ifdef _WIN32
 //-------------------------------------------------------------------------------------
 BOOL IsUACEnabled()
 {
@@ -161,3 +263,11 @@ BOOL IsUACEnabled()
 
 	return bRet;
 }
+#else
+//-------------------------------------------------------------------------------------
+BOOL IsUACEnabled()
+{
+	//no impersonation to step out of
+	return FALSE;
+}
+#endif
@@ -19,7 +19,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #define ISSLASH(a) ((a) == L'\\')
+#else
+#define ISSLASH(a) ((a) == L'\\' || (a) == L'/')
+#endif
 
 BOOL FileExists(LPCWSTR szFileName);
 
@@ -29,6 +33,9 @@ BOOL DirectoryExists(LPCWSTR szDirName);
 
 void Trim(LPWSTR szString);
 
+//replaces the characters not allowed in a file name in one pass, returns the length
+size_t ReplaceInvalidFileChars(LPWSTR szString, WCHAR cReplace);
+
 void GetFileParent(LPCWSTR szFile, LPWSTR szParent, size_t count);
 
 BOOL IsUACEnabled();
@@ -0,0 +1,2405 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <wctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <limits.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NATIVE_PATH 4096
+
+//pseudo handle of GetCurrentThread and GetCurrentProcess, never an object
+#define PSEUDO_HANDLE ((HANDLE)(intptr_t)-2)
+
+typedef struct tagFINDSTATE
+{
+	DIR* pDir;
+	WCHAR szMask[MAX_PATH];
+} FINDSTATE, *LPFINDSTATE;
+
+//a thread blocked in a wait: each has its own condition variable, linked
+//into the waiter list of every object it waits for
+typedef struct tagWAITER
+{
+	pthread_cond_t cond;
+} WAITER, *LPWAITER;
+
+typedef struct tagWAITLINK
+{
+	LPWAITER pWaiter;
+	struct tagWAITLINK* pPrev;
+	struct tagWAITLINK* pNext;
+} WAITLINK, *LPWAITLINK;
+
+typedef enum
+{
+	OBJ_FILE,
+	OBJ_EVENT,
+	OBJ_SEMAPHORE,
+	OBJ_THREAD,
+	OBJ_PROCESS,
+} OBJTYPE;
+
+//what a HANDLE points to; all but nRefs of a file are guarded by g_mtxObjects
+typedef struct tagOBJECT
+{
+	OBJTYPE nType;
+	LONG nRefs;
+	LPWAITLINK pWaiters;
+	//file or pipe
+	int fd;
+	//event, thread and process (signaled once ended)
+	BOOL bSignaled;
+	BOOL bManualReset;
+	//semaphore
+	LONG nCount;
+	LONG nMax;
+	//thread and process
+	DWORD dwExitCode;
+	pthread_t thread;
+	pid_t pid;
+	//thread: TerminateThread and CancelSynchronousIo
+	LPWAITER pWaiting;
+	BOOL bTerminate;
+	volatile LONG bInIo;
+	volatile LONG bCancelIo;
+} OBJECT, *LPOBJECT;
+
+typedef struct tagTHREADSTART
+{
+	LPOBJECT pThread;
+	LPTHREAD_START_ROUTINE pfnStart;
+	LPVOID lpParam;
+} THREADSTART, *LPTHREADSTART;
+
+static pthread_mutex_t g_mtxObjects = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_onceSignals = PTHREAD_ONCE_INIT;
+
+static thread_local DWORD t_dwLastError = ERROR_SUCCESS;
+//object of the running thread, when started by CreateThread
+static thread_local LPOBJECT t_pSelf = NULL;
+//set while a terminated thread unwinds, so it doesn't exit twice
+static thread_local BOOL t_bExiting = FALSE;
+
+//-------------------------------------------------------------------------------------
+static void InvalidParameter(const char* szFunction)
+{
+	//the Microsoft CRT terminates the process by default, and so do we:
+	//a silent truncation here would hide what crashes the spooler on Windows
+	fprintf(stderr, "%s: invalid parameter\n", szFunction);
+	abort();
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD ErrorFromErrno(int nErr)
+{
+	switch (nErr)
+	{
+	case 0:
+		return ERROR_SUCCESS;
+	case ENOENT:
+		return ERROR_FILE_NOT_FOUND;
+	case ENOTDIR:
+	case ENAMETOOLONG:
+		return ERROR_PATH_NOT_FOUND;
+	case EACCES:
+	case EPERM:
+	case EROFS:
+		return ERROR_ACCESS_DENIED;
+	case EBADF:
+		return ERROR_INVALID_HANDLE;
+	case ENOMEM:
+	case EAGAIN:
+		return ERROR_NOT_ENOUGH_MEMORY;
+	case EEXIST:
+		return ERROR_FILE_EXISTS;
+	case EINVAL:
+		return ERROR_INVALID_PARAMETER;
+	case ENOSPC:
+		return ERROR_DISK_FULL;
+	case EPIPE:
+		//the reader went away: what Win32 says writing to a closed pipe
+		return ERROR_NO_DATA;
+	default:
+		return ERROR_GEN_FAILURE;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL Fail(int nErr)
+{
+	t_dwLastError = ErrorFromErrno(nErr);
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL FailWith(DWORD dwErr)
+{
+	t_dwLastError = dwErr;
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static off_t Offset(LPOVERLAPPED lpOverlapped)
+{
+	return static_cast<off_t>((static_cast<ULONGLONG>(lpOverlapped->OffsetHigh) << 32) | lpOverlapped->Offset);
+}
+
+//-------------------------------------------------------------------------------------
+static size_t EncodeUtf8(unsigned long ch, char* buf)
+{
+	if (ch < 0x80)
+	{
+		buf[0] = static_cast<char>(ch);
+		return 1;
+	}
+	else if (ch < 0x800)
+	{
+		buf[0] = static_cast<char>(0xC0 | (ch >> 6));
+		buf[1] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 2;
+	}
+	else if (ch < 0x10000)
+	{
+		buf[0] = static_cast<char>(0xE0 | (ch >> 12));
+		buf[1] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		buf[2] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 3;
+	}
+	else
+	{
+		buf[0] = static_cast<char>(0xF0 | ((ch >> 18) & 0x07));
+		buf[1] = static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+		buf[2] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		buf[3] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 4;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ToNative(LPCWSTR szPath, char* szOut, size_t cbOut)
+{
+	//UTF-8, with Win32 separators turned into POSIX ones
+	size_t n = 0;
+
+	for (; *szPath; szPath++)
+	{
+		unsigned long ch = static_cast<unsigned long>(*szPath);
+		char buf[4];
+
+		if (ch == L'\\')
+			ch = L'/';
+
+		size_t len = EncodeUtf8(ch, buf);
+
+		if (n + len >= cbOut)
+		{
+			t_dwLastError = ERROR_PATH_NOT_FOUND;
+			return FALSE;
+		}
+
+		memcpy(szOut + n, buf, len);
+		n += len;
+	}
+
+	szOut[n] = '\0';
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static void FromNative(const char* szName, LPWSTR szOut, size_t cchOut)
+{
+	//malformed sequences are taken byte by byte
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(szName);
+	size_t n = 0;
+
+	while (*p && n < cchOut - 1)
+	{
+		unsigned long ch = *p++;
+		int extra = (ch >= 0xF0) ? 3 : (ch >= 0xE0) ? 2 : (ch >= 0xC0) ? 1 : 0;
+
+		if (extra)
+		{
+			unsigned long cp = ch & (0x3F >> extra);
+			int i;
+			for (i = 0; i < extra && (p[i] & 0xC0) == 0x80; i++)
+				cp = (cp << 6) | (p[i] & 0x3F);
+			if (i == extra)
+			{
+				ch = cp;
+				p += extra;
+			}
+		}
+
+		szOut[n++] = static_cast<WCHAR>(ch);
+	}
+
+	szOut[n] = L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL MatchMask(LPCWSTR szMask, LPCWSTR szName)
+{
+	//Win32 wildcards: * and ?, case insensitive
+	LPCWSTR pStar = NULL;
+	LPCWSTR pResume = NULL;
+
+	while (*szName)
+	{
+		if (*szMask == L'*')
+		{
+			pStar = szMask++;
+			pResume = szName;
+		}
+		else if (*szMask == L'?' || (*szMask && towlower(*szMask) == towlower(*szName)))
+		{
+			szMask++;
+			szName++;
+		}
+		else if (pStar)
+		{
+			szMask = pStar + 1;
+			szName = ++pResume;
+		}
+		else
+			return FALSE;
+	}
+
+	while (*szMask == L'*')
+		szMask++;
+
+	return *szMask == L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+static void OnCancelIo(int /*nSig*/)
+{
+	//nothing to do: being delivered is what interrupts the blocking call
+}
+
+//-------------------------------------------------------------------------------------
+static void InstallSignals()
+{
+	//a write to a pipe whose reader is gone fails with EPIPE, as on Windows,
+	//instead of killing the process
+	signal(SIGPIPE, SIG_IGN);
+
+	//CancelSynchronousIo: no SA_RESTART, so that read and write return EINTR
+	struct sigaction sa;
+	ZeroMemory(&sa, sizeof(sa));
+	sa.sa_handler = OnCancelIo;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGRTMIN, &sa, NULL);
+}
+
+//-------------------------------------------------------------------------------------
+static LPOBJECT NewObject(OBJTYPE nType, LONG nRefs)
+{
+	LPOBJECT pObj = new OBJECT;
+
+	ZeroMemory(pObj, sizeof(*pObj));
+	pObj->nType = nType;
+	pObj->nRefs = nRefs;
+	pObj->fd = -1;
+
+	return pObj;
+}
+
+//-------------------------------------------------------------------------------------
+static LPOBJECT ToObject(HANDLE hObject)
+{
+	if (!hObject || hObject == INVALID_HANDLE_VALUE || hObject == PSEUDO_HANDLE)
+	{
+		t_dwLastError = ERROR_INVALID_HANDLE;
+		return NULL;
+	}
+
+	return static_cast<LPOBJECT>(hObject);
+}
+
+//-------------------------------------------------------------------------------------
+static int FileDescriptor(HANDLE hFile)
+{
+	LPOBJECT pObj = ToObject(hFile);
+
+	if (!pObj || pObj->nType != OBJ_FILE)
+	{
+		t_dwLastError = ERROR_INVALID_HANDLE;
+		return -1;
+	}
+
+	return pObj->fd;
+}
+
+//-------------------------------------------------------------------------------------
+static HANDLE NewFile(int fd)
+{
+	LPOBJECT pObj = NewObject(OBJ_FILE, 1);
+	pObj->fd = fd;
+	return pObj;
+}
+
+//-------------------------------------------------------------------------------------
+static void ReleaseObject(LPOBJECT pObj)
+{
+	if (__atomic_sub_fetch(&pObj->nRefs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	if (pObj->nType == OBJ_FILE)
+		close(pObj->fd);
+
+	delete pObj;
+}
+
+//-------------------------------------------------------------------------------------
+static void WakeWaiters(LPOBJECT pObj)
+{
+	//g_mtxObjects held
+	for (LPWAITLINK pLink = pObj->pWaiters; pLink; pLink = pLink->pNext)
+		pthread_cond_signal(&pLink->pWaiter->cond);
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL IsSignaled(LPOBJECT pObj)
+{
+	//g_mtxObjects held
+	return (pObj->nType == OBJ_SEMAPHORE) ? pObj->nCount > 0 : pObj->bSignaled;
+}
+
+//-------------------------------------------------------------------------------------
+static void Consume(LPOBJECT pObj)
+{
+	//g_mtxObjects held: what a satisfied wait takes away
+	if (pObj->nType == OBJ_SEMAPHORE)
+		pObj->nCount--;
+	else if (pObj->nType == OBJ_EVENT && !pObj->bManualReset)
+		pObj->bSignaled = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static void ExitTerminated()
+{
+	//TerminateThread: unwind and end here; the thread object is signaled on the way out
+	t_bExiting = TRUE;
+	pthread_exit(NULL);
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL IsTerminated()
+{
+	return t_pSelf && !t_bExiting && __atomic_load_n(&t_pSelf->bTerminate, __ATOMIC_ACQUIRE);
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD Wait(DWORD nCount, LPOBJECT* ppObjs, BOOL bWaitAll, DWORD dwMilliseconds)
+{
+	//nCount == 0 is a plain sleep, which TerminateThread can still interrupt
+	struct timespec tsEnd;
+	WAITER waiter;
+	WAITLINK links[MAXIMUM_WAIT_OBJECTS];
+	BOOL bLinked = FALSE;
+	DWORD dwRet = WAIT_TIMEOUT;
+
+	if (IsTerminated())
+		ExitTerminated();
+
+	if (dwMilliseconds != INFINITE)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+		tsEnd.tv_sec += dwMilliseconds / 1000;
+		tsEnd.tv_nsec += (dwMilliseconds % 1000) * 1000000L;
+		if (tsEnd.tv_nsec >= 1000000000L)
+		{
+			tsEnd.tv_sec++;
+			tsEnd.tv_nsec -= 1000000000L;
+		}
+	}
+
+	pthread_mutex_lock(&g_mtxObjects);
+
+	for (;;)
+	{
+		DWORD i;
+
+		if (bWaitAll && nCount > 0)
+		{
+			for (i = 0; i < nCount && IsSignaled(ppObjs[i]); i++)
+				;
+			if (i == nCount)
+			{
+				for (i = 0; i < nCount; i++)
+					Consume(ppObjs[i]);
+				dwRet = WAIT_OBJECT_0;
+				break;
+			}
+		}
+		else if (!bWaitAll)
+		{
+			for (i = 0; i < nCount && !IsSignaled(ppObjs[i]); i++)
+				;
+			if (i < nCount)
+			{
+				Consume(ppObjs[i]);
+				dwRet = WAIT_OBJECT_0 + i;
+				break;
+			}
+		}
+
+		if (IsTerminated() || dwMilliseconds == 0)
+			break;
+
+		if (!bLinked)
+		{
+			pthread_condattr_t attr;
+			pthread_condattr_init(&attr);
+			pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+			pthread_cond_init(&waiter.cond, &attr);
+			pthread_condattr_destroy(&attr);
+
+			for (i = 0; i < nCount; i++)
+			{
+				links[i].pWaiter = &waiter;
+				links[i].pPrev = NULL;
+				links[i].pNext = ppObjs[i]->pWaiters;
+				if (ppObjs[i]->pWaiters)
+					ppObjs[i]->pWaiters->pPrev = &links[i];
+				ppObjs[i]->pWaiters = &links[i];
+			}
+			if (t_pSelf)
+				t_pSelf->pWaiting = &waiter;
+			bLinked = TRUE;
+		}
+
+		if (dwMilliseconds == INFINITE)
+			pthread_cond_wait(&waiter.cond, &g_mtxObjects);
+		else if (pthread_cond_timedwait(&waiter.cond, &g_mtxObjects, &tsEnd) == ETIMEDOUT)
+			dwMilliseconds = 0;
+	}
+
+	if (bLinked)
+	{
+		for (DWORD i = 0; i < nCount; i++)
+		{
+			if (links[i].pPrev)
+				links[i].pPrev->pNext = links[i].pNext;
+			else
+				ppObjs[i]->pWaiters = links[i].pNext;
+			if (links[i].pNext)
+				links[i].pNext->pPrev = links[i].pPrev;
+		}
+		if (t_pSelf)
+			t_pSelf->pWaiting = NULL;
+		pthread_cond_destroy(&waiter.cond);
+	}
+
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	if (IsTerminated())
+		ExitTerminated();
+
+	return dwRet;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL BeginIo(LPOBJECT pSelf)
+{
+	//the window CancelSynchronousIo can interrupt; FALSE if already cancelled
+	if (!pSelf)
+		return TRUE;
+
+	__atomic_store_n(&pSelf->bInIo, TRUE, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&pSelf->bCancelIo, FALSE, __ATOMIC_SEQ_CST))
+	{
+		__atomic_store_n(&pSelf->bInIo, FALSE, __ATOMIC_SEQ_CST);
+		return FALSE;
+	}
+
+	//a pending TerminateThread ends the thread inside the blocking call
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static void EndIo(LPOBJECT pSelf)
+{
+	if (!pSelf)
+		return;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	__atomic_store_n(&pSelf->bInIo, FALSE, __ATOMIC_SEQ_CST);
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL IoCancelled(LPOBJECT pSelf)
+{
+	//after EINTR: cancelled, or just some other signal to retry after
+	return pSelf && __atomic_exchange_n(&pSelf->bCancelIo, FALSE, __ATOMIC_SEQ_CST);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD GetLastError()
+{
+	return t_dwLastError;
+}
+
+//-------------------------------------------------------------------------------------
+void SetLastError(DWORD dwErr)
+{
+	t_dwLastError = dwErr;
+}
+
+//-------------------------------------------------------------------------------------
+void GetLocalTime(LPSYSTEMTIME lpSystemTime)
+{
+	struct timespec ts;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+
+	lpSystemTime->wYear = static_cast<WORD>(tm.tm_year + 1900);
+	lpSystemTime->wMonth = static_cast<WORD>(tm.tm_mon + 1);
+	lpSystemTime->wDayOfWeek = static_cast<WORD>(tm.tm_wday);
+	lpSystemTime->wDay = static_cast<WORD>(tm.tm_mday);
+	lpSystemTime->wHour = static_cast<WORD>(tm.tm_hour);
+	lpSystemTime->wMinute = static_cast<WORD>(tm.tm_min);
+	lpSystemTime->wSecond = static_cast<WORD>(tm.tm_sec);
+	lpSystemTime->wMilliseconds = static_cast<WORD>(ts.tv_nsec / 1000000);
+}
+
+//seconds from 1601-01-01 to 1970-01-01
+#define EPOCH_DIFF 11644473600ULL
+
+//-------------------------------------------------------------------------------------
+void GetSystemTimeAsFileTime(LPFILETIME lpSystemTimeAsFileTime)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	ULONGLONG ft = (static_cast<ULONGLONG>(ts.tv_sec) + EPOCH_DIFF) * 10000000ULL + ts.tv_nsec / 100;
+	lpSystemTimeAsFileTime->dwLowDateTime = static_cast<DWORD>(ft);
+	lpSystemTimeAsFileTime->dwHighDateTime = static_cast<DWORD>(ft >> 32);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL FileTimeToLocalFileTime(const FILETIME* lpFileTime, LPFILETIME lpLocalFileTime)
+{
+	ULONGLONG ft = (static_cast<ULONGLONG>(lpFileTime->dwHighDateTime) << 32) | lpFileTime->dwLowDateTime;
+	time_t t = static_cast<time_t>(ft / 10000000ULL - EPOCH_DIFF);
+	struct tm tm;
+
+	//the offset in effect at that time, which Win32 doesn't bother with
+	localtime_r(&t, &tm);
+	ft += static_cast<LONGLONG>(tm.tm_gmtoff) * 10000000LL;
+
+	lpLocalFileTime->dwLowDateTime = static_cast<DWORD>(ft);
+	lpLocalFileTime->dwHighDateTime = static_cast<DWORD>(ft >> 32);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL FileTimeToSystemTime(const FILETIME* lpFileTime, LPSYSTEMTIME lpSystemTime)
+{
+	ULONGLONG ft = (static_cast<ULONGLONG>(lpFileTime->dwHighDateTime) << 32) | lpFileTime->dwLowDateTime;
+	time_t t = static_cast<time_t>(ft / 10000000ULL - EPOCH_DIFF);
+	struct tm tm;
+
+	if (!gmtime_r(&t, &tm))
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	lpSystemTime->wYear = static_cast<WORD>(tm.tm_year + 1900);
+	lpSystemTime->wMonth = static_cast<WORD>(tm.tm_mon + 1);
+	lpSystemTime->wDayOfWeek = static_cast<WORD>(tm.tm_wday);
+	lpSystemTime->wDay = static_cast<WORD>(tm.tm_mday);
+	lpSystemTime->wHour = static_cast<WORD>(tm.tm_hour);
+	lpSystemTime->wMinute = static_cast<WORD>(tm.tm_min);
+	lpSystemTime->wSecond = static_cast<WORD>(tm.tm_sec);
+	lpSystemTime->wMilliseconds = static_cast<WORD>((ft / 10000ULL) % 1000);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD GetTickCount()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<DWORD>(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+//-------------------------------------------------------------------------------------
+void Sleep(DWORD dwMilliseconds)
+{
+	Wait(0, NULL, FALSE, dwMilliseconds);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL QueryPerformanceCounter(LARGE_INTEGER* lpPerformanceCount)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lpPerformanceCount->QuadPart = static_cast<LONGLONG>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* lpFrequency)
+{
+	lpFrequency->QuadPart = 1000000000LL;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD GetTempPathW(DWORD nBufferLength, LPWSTR lpBuffer)
+{
+	WCHAR szTemp[MAX_PATH + 1];
+	const char* szDir = getenv("TMPDIR");
+
+	if (!szDir || !*szDir)
+		szDir = "/tmp";
+
+	FromNative(szDir, szTemp, LENGTHOF(szTemp) - 1);
+
+	//like Win32, the result ends with a separator
+	size_t len = wcslen(szTemp);
+	if (szTemp[len - 1] != L'/')
+	{
+		szTemp[len++] = L'/';
+		szTemp[len] = L'\0';
+	}
+
+	if (len + 1 > nBufferLength)
+		return static_cast<DWORD>(len + 1);
+
+	wcscpy(lpBuffer, szTemp);
+
+	return static_cast<DWORD>(len);
+}
+
+//-------------------------------------------------------------------------------------
+UINT GetSystemDirectoryW(LPWSTR lpBuffer, UINT uSize)
+{
+	//where the monitor keeps its logs and counters: MFM_SYSTEMDIR, or the
+	//temporary directory, without the trailing separator
+	WCHAR szDir[MAX_PATH + 1];
+	const char* szEnv = getenv("MFM_SYSTEMDIR");
+
+	if (!szEnv || !*szEnv)
+		szEnv = getenv("TMPDIR");
+	if (!szEnv || !*szEnv)
+		szEnv = "/tmp";
+
+	FromNative(szEnv, szDir, LENGTHOF(szDir));
+
+	size_t len = wcslen(szDir);
+	while (len > 1 && szDir[len - 1] == L'/')
+		szDir[--len] = L'\0';
+
+	if (len + 1 > uSize)
+		return static_cast<UINT>(len + 1);
+
+	wcscpy(lpBuffer, szDir);
+
+	return static_cast<UINT>(len);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD GetFileAttributesW(LPCWSTR lpFileName)
+{
+	char szPath[NATIVE_PATH];
+	struct stat st;
+
+	if (!ToNative(lpFileName, szPath, sizeof(szPath)))
+		return INVALID_FILE_ATTRIBUTES;
+
+	if (stat(szPath, &st) != 0)
+	{
+		Fail(errno);
+		return INVALID_FILE_ATTRIBUTES;
+	}
+
+	return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CreateDirectoryW(LPCWSTR lpPathName, LPVOID /*lpSecurityAttributes*/)
+{
+	char szPath[NATIVE_PATH];
+
+	if (!ToNative(lpPathName, szPath, sizeof(szPath)))
+		return FALSE;
+
+	if (mkdir(szPath, 0777) != 0)
+	{
+		Fail(errno);
+		if (errno == EEXIST)
+			t_dwLastError = ERROR_ALREADY_EXISTS;
+		else if (errno == ENOENT)
+			t_dwLastError = ERROR_PATH_NOT_FOUND;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL DeleteFileW(LPCWSTR lpFileName)
+{
+	char szPath[NATIVE_PATH];
+
+	if (!ToNative(lpFileName, szPath, sizeof(szPath)))
+		return FALSE;
+
+	if (unlink(szPath) != 0)
+		return Fail(errno);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CreateFileW(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD /*dwShareMode*/,
+	LPVOID /*lpSecurityAttributes*/, DWORD dwCreationDisposition, DWORD /*dwFlagsAndAttributes*/,
+	HANDLE /*hTemplateFile*/)
+{
+	char szPath[NATIVE_PATH];
+
+	if (!ToNative(lpFileName, szPath, sizeof(szPath)))
+		return INVALID_HANDLE_VALUE;
+
+	int flags = O_CLOEXEC;
+
+	if ((dwDesiredAccess & GENERIC_READ) && (dwDesiredAccess & GENERIC_WRITE))
+		flags |= O_RDWR;
+	else if (dwDesiredAccess & GENERIC_WRITE)
+		flags |= O_WRONLY;
+	else
+		flags |= O_RDONLY;
+
+	switch (dwCreationDisposition)
+	{
+	case CREATE_NEW:
+		flags |= O_CREAT | O_EXCL;
+		break;
+	case CREATE_ALWAYS:
+		flags |= O_CREAT | O_TRUNC;
+		break;
+	case OPEN_ALWAYS:
+		flags |= O_CREAT;
+		break;
+	case OPEN_EXISTING:
+		break;
+	default:
+		t_dwLastError = ERROR_INVALID_PARAMETER;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	int fd = open(szPath, flags, 0666);
+
+	if (fd < 0)
+	{
+		//a missing parent is reported as a missing path, as Win32 does
+		Fail(errno);
+		if (errno == ENOENT && dwCreationDisposition != OPEN_EXISTING)
+			t_dwLastError = ERROR_PATH_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return NewFile(fd);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite,
+	LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped)
+{
+	int fd = FileDescriptor(hFile);
+	const char* p = static_cast<const char*>(lpBuffer);
+	LPOBJECT pSelf = t_pSelf;
+	DWORD cbDone = 0;
+	int nErr = 0;
+
+	if (lpNumberOfBytesWritten)
+		*lpNumberOfBytesWritten = 0;
+
+	if (fd < 0)
+		return FALSE;
+
+	if (!BeginIo(pSelf))
+		return FailWith(ERROR_OPERATION_ABORTED);
+
+	while (cbDone < nNumberOfBytesToWrite)
+	{
+		//with an OVERLAPPED, at its offset and leaving the file position alone
+		ssize_t n = lpOverlapped ?
+			pwrite(fd, p + cbDone, nNumberOfBytesToWrite - cbDone, Offset(lpOverlapped) + cbDone) :
+			write(fd, p + cbDone, nNumberOfBytesToWrite - cbDone);
+		if (n < 0)
+		{
+			if (errno == EINTR && !IoCancelled(pSelf))
+				continue;
+			nErr = errno;
+			break;
+		}
+		cbDone += static_cast<DWORD>(n);
+	}
+
+	EndIo(pSelf);
+
+	if (lpNumberOfBytesWritten)
+		*lpNumberOfBytesWritten = cbDone;
+
+	if (nErr == EINTR)
+		return FailWith(ERROR_OPERATION_ABORTED);
+	if (nErr)
+		return Fail(nErr);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL ReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead,
+	LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+{
+	int fd = FileDescriptor(hFile);
+	LPOBJECT pSelf = t_pSelf;
+	ssize_t n;
+
+	if (lpNumberOfBytesRead)
+		*lpNumberOfBytesRead = 0;
+
+	if (fd < 0)
+		return FALSE;
+
+	if (!BeginIo(pSelf))
+		return FailWith(ERROR_OPERATION_ABORTED);
+
+	for (;;)
+	{
+		n = lpOverlapped ?
+			pread(fd, lpBuffer, nNumberOfBytesToRead, Offset(lpOverlapped)) :
+			read(fd, lpBuffer, nNumberOfBytesToRead);
+		if (n >= 0 || errno != EINTR || IoCancelled(pSelf))
+			break;
+	}
+
+	int nErr = (n < 0) ? errno : 0;
+
+	EndIo(pSelf);
+
+	if (nErr == EINTR)
+		return FailWith(ERROR_OPERATION_ABORTED);
+	if (nErr)
+		return Fail(nErr);
+
+	if (lpNumberOfBytesRead)
+		*lpNumberOfBytesRead = static_cast<DWORD>(n);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL RangeLock(HANDLE hFile, short nType, BOOL bWait, DWORD cbLow, DWORD cbHigh,
+	LPOVERLAPPED lpOverlapped)
+{
+	//open file description locks belong to the handle, as on Windows, so two
+	//handles of one process exclude each other; plain POSIX locks don't
+	struct flock fl;
+	int fd = FileDescriptor(hFile);
+
+	if (fd < 0)
+		return FALSE;
+
+	ZeroMemory(&fl, sizeof(fl));
+	fl.l_type = nType;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = Offset(lpOverlapped);
+	fl.l_len = static_cast<off_t>((static_cast<ULONGLONG>(cbHigh) << 32) | cbLow);
+
+#ifdef F_OFD_SETLK
+	int nCmd = bWait ? F_OFD_SETLKW : F_OFD_SETLK;
+#else
+	int nCmd = bWait ? F_SETLKW : F_SETLK;
+#endif
+
+	int nRet;
+	do
+	{
+		nRet = fcntl(fd, nCmd, &fl);
+	} while (nRet != 0 && errno == EINTR);
+
+	if (nRet != 0)
+	{
+		Fail(errno);
+		if (errno == EAGAIN || errno == EACCES)
+			t_dwLastError = ERROR_LOCK_VIOLATION;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL LockFileEx(HANDLE hFile, DWORD dwFlags, DWORD /*dwReserved*/, DWORD nNumberOfBytesToLockLow,
+	DWORD nNumberOfBytesToLockHigh, LPOVERLAPPED lpOverlapped)
+{
+	return RangeLock(hFile, (dwFlags & LOCKFILE_EXCLUSIVE_LOCK) ? F_WRLCK : F_RDLCK,
+		!(dwFlags & LOCKFILE_FAIL_IMMEDIATELY), nNumberOfBytesToLockLow, nNumberOfBytesToLockHigh,
+		lpOverlapped);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL UnlockFileEx(HANDLE hFile, DWORD /*dwReserved*/, DWORD nNumberOfBytesToUnlockLow,
+	DWORD nNumberOfBytesToUnlockHigh, LPOVERLAPPED lpOverlapped)
+{
+	return RangeLock(hFile, F_UNLCK, FALSE, nNumberOfBytesToUnlockLow, nNumberOfBytesToUnlockHigh,
+		lpOverlapped);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER* lpFileSize)
+{
+	struct stat st;
+	int fd = FileDescriptor(hFile);
+
+	if (fd < 0)
+		return FALSE;
+
+	if (fstat(fd, &st) != 0)
+		return Fail(errno);
+
+	lpFileSize->QuadPart = static_cast<LONGLONG>(st.st_size);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL SetFilePointerEx(HANDLE hFile, LARGE_INTEGER liDistanceToMove, LARGE_INTEGER* lpNewFilePointer,
+	DWORD dwMoveMethod)
+{
+	static const int whence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+	int fd = FileDescriptor(hFile);
+
+	if (fd < 0)
+		return FALSE;
+
+	if (dwMoveMethod > FILE_END)
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	off_t pos = lseek(fd, static_cast<off_t>(liDistanceToMove.QuadPart), whence[dwMoveMethod]);
+	if (pos < 0)
+		return Fail(errno);
+
+	if (lpNewFilePointer)
+		lpNewFilePointer->QuadPart = static_cast<LONGLONG>(pos);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD SetFilePointer(HANDLE hFile, LONG lDistanceToMove, LPLONG lpDistanceToMoveHigh, DWORD dwMoveMethod)
+{
+	LARGE_INTEGER li;
+
+	if (lpDistanceToMoveHigh)
+	{
+		li.LowPart = static_cast<DWORD>(lDistanceToMove);
+		li.HighPart = *lpDistanceToMoveHigh;
+	}
+	else
+		li.QuadPart = lDistanceToMove;
+
+	if (!SetFilePointerEx(hFile, li, &li, dwMoveMethod))
+		return INVALID_SET_FILE_POINTER;
+
+	if (lpDistanceToMoveHigh)
+		*lpDistanceToMoveHigh = li.HighPart;
+
+	//a position whose low part is INVALID_SET_FILE_POINTER is told apart by this
+	t_dwLastError = ERROR_SUCCESS;
+
+	return li.LowPart;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL MoveFileExW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileName, DWORD dwFlags)
+{
+	char szOld[NATIVE_PATH];
+	char szNew[NATIVE_PATH];
+
+	if (!ToNative(lpExistingFileName, szOld, sizeof(szOld)) ||
+		!ToNative(lpNewFileName, szNew, sizeof(szNew)))
+	{
+		return FALSE;
+	}
+
+	//rename always replaces, refuse it like Windows does without the flag
+	if (!(dwFlags & MOVEFILE_REPLACE_EXISTING) && access(szNew, F_OK) == 0)
+		return Fail(EEXIST);
+
+	if (rename(szOld, szNew) != 0)
+		return Fail(errno);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL MoveFileW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileName)
+{
+	return MoveFileExW(lpExistingFileName, lpNewFileName, 0);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL FlushFileBuffers(HANDLE hFile)
+{
+	int fd = FileDescriptor(hFile);
+
+	if (fd < 0)
+		return FALSE;
+
+	if (fsync(fd) != 0)
+		return Fail(errno);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CreatePipe(PHANDLE hReadPipe, PHANDLE hWritePipe, LPSECURITY_ATTRIBUTES /*lpPipeAttributes*/,
+	DWORD /*nSize*/)
+{
+	int fds[2];
+
+	pthread_once(&g_onceSignals, InstallSignals);
+
+	//close on exec: CreateProcessW hands the child only its standard handles
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		return Fail(errno);
+
+	*hReadPipe = NewFile(fds[0]);
+	*hWritePipe = NewFile(fds[1]);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL SetHandleInformation(HANDLE hObject, DWORD /*dwMask*/, DWORD /*dwFlags*/)
+{
+	//see CreatePipe: no handle is inherited but those passed as standard handles
+	return ToObject(hObject) != NULL;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CloseHandle(HANDLE hObject)
+{
+	if (hObject == PSEUDO_HANDLE)
+		return TRUE;
+
+	LPOBJECT pObj = ToObject(hObject);
+
+	if (!pObj)
+		return FALSE;
+
+	ReleaseObject(pObj);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CreateEventW(LPSECURITY_ATTRIBUTES /*lpEventAttributes*/, BOOL bManualReset, BOOL bInitialState,
+	LPCWSTR lpName)
+{
+	//named events are shared between processes, which nothing here needs
+	if (lpName)
+	{
+		t_dwLastError = ERROR_NOT_SUPPORTED;
+		return NULL;
+	}
+
+	LPOBJECT pObj = NewObject(OBJ_EVENT, 1);
+	pObj->bManualReset = bManualReset;
+	pObj->bSignaled = bInitialState;
+
+	return pObj;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL SignalEvent(HANDLE hEvent, BOOL bSignaled)
+{
+	LPOBJECT pObj = ToObject(hEvent);
+
+	if (!pObj || pObj->nType != OBJ_EVENT)
+		return FailWith(ERROR_INVALID_HANDLE);
+
+	pthread_mutex_lock(&g_mtxObjects);
+	pObj->bSignaled = bSignaled;
+	if (bSignaled)
+		WakeWaiters(pObj);
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL SetEvent(HANDLE hEvent)
+{
+	return SignalEvent(hEvent, TRUE);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL ResetEvent(HANDLE hEvent)
+{
+	return SignalEvent(hEvent, FALSE);
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CreateSemaphoreW(LPSECURITY_ATTRIBUTES /*lpSemaphoreAttributes*/, LONG lInitialCount,
+	LONG lMaximumCount, LPCWSTR lpName)
+{
+	if (lpName)
+	{
+		t_dwLastError = ERROR_NOT_SUPPORTED;
+		return NULL;
+	}
+
+	if (lMaximumCount <= 0 || lInitialCount < 0 || lInitialCount > lMaximumCount)
+	{
+		t_dwLastError = ERROR_INVALID_PARAMETER;
+		return NULL;
+	}
+
+	LPOBJECT pObj = NewObject(OBJ_SEMAPHORE, 1);
+	pObj->nCount = lInitialCount;
+	pObj->nMax = lMaximumCount;
+
+	return pObj;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG lReleaseCount, LPLONG lpPreviousCount)
+{
+	LPOBJECT pObj = ToObject(hSemaphore);
+
+	if (!pObj || pObj->nType != OBJ_SEMAPHORE)
+		return FailWith(ERROR_INVALID_HANDLE);
+
+	if (lReleaseCount <= 0)
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	pthread_mutex_lock(&g_mtxObjects);
+
+	if (lReleaseCount > pObj->nMax - pObj->nCount)
+	{
+		pthread_mutex_unlock(&g_mtxObjects);
+		return FailWith(ERROR_TOO_MANY_POSTS);
+	}
+
+	if (lpPreviousCount)
+		*lpPreviousCount = pObj->nCount;
+	pObj->nCount += lReleaseCount;
+	WakeWaiters(pObj);
+
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAll, DWORD dwMilliseconds)
+{
+	LPOBJECT objs[MAXIMUM_WAIT_OBJECTS];
+
+	if (nCount == 0 || nCount > MAXIMUM_WAIT_OBJECTS)
+	{
+		t_dwLastError = ERROR_INVALID_PARAMETER;
+		return WAIT_FAILED;
+	}
+
+	for (DWORD i = 0; i < nCount; i++)
+	{
+		//files are not waitable here: nothing in the monitor waits for I/O that way
+		objs[i] = ToObject(lpHandles[i]);
+		if (!objs[i] || objs[i]->nType == OBJ_FILE)
+		{
+			t_dwLastError = ERROR_INVALID_HANDLE;
+			return WAIT_FAILED;
+		}
+	}
+
+	return Wait(nCount, objs, bWaitAll, dwMilliseconds);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
+{
+	return WaitForMultipleObjects(1, &hHandle, FALSE, dwMilliseconds);
+}
+
+//-------------------------------------------------------------------------------------
+static void SignalEnded(LPOBJECT pObj, DWORD dwExitCode)
+{
+	//a thread or process is over: wake who waits for it and drop its reference
+	pthread_mutex_lock(&g_mtxObjects);
+	if (!pObj->bTerminate)
+		pObj->dwExitCode = dwExitCode;
+	pObj->bSignaled = TRUE;
+	WakeWaiters(pObj);
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	ReleaseObject(pObj);
+}
+
+//an ended thread, by return or by TerminateThread
+class CThreadEnd
+{
+public:
+	CThreadEnd(LPOBJECT pThread) : m_pThread(pThread), m_dwExitCode(0) {}
+	~CThreadEnd() { SignalEnded(m_pThread, m_dwExitCode); }
+	void SetExitCode(DWORD dwExitCode) { m_dwExitCode = dwExitCode; }
+
+private:
+	LPOBJECT m_pThread;
+	DWORD m_dwExitCode;
+};
+
+//-------------------------------------------------------------------------------------
+static void* ThreadStart(void* lpParam)
+{
+	LPTHREADSTART pStart = static_cast<LPTHREADSTART>(lpParam);
+	LPTHREAD_START_ROUTINE pfnStart = pStart->pfnStart;
+	LPVOID lpThreadParam = pStart->lpParam;
+	CThreadEnd end(pStart->pThread);
+
+	//Win32 threads can't be cancelled halfway through a critical section:
+	//TerminateThread only cancels blocking I/O, see BeginIo
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+	t_pSelf = pStart->pThread;
+	delete pStart;
+
+	end.SetExitCode(pfnStart(lpThreadParam));
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES /*lpThreadAttributes*/, SIZE_T dwStackSize,
+	LPTHREAD_START_ROUTINE lpStartAddress, LPVOID lpParameter, DWORD /*dwCreationFlags*/,
+	LPDWORD lpThreadId)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_once(&g_onceSignals, InstallSignals);
+
+	//one reference for the handle, one for the running thread
+	LPOBJECT pObj = NewObject(OBJ_THREAD, 2);
+
+	LPTHREADSTART pStart = new THREADSTART;
+	pStart->pThread = pObj;
+	pStart->pfnStart = lpStartAddress;
+	pStart->lpParam = lpParameter;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (dwStackSize)
+	{
+		SIZE_T cbMin = static_cast<SIZE_T>(PTHREAD_STACK_MIN);
+		pthread_attr_setstacksize(&attr, dwStackSize < cbMin ? cbMin : dwStackSize);
+	}
+
+	//the handle may be waited for as soon as we return: set up before it runs
+	pthread_mutex_lock(&g_mtxObjects);
+	int nErr = pthread_create(&thread, &attr, ThreadStart, pStart);
+	if (nErr == 0)
+		pObj->thread = thread;
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	pthread_attr_destroy(&attr);
+
+	if (nErr != 0)
+	{
+		delete pStart;
+		delete pObj;
+		Fail(nErr);
+		return NULL;
+	}
+
+	if (lpThreadId)
+		*lpThreadId = static_cast<DWORD>(reinterpret_cast<uintptr_t>(pObj));
+
+	return pObj;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL TerminateThread(HANDLE hThread, DWORD dwExitCode)
+{
+	LPOBJECT pObj = ToObject(hThread);
+
+	if (!pObj || pObj->nType != OBJ_THREAD)
+		return FailWith(ERROR_INVALID_HANDLE);
+
+	//the thread ends in its next blocking read or write, wait or critical
+	//section; until then it still runs, unlike on Windows
+	pthread_mutex_lock(&g_mtxObjects);
+	if (!pObj->bSignaled && !pObj->bTerminate)
+	{
+		pObj->dwExitCode = dwExitCode;
+		__atomic_store_n(&pObj->bTerminate, TRUE, __ATOMIC_RELEASE);
+		if (pObj->pWaiting)
+			pthread_cond_signal(&pObj->pWaiting->cond);
+		pthread_cancel(pObj->thread);
+	}
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CancelSynchronousIo(HANDLE hThread)
+{
+	LPOBJECT pObj = ToObject(hThread);
+
+	if (!pObj || pObj->nType != OBJ_THREAD)
+		return FailWith(ERROR_INVALID_HANDLE);
+
+	BOOL bRet = FALSE;
+
+	pthread_mutex_lock(&g_mtxObjects);
+	if (!pObj->bSignaled && __atomic_load_n(&pObj->bInIo, __ATOMIC_SEQ_CST))
+	{
+		//flag first: the signal only gets the thread out of the blocking call,
+		//a call about to start sees the flag in BeginIo
+		__atomic_store_n(&pObj->bCancelIo, TRUE, __ATOMIC_SEQ_CST);
+		pthread_kill(pObj->thread, SIGRTMIN);
+		bRet = TRUE;
+	}
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	if (!bRet)
+		t_dwLastError = ERROR_NOT_FOUND;
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL GetExitCode(HANDLE hObject, OBJTYPE nType, LPDWORD lpExitCode)
+{
+	LPOBJECT pObj = ToObject(hObject);
+
+	if (!pObj || pObj->nType != nType)
+		return FailWith(ERROR_INVALID_HANDLE);
+
+	pthread_mutex_lock(&g_mtxObjects);
+	*lpExitCode = pObj->bSignaled ? pObj->dwExitCode : STILL_ACTIVE;
+	pthread_mutex_unlock(&g_mtxObjects);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetExitCodeThread(HANDLE hThread, LPDWORD lpExitCode)
+{
+	return GetExitCode(hThread, OBJ_THREAD, lpExitCode);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD GetCurrentThreadId()
+{
+	return static_cast<DWORD>(gettid());
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE GetCurrentThread()
+{
+	return PSEUDO_HANDLE;
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE GetCurrentProcess()
+{
+	return PSEUDO_HANDLE;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD TlsAlloc()
+{
+	pthread_key_t key;
+
+	if (pthread_key_create(&key, NULL) != 0)
+	{
+		t_dwLastError = ERROR_NOT_ENOUGH_MEMORY;
+		return TLS_OUT_OF_INDEXES;
+	}
+
+	return static_cast<DWORD>(key);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL TlsFree(DWORD dwTlsIndex)
+{
+	if (pthread_key_delete(static_cast<pthread_key_t>(dwTlsIndex)) != 0)
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+LPVOID TlsGetValue(DWORD dwTlsIndex)
+{
+	//like Win32, so that a NULL value can be told from a failure
+	t_dwLastError = ERROR_SUCCESS;
+	return pthread_getspecific(static_cast<pthread_key_t>(dwTlsIndex));
+}
+
+//-------------------------------------------------------------------------------------
+BOOL TlsSetValue(DWORD dwTlsIndex, LPVOID lpTlsValue)
+{
+	if (pthread_setspecific(static_cast<pthread_key_t>(dwTlsIndex), lpTlsValue) != 0)
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static void* ReapProcess(void* lpParam)
+{
+	LPOBJECT pObj = static_cast<LPOBJECT>(lpParam);
+	int status = 0;
+
+	while (waitpid(pObj->pid, &status, 0) < 0 && errno == EINTR)
+		;
+
+	//killed by a signal: 128 plus its number, as a shell would report it
+	SignalEnded(pObj, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL SpawnStdHandle(posix_spawn_file_actions_t* pActions, HANDLE hStd, int fdTarget)
+{
+	LPOBJECT pObj = (hStd && hStd != INVALID_HANDLE_VALUE) ? static_cast<LPOBJECT>(hStd) : NULL;
+
+	if (pObj && pObj->nType == OBJ_FILE)
+		return posix_spawn_file_actions_adddup2(pActions, pObj->fd, fdTarget) == 0;
+
+	return posix_spawn_file_actions_addopen(pActions, fdTarget, "/dev/null", fdTarget ? O_WRONLY : O_RDONLY, 0) == 0;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CreateProcessW(LPCWSTR lpApplicationName, LPWSTR lpCommandLine,
+	LPSECURITY_ATTRIBUTES /*lpProcessAttributes*/, LPSECURITY_ATTRIBUTES /*lpThreadAttributes*/,
+	BOOL /*bInheritHandles*/, DWORD /*dwCreationFlags*/, LPVOID /*lpEnvironment*/, LPCWSTR lpCurrentDirectory,
+	LPSTARTUPINFOW lpStartupInfo, LPPROCESS_INFORMATION lpProcessInformation)
+{
+	LPCWSTR szCmd = lpCommandLine ? lpCommandLine : lpApplicationName;
+	char szNativeDir[NATIVE_PATH];
+
+	if (!szCmd)
+		return FailWith(ERROR_INVALID_PARAMETER);
+
+	if (lpCurrentDirectory && !ToNative(lpCurrentDirectory, szNativeDir, sizeof(szNativeDir)))
+		return FALSE;
+
+	//the command line, paths and all, goes to the shell
+	size_t cbCmd = wcslen(szCmd) * 4 + 1;
+	char* szNativeCmd = new char[cbCmd];
+
+	if (!ToNative(szCmd, szNativeCmd, cbCmd))
+	{
+		delete[] szNativeCmd;
+		return FALSE;
+	}
+
+	pthread_once(&g_onceSignals, InstallSignals);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	BOOL bOk = TRUE;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	//the child starts with the default SIGPIPE we ignore in here
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+	if (lpStartupInfo && (lpStartupInfo->dwFlags & STARTF_USESTDHANDLES))
+	{
+		bOk = SpawnStdHandle(&actions, lpStartupInfo->hStdInput, 0) &&
+			SpawnStdHandle(&actions, lpStartupInfo->hStdOutput, 1) &&
+			SpawnStdHandle(&actions, lpStartupInfo->hStdError, 2);
+	}
+
+	if (bOk && lpCurrentDirectory)
+		bOk = posix_spawn_file_actions_addchdir_np(&actions, szNativeDir) == 0;
+
+	pid_t pid = 0;
+	int nErr = ENOMEM;
+
+	if (bOk)
+	{
+		char szShell[] = "/bin/sh";
+		char szDashC[] = "-c";
+		char* argv[] = { szShell, szDashC, szNativeCmd, NULL };
+
+		nErr = posix_spawn(&pid, szShell, &actions, &attr, argv, environ);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	delete[] szNativeCmd;
+
+	if (nErr != 0)
+		return Fail(nErr);
+
+	//hProcess, hThread and the reaper each hold a reference
+	LPOBJECT pObj = NewObject(OBJ_PROCESS, 3);
+	pObj->pid = pid;
+
+	pthread_t reaper;
+	pthread_attr_t reaperAttr;
+	pthread_attr_init(&reaperAttr);
+	pthread_attr_setdetachstate(&reaperAttr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&reaper, &reaperAttr, ReapProcess, pObj) != 0)
+	{
+		//nobody to collect it: wait here rather than leave a zombie behind
+		ReapProcess(pObj);
+	}
+	pthread_attr_destroy(&reaperAttr);
+
+	lpProcessInformation->hProcess = pObj;
+	lpProcessInformation->hThread = pObj;
+	lpProcessInformation->dwProcessId = static_cast<DWORD>(pid);
+	lpProcessInformation->dwThreadId = static_cast<DWORD>(pid);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CreateProcessAsUserW(HANDLE /*hToken*/, LPCWSTR lpApplicationName, LPWSTR lpCommandLine,
+	LPSECURITY_ATTRIBUTES lpProcessAttributes, LPSECURITY_ATTRIBUTES lpThreadAttributes,
+	BOOL bInheritHandles, DWORD dwCreationFlags, LPVOID lpEnvironment, LPCWSTR lpCurrentDirectory,
+	LPSTARTUPINFOW lpStartupInfo, LPPROCESS_INFORMATION lpProcessInformation)
+{
+	//a logon token of the mock provider is nothing setuid could use
+	return CreateProcessW(lpApplicationName, lpCommandLine, lpProcessAttributes, lpThreadAttributes,
+		bInheritHandles, dwCreationFlags, lpEnvironment, lpCurrentDirectory, lpStartupInfo,
+		lpProcessInformation);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetExitCodeProcess(HANDLE hProcess, LPDWORD lpExitCode)
+{
+	return GetExitCode(hProcess, OBJ_PROCESS, lpExitCode);
+}
+
+//-------------------------------------------------------------------------------------
+void InitializeCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	static_assert(sizeof(lpCriticalSection->opaque) >= sizeof(pthread_mutex_t), "CRITICAL_SECTION too small");
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(reinterpret_cast<pthread_mutex_t*>(lpCriticalSection->opaque), &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+//-------------------------------------------------------------------------------------
+void DeleteCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_destroy(reinterpret_cast<pthread_mutex_t*>(lpCriticalSection->opaque));
+}
+
+//-------------------------------------------------------------------------------------
+void EnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_t* pMutex = reinterpret_cast<pthread_mutex_t*>(lpCriticalSection->opaque);
+
+	pthread_mutex_lock(pMutex);
+
+	//a thread terminated while it waited for the lock (the writer pool does
+	//that holding it) must not go on, and must not keep it either
+	if (IsTerminated())
+	{
+		pthread_mutex_unlock(pMutex);
+		ExitTerminated();
+	}
+}
+
+//-------------------------------------------------------------------------------------
+BOOL TryEnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	return pthread_mutex_trylock(reinterpret_cast<pthread_mutex_t*>(lpCriticalSection->opaque)) == 0;
+}
+
+//-------------------------------------------------------------------------------------
+void LeaveCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	pthread_mutex_unlock(reinterpret_cast<pthread_mutex_t*>(lpCriticalSection->opaque));
+}
+
+//the sequence number lives in the top 16 bits of the head, above the pointer
+#define SLIST_PTRBITS 48
+#define SLIST_PTRMASK ((1ULL << SLIST_PTRBITS) - 1)
+
+//-------------------------------------------------------------------------------------
+static PSLIST_ENTRY SListTop(ULONGLONG top)
+{
+	return reinterpret_cast<PSLIST_ENTRY>(static_cast<uintptr_t>(top & SLIST_PTRMASK));
+}
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG SListHead(ULONGLONG top, PSLIST_ENTRY pEntry)
+{
+	ULONGLONG ptr = static_cast<ULONGLONG>(reinterpret_cast<uintptr_t>(pEntry));
+
+	if (ptr & ~SLIST_PTRMASK)
+	{
+		fprintf(stderr, "SLIST: entry %p out of range\n", static_cast<void*>(pEntry));
+		abort();
+	}
+
+	return (((top >> SLIST_PTRBITS) + 1) << SLIST_PTRBITS) | ptr;
+}
+
+//-------------------------------------------------------------------------------------
+void InitializeSListHead(PSLIST_HEADER ListHead)
+{
+	ListHead->Top = 0;
+	ListHead->Depth = 0;
+}
+
+//-------------------------------------------------------------------------------------
+PSLIST_ENTRY InterlockedPushEntrySList(PSLIST_HEADER ListHead, PSLIST_ENTRY ListEntry)
+{
+	ULONGLONG top = __atomic_load_n(&ListHead->Top, __ATOMIC_ACQUIRE);
+
+	do
+	{
+		ListEntry->Next = SListTop(top);
+	} while (!__atomic_compare_exchange_n(&ListHead->Top, &top, SListHead(top, ListEntry), true,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	__atomic_add_fetch(&ListHead->Depth, 1, __ATOMIC_RELAXED);
+
+	return ListEntry->Next;
+}
+
+//-------------------------------------------------------------------------------------
+PSLIST_ENTRY InterlockedPopEntrySList(PSLIST_HEADER ListHead)
+{
+	ULONGLONG top = __atomic_load_n(&ListHead->Top, __ATOMIC_ACQUIRE);
+	PSLIST_ENTRY pEntry;
+
+	//entries are never given back to the system while in a list, so reading
+	//Next of one another thread just popped is harmless: the CAS fails
+	do
+	{
+		pEntry = SListTop(top);
+		if (!pEntry)
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&ListHead->Top, &top, SListHead(top, pEntry->Next), true,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	__atomic_sub_fetch(&ListHead->Depth, 1, __ATOMIC_RELAXED);
+
+	return pEntry;
+}
+
+//-------------------------------------------------------------------------------------
+PSLIST_ENTRY InterlockedFlushSList(PSLIST_HEADER ListHead)
+{
+	ULONGLONG top = __atomic_load_n(&ListHead->Top, __ATOMIC_ACQUIRE);
+
+	while (!__atomic_compare_exchange_n(&ListHead->Top, &top, SListHead(top, NULL), true,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		;
+
+	__atomic_store_n(&ListHead->Depth, 0, __ATOMIC_RELAXED);
+
+	return SListTop(top);
+}
+
+//-------------------------------------------------------------------------------------
+WORD QueryDepthSList(PSLIST_HEADER ListHead)
+{
+	LONG nDepth = __atomic_load_n(&ListHead->Depth, __ATOMIC_RELAXED);
+
+	return static_cast<WORD>(nDepth < 0 ? 0 : nDepth);
+}
+
+//-------------------------------------------------------------------------------------
+void* _aligned_malloc(size_t size, size_t alignment)
+{
+	void* p = NULL;
+
+	if (alignment < sizeof(void*))
+		alignment = sizeof(void*);
+
+	if (posix_memalign(&p, alignment, size) != 0)
+		return NULL;
+
+	return p;
+}
+
+//-------------------------------------------------------------------------------------
+void _aligned_free(void* memblock)
+{
+	free(memblock);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetComputerNameW(LPWSTR lpBuffer, LPDWORD nSize)
+{
+	char szHost[256];
+	WCHAR szName[MAX_COMPUTERNAME_LENGTH + 1];
+
+	if (gethostname(szHost, sizeof(szHost)) != 0)
+		return Fail(errno);
+	szHost[sizeof(szHost) - 1] = '\0';
+
+	//NetBIOS style: the first label, no longer than MAX_COMPUTERNAME_LENGTH
+	char* pDot = strchr(szHost, '.');
+	if (pDot)
+		*pDot = '\0';
+	FromNative(szHost, szName, LENGTHOF(szName));
+
+	DWORD len = static_cast<DWORD>(wcslen(szName));
+	if (len + 1 > *nSize)
+	{
+		*nSize = len + 1;
+		return FailWith(ERROR_BUFFER_OVERFLOW);
+	}
+
+	wcscpy(lpBuffer, szName);
+	*nSize = len;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetUserNameW(LPWSTR lpBuffer, LPDWORD pcbBuffer)
+{
+	WCHAR szName[UNLEN + 1];
+	struct passwd* pw = getpwuid(geteuid());
+
+	if (!pw)
+		return FailWith(ERROR_GEN_FAILURE);
+
+	FromNative(pw->pw_name, szName, LENGTHOF(szName));
+
+	//unlike GetComputerNameW, the count includes the terminator
+	DWORD cch = static_cast<DWORD>(wcslen(szName)) + 1;
+	if (cch > *pcbBuffer)
+	{
+		*pcbBuffer = cch;
+		return FailWith(ERROR_INSUFFICIENT_BUFFER);
+	}
+
+	wcscpy(lpBuffer, szName);
+	*pcbBuffer = cch;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+int WideCharToMultiByte(UINT CodePage, DWORD /*dwFlags*/, LPCWSTR lpWideCharStr, int cchWideChar,
+	LPSTR lpMultiByteStr, int cbMultiByte, LPCSTR /*lpDefaultChar*/, BOOL* /*lpUsedDefaultChar*/)
+{
+	if (CodePage != CP_UTF8)
+	{
+		t_dwLastError = ERROR_INVALID_PARAMETER;
+		return 0;
+	}
+
+	//-1: up to and including the terminator
+	size_t cch = (cchWideChar < 0) ? wcslen(lpWideCharStr) + 1 : static_cast<size_t>(cchWideChar);
+	int cb = 0;
+
+	for (size_t i = 0; i < cch; i++)
+	{
+		char buf[4];
+		int len = static_cast<int>(EncodeUtf8(static_cast<unsigned long>(lpWideCharStr[i]), buf));
+
+		if (cbMultiByte)
+		{
+			if (cb + len > cbMultiByte)
+			{
+				t_dwLastError = ERROR_INSUFFICIENT_BUFFER;
+				return 0;
+			}
+			memcpy(lpMultiByteStr + cb, buf, len);
+		}
+		cb += len;
+	}
+
+	return cb;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL ImpersonateLoggedOnUser(HANDLE /*hToken*/)
+{
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL RevertToSelf()
+{
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL OpenThreadToken(HANDLE /*ThreadHandle*/, DWORD /*DesiredAccess*/, BOOL /*OpenAsSelf*/, PHANDLE TokenHandle)
+{
+	//never impersonating: there is no token to open
+	*TokenHandle = NULL;
+	return FailWith(ERROR_NO_TOKEN);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL SetThreadToken(PHANDLE /*Thread*/, HANDLE /*Token*/)
+{
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+HWND GetDesktopWindow()
+{
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+int MessageBoxW(HWND /*hWnd*/, LPCWSTR /*lpText*/, LPCWSTR /*lpCaption*/, UINT /*uType*/)
+{
+	return IDNO;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL OpenPrinterW(LPWSTR /*pPrinterName*/, LPHANDLE phPrinter, LPPRINTER_DEFAULTSW /*pDefault*/)
+{
+	*phPrinter = NULL;
+	return FailWith(ERROR_NOT_SUPPORTED);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL ClosePrinter(HANDLE /*hPrinter*/)
+{
+	return FailWith(ERROR_NOT_SUPPORTED);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL GetJobW(HANDLE /*hPrinter*/, DWORD /*JobId*/, DWORD /*Level*/, LPBYTE /*pJob*/, DWORD /*cbBuf*/,
+	LPDWORD pcbNeeded)
+{
+	*pcbNeeded = 0;
+	return FailWith(ERROR_NOT_SUPPORTED);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL SetJobW(HANDLE /*hPrinter*/, DWORD /*JobId*/, DWORD /*Level*/, LPBYTE /*pJob*/, DWORD /*Command*/)
+{
+	return FailWith(ERROR_NOT_SUPPORTED);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL EnumPortsW(LPWSTR /*pName*/, DWORD /*Level*/, LPBYTE /*pPorts*/, DWORD /*cbBuf*/, LPDWORD pcbNeeded,
+	LPDWORD pcReturned)
+{
+	*pcbNeeded = 0;
+	*pcReturned = 0;
+	return FailWith(ERROR_NOT_SUPPORTED);
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE FindFirstFileW(LPCWSTR lpFileName, LPWIN32_FIND_DATAW lpFindFileData)
+{
+	//the mask is the last path component, the rest is the directory to scan
+	LPCWSTR pMask = lpFileName;
+	for (LPCWSTR p = lpFileName; *p; p++)
+		if (*p == L'\\' || *p == L'/')
+			pMask = p + 1;
+
+	if (wcslen(pMask) >= MAX_PATH)
+	{
+		t_dwLastError = ERROR_PATH_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	WCHAR szDir[MAX_PATH + 1];
+	size_t cchDir = pMask - lpFileName;
+
+	if (cchDir >= LENGTHOF(szDir))
+	{
+		t_dwLastError = ERROR_PATH_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	if (cchDir == 0)
+		wcscpy(szDir, L".");
+	else
+	{
+		wmemcpy(szDir, lpFileName, cchDir);
+		szDir[cchDir] = L'\0';
+	}
+
+	char szPath[NATIVE_PATH];
+
+	if (!wcspbrk(pMask, L"*?"))
+	{
+		//no wildcards: a single stat instead of a directory scan
+		struct stat st;
+
+		if (!ToNative(lpFileName, szPath, sizeof(szPath)))
+			return INVALID_HANDLE_VALUE;
+
+		if (stat(szPath, &st) != 0)
+		{
+			Fail(errno);
+			return INVALID_HANDLE_VALUE;
+		}
+
+		wcscpy(lpFindFileData->cFileName, pMask);
+		lpFindFileData->dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+
+		LPFINDSTATE pState = new FINDSTATE;
+		pState->pDir = NULL;
+		return pState;
+	}
+
+	if (!ToNative(szDir, szPath, sizeof(szPath)))
+		return INVALID_HANDLE_VALUE;
+
+	DIR* pDir = opendir(szPath);
+	if (!pDir)
+	{
+		Fail(errno);
+		if (errno == ENOENT)
+			t_dwLastError = ERROR_PATH_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	LPFINDSTATE pState = new FINDSTATE;
+	pState->pDir = pDir;
+	wcscpy(pState->szMask, pMask);
+
+	if (!FindNextFileW(pState, lpFindFileData))
+	{
+		FindClose(pState);
+		t_dwLastError = ERROR_FILE_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return pState;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL FindNextFileW(HANDLE hFindFile, LPWIN32_FIND_DATAW lpFindFileData)
+{
+	LPFINDSTATE pState = static_cast<LPFINDSTATE>(hFindFile);
+	struct dirent* pEntry;
+
+	if (!pState->pDir)
+	{
+		t_dwLastError = ERROR_NO_MORE_FILES;
+		return FALSE;
+	}
+
+	while ((pEntry = readdir(pState->pDir)) != NULL)
+	{
+		FromNative(pEntry->d_name, lpFindFileData->cFileName, LENGTHOF(lpFindFileData->cFileName));
+
+		if (!MatchMask(pState->szMask, lpFindFileData->cFileName))
+			continue;
+
+		struct stat st;
+		if (fstatat(dirfd(pState->pDir), pEntry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode))
+			lpFindFileData->dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+		else
+			lpFindFileData->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+
+		return TRUE;
+	}
+
+	t_dwLastError = ERROR_NO_MORE_FILES;
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL FindClose(HANDLE hFindFile)
+{
+	LPFINDSTATE pState = static_cast<LPFINDSTATE>(hFindFile);
+
+	if (pState->pDir)
+		closedir(pState->pDir);
+	delete pState;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+errno_t wcscpy_s(wchar_t* szDest, size_t cchDest, const wchar_t* szSrc)
+{
+	size_t len = wcslen(szSrc);
+
+	if (len >= cchDest)
+	{
+		if (cchDest > 0)
+			*szDest = L'\0';
+		InvalidParameter("wcscpy_s");
+		return ERANGE;
+	}
+
+	wmemcpy(szDest, szSrc, len + 1);
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------
+errno_t strcpy_s(char* szDest, size_t cbDest, const char* szSrc)
+{
+	size_t len = strlen(szSrc);
+
+	if (len >= cbDest)
+	{
+		if (cbDest > 0)
+			*szDest = '\0';
+		InvalidParameter("strcpy_s");
+		return ERANGE;
+	}
+
+	memcpy(szDest, szSrc, len + 1);
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------
+errno_t wcscat_s(wchar_t* szDest, size_t cchDest, const wchar_t* szSrc)
+{
+	size_t pos = wcsnlen(szDest, cchDest);
+
+	if (pos == cchDest || wcslen(szSrc) >= cchDest - pos)
+	{
+		if (cchDest > 0)
+			*szDest = L'\0';
+		InvalidParameter("wcscat_s");
+		return EINVAL;
+	}
+
+	return wcscpy_s(szDest + pos, cchDest - pos, szSrc);
+}
+
+//-------------------------------------------------------------------------------------
+errno_t wcsncpy_s(wchar_t* szDest, size_t cchDest, const wchar_t* szSrc, size_t cchCount)
+{
+	if (cchDest == 0)
+	{
+		InvalidParameter("wcsncpy_s");
+		return EINVAL;
+	}
+
+	size_t len = wcslen(szSrc);
+	errno_t ret = 0;
+
+	if (cchCount == _TRUNCATE)
+	{
+		if (len >= cchDest)
+		{
+			len = cchDest - 1;
+			ret = STRUNCATE;
+		}
+	}
+	else
+	{
+		if (len > cchCount)
+			len = cchCount;
+		if (len >= cchDest)
+		{
+			*szDest = L'\0';
+			InvalidParameter("wcsncpy_s");
+			return ERANGE;
+		}
+	}
+
+	wmemcpy(szDest, szSrc, len);
+	szDest[len] = L'\0';
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+template <typename T>
+static T* IsoFormat(const T* szFormat, T* szLocal, size_t cchLocal, BOOL bWide)
+{
+	//translate the Microsoft conversions into their ISO C counterparts: %I64 is
+	//%ll and %I is %z; in wide formats, %s and %c take wide arguments and %S
+	//and %C narrow ones, while narrow formats already agree
+	size_t cchFormat = 0;
+	while (szFormat[cchFormat])
+		cchFormat++;
+	cchFormat = cchFormat * 2 + 1;
+
+	T* szIso = (cchFormat <= cchLocal) ? szLocal : new T[cchFormat];
+	T* pOut = szIso;
+
+	while (*szFormat)
+	{
+		if (*szFormat != '%')
+		{
+			*pOut++ = *szFormat++;
+			continue;
+		}
+
+		*pOut++ = *szFormat++;
+
+		if (*szFormat == '%')
+		{
+			*pOut++ = *szFormat++;
+			continue;
+		}
+
+		while (*szFormat && *szFormat < 0x80 && strchr("-+ #0123456789.*", static_cast<char>(*szFormat)))
+			*pOut++ = *szFormat++;
+
+		BOOL bShort = FALSE;
+		BOOL bLong = FALSE;
+
+		if (szFormat[0] == 'I' && szFormat[1] == '6' && szFormat[2] == '4')
+		{
+			*pOut++ = 'l';
+			*pOut++ = 'l';
+			szFormat += 3;
+		}
+		else if (*szFormat == 'I')
+		{
+			*pOut++ = 'z';
+			szFormat++;
+		}
+		else if (*szFormat == 'h')
+		{
+			bShort = TRUE;
+			szFormat++;
+		}
+		else if (*szFormat == 'l' && szFormat[1] != 'l')
+		{
+			bLong = TRUE;
+			szFormat++;
+		}
+
+		switch (bWide ? *szFormat : 0)
+		{
+		case 's':
+		case 'c':
+			if (!bShort)
+				*pOut++ = 'l';
+			*pOut++ = *szFormat++;
+			break;
+		case 'S':
+		case 'C':
+			if (bLong)
+				*pOut++ = 'l';
+			*pOut++ = static_cast<T>(*szFormat++ - 'A' + 'a');
+			break;
+		default:
+			if (bShort)
+				*pOut++ = 'h';
+			else if (bLong)
+				*pOut++ = 'l';
+			break;
+		}
+	}
+
+	*pOut = '\0';
+
+	return szIso;
+}
+
+//-------------------------------------------------------------------------------------
+int vswprintf_s(wchar_t* szDest, size_t cchDest, const wchar_t* szFormat, va_list args)
+{
+	wchar_t szLocal[512];
+	wchar_t* szIso = IsoFormat(szFormat, szLocal, LENGTHOF(szLocal), TRUE);
+
+	int ret = vswprintf(szDest, cchDest, szIso, args);
+
+	if (szIso != szLocal)
+		delete[] szIso;
+
+	if (ret < 0)
+	{
+		if (cchDest > 0)
+			*szDest = L'\0';
+		InvalidParameter("swprintf_s");
+	}
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int swprintf_s(wchar_t* szDest, size_t cchDest, const wchar_t* szFormat, ...)
+{
+	va_list args;
+	va_start(args, szFormat);
+	int ret = vswprintf_s(szDest, cchDest, szFormat, args);
+	va_end(args);
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int _vsnwprintf_s(wchar_t* szDest, size_t cchDest, size_t cchCount, const wchar_t* szFormat, va_list args)
+{
+	//_TRUNCATE: as much as fits, and -1 if that's not all of it; otherwise at
+	//most cchCount characters, which must fit
+	if (cchDest == 0)
+	{
+		InvalidParameter("_vsnwprintf_s");
+		return -1;
+	}
+
+	size_t cchMax = cchDest;
+	if (cchCount != _TRUNCATE && cchCount < cchDest)
+		cchMax = cchCount + 1;
+
+	wchar_t szLocal[512];
+	wchar_t* szIso = IsoFormat(szFormat, szLocal, LENGTHOF(szLocal), TRUE);
+
+	int ret = vswprintf(szDest, cchMax, szIso, args);
+
+	if (szIso != szLocal)
+		delete[] szIso;
+
+	if (ret < 0)
+	{
+		//glibc leaves the truncated text unterminated
+		szDest[cchMax - 1] = L'\0';
+		if (cchCount != _TRUNCATE && cchMax == cchDest)
+		{
+			*szDest = L'\0';
+			InvalidParameter("_vsnwprintf_s");
+		}
+	}
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int _vscprintf(const char* szFormat, va_list args)
+{
+	char szLocal[256];
+	char* szIso = IsoFormat(szFormat, szLocal, LENGTHOF(szLocal), FALSE);
+
+	int ret = vsnprintf(NULL, 0, szIso, args);
+
+	if (szIso != szLocal)
+		delete[] szIso;
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int vsprintf_s(char* szDest, size_t cbDest, const char* szFormat, va_list args)
+{
+	char szLocal[256];
+	char* szIso = IsoFormat(szFormat, szLocal, LENGTHOF(szLocal), FALSE);
+
+	int ret = vsnprintf(szDest, cbDest, szIso, args);
+
+	if (szIso != szLocal)
+		delete[] szIso;
+
+	if (ret < 0 || static_cast<size_t>(ret) >= cbDest)
+	{
+		if (cbDest > 0)
+			*szDest = '\0';
+		InvalidParameter("sprintf_s");
+		return -1;
+	}
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int sprintf_s(char* szDest, size_t cbDest, const char* szFormat, ...)
+{
+	va_list args;
+	va_start(args, szFormat);
+	int ret = vsprintf_s(szDest, cbDest, szFormat, args);
+	va_end(args);
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int _wcsicmp(const wchar_t* sz1, const wchar_t* sz2)
+{
+	wint_t c1, c2;
+
+	do
+	{
+		c1 = towlower(*sz1++);
+		c2 = towlower(*sz2++);
+	} while (c1 && c1 == c2);
+
+	return static_cast<int>(c1) - static_cast<int>(c2);
+}
+
+//-------------------------------------------------------------------------------------
+int _wcsnicmp(const wchar_t* sz1, const wchar_t* sz2, size_t cch)
+{
+	wint_t c1 = 0, c2 = 0;
+
+	while (cch-- > 0)
+	{
+		c1 = towlower(*sz1++);
+		c2 = towlower(*sz2++);
+		if (!c1 || c1 != c2)
+			break;
+	}
+
+	return static_cast<int>(c1) - static_cast<int>(c2);
+}
+
+//-------------------------------------------------------------------------------------
+wchar_t* _wcsdup(const wchar_t* sz)
+{
+	//released with free, as the CRT's
+	return wcsdup(sz);
+}
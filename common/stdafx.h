@@ -19,9 +19,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
 #include <winspool.h>
 #include <wchar.h>
 #include "sec_api.h"
+#else
+#include "posix.h"
+#endif
 
 #define LENGTHOF(x) (sizeof(x)/sizeof((x)[0]))
@@ -0,0 +1,70 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  fuzz_cfgtlv - libFuzzer target for the port settings wire format.
+*  The input is handed to DecodePortConfig as SetConfigEx does; what decodes
+*  is encoded again, and the encoding must survive a second round unchanged.
+*/
+
+#include "../common/stdafx.h"
+#include "../common/cfgtlv.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t cbData)
+{
+	if (cbData > 0x10000)
+		return 0;
+
+	//a copy, so that reads past the input are caught
+	LPBYTE pInput = new BYTE[cbData + 1];
+	memcpy(pInput, pData, cbData);
+
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	ZeroMemory(pConfig, sizeof(*pConfig));
+
+	if (DecodePortConfig(pInput, static_cast<DWORD>(cbData), pConfig))
+	{
+		DWORD cbFirst = EncodePortConfig(pConfig, NULL, 0);
+		LPBYTE pFirst = new BYTE[cbFirst];
+		_ASSERTE(EncodePortConfig(pConfig, pFirst, cbFirst) == cbFirst);
+
+		LPPORTCONFIG2 pAgain = new PORTCONFIG2;
+		ZeroMemory(pAgain, sizeof(*pAgain));
+		if (!DecodePortConfig(pFirst, cbFirst, pAgain))
+			abort();
+
+		LPBYTE pSecond = new BYTE[cbFirst];
+		if (EncodePortConfig(pAgain, pSecond, cbFirst) != cbFirst || memcmp(pFirst, pSecond, cbFirst) != 0)
+			abort();
+
+		delete[] pSecond;
+		delete pAgain;
+		delete[] pFirst;
+	}
+
+	delete pConfig;
+	delete[] pInput;
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  fuzz_pattern - libFuzzer target for the pattern engine.
+*  Parses the pattern, then renders it the way CreateOutputFile does: Value
+*  and SearchValue for the first candidates of the collision loop, then again
+*  after a Reset. Memory errors are caught by the sanitizers, and a buffer too
+*  small for a secure CRT call terminates the process, as on Windows.
+*  Input format: see fuzzinput.h.
+*/
+
+#include "../common/stdafx.h"
+#include "../common/defs.h"
+#include "../monitor/pattern.h"
+#include "../monitor/patcontext.h"
+#include "fuzzinput.h"
+#include <stdint.h>
+
+#define FUZZ_CANDIDATES	64
+
+static volatile unsigned int g_nSink = 0;
+
+//-------------------------------------------------------------------------------------
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t cbData)
+{
+	CFuzzInput* pInput = new CFuzzInput(pData, cbData);
+	CPattern* pPattern = new CPattern(pInput->Pattern(), pInput, pInput->UserCommand());
+
+	int n = 0;
+	do
+	{
+		LPCWSTR szValue = pPattern->Value();
+		LPCWSTR szSearch = pPattern->SearchValue();
+		_ASSERTE(wcslen(szValue) < MAX_COMMAND && wcslen(szSearch) < MAX_COMMAND);
+		g_nSink += *szValue + *szSearch;
+	} while (++n < FUZZ_CANDIDATES && pPattern->NextValue());
+
+	pPattern->Reset();
+	g_nSink += *pPattern->Value();
+
+	delete pPattern;
+	delete pInput;
+
+	return 0;
+}
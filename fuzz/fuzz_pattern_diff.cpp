@@ -0,0 +1,118 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  fuzz_pattern_diff - differential libFuzzer target for the pattern engine.
+*  Renders the same pattern and job with CPattern and with a candidate engine
+*  and stops on the first file name, search name or collision step on which
+*  they disagree. A replacement engine is plugged in by building with
+*  -DMFM_FUZZ_CANDIDATE=\"header.h\", where the header defines CCandidatePattern
+*  with CPattern's constructor, Value, SearchValue, NextValue and Reset.
+*  Without it the candidate is a second CPattern, which checks that rendering
+*  is repeatable and that Reset really brings a pattern back to its start.
+*  Input format: see fuzzinput.h.
+*/
+
+#include "../common/stdafx.h"
+#include "../common/defs.h"
+#include "../monitor/pattern.h"
+#include "../monitor/patcontext.h"
+#include "fuzzinput.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MFM_FUZZ_CANDIDATE
+#include MFM_FUZZ_CANDIDATE
+#else
+typedef CPattern CCandidatePattern;
+#endif
+
+#define FUZZ_CANDIDATES	64
+
+//-------------------------------------------------------------------------------------
+static void Mismatch(const char* szWhat, int nStep, LPCWSTR szPattern, LPCWSTR szExpected, LPCWSTR szActual)
+{
+	fprintf(stderr, "%s differs at step %d\n  pattern:   %ls\n  expected:  %ls\n  candidate: %ls\n",
+		szWhat, nStep, szPattern, szExpected, szActual);
+	abort();
+}
+
+//-------------------------------------------------------------------------------------
+static void Compare(const char* szWhat, int nStep, CPattern* pReference, LPCWSTR szPattern,
+	LPCWSTR szExpected, LPCWSTR szActual)
+{
+	if (wcscmp(szExpected, szActual) == 0)
+		return;
+
+	//date fields follow the clock: if the reference itself moved on, the
+	//second ticked between the two renderings and nothing can be said
+	LPCWSTR szAgain = (szWhat[0] == 'V') ? pReference->Value() : pReference->SearchValue();
+	if (wcscmp(szExpected, szAgain) != 0)
+		return;
+
+	Mismatch(szWhat, nStep, szPattern, szExpected, szActual);
+}
+
+//-------------------------------------------------------------------------------------
+static void Step(int nStep, CPattern* pReference, CCandidatePattern* pCandidate, LPCWSTR szPattern)
+{
+	//Value and SearchValue return internal buffers, keep a copy
+	static WCHAR szExpected[MAX_COMMAND];
+
+	wcscpy_s(szExpected, LENGTHOF(szExpected), pReference->Value());
+	Compare("Value", nStep, pReference, szPattern, szExpected, pCandidate->Value());
+
+	wcscpy_s(szExpected, LENGTHOF(szExpected), pReference->SearchValue());
+	Compare("SearchValue", nStep, pReference, szPattern, szExpected, pCandidate->SearchValue());
+}
+
+//-------------------------------------------------------------------------------------
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t cbData)
+{
+	CFuzzInput* pInput = new CFuzzInput(pData, cbData);
+	CPattern* pReference = new CPattern(pInput->Pattern(), pInput, pInput->UserCommand());
+	CCandidatePattern* pCandidate = new CCandidatePattern(pInput->Pattern(), pInput, pInput->UserCommand());
+	LPCWSTR szPattern = pInput->Pattern();
+
+	//the candidate takes a few steps first, then both start over from Reset
+	for (int n = 0; n < 3 && pCandidate->NextValue(); n++)
+		;
+	pCandidate->Reset();
+
+	int nStep = 0;
+	for (;;)
+	{
+		Step(nStep, pReference, pCandidate, szPattern);
+
+		BOOL bMore = pReference->NextValue();
+		if (bMore != pCandidate->NextValue())
+			Mismatch("NextValue", nStep, szPattern, bMore ? L"TRUE" : L"FALSE", bMore ? L"FALSE" : L"TRUE");
+
+		if (!bMore || ++nStep == FUZZ_CANDIDATES)
+			break;
+	}
+
+	delete pCandidate;
+	delete pReference;
+	delete pInput;
+
+	return 0;
+}
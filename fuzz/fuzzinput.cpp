@@ -0,0 +1,93 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "../common/stdafx.h"
+#include "../common/defs.h"
+#include "../monitor/patcontext.h"
+#include "fuzzinput.h"
+
+//-------------------------------------------------------------------------------------
+static size_t DecodeLine(const unsigned char* p, const unsigned char* pEnd, LPWSTR szOut, size_t cchMax)
+{
+	//UTF-8 up to the end of line; malformed sequences are taken byte by byte
+	const unsigned char* pStart = p;
+	size_t n = 0;
+
+	while (p < pEnd && *p != '\n')
+	{
+		unsigned long ch = *p++;
+		int extra = (ch >= 0xF0) ? 3 : (ch >= 0xE0) ? 2 : (ch >= 0xC0) ? 1 : 0;
+
+		if (extra && pEnd - p >= extra)
+		{
+			unsigned long cp = ch & (0x3F >> extra);
+			int i;
+			for (i = 0; i < extra && (p[i] & 0xC0) == 0x80; i++)
+				cp = (cp << 6) | (p[i] & 0x3F);
+			if (i == extra)
+			{
+				ch = cp;
+				p += extra;
+			}
+		}
+
+		//a NUL would end the string early, anything else goes
+		if (ch == 0)
+			ch = L' ';
+
+		if (n < cchMax)
+			szOut[n++] = static_cast<WCHAR>(ch);
+	}
+
+	szOut[n] = L'\0';
+
+	return p - pStart;
+}
+
+//-------------------------------------------------------------------------------------
+CFuzzInput::CFuzzInput(const unsigned char* pData, size_t cbData)
+{
+	const unsigned char* p = pData;
+	const unsigned char* pEnd = pData + cbData;
+
+	m_bUserCommand = (p < pEnd && *p == '>');
+	if (m_bUserCommand)
+		p++;
+
+	for (int n = 0; n < FUZZ_FIELDS; n++)
+	{
+		//what the monitor can hold: config strings for the pattern, its own
+		//buffers for file name and path, no fixed limit for job properties
+		size_t cchMax = FUZZ_MAXFIELD;
+		if (n == 0)
+			cchMax = m_bUserCommand ? MAX_USERCOMMMAND - 1 : MAX_PATH;
+		else if (n >= 6)
+			cchMax = MAX_PATH;
+
+		p += DecodeLine(p, pEnd, m_szFields[n], cchMax);
+		if (p < pEnd)
+			p++;
+	}
+
+	//the job id is derived from the input, so that it varies too
+	m_nJobId = 0;
+	for (size_t n = 0; n < cbData; n++)
+		m_nJobId = m_nJobId * 31 + pData[n];
+}
@@ -0,0 +1,58 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#define FUZZ_FIELDS		8
+#define FUZZ_MAXFIELD	4096	//job properties coming from the spooler have no fixed limit
+
+/*
+*  CFuzzInput
+*  turns a fuzzer input into a pattern and the job it is rendered for.
+*  The input is UTF-8 text, one field per line:
+*    pattern (a leading > makes it a user command)
+*    job title, user name, computer name, printer name, bin, file name, path
+*  Missing fields are empty. The pattern and the file name and path are cut to
+*  the sizes the monitor stores them in; the other fields are kept up to
+*  FUZZ_MAXFIELD characters.
+*/
+
+class CFuzzInput : public CPatternContext
+{
+public:
+	CFuzzInput(const unsigned char* pData, size_t cbData);
+
+public:
+	LPCWSTR Pattern() const { return m_szFields[0]; }
+	BOOL UserCommand() const { return m_bUserCommand; }
+	LPCWSTR JobTitle() const { return m_szFields[1]; }
+	DWORD JobId() const { return m_nJobId; }
+	LPCWSTR UserName() const { return m_szFields[2]; }
+	LPCWSTR ComputerName() const { return m_szFields[3]; }
+	LPCWSTR PrinterName() const { return m_szFields[4]; }
+	LPCWSTR Bin() const { return m_szFields[5]; }
+	LPCWSTR FileName() const { return m_szFields[6]; }
+	LPCWSTR Path() const { return m_szFields[7]; }
+
+private:
+	WCHAR m_szFields[FUZZ_FIELDS][FUZZ_MAXFIELD + 1];
+	BOOL m_bUserCommand;
+	DWORD m_nJobId;
+};
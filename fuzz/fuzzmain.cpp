@@ -0,0 +1,61 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  fuzzmain - runs a fuzz target on the files given on the command line.
+*  Linked instead of libFuzzer by compilers that lack it, so that the targets
+*  still build everywhere and the corpus can be replayed, e.g. in a sanitizer
+*  build or under a debugger.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t cbData);
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		FILE* fp = fopen(argv[i], "rb");
+		if (!fp)
+		{
+			fprintf(stderr, "can't open %s\n", argv[i]);
+			return 1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		long cb = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		unsigned char* pData = new unsigned char[cb > 0 ? cb : 1];
+		size_t cbRead = fread(pData, 1, cb > 0 ? cb : 0, fp);
+		fclose(fp);
+
+		LLVMFuzzerTestOneInput(pData, cbRead);
+		delete[] pData;
+
+		printf("%s: ok\n", argv[i]);
+	}
+
+	return 0;
+}
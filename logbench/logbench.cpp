@@ -0,0 +1,188 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  logbench - throughput of the log from many threads.
+*  Every thread logs the two debug lines of MfmWritePort and an info line, in
+*  turn, through a CMfmLog at debug level, as ports printing together do;
+*  the lines go through the lock-free queue to the writer thread and into the
+*  log file, rotation included. The time spent in the calls is what a port
+*  pays; the time until the log is deleted, which waits for the writer to
+*  empty the queue, gives the lines per second that reach the file. The
+*  result is printed as JSON, one run per line. The log goes where the
+*  monitor's goes: MFM_SYSTEMDIR (default: the temporary directory) through
+*  the POSIX backend, the system directory on Windows.
+*
+*  usage: logbench [-n lines] [-f text|binary] [threads...]
+*    -n lines     lines per thread (default 20000)
+*    -f format    log format (default: both)
+*    threads      thread counts to measure (default 1 2 4 8)
+*/
+
+#include "../monitor/stdafx.h"
+#include "../monitor/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#define MAX_THREADS 256
+
+static CMfmLog* g_pBenchLog = NULL;
+static DWORD g_nLines = 20000;
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG Now()
+{
+	static ULONGLONG ullFreq = 0;
+	LARGE_INTEGER li;
+
+	if (ullFreq == 0)
+	{
+		QueryPerformanceFrequency(&li);
+		ullFreq = static_cast<ULONGLONG>(li.QuadPart);
+	}
+	QueryPerformanceCounter(&li);
+
+	//nanoseconds
+	return static_cast<ULONGLONG>(li.QuadPart) / ullFreq * 1000000000ULL +
+		static_cast<ULONGLONG>(li.QuadPart) % ullFreq * 1000000000ULL / ullFreq;
+}
+
+//-------------------------------------------------------------------------------------
+static void LogThread(DWORD nThread, ULONGLONG* pullNs)
+{
+	ULONGLONG ullStart = Now();
+
+	for (DWORD n = 0; n < g_nLines; n++)
+	{
+		switch (n % 3)
+		{
+		case 0:
+			g_pBenchLog->Debug(L"MfmWritePort called (%u bytes)", 4096 + n % 512);
+			break;
+		case 1:
+			g_pBenchLog->Debug(L"MfmWritePort returning TRUE");
+			break;
+		default:
+			g_pBenchLog->Info(L"thread %u: job %u written to \"%s\"", nThread, n / 3,
+				L"D:\\spool\\out\\dept0042\\file0042.prn");
+			break;
+		}
+	}
+
+	*pullNs = Now() - ullStart;
+}
+
+//-------------------------------------------------------------------------------------
+static void Run(DWORD nThreads, DWORD nFormat, BOOL bFirst)
+{
+	std::thread* pThreads[MAX_THREADS];
+	ULONGLONG ullNs[MAX_THREADS];
+
+	g_pBenchLog = new CMfmLog();
+	g_pBenchLog->SetLogLevel(LOGLEVEL_DEBUG);
+	g_pBenchLog->SetLogFormat(nFormat);
+
+	ULONGLONG ullStart = Now();
+
+	for (DWORD n = 0; n < nThreads; n++)
+		pThreads[n] = new std::thread(LogThread, n, &ullNs[n]);
+
+	for (DWORD n = 0; n < nThreads; n++)
+	{
+		pThreads[n]->join();
+		delete pThreads[n];
+	}
+
+	ULONGLONG ullCalls = Now();
+
+	//the writer takes what is still queued before it stops
+	delete g_pBenchLog;
+	g_pBenchLog = NULL;
+
+	ULONGLONG ullEnd = Now();
+
+	ULONGLONG ullCallNs = 0;
+	for (DWORD n = 0; n < nThreads; n++)
+		ullCallNs += ullNs[n];
+
+	double dLines = static_cast<double>(nThreads) * g_nLines;
+
+	printf("%s{\"name\":\"%s/%u\",\"threads\":%u,\"lines\":%.0f,\"ns_per_call\":%.1f,"
+		"\"calls_per_s\":%.0f,\"lines_per_s\":%.0f,\"drain_ms\":%.3f}",
+		bFirst ? "" : ",\n", nFormat == LOGFORMAT_BINARY ? "binary" : "text", nThreads, nThreads, dLines,
+		ullCallNs / dLines, dLines * 1e9 / (ullCalls - ullStart), dLines * 1e9 / (ullEnd - ullStart),
+		(ullEnd - ullCalls) / 1e6);
+	fflush(stdout);
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	DWORD threads[MAX_THREADS];
+	DWORD nRuns = 0;
+	int nFormat = -1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			g_nLines = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && strcmp(argv[i + 1], "text") == 0)
+			nFormat = LOGFORMAT_TEXT, i++;
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && strcmp(argv[i + 1], "binary") == 0)
+			nFormat = LOGFORMAT_BINARY, i++;
+		else if (argv[i][0] != '-' && nRuns < MAX_THREADS && atoi(argv[i]) > 0 && atoi(argv[i]) <= MAX_THREADS)
+			threads[nRuns++] = static_cast<DWORD>(atoi(argv[i]));
+		else
+		{
+			fprintf(stderr, "usage: logbench [-n lines] [-f text|binary] [threads...]\n");
+			return 1;
+		}
+	}
+
+	if (nRuns == 0)
+	{
+		threads[nRuns++] = 1;
+		threads[nRuns++] = 2;
+		threads[nRuns++] = 4;
+		threads[nRuns++] = 8;
+	}
+
+	printf("[\n");
+
+	BOOL bFirst = TRUE;
+
+	for (DWORD nFmt = LOGFORMAT_MIN; nFmt <= LOGFORMAT_MAX; nFmt++)
+	{
+		if (nFormat >= 0 && nFmt != static_cast<DWORD>(nFormat))
+			continue;
+
+		for (DWORD n = 0; n < nRuns; n++)
+		{
+			Run(threads[n], nFmt, bFirst);
+			bFirst = FALSE;
+		}
+	}
+
+	printf("\n]\n");
+
+	return 0;
+}
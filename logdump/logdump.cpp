@@ -0,0 +1,266 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+*  logdump - renders a binary MFILEMON log (LogFormat = 1) as text.
+*  Portable: builds with any C++ compiler, no Windows headers needed.
+*
+*  usage: logdump mfilemon.blog [mfilemon.1.blog ...]
+*  output lines look like those of the text log, timestamps are UTC.
+*/
+
+#include "../common/blog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LENGTHOF(x) (sizeof(x)/sizeof((x)[0]))
+
+static wchar_t* g_formats[0x10000];
+static wchar_t* g_ports[0x10000];
+
+//-------------------------------------------------------------------------------------
+static size_t PutUtf8(char* pOut, unsigned long ch)
+{
+	if (ch < 0x80)
+	{
+		pOut[0] = static_cast<char>(ch);
+		return 1;
+	}
+	else if (ch < 0x800)
+	{
+		pOut[0] = static_cast<char>(0xC0 | (ch >> 6));
+		pOut[1] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 2;
+	}
+	else if (ch < 0x10000)
+	{
+		pOut[0] = static_cast<char>(0xE0 | (ch >> 12));
+		pOut[1] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		pOut[2] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 3;
+	}
+	else
+	{
+		pOut[0] = static_cast<char>(0xF0 | (ch >> 18));
+		pOut[1] = static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+		pOut[2] = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+		pOut[3] = static_cast<char>(0x80 | (ch & 0x3F));
+		return 4;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void PutText(FILE* out, const wchar_t* szText)
+{
+	//UTF-16 units, as the log stores them, written as UTF-8
+	char szChar[4];
+
+	for (const wchar_t* p = szText; *p; p++)
+	{
+		unsigned long ch = static_cast<unsigned long>(*p);
+
+		if (ch >= 0xD800 && ch < 0xDC00 && p[1] >= 0xDC00 && p[1] < 0xE000)
+		{
+			ch = 0x10000 + ((ch - 0xD800) << 10) + (static_cast<unsigned long>(p[1]) - 0xDC00);
+			p++;
+		}
+
+		fwrite(szChar, 1, PutUtf8(szChar, ch), out);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static wchar_t* ReadString(const unsigned char* p, size_t cbAvail, size_t* pcbUsed)
+{
+	//u16 count followed by UTF-16 units, returned as a malloc'ed string
+	if (cbAvail < 2)
+		return NULL;
+
+	size_t n = BlogGetU16(p);
+
+	if (2 + n * 2 > cbAvail)
+		return NULL;
+
+	wchar_t* szOut = static_cast<wchar_t*>(malloc((n + 1) * sizeof(wchar_t)));
+
+	for (size_t i = 0; i < n; i++)
+		szOut[i] = static_cast<wchar_t>(BlogGetU16(p + 2 + i * 2));
+
+	szOut[n] = L'\0';
+	*pcbUsed = 2 + n * 2;
+
+	return szOut;
+}
+
+//-------------------------------------------------------------------------------------
+static void FormatTime(unsigned long long ft, char* szOut, size_t cchOut)
+{
+	//FILETIME to civil date, without relying on the C library time zone support
+	unsigned long long ms = ft / 10000ULL;
+	long long days = static_cast<long long>(ms / 86400000ULL) - 134774; //1601-01-01 to 1970-01-01
+	unsigned int msOfDay = static_cast<unsigned int>(ms % 86400000ULL);
+
+	long long z = days + 719468;
+	long long era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned int doe = static_cast<unsigned int>(z - era * 146097);
+	unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned int mp = (5 * doy + 2) / 153;
+	unsigned int d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned int m = mp < 10 ? mp + 3 : mp - 9;
+	long long y = static_cast<long long>(yoe) + era * 400 + (m <= 2 ? 1 : 0);
+
+	snprintf(szOut, cchOut, "%02u-%02u-%04lld %02u:%02u:%02u.%03u",
+		d, m, y,
+		msOfDay / 3600000, (msOfDay / 60000) % 60, (msOfDay / 1000) % 60, msOfDay % 1000);
+}
+
+//-------------------------------------------------------------------------------------
+static void Define(wchar_t** table, const unsigned char* p, size_t cb)
+{
+	size_t cbUsed;
+
+	if (cb < 2)
+		return;
+
+	unsigned int id = BlogGetU16(p);
+	wchar_t* szString = ReadString(p + 2, cb - 2, &cbUsed);
+
+	if (szString)
+	{
+		free(table[id]);
+		table[id] = szString;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static int Dump(const char* szPath, FILE* out)
+{
+	FILE* in = fopen(szPath, "rb");
+
+	if (!in)
+	{
+		fprintf(stderr, "logdump: can't open %s\n", szPath);
+		return 1;
+	}
+
+	char magic[BLOG_MAGICLEN];
+
+	if (fread(magic, 1, BLOG_MAGICLEN, in) != BLOG_MAGICLEN ||
+		memcmp(magic, BLOG_MAGIC, BLOG_MAGICLEN) != 0)
+	{
+		fprintf(stderr, "logdump: %s is not a binary MFILEMON log\n", szPath);
+		fclose(in);
+		return 1;
+	}
+
+	static unsigned char record[BLOG_MAXRECORD + 1];
+	static wchar_t szText[BLOG_MAXRECORD + 1];
+	int ret = 0;
+
+	while (fread(record, 1, BLOG_HDRLEN, in) == BLOG_HDRLEN)
+	{
+		size_t cb = BlogGetU16(record);
+
+		if (cb < BLOG_HDRLEN || fread(record + BLOG_HDRLEN, 1, cb - BLOG_HDRLEN, in) != cb - BLOG_HDRLEN)
+		{
+			fprintf(stderr, "logdump: %s: truncated record\n", szPath);
+			ret = 1;
+			break;
+		}
+
+		const unsigned char* p = record + BLOG_HDRLEN;
+		const unsigned char* pEnd = record + cb;
+
+		switch (record[2])
+		{
+		case BLOG_REC_FORMAT:
+			Define(g_formats, p, pEnd - p);
+			break;
+
+		case BLOG_REC_PORT:
+			Define(g_ports, p, pEnd - p);
+			break;
+
+		case BLOG_REC_MESSAGE:
+		{
+			if (cb < BLOG_MSGHDRLEN)
+				break;
+
+			char szTime[64];
+			unsigned int nType = record[3];
+			unsigned int nPort = BlogGetU16(p + 8);
+			unsigned int nFormat = BlogGetU16(p + 10);
+
+			FormatTime(BlogGetU64(p), szTime, sizeof(szTime));
+
+			fprintf(out, "%s  [%s] ", szTime, nType <= BLOG_TYPE_MAX ? BlogTypeNames[nType] : "?");
+
+			if (nPort != 0)
+			{
+				if (g_ports[nPort])
+				{
+					PutText(out, g_ports[nPort]);
+					fputs(": ", out);
+				}
+				else
+					fprintf(out, "port #%u: ", nPort);
+			}
+
+			//the same decoding as the text log of the monitor
+			if (g_formats[nFormat])
+			{
+				BlogFormat(szText, LENGTHOF(szText), g_formats[nFormat], p + 12, pEnd - p - 12);
+				PutText(out, szText);
+			}
+			else
+				fprintf(out, "<unknown format #%u>", nFormat);
+
+			fputc('\n', out);
+			break;
+		}
+
+		default:
+			//records of a newer writer, skip them
+			break;
+		}
+	}
+
+	fclose(in);
+
+	return ret;
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: logdump <file> [<file> ...]\n");
+		return 2;
+	}
+
+	int ret = 0;
+
+	for (int i = 1; i < argc; i++)
+		ret |= Dump(argv[i], stdout);
+
+	return ret;
+}
@@ -0,0 +1,960 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  mfmsim - a load generator for the monitor.
+*  Loads the real monitor on the mock spooler (see mockspl.h), adds the ports
+*  through XcvDataPort as the port UI does, and plays a stream of jobs through
+*  MfmOpenPort, MfmStartDocPort, MfmWritePort, MfmEndDocPort and MfmClosePort:
+*  file naming, counter file, directory cache, writer pool and statistics
+*  are the monitor's own. Every port runs on its own thread, like the spooler
+*  does. Builds on Windows and, through the POSIX backend, on Linux; the
+*  monitor's log and snapshot go to MFM_SYSTEMDIR (default: the temporary
+*  directory).
+*
+*  The job stream is synthetic, or read from a stream file, or rebuilt from a
+*  trace taken on a live server with SetTrace/GetTrace (StartDocPort gives the
+*  arrival, WritePort the size of every write). A stream file has one job per
+*  line:
+*    arrival_us port chunk[,chunk...]
+*  and lines starting with # are ignored. -d writes the stream in use, so that
+*  a captured trace can be kept and edited as a stream file.
+*
+*  usage: mfmsim [options] outputpath
+*    -p pattern   file pattern (default file%i.prn)
+*    -n jobs      number of synthetic jobs (default 100)
+*    -s bytes     job size, or min-max (default 65536)
+*    -c bytes     write chunk size (default 4096)
+*    -P ports     number of ports (default 1), port n writes to outputpath/portn
+*    -a           all ports write to outputpath itself
+*    -r rate      arrivals per second, Poisson (default 0: back to back)
+*    -t title     job title (default "Document")
+*    -f file      replay a stream file
+*    -T file      replay a trace exported by GetTrace
+*    -d file      write the job stream to a stream file
+*    -F files     put this many files in every output directory first
+*    -o           overwrite existing files
+*
+*  Probes and naming times are read back from the monitor's GetStats; naming
+*  percentiles are the upper bounds of its histogram buckets, the mean is
+*  exact.
+*  -F fills the output directories with the names the pattern gives for the
+*  first values of its counter, as left by earlier jobs, so that the jobs of
+*  the run probe past all of them: compare the naming time per job of a flat
+*  pattern with a %S one (e.g. file%7i.prn against %S\file%7i.prn) as the
+*  directory grows to 10000, 100000 and 1000000 files.
+*  The ports number from the counter file when the output directory has one
+*  (see ctrfile.h). Create an empty mfilemon.ctr there and run several mfmsim
+*  with -a on the same directory to see ports and processes share it:
+*  probes/job stays close to 1 and no job fails.
+*/
+
+#include "../monitor/stdafx.h"
+#include "../mockspl/mockspl.h"
+#include "../monitor/pattern.h"
+#include "../monitor/patcontext.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <math.h>
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#define SEPARATOR L'\\'
+#else
+#define SEPARATOR L'/'
+#endif
+
+#define MAX_PORTS 256
+
+//a growable array of plain values
+template <class T> class CSimArray
+{
+public:
+	CSimArray() { m_pData = NULL; m_nCount = m_nSize = 0; }
+	~CSimArray() { delete[] m_pData; }
+
+public:
+	void Add(T value)
+	{
+		if (m_nCount == m_nSize)
+		{
+			m_nSize = m_nSize ? m_nSize * 2 : 64;
+			T* pData = new T[m_nSize];
+			if (m_nCount)
+				memcpy(pData, m_pData, m_nCount * sizeof(T));
+			delete[] m_pData;
+			m_pData = pData;
+		}
+		m_pData[m_nCount++] = value;
+	}
+	T* Data() const { return m_pData; }
+	size_t Count() const { return m_nCount; }
+	T& operator[](size_t n) const { return m_pData[n]; }
+
+private:
+	CSimArray(const CSimArray&);
+	CSimArray& operator=(const CSimArray&);
+
+private:
+	T* m_pData;
+	size_t m_nCount;
+	size_t m_nSize;
+};
+
+typedef struct tagSIMJOB
+{
+	ULONGLONG ullArrival;	//us from the start of the run
+	DWORD nPort;
+	DWORD nJobId;
+	CSimArray<DWORD>* pChunks;
+} SIMJOB, *LPSIMJOB;
+
+typedef struct tagSIMEVENT
+{
+	ULONGLONG ullTs;
+	DWORD nPid;
+	DWORD nJobId;
+	DWORD cbData;
+	BOOL bStart;
+} SIMEVENT, *LPSIMEVENT;
+
+enum { LAT_STARTDOC, LAT_WRITE, LAT_ENDDOC, LAT_NAMING, LAT_COUNT };
+
+static const char* const g_szLatNames[LAT_COUNT] = {
+	"StartDocPort",
+	"WritePort",
+	"EndDocPort",
+	"naming"
+};
+
+/* SIMPORT: a monitor port, its share of the stream and what its thread measures */
+typedef struct tagSIMPORT
+{
+	WCHAR szPortName[MAX_PATH + 1];
+	WCHAR szPrinterName[MAX_PATH + 1];
+	CSimArray<LPSIMJOB> jobs;
+	CSimArray<ULONGLONG> lat[LAT_COUNT];
+	DWORD nJobs;
+	ULONGLONG ullBytes;
+	BOOL bFailed;
+} SIMPORT, *LPSIMPORT;
+
+/* CSimContext: the job the -F files are named for */
+class CSimContext : public CPatternContext
+{
+public:
+	LPCWSTR JobTitle() const;
+	DWORD JobId() const { return 0; }
+	LPCWSTR UserName() const { return L""; }
+	LPCWSTR ComputerName() const { return L""; }
+	LPCWSTR PrinterName() const { return L"Mock Printer 0"; }
+	LPCWSTR FileName() const { return L""; }
+	LPCWSTR Path() const { return L""; }
+	LPCWSTR Bin() const { return L""; }
+};
+
+static LPMONITOR2 g_pMonitor = NULL;
+static WCHAR g_szTitle[MAX_PATH + 1] = L"Document";
+static DWORD g_cbChunk = 4096;
+static ULONGLONG g_ullEpoch = 0;
+static unsigned int g_nRandom = 2463534242U;
+
+//-------------------------------------------------------------------------------------
+LPCWSTR CSimContext::JobTitle() const
+{
+	return g_szTitle;
+}
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG Now()
+{
+	static ULONGLONG ullFreq = 0;
+	LARGE_INTEGER li;
+
+	if (ullFreq == 0)
+	{
+		QueryPerformanceFrequency(&li);
+		ullFreq = static_cast<ULONGLONG>(li.QuadPart);
+	}
+	QueryPerformanceCounter(&li);
+
+	//microseconds
+	return static_cast<ULONGLONG>(li.QuadPart) / ullFreq * 1000000ULL +
+		static_cast<ULONGLONG>(li.QuadPart) % ullFreq * 1000000ULL / ullFreq;
+}
+
+//-------------------------------------------------------------------------------------
+static double Random()
+{
+	//xorshift32, the same stream on every run; in (0, 1]
+	g_nRandom ^= g_nRandom << 13;
+	g_nRandom ^= g_nRandom >> 17;
+	g_nRandom ^= g_nRandom << 5;
+	return (g_nRandom + 1.0) / 4294967296.0;
+}
+
+//-------------------------------------------------------------------------------------
+static void PortThread(LPSIMPORT pPort)
+{
+	DWORD cbBuffer = g_cbChunk;
+	BYTE* pBuffer = new BYTE[cbBuffer];
+	HANDLE hPort;
+
+	memset(pBuffer, 0x55, cbBuffer);
+
+	if (!g_pMonitor->pfnOpenPort(NULL, pPort->szPortName, &hPort))
+	{
+		fprintf(stderr, "can't open %ls (%u)\n", pPort->szPortName, GetLastError());
+		pPort->bFailed = TRUE;
+		delete[] pBuffer;
+		return;
+	}
+
+	for (size_t n = 0; n < pPort->jobs.Count(); n++)
+	{
+		LPSIMJOB pJob = pPort->jobs[n];
+
+		//wait for the job to arrive
+		ULONGLONG ullNow = Now() - g_ullEpoch;
+		if (pJob->ullArrival > ullNow)
+			std::this_thread::sleep_for(std::chrono::microseconds(pJob->ullArrival - ullNow));
+
+		DOC_INFO_1W di = { g_szTitle, NULL, const_cast<LPWSTR>(L"RAW") };
+
+		ULONGLONG ullStart = Now();
+		BOOL bOk = g_pMonitor->pfnStartDocPort(hPort, pPort->szPrinterName, pJob->nJobId, 1,
+			reinterpret_cast<LPBYTE>(&di));
+		pPort->lat[LAT_STARTDOC].Add(Now() - ullStart);
+
+		if (!bOk)
+		{
+			fprintf(stderr, "StartDocPort failed on %ls (%u)\n", pPort->szPortName, GetLastError());
+			pPort->bFailed = TRUE;
+			break;
+		}
+
+		for (size_t c = 0; c < pJob->pChunks->Count() && bOk; c++)
+		{
+			DWORD cb = (*pJob->pChunks)[c];
+			DWORD wri = 0;
+
+			if (cb > cbBuffer)
+			{
+				delete[] pBuffer;
+				cbBuffer = cb;
+				pBuffer = new BYTE[cbBuffer];
+				memset(pBuffer, 0x55, cbBuffer);
+			}
+
+			ullStart = Now();
+			bOk = g_pMonitor->pfnWritePort(hPort, pBuffer, cb, &wri) && wri == cb;
+			pPort->lat[LAT_WRITE].Add(Now() - ullStart);
+			pPort->ullBytes += wri;
+		}
+
+		if (!bOk)
+			fprintf(stderr, "WritePort failed on %ls (%u)\n", pPort->szPortName, GetLastError());
+
+		//the spooler ends the job even when a write failed
+		ullStart = Now();
+		if (!g_pMonitor->pfnEndDocPort(hPort) && bOk)
+		{
+			fprintf(stderr, "EndDocPort failed on %ls (%u)\n", pPort->szPortName, GetLastError());
+			bOk = FALSE;
+		}
+		pPort->lat[LAT_ENDDOC].Add(Now() - ullStart);
+
+		if (!bOk)
+		{
+			pPort->bFailed = TRUE;
+			break;
+		}
+
+		pPort->nJobs++;
+	}
+
+	g_pMonitor->pfnClosePort(hPort);
+
+	delete[] pBuffer;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL StartsWith(const char* szLine, const char* szPrefix)
+{
+	return strncmp(szLine, szPrefix, strlen(szPrefix)) == 0;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ReadStats(DWORD* pnProbes, CSimArray<ULONGLONG>* pNaming, double* pdNamingSum)
+{
+	//what the monitor counted, for all ports: probes, and the naming
+	//histogram turned back into samples at the upper bound of their bucket,
+	//with its exact sum
+	LPSTR szStats = MockGetStats(g_pMonitor, NULL);
+	if (!szStats)
+	{
+		fprintf(stderr, "GetStats failed\n");
+		return FALSE;
+	}
+
+	ULONGLONG ullPrevious = 0;
+	*pnProbes = 0;
+	*pdNamingSum = 0;
+
+	for (char* p = szStats; *p; )
+	{
+		char* pEnd = strchr(p, '\n');
+		if (pEnd)
+			*pEnd = '\0';
+
+		const char* szValue = strrchr(p, ' ');
+
+		if (szValue && StartsWith(p, "mfilemon_filename_probes_total{"))
+			*pnProbes += strtoul(szValue + 1, NULL, 10);
+		else if (szValue && StartsWith(p, "mfilemon_filename_seconds_sum{"))
+			*pdNamingSum += atof(szValue + 1);
+		else if (szValue && StartsWith(p, "mfilemon_filename_seconds_bucket{"))
+		{
+			//buckets are cumulative, and +Inf closes the series of a port
+			const char* szLe = strstr(p, "le=\"");
+			ULONGLONG ullCount = strtoull(szValue + 1, NULL, 10);
+
+			if (szLe && strncmp(szLe + 4, "+Inf", 4) == 0)
+				ullPrevious = 0;
+			else if (szLe)
+			{
+				ULONGLONG ullMicroseconds = static_cast<ULONGLONG>(atof(szLe + 4) * 1e6 + 0.5);
+				for (; ullPrevious < ullCount; ullPrevious++)
+					pNaming->Add(ullMicroseconds);
+			}
+		}
+
+		if (!pEnd)
+			break;
+		p = pEnd + 1;
+	}
+
+	delete[] szStats;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static LPSIMJOB NewJob(CSimArray<LPSIMJOB>* pJobs, ULONGLONG ullArrival, DWORD nPort, DWORD nJobId)
+{
+	LPSIMJOB pJob = new SIMJOB;
+	pJob->ullArrival = ullArrival;
+	pJob->nPort = nPort;
+	pJob->nJobId = nJobId;
+	pJob->pChunks = new CSimArray<DWORD>;
+	pJobs->Add(pJob);
+	return pJob;
+}
+
+//-------------------------------------------------------------------------------------
+static void Synthesize(CSimArray<LPSIMJOB>* pJobs, DWORD nJobs, DWORD cbMin, DWORD cbMax,
+	DWORD nPorts, double dRate)
+{
+	ULONGLONG ullArrival = 0;
+	double dClock = 0;
+
+	for (DWORD n = 0; n < nJobs; n++)
+	{
+		if (dRate > 0)
+		{
+			dClock += -log(Random()) / dRate * 1e6;
+			ullArrival = static_cast<ULONGLONG>(dClock);
+		}
+
+		LPSIMJOB pJob = NewJob(pJobs, ullArrival, n % nPorts, n + 1);
+
+		DWORD cbJob = cbMin;
+		if (cbMax > cbMin)
+			cbJob += static_cast<DWORD>((cbMax - cbMin + 1.0) * Random()) % (cbMax - cbMin + 1);
+
+		for (DWORD cbLeft = cbJob; cbLeft > 0; )
+		{
+			DWORD cb = (cbLeft < g_cbChunk) ? cbLeft : g_cbChunk;
+			pJob->pChunks->Add(cb);
+			cbLeft -= cb;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ReadStream(CSimArray<LPSIMJOB>* pJobs, const char* szFile)
+{
+	FILE* fp = fopen(szFile, "r");
+	if (!fp)
+	{
+		fprintf(stderr, "can't open %s\n", szFile);
+		return FALSE;
+	}
+
+	char szLine[65536];
+	DWORD nLine = 0;
+
+	while (fgets(szLine, sizeof(szLine), fp))
+	{
+		nLine++;
+
+		char* p = szLine;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\r' || *p == '\n' || !*p)
+			continue;
+
+		char* pEnd;
+		ULONGLONG ullArrival = strtoull(p, &pEnd, 10);
+		DWORD nPort = strtoul(pEnd, &pEnd, 10);
+
+		if (pEnd == p || nPort >= MAX_PORTS)
+		{
+			fprintf(stderr, "%s(%u): bad line\n", szFile, nLine);
+			fclose(fp);
+			return FALSE;
+		}
+
+		LPSIMJOB pJob = NewJob(pJobs, ullArrival, nPort, static_cast<DWORD>(pJobs->Count() + 1));
+
+		for (p = pEnd; ; p = pEnd + 1)
+		{
+			DWORD cb = strtoul(p, &pEnd, 10);
+			if (pEnd == p)
+				break;
+			pJob->pChunks->Add(cb);
+			if (*pEnd != ',')
+				break;
+		}
+	}
+
+	fclose(fp);
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL JsonNumber(const char* szLine, const char* szKey, ULONGLONG* pValue)
+{
+	//good enough for the one-event-per-line JSON that GetTrace produces
+	char szPattern[32];
+	sprintf(szPattern, "\"%s\":", szKey);
+
+	const char* p = strstr(szLine, szPattern);
+	if (!p)
+		return FALSE;
+
+	*pValue = strtoull(p + strlen(szPattern), NULL, 10);
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static int CompareEvents(const void* p1, const void* p2)
+{
+	const SIMEVENT* e1 = static_cast<const SIMEVENT*>(p1);
+	const SIMEVENT* e2 = static_cast<const SIMEVENT*>(p2);
+	return (e1->ullTs < e2->ullTs) ? -1 : (e1->ullTs > e2->ullTs) ? 1 : 0;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ReadTrace(CSimArray<LPSIMJOB>* pJobs, const char* szFile)
+{
+	FILE* fp = fopen(szFile, "r");
+	if (!fp)
+	{
+		fprintf(stderr, "can't open %s\n", szFile);
+		return FALSE;
+	}
+
+	CSimArray<SIMEVENT> events;
+	char szLine[4096];
+
+	while (fgets(szLine, sizeof(szLine), fp))
+	{
+		SIMEVENT ev;
+		ULONGLONG ullValue;
+
+		ZeroMemory(&ev, sizeof(ev));
+
+		if (strstr(szLine, "\"name\":\"StartDocPort\""))
+			ev.bStart = TRUE;
+		else if (!strstr(szLine, "\"name\":\"WritePort\""))
+			continue;
+
+		if (!JsonNumber(szLine, "ts", &ev.ullTs))
+			continue;
+		if (JsonNumber(szLine, "pid", &ullValue))
+			ev.nPid = static_cast<DWORD>(ullValue);
+		if (JsonNumber(szLine, "job", &ullValue))
+			ev.nJobId = static_cast<DWORD>(ullValue);
+		if (JsonNumber(szLine, "bytes", &ullValue))
+			ev.cbData = static_cast<DWORD>(ullValue);
+
+		events.Add(ev);
+	}
+
+	fclose(fp);
+
+	if (events.Count() == 0)
+	{
+		fprintf(stderr, "%s: no StartDocPort or WritePort events\n", szFile);
+		return FALSE;
+	}
+
+	//threads are exported one after the other, put the events back in time order
+	qsort(events.Data(), events.Count(), sizeof(SIMEVENT), CompareEvents);
+
+	DWORD pids[MAX_PORTS];
+	LPSIMJOB pCurrent[MAX_PORTS];
+	DWORD nPorts = 0;
+	ULONGLONG ullFirst = events[0].ullTs;
+
+	for (size_t n = 0; n < events.Count(); n++)
+	{
+		const SIMEVENT& ev = events[n];
+		DWORD nPort;
+
+		//trace pids (port log ids) become ports 0, 1, 2... in order of appearance
+		for (nPort = 0; nPort < nPorts && pids[nPort] != ev.nPid; nPort++)
+			;
+		if (nPort == nPorts)
+		{
+			if (nPorts == MAX_PORTS)
+				continue;
+			pids[nPorts] = ev.nPid;
+			pCurrent[nPorts++] = NULL;
+		}
+
+		//a write whose StartDocPort fell out of the ring starts the job itself
+		LPSIMJOB pJob = pCurrent[nPort];
+		if (ev.bStart || !pJob || pJob->nJobId != ev.nJobId)
+			pJob = pCurrent[nPort] = NewJob(pJobs, ev.ullTs - ullFirst, nPort, ev.nJobId);
+
+		if (!ev.bStart)
+			pJob->pChunks->Add(ev.cbData);
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WriteStream(CSimArray<LPSIMJOB>* pJobs, const char* szFile)
+{
+	FILE* fp = fopen(szFile, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "can't create %s\n", szFile);
+		return FALSE;
+	}
+
+	fprintf(fp, "# arrival_us port chunk[,chunk...]\n");
+
+	for (size_t n = 0; n < pJobs->Count(); n++)
+	{
+		LPSIMJOB pJob = (*pJobs)[n];
+		fprintf(fp, "%llu %u ", static_cast<unsigned long long>(pJob->ullArrival), pJob->nPort);
+		for (size_t c = 0; c < pJob->pChunks->Count(); c++)
+			fprintf(fp, c ? ",%u" : "%u", (*pJob->pChunks)[c]);
+		if (pJob->pChunks->Count() == 0)
+			fprintf(fp, "0");
+		fprintf(fp, "\n");
+	}
+
+	fclose(fp);
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL CreateParents(LPCWSTR szPath)
+{
+	//every directory on the way, as the port's RecursiveCreateFolder does
+	WCHAR szDir[MAX_PATH + 1];
+	BOOL bRet = FALSE;
+
+	wcscpy_s(szDir, LENGTHOF(szDir), szPath);
+
+	for (LPWSTR p = szDir + 1; *p; p++)
+	{
+		if (*p != L'\\' && *p != L'/')
+			continue;
+
+		WCHAR c = *p;
+		*p = L'\0';
+		bRet = CreateDirectoryW(szDir, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+		*p = c;
+	}
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL Prefill(LPCWSTR szDirectory, LPCWSTR szPattern, DWORD nFiles)
+{
+	//the names the pattern gives for its first nFiles counter values
+	CSimContext context;
+	CPattern pattern(szPattern, &context, FALSE);
+	WCHAR szPath[MAX_PATH + 1];
+
+	for (DWORD n = 0; n < nFiles; n++)
+	{
+		if (n > 0 && !pattern.NextValue())
+		{
+			fprintf(stderr, "%ls has room for %u files only\n", szPattern, n);
+			return FALSE;
+		}
+
+		swprintf_s(szPath, LENGTHOF(szPath), L"%s%c%s", szDirectory, SEPARATOR, pattern.Value());
+
+		HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE && CreateParents(szPath))
+			hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			fprintf(stderr, "can't create %ls (%u)\n", szPath, GetLastError());
+			return FALSE;
+		}
+
+		CloseHandle(hFile);
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static int CompareTimes(const void* p1, const void* p2)
+{
+	ULONGLONG t1 = *static_cast<const ULONGLONG*>(p1);
+	ULONGLONG t2 = *static_cast<const ULONGLONG*>(p2);
+	return (t1 < t2) ? -1 : (t1 > t2) ? 1 : 0;
+}
+
+//-------------------------------------------------------------------------------------
+static void PrintLatency(const char* szName, CSimArray<ULONGLONG>* pTimes)
+{
+	size_t n = pTimes->Count();
+
+	if (n == 0)
+	{
+		printf("%-14s %10u\n", szName, 0U);
+		return;
+	}
+
+	ULONGLONG* p = pTimes->Data();
+	qsort(p, n, sizeof(ULONGLONG), CompareTimes);
+
+	#define PCT(q) static_cast<unsigned long long>(p[(static_cast<size_t>(n * (q)) < n) ? static_cast<size_t>(n * (q)) : n - 1])
+
+	printf("%-14s %10llu %9llu %9llu %9llu %9llu\n", szName, static_cast<unsigned long long>(n),
+		PCT(0.5), PCT(0.99), PCT(0.999), static_cast<unsigned long long>(p[n - 1]));
+
+	#undef PCT
+}
+
+//-------------------------------------------------------------------------------------
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: mfmsim [options] outputpath\n"
+		"  -p pattern   file pattern (default file%%i.prn)\n"
+		"  -n jobs      number of synthetic jobs (default 100)\n"
+		"  -s bytes     job size, or min-max (default 65536)\n"
+		"  -c bytes     write chunk size (default 4096)\n"
+		"  -P ports     number of ports (default 1)\n"
+		"  -a           all ports write to outputpath itself\n"
+		"  -r rate      arrivals per second, Poisson (default 0: back to back)\n"
+		"  -t title     job title (default \"Document\")\n"
+		"  -f file      replay a stream file\n"
+		"  -T file      replay a trace exported by GetTrace\n"
+		"  -d file      write the job stream to a stream file\n"
+		"  -F files     put this many files in every output directory first\n"
+		"  -o           overwrite existing files\n");
+}
+
+//-------------------------------------------------------------------------------------
+static void Widen(const char* szArg, LPWSTR szOut, size_t cchOut)
+{
+	size_t n = mbstowcs(szOut, szArg, cchOut - 1);
+	if (n == static_cast<size_t>(-1))
+	{
+		//not valid in the current locale, take it byte by byte
+		for (n = 0; szArg[n] && n < cchOut - 1; n++)
+			szOut[n] = static_cast<unsigned char>(szArg[n]);
+	}
+	szOut[n] = L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	WCHAR szPattern[MAX_PATH + 1];
+	WCHAR szOutputPath[MAX_PATH + 1];
+	DWORD nJobs = 100;
+	DWORD cbMin = 65536;
+	DWORD cbMax = 65536;
+	DWORD nPorts = 1;
+	DWORD nPrefill = 0;
+	double dRate = 0;
+	BOOL bOverwrite = FALSE;
+	BOOL bSameDir = FALSE;
+	const char* szStream = NULL;
+	const char* szTrace = NULL;
+	const char* szDump = NULL;
+	int i;
+
+	setlocale(LC_ALL, "");
+
+	wcscpy_s(szPattern, LENGTHOF(szPattern), CPattern::szDefaultFilePattern);
+	*szOutputPath = L'\0';
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0)
+			bOverwrite = TRUE;
+		else if (strcmp(argv[i], "-a") == 0)
+			bSameDir = TRUE;
+		else if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 < argc)
+		{
+			const char* szVal = argv[++i];
+			char* pEnd;
+			switch (argv[i - 1][1])
+			{
+			case 'p':
+				Widen(szVal, szPattern, LENGTHOF(szPattern));
+				break;
+			case 'n':
+				nJobs = strtoul(szVal, NULL, 10);
+				break;
+			case 's':
+				cbMin = cbMax = strtoul(szVal, &pEnd, 10);
+				if (*pEnd == '-')
+					cbMax = strtoul(pEnd + 1, NULL, 10);
+				break;
+			case 'c':
+				g_cbChunk = strtoul(szVal, NULL, 10);
+				break;
+			case 'P':
+				nPorts = strtoul(szVal, NULL, 10);
+				break;
+			case 'r':
+				dRate = atof(szVal);
+				break;
+			case 't':
+				Widen(szVal, g_szTitle, LENGTHOF(g_szTitle));
+				break;
+			case 'f':
+				szStream = szVal;
+				break;
+			case 'T':
+				szTrace = szVal;
+				break;
+			case 'd':
+				szDump = szVal;
+				break;
+			case 'F':
+				nPrefill = strtoul(szVal, NULL, 10);
+				break;
+			default:
+				Usage();
+				return 1;
+			}
+		}
+		else if (argv[i][0] != '-' && !*szOutputPath)
+			Widen(argv[i], szOutputPath, LENGTHOF(szOutputPath));
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	if (!*szOutputPath || g_cbChunk == 0 || nPorts == 0 || nPorts > MAX_PORTS || cbMax < cbMin)
+	{
+		Usage();
+		return 1;
+	}
+
+	//build the job stream
+	CSimArray<LPSIMJOB> jobs;
+
+	if (szStream && !ReadStream(&jobs, szStream))
+		return 1;
+	else if (szTrace && !ReadTrace(&jobs, szTrace))
+		return 1;
+	else if (!szStream && !szTrace)
+		Synthesize(&jobs, nJobs, cbMin, cbMax, nPorts, dRate);
+
+	if (szDump && !WriteStream(&jobs, szDump))
+		return 1;
+
+	//streams may use any number of ports
+	if (szStream || szTrace)
+	{
+		nPorts = 1;
+		for (size_t n = 0; n < jobs.Count(); n++)
+			if (jobs[n]->nPort >= nPorts)
+				nPorts = jobs[n]->nPort + 1;
+	}
+
+	//the monitor, on an empty registry; the ports are added as the port UI does
+	CMockRegistry registry;
+
+	g_pMonitor = MockMonitorStart(&registry);
+	if (!g_pMonitor)
+	{
+		fprintf(stderr, "can't start the monitor\n");
+		return 1;
+	}
+
+	MockSetJobInfo(NULL, NULL, g_szTitle);
+
+	LPSIMPORT pPorts = new SIMPORT[nPorts];
+	LPPORTCONFIG pConfig = new PORTCONFIG;
+	int nRet = 0;
+
+	for (DWORD n = 0; n < nPorts && nRet == 0; n++)
+	{
+		ZeroMemory(pConfig, sizeof(*pConfig));
+
+		swprintf_s(pPorts[n].szPortName, LENGTHOF(pPorts[n].szPortName), L"SIM%u:", n);
+		swprintf_s(pPorts[n].szPrinterName, LENGTHOF(pPorts[n].szPrinterName), L"Mock Printer %u", n);
+		pPorts[n].nJobs = 0;
+		pPorts[n].ullBytes = 0;
+		pPorts[n].bFailed = FALSE;
+
+		wcscpy_s(pConfig->szPortName, LENGTHOF(pConfig->szPortName), pPorts[n].szPortName);
+		if (nPorts > 1 && !bSameDir)
+			swprintf_s(pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath), L"%s%cport%u",
+				szOutputPath, SEPARATOR, n);
+		else
+			wcscpy_s(pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath), szOutputPath);
+		wcscpy_s(pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern), szPattern);
+		pConfig->bOverwrite = bOverwrite;
+		pConfig->bHideProcess = TRUE;
+		pConfig->dwWaitTimeout = 10;
+
+		//a directory shared by the ports is filled once
+		if (nPrefill > 0 && (n == 0 || (nPorts > 1 && !bSameDir)))
+		{
+			ULONGLONG ullStart = Now();
+
+			if (!Prefill(pConfig->szOutputPath, szPattern, nPrefill))
+			{
+				nRet = 1;
+				break;
+			}
+
+			fprintf(stderr, "%ls: %u files in %.1f s\n", pConfig->szOutputPath, nPrefill,
+				(Now() - ullStart) / 1e6);
+		}
+
+		DWORD dwErr = MockAddPort(g_pMonitor, pConfig);
+		if (dwErr != ERROR_SUCCESS)
+		{
+			fprintf(stderr, "can't add port %ls (%u)\n", pConfig->szPortName, dwErr);
+			nRet = 1;
+		}
+	}
+
+	delete pConfig;
+
+	for (size_t n = 0; n < jobs.Count(); n++)
+		pPorts[jobs[n]->nPort].jobs.Add(jobs[n]);
+
+	//run: one thread per port, like the spooler
+	std::thread** ppThreads = new std::thread*[nPorts];
+	CSimArray<ULONGLONG> lat[LAT_COUNT];
+	DWORD nProbes = 0;
+	double dNamingSum = 0;
+	double dSeconds = 0;
+
+	if (nRet == 0)
+	{
+		g_ullEpoch = Now();
+
+		for (DWORD n = 0; n < nPorts; n++)
+			ppThreads[n] = new std::thread(PortThread, &pPorts[n]);
+
+		for (DWORD n = 0; n < nPorts; n++)
+		{
+			ppThreads[n]->join();
+			delete ppThreads[n];
+		}
+
+		dSeconds = (Now() - g_ullEpoch) / 1e6;
+
+		if (!ReadStats(&nProbes, &lat[LAT_NAMING], &dNamingSum))
+			nRet = 1;
+	}
+
+	delete[] ppThreads;
+
+	MockMonitorStop(g_pMonitor);
+
+	//merge and report
+	ULONGLONG ullBytes = 0;
+	DWORD nDone = 0;
+	BOOL bFailed = FALSE;
+
+	for (DWORD n = 0; n < nPorts; n++)
+	{
+		for (int l = 0; l < LAT_COUNT; l++)
+			for (size_t k = 0; k < pPorts[n].lat[l].Count(); k++)
+				lat[l].Add(pPorts[n].lat[l][k]);
+
+		ullBytes += pPorts[n].ullBytes;
+		nDone += pPorts[n].nJobs;
+		bFailed |= pPorts[n].bFailed;
+	}
+
+	if (nRet == 0)
+	{
+		printf("ports          %u\n", nPorts);
+		if (nPrefill > 0)
+			printf("existing files %u\n", nPrefill);
+		printf("jobs           %u of %llu\n", nDone, static_cast<unsigned long long>(jobs.Count()));
+		printf("bytes          %llu\n", static_cast<unsigned long long>(ullBytes));
+		printf("elapsed        %.3f s\n", dSeconds);
+		if (dSeconds > 0)
+		{
+			printf("jobs/s         %.1f\n", nDone / dSeconds);
+			printf("MB/s           %.2f\n", ullBytes / dSeconds / 1048576.0);
+		}
+		if (nDone > 0)
+			printf("probes/job     %.2f\n", static_cast<double>(nProbes) / nDone);
+		if (lat[LAT_NAMING].Count() > 0)
+			printf("naming/job     %.1f us\n", dNamingSum * 1e6 / lat[LAT_NAMING].Count());
+
+		printf("\n%-14s %10s %9s %9s %9s %9s (us)\n", "", "count", "p50", "p99", "p999", "max");
+		for (int l = 0; l < LAT_COUNT; l++)
+			PrintLatency(g_szLatNames[l], &lat[l]);
+	}
+
+	delete[] pPorts;
+
+	for (size_t n = 0; n < jobs.Count(); n++)
+	{
+		delete jobs[n]->pChunks;
+		delete jobs[n];
+	}
+
+	return nRet ? nRet : bFailed ? 2 : 0;
+}
@@ -0,0 +1,570 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "../monitor/stdafx.h"
+#include "mockreg.h"
+#include "../common/autoclean.h"
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::CMockRegistry()
+{
+	ZeroMemory(&m_reg, sizeof(m_reg));
+	m_reg.cbSize = sizeof(m_reg);
+	m_reg.fpCreateKey = MockCreateKey;
+	m_reg.fpOpenKey = MockOpenKey;
+	m_reg.fpCloseKey = MockCloseKey;
+	m_reg.fpDeleteKey = MockDeleteKey;
+	m_reg.fpEnumKey = MockEnumKey;
+	m_reg.fpQueryInfoKey = MockQueryInfoKey;
+	m_reg.fpSetValue = MockSetValue;
+	m_reg.fpDeleteValue = MockDeleteValue;
+	m_reg.fpEnumValue = MockEnumValue;
+	m_reg.fpQueryValue = MockQueryValue;
+
+	m_pRoot = NewKey(L"");
+	m_ullLatency = 0;
+	m_nCalls = 0;
+
+	LARGE_INTEGER li;
+	QueryPerformanceFrequency(&li);
+	m_ullFreq = static_cast<ULONGLONG>(li.QuadPart);
+
+	InitializeCriticalSection(&m_CSRegistry);
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::~CMockRegistry()
+{
+	FreeKey(m_pRoot);
+	DeleteCriticalSection(&m_CSRegistry);
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::MonitorInit(PMONITORINIT pInit)
+{
+	//what the spooler passes to InitializePrintMonitor2
+	ZeroMemory(pInit, sizeof(*pInit));
+	pInit->cbSize = sizeof(*pInit);
+	pInit->hSpooler = static_cast<HANDLE>(this);
+	pInit->hckRegistryRoot = Root();
+	pInit->pMonitorReg = &m_reg;
+	pInit->bLocal = TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry* CMockRegistry::Call(HANDLE hSpooler)
+{
+	//every callback is a trip through the spooler
+	CMockRegistry* pThis = static_cast<CMockRegistry*>(hSpooler);
+
+	InterlockedIncrement64(&pThis->m_nCalls);
+
+	if (pThis->m_ullLatency)
+	{
+		LARGE_INTEGER li;
+		QueryPerformanceCounter(&li);
+		ULONGLONG ullEnd = static_cast<ULONGLONG>(li.QuadPart) +
+			pThis->m_ullLatency * pThis->m_ullFreq / 1000000000ULL;
+		do
+			QueryPerformanceCounter(&li);
+		while (static_cast<ULONGLONG>(li.QuadPart) < ullEnd);
+	}
+
+	return pThis;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CMockRegistry::Hash(LPCWSTR szName)
+{
+	//FNV-1a over upper-cased characters, key names are case insensitive
+	DWORD dwHash = 2166136261U;
+
+	for (; *szName; szName++)
+	{
+		dwHash ^= static_cast<DWORD>(towupper(*szName));
+		dwHash *= 16777619U;
+	}
+
+	return dwHash;
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::LPMOCKKEY CMockRegistry::NewKey(LPCWSTR szName)
+{
+	LPMOCKKEY pKey = new MOCKKEY;
+	ZeroMemory(pKey, sizeof(*pKey));
+	pKey->szName = _wcsdup(szName);
+	return pKey;
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::FreeKey(LPMOCKKEY pKey)
+{
+	for (DWORD n = 0; n < pKey->nChildren; n++)
+		FreeKey(pKey->pChildren[n]);
+
+	for (DWORD n = 0; n < pKey->nValues; n++)
+	{
+		free(pKey->pValues[n].szName);
+		delete[] pKey->pValues[n].pData;
+	}
+
+	free(pKey->szName);
+	delete[] pKey->pChildren;
+	delete[] pKey->pIndex;
+	delete[] pKey->pValues;
+	delete pKey;
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::Reindex(LPMOCKKEY pKey)
+{
+	//twice the room the children need, at least
+	DWORD nSlots = 16;
+	while (nSlots < pKey->nMaxChildren * 2)
+		nSlots <<= 1;
+
+	delete[] pKey->pIndex;
+	pKey->pIndex = new LPMOCKKEY[nSlots];
+	ZeroMemory(pKey->pIndex, nSlots * sizeof(LPMOCKKEY));
+	pKey->nIndexMask = nSlots - 1;
+
+	for (DWORD n = 0; n < pKey->nChildren; n++)
+	{
+		DWORD nSlot = Hash(pKey->pChildren[n]->szName) & pKey->nIndexMask;
+		while (pKey->pIndex[nSlot])
+			nSlot = (nSlot + 1) & pKey->nIndexMask;
+		pKey->pIndex[nSlot] = pKey->pChildren[n];
+	}
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::LPMOCKKEY CMockRegistry::Child(LPMOCKKEY pKey, LPCWSTR szName)
+{
+	if (!pKey->pIndex)
+		return NULL;
+
+	for (DWORD nSlot = Hash(szName) & pKey->nIndexMask; pKey->pIndex[nSlot];
+		nSlot = (nSlot + 1) & pKey->nIndexMask)
+	{
+		if (_wcsicmp(pKey->pIndex[nSlot]->szName, szName) == 0)
+			return pKey->pIndex[nSlot];
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::LPMOCKKEY CMockRegistry::AddChild(LPMOCKKEY pKey, LPCWSTR szName)
+{
+	LPMOCKKEY pChild = Child(pKey, szName);
+	if (pChild)
+		return pChild;
+
+	pChild = NewKey(szName);
+
+	if (pKey->nChildren == pKey->nMaxChildren)
+	{
+		pKey->nMaxChildren = pKey->nMaxChildren ? pKey->nMaxChildren * 2 : 16;
+		LPMOCKKEY* pChildren = new LPMOCKKEY[pKey->nMaxChildren];
+		if (pKey->nChildren)
+			CopyMemory(pChildren, pKey->pChildren, pKey->nChildren * sizeof(LPMOCKKEY));
+		delete[] pKey->pChildren;
+		pKey->pChildren = pChildren;
+		pKey->pChildren[pKey->nChildren++] = pChild;
+		Reindex(pKey);
+	}
+	else
+	{
+		pKey->pChildren[pKey->nChildren++] = pChild;
+		DWORD nSlot = Hash(szName) & pKey->nIndexMask;
+		while (pKey->pIndex[nSlot])
+			nSlot = (nSlot + 1) & pKey->nIndexMask;
+		pKey->pIndex[nSlot] = pChild;
+	}
+
+	return pChild;
+}
+
+//-------------------------------------------------------------------------------------
+CMockRegistry::LPMOCKVALUE CMockRegistry::Value(LPMOCKKEY pKey, LPCWSTR szName)
+{
+	//a port has about twenty values, a scan is fine
+	for (DWORD n = 0; n < pKey->nValues; n++)
+	{
+		if (_wcsicmp(pKey->pValues[n].szName, szName) == 0)
+			return &pKey->pValues[n];
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CMockRegistry::CreateKey(HANDLE hKey, LPCWSTR szName)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	return AddChild(static_cast<LPMOCKKEY>(hKey), szName);
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CMockRegistry::FindKey(HANDLE hKey, LPCWSTR szName)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	return Child(static_cast<LPMOCKKEY>(hKey), szName);
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::SetValue(HANDLE hKey, LPCWSTR szName, DWORD dwType, LPCVOID pData, DWORD cbData)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hKey);
+	LPMOCKVALUE pValue = Value(pKey, szName);
+
+	if (!pValue)
+	{
+		if (pKey->nValues == pKey->nMaxValues)
+		{
+			pKey->nMaxValues = pKey->nMaxValues ? pKey->nMaxValues * 2 : 24;
+			LPMOCKVALUE pValues = new MOCKVALUE[pKey->nMaxValues];
+			if (pKey->nValues)
+				CopyMemory(pValues, pKey->pValues, pKey->nValues * sizeof(MOCKVALUE));
+			delete[] pKey->pValues;
+			pKey->pValues = pValues;
+		}
+
+		pValue = &pKey->pValues[pKey->nValues++];
+		pValue->szName = _wcsdup(szName);
+	}
+	else
+		delete[] pValue->pData;
+
+	pValue->dwType = dwType;
+	pValue->pData = new BYTE[cbData ? cbData : 1];
+	pValue->cbData = cbData;
+	if (cbData)
+		CopyMemory(pValue->pData, pData, cbData);
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::SetString(HANDLE hKey, LPCWSTR szName, LPCWSTR szValue)
+{
+	SetValue(hKey, szName, REG_SZ, szValue, static_cast<DWORD>(wcslen(szValue) * sizeof(WCHAR)));
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::SetDword(HANDLE hKey, LPCWSTR szName, DWORD dwValue)
+{
+	SetValue(hKey, szName, REG_DWORD, &dwValue, sizeof(dwValue));
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CMockRegistry::GetDword(HANDLE hKey, LPCWSTR szName, LPDWORD pdwValue)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	LPMOCKVALUE pValue = Value(static_cast<LPMOCKKEY>(hKey), szName);
+	if (!pValue || pValue->cbData != sizeof(DWORD))
+		return FALSE;
+
+	CopyMemory(pdwValue, pValue->pData, sizeof(DWORD));
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CMockRegistry::GetValue(HANDLE hKey, LPCWSTR szName, LPVOID pData, LPDWORD pcbData)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	LPMOCKVALUE pValue = Value(static_cast<LPMOCKKEY>(hKey), szName);
+	if (!pValue || pValue->cbData > *pcbData)
+		return FALSE;
+
+	CopyMemory(pData, pValue->pData, pValue->cbData);
+	*pcbData = pValue->cbData;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::DeleteValue(HANDLE hKey, LPCWSTR szName)
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hKey);
+	LPMOCKVALUE pValue = Value(pKey, szName);
+
+	if (pValue)
+	{
+		free(pValue->szName);
+		delete[] pValue->pData;
+		*pValue = pKey->pValues[--pKey->nValues];
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CMockRegistry::Clear()
+{
+	CAutoCriticalSection acs(&m_CSRegistry);
+
+	//the root stays the same key: the monitor holds it as hckRegistryRoot
+	LPMOCKKEY pOld = NewKey(L"");
+	MOCKKEY tmp = *m_pRoot;
+	*m_pRoot = *pOld;
+	*pOld = tmp;
+	FreeKey(pOld);
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockCreateKey(HANDLE hcKey, LPCWSTR pszSubKey, DWORD /*dwOptions*/,
+	REGSAM /*samDesired*/, PSECURITY_ATTRIBUTES /*pSecurityAttributes*/, PHANDLE phckResult,
+	PDWORD pdwDisposition, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hcKey);
+	BOOL bExisting = Child(pKey, pszSubKey) != NULL;
+
+	*phckResult = AddChild(pKey, pszSubKey);
+	if (pdwDisposition)
+		*pdwDisposition = bExisting ? REG_OPENED_EXISTING_KEY : REG_CREATED_NEW_KEY;
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockOpenKey(HANDLE hcKey, LPCWSTR pszSubKey, REGSAM /*samDesired*/,
+	PHANDLE phkResult, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = Child(static_cast<LPMOCKKEY>(hcKey), pszSubKey);
+	if (!pKey)
+		return ERROR_FILE_NOT_FOUND;
+
+	*phkResult = pKey;
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockCloseKey(HANDLE /*hcKey*/, HANDLE hSpooler)
+{
+	Call(hSpooler);
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockDeleteKey(HANDLE hcKey, LPCWSTR pszSubKey, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hcKey);
+	LPMOCKKEY pChild = Child(pKey, pszSubKey);
+
+	if (!pChild)
+		return ERROR_FILE_NOT_FOUND;
+
+	//like RegDeleteKey, only a key without subkeys goes
+	if (pChild->nChildren)
+		return ERROR_ACCESS_DENIED;
+
+	DWORD n = 0;
+	while (pKey->pChildren[n] != pChild)
+		n++;
+	MoveMemory(&pKey->pChildren[n], &pKey->pChildren[n + 1], (pKey->nChildren - n - 1) * sizeof(LPMOCKKEY));
+	pKey->nChildren--;
+
+	FreeKey(pChild);
+	Reindex(pKey);
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockEnumKey(HANDLE hcKey, DWORD dwIndex, LPWSTR pszName, PDWORD pcchName,
+	PFILETIME pftLastWriteTime, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hcKey);
+
+	if (dwIndex >= pKey->nChildren)
+		return ERROR_NO_MORE_ITEMS;
+
+	LPCWSTR szName = pKey->pChildren[dwIndex]->szName;
+	size_t cch = wcslen(szName);
+	if (cch >= *pcchName)
+		return ERROR_MORE_DATA;
+
+	wcscpy_s(pszName, *pcchName, szName);
+	*pcchName = static_cast<DWORD>(cch);
+
+	if (pftLastWriteTime)
+		ZeroMemory(pftLastWriteTime, sizeof(*pftLastWriteTime));
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockQueryInfoKey(HANDLE hcKey, PDWORD pcSubKeys, PDWORD pcbKey, PDWORD pcValues,
+	PDWORD pcbValue, PDWORD pcbData, PDWORD pcbSecurityDescriptor, PFILETIME pftLastWriteTime,
+	HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hcKey);
+	DWORD cchKey = 0, cchValue = 0, cbData = 0;
+
+	for (DWORD n = 0; n < pKey->nChildren; n++)
+	{
+		DWORD cch = static_cast<DWORD>(wcslen(pKey->pChildren[n]->szName));
+		if (cch > cchKey)
+			cchKey = cch;
+	}
+
+	for (DWORD n = 0; n < pKey->nValues; n++)
+	{
+		DWORD cch = static_cast<DWORD>(wcslen(pKey->pValues[n].szName));
+		if (cch > cchValue)
+			cchValue = cch;
+		if (pKey->pValues[n].cbData > cbData)
+			cbData = pKey->pValues[n].cbData;
+	}
+
+	//name lengths in characters, as RegQueryInfoKey gives them
+	if (pcSubKeys)
+		*pcSubKeys = pKey->nChildren;
+	if (pcbKey)
+		*pcbKey = cchKey;
+	if (pcValues)
+		*pcValues = pKey->nValues;
+	if (pcbValue)
+		*pcbValue = cchValue;
+	if (pcbData)
+		*pcbData = cbData;
+	if (pcbSecurityDescriptor)
+		*pcbSecurityDescriptor = 0;
+	if (pftLastWriteTime)
+		ZeroMemory(pftLastWriteTime, sizeof(*pftLastWriteTime));
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockSetValue(HANDLE hcKey, LPCWSTR pszValue, DWORD dwType, const BYTE* pData,
+	DWORD cbData, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+
+	pThis->SetValue(hcKey, pszValue, dwType, pData, cbData);
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockDeleteValue(HANDLE hcKey, LPCWSTR pszValue, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	if (!Value(static_cast<LPMOCKKEY>(hcKey), pszValue))
+		return ERROR_FILE_NOT_FOUND;
+
+	pThis->DeleteValue(hcKey, pszValue);
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockEnumValue(HANDLE hcKey, DWORD dwIndex, LPWSTR pszValue, PDWORD pcbValue,
+	PDWORD pType, PBYTE pData, PDWORD pcbData, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKKEY pKey = static_cast<LPMOCKKEY>(hcKey);
+
+	if (dwIndex >= pKey->nValues)
+		return ERROR_NO_MORE_ITEMS;
+
+	LPMOCKVALUE pValue = &pKey->pValues[dwIndex];
+
+	//the name size is in characters, despite its name
+	size_t cch = wcslen(pValue->szName);
+	if (cch >= *pcbValue)
+		return ERROR_MORE_DATA;
+
+	wcscpy_s(pszValue, *pcbValue, pValue->szName);
+	*pcbValue = static_cast<DWORD>(cch);
+
+	if (pType)
+		*pType = pValue->dwType;
+
+	if (pcbData)
+	{
+		if (pData && pValue->cbData > *pcbData)
+		{
+			*pcbData = pValue->cbData;
+			return ERROR_MORE_DATA;
+		}
+		if (pData)
+			CopyMemory(pData, pValue->pData, pValue->cbData);
+		*pcbData = pValue->cbData;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+LONG WINAPI CMockRegistry::MockQueryValue(HANDLE hcKey, LPCWSTR pszValue, PDWORD pType, PBYTE pData,
+	PDWORD pcbData, HANDLE hSpooler)
+{
+	CMockRegistry* pThis = Call(hSpooler);
+	CAutoCriticalSection acs(&pThis->m_CSRegistry);
+
+	LPMOCKVALUE pValue = Value(static_cast<LPMOCKKEY>(hcKey), pszValue);
+	if (!pValue)
+		return ERROR_FILE_NOT_FOUND;
+
+	if (pType)
+		*pType = pValue->dwType;
+
+	if (pData && pValue->cbData > *pcbData)
+	{
+		*pcbData = pValue->cbData;
+		return ERROR_MORE_DATA;
+	}
+
+	if (pData)
+		CopyMemory(pData, pValue->pData, pValue->cbData);
+	*pcbData = pValue->cbData;
+
+	return ERROR_SUCCESS;
+}
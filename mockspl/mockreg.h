@@ -0,0 +1,115 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+/*
+*  CMockRegistry
+*  the registry behind the MONITORREG callbacks the spooler hands to the
+*  monitor, kept in memory. Keys nest and are looked up by name, case
+*  insensitively, through a hash index, so that a root holding tens of
+*  thousands of ports opens any of them in constant time. Every callback is
+*  counted and can be given a cost, to stand for the trip through the spooler
+*  into the registry. Keys belong to the registry: closing a handle does
+*  nothing, deleting the key frees it.
+*  The registry is passed to the callbacks as the spooler handle (see
+*  MonitorInit).
+*/
+
+class CMockRegistry
+{
+private:
+	typedef struct tagMOCKVALUE
+	{
+		LPWSTR szName;
+		DWORD dwType;
+		LPBYTE pData;
+		DWORD cbData;
+	} MOCKVALUE, *LPMOCKVALUE;
+
+	typedef struct tagMOCKKEY
+	{
+		LPWSTR szName;
+		tagMOCKKEY** pChildren;		//in creation order, for EnumKey
+		DWORD nChildren;
+		DWORD nMaxChildren;
+		tagMOCKKEY** pIndex;		//open addressing over pChildren
+		DWORD nIndexMask;
+		LPMOCKVALUE pValues;
+		DWORD nValues;
+		DWORD nMaxValues;
+	} MOCKKEY, *LPMOCKKEY;
+
+public:
+	CMockRegistry();
+	virtual ~CMockRegistry();
+
+public:
+	HANDLE Root() const { return m_pRoot; }
+	HANDLE CreateKey(HANDLE hKey, LPCWSTR szName);
+	HANDLE FindKey(HANDLE hKey, LPCWSTR szName);
+	void SetValue(HANDLE hKey, LPCWSTR szName, DWORD dwType, LPCVOID pData, DWORD cbData);
+	void SetString(HANDLE hKey, LPCWSTR szName, LPCWSTR szValue);
+	void SetDword(HANDLE hKey, LPCWSTR szName, DWORD dwValue);
+	BOOL GetDword(HANDLE hKey, LPCWSTR szName, LPDWORD pdwValue);
+	BOOL GetValue(HANDLE hKey, LPCWSTR szName, LPVOID pData, LPDWORD pcbData);
+	void DeleteValue(HANDLE hKey, LPCWSTR szName);
+	void Clear();
+	void SetLatency(ULONGLONG ullNanoseconds) { m_ullLatency = ullNanoseconds; }
+	ULONGLONG Calls() const { return static_cast<ULONGLONG>(m_nCalls); }
+	void ResetCalls() { m_nCalls = 0; }
+	void MonitorInit(PMONITORINIT pInit);
+
+private:
+	static LONG WINAPI MockCreateKey(HANDLE hcKey, LPCWSTR pszSubKey, DWORD dwOptions, REGSAM samDesired,
+		PSECURITY_ATTRIBUTES pSecurityAttributes, PHANDLE phckResult, PDWORD pdwDisposition, HANDLE hSpooler);
+	static LONG WINAPI MockOpenKey(HANDLE hcKey, LPCWSTR pszSubKey, REGSAM samDesired, PHANDLE phkResult,
+		HANDLE hSpooler);
+	static LONG WINAPI MockCloseKey(HANDLE hcKey, HANDLE hSpooler);
+	static LONG WINAPI MockDeleteKey(HANDLE hcKey, LPCWSTR pszSubKey, HANDLE hSpooler);
+	static LONG WINAPI MockEnumKey(HANDLE hcKey, DWORD dwIndex, LPWSTR pszName, PDWORD pcchName,
+		PFILETIME pftLastWriteTime, HANDLE hSpooler);
+	static LONG WINAPI MockQueryInfoKey(HANDLE hcKey, PDWORD pcSubKeys, PDWORD pcbKey, PDWORD pcValues,
+		PDWORD pcbValue, PDWORD pcbData, PDWORD pcbSecurityDescriptor, PFILETIME pftLastWriteTime,
+		HANDLE hSpooler);
+	static LONG WINAPI MockSetValue(HANDLE hcKey, LPCWSTR pszValue, DWORD dwType, const BYTE* pData,
+		DWORD cbData, HANDLE hSpooler);
+	static LONG WINAPI MockDeleteValue(HANDLE hcKey, LPCWSTR pszValue, HANDLE hSpooler);
+	static LONG WINAPI MockEnumValue(HANDLE hcKey, DWORD dwIndex, LPWSTR pszValue, PDWORD pcbValue,
+		PDWORD pType, PBYTE pData, PDWORD pcbData, HANDLE hSpooler);
+	static LONG WINAPI MockQueryValue(HANDLE hcKey, LPCWSTR pszValue, PDWORD pType, PBYTE pData,
+		PDWORD pcbData, HANDLE hSpooler);
+	static CMockRegistry* Call(HANDLE hSpooler);
+	static DWORD Hash(LPCWSTR szName);
+	static LPMOCKKEY NewKey(LPCWSTR szName);
+	static void FreeKey(LPMOCKKEY pKey);
+	static void Reindex(LPMOCKKEY pKey);
+	static LPMOCKKEY Child(LPMOCKKEY pKey, LPCWSTR szName);
+	static LPMOCKKEY AddChild(LPMOCKKEY pKey, LPCWSTR szName);
+	static LPMOCKVALUE Value(LPMOCKKEY pKey, LPCWSTR szName);
+
+private:
+	MONITORREG m_reg;
+	LPMOCKKEY m_pRoot;
+	ULONGLONG m_ullLatency;
+	ULONGLONG m_ullFreq;
+	volatile LONG64 m_nCalls;
+	CRITICAL_SECTION m_CSRegistry;
+};
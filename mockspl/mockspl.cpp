@@ -0,0 +1,399 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "../monitor/stdafx.h"
+#include "mockspl.h"
+#include "../monitor/monitor.h"
+
+#define MOCK_PRINTER_MAGIC	0x504D464DU		//"MFMP"
+#define MOCK_TOKEN_MAGIC	0x544D464DU		//"MFMT"
+#define MOCK_CLOCK_START	0xFFFFE000U		//8 s before the wrap
+
+typedef struct tagMOCKPRINTER
+{
+	DWORD dwMagic;
+	WCHAR szName[MAX_PATH + 1];
+} MOCKPRINTER, *LPMOCKPRINTER;
+
+typedef struct tagMOCKTOKEN
+{
+	DWORD dwMagic;
+} MOCKTOKEN, *LPMOCKTOKEN;
+
+//the job every GetJob describes; set while no job is running
+static WCHAR s_szUser[MAX_PATH + 1] = L"user";
+static WCHAR s_szMachine[MAX_PATH + 1] = L"\\\\client";
+static WCHAR s_szDocument[MAX_PATH + 1] = L"Document";
+
+static MOCKCOUNTS s_counts = { 0 };
+static volatile LONG s_nSpoolerFailures = 0;
+static volatile DWORD s_dwSpoolerError = ERROR_SUCCESS;
+static volatile LONG s_nLogonFailures = 0;
+static volatile DWORD s_dwLogonError = ERROR_SUCCESS;
+static volatile LONG s_nClock = static_cast<LONG>(MOCK_CLOCK_START);
+
+static MONITORINIT s_init;
+
+//-------------------------------------------------------------------------------------
+static BOOL TakeFailure(volatile LONG* pnFailures)
+{
+	//one of the calls that were told to fail, if any are left
+	LONG n;
+
+	while ((n = *pnFailures) > 0)
+	{
+		if (InterlockedCompareExchange(pnFailures, n - 1, n) == n)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WINAPI MockOpenPrinter(LPWSTR pPrinterName, LPHANDLE phPrinter, LPPRINTER_DEFAULTSW /*pDefault*/)
+{
+	InterlockedIncrement(&s_counts.nOpenPrinter);
+
+	if (!pPrinterName || !*pPrinterName)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	LPMOCKPRINTER pPrinter = new MOCKPRINTER;
+	pPrinter->dwMagic = MOCK_PRINTER_MAGIC;
+	wcscpy_s(pPrinter->szName, LENGTHOF(pPrinter->szName), pPrinterName);
+
+	InterlockedIncrement(&s_counts.nPrinters);
+
+	*phPrinter = static_cast<HANDLE>(pPrinter);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WINAPI MockClosePrinter(HANDLE hPrinter)
+{
+	InterlockedIncrement(&s_counts.nClosePrinter);
+
+	LPMOCKPRINTER pPrinter = static_cast<LPMOCKPRINTER>(hPrinter);
+	if (!pPrinter || pPrinter->dwMagic != MOCK_PRINTER_MAGIC)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pPrinter->dwMagic = 0;
+	delete pPrinter;
+
+	InterlockedDecrement(&s_counts.nPrinters);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static LPWSTR CopyString(LPBYTE* ppStrings, LPCWSTR szString)
+{
+	LPWSTR szCopy = reinterpret_cast<LPWSTR>(*ppStrings);
+	size_t cb = (wcslen(szString) + 1) * sizeof(WCHAR);
+	CopyMemory(szCopy, szString, cb);
+	*ppStrings += cb;
+	return szCopy;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WINAPI MockGetJob(HANDLE hPrinter, DWORD JobId, DWORD Level, LPBYTE pJob, DWORD cbBuf,
+	LPDWORD pcbNeeded)
+{
+	InterlockedIncrement(&s_counts.nGetJob);
+
+	LPMOCKPRINTER pPrinter = static_cast<LPMOCKPRINTER>(hPrinter);
+	if (!pPrinter || pPrinter->dwMagic != MOCK_PRINTER_MAGIC)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if (TakeFailure(&s_nSpoolerFailures))
+	{
+		SetLastError(s_dwSpoolerError);
+		return FALSE;
+	}
+
+	if (Level != 2)
+	{
+		SetLastError(ERROR_INVALID_LEVEL);
+		return FALSE;
+	}
+
+	//the structure, then its strings, as the spooler lays them out
+	static const WCHAR szDatatype[] = L"RAW";
+	DWORD cbNeeded = sizeof(JOB_INFO_2W) + static_cast<DWORD>((wcslen(pPrinter->szName) + wcslen(s_szMachine) +
+		wcslen(s_szUser) + wcslen(s_szDocument) + wcslen(szDatatype) + 5) * sizeof(WCHAR));
+
+	*pcbNeeded = cbNeeded;
+	if (!pJob || cbBuf < cbNeeded)
+	{
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	JOB_INFO_2W* pji = reinterpret_cast<JOB_INFO_2W*>(pJob);
+	LPBYTE pStrings = pJob + sizeof(JOB_INFO_2W);
+
+	ZeroMemory(pji, sizeof(*pji));
+	pji->JobId = JobId;
+	pji->pPrinterName = CopyString(&pStrings, pPrinter->szName);
+	pji->pMachineName = CopyString(&pStrings, s_szMachine);
+	pji->pUserName = CopyString(&pStrings, s_szUser);
+	pji->pDocument = CopyString(&pStrings, s_szDocument);
+	pji->pDatatype = CopyString(&pStrings, szDatatype);
+	GetLocalTime(&pji->Submitted);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WINAPI MockSetJob(HANDLE hPrinter, DWORD /*JobId*/, DWORD /*Level*/, LPBYTE /*pJob*/,
+	DWORD /*Command*/)
+{
+	InterlockedIncrement(&s_counts.nSetJob);
+
+	LPMOCKPRINTER pPrinter = static_cast<LPMOCKPRINTER>(hPrinter);
+	if (!pPrinter || pPrinter->dwMagic != MOCK_PRINTER_MAGIC)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if (TakeFailure(&s_nSpoolerFailures))
+	{
+		SetLastError(s_dwSpoolerError);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL MockLogon(LPWSTR /*lpszUsername*/, LPWSTR /*lpszDomain*/, LPWSTR /*lpszPassword*/,
+	PHANDLE phToken, BOOL* pbRestrictedToken)
+{
+	InterlockedIncrement(&s_counts.nLogon);
+
+	if (TakeFailure(&s_nLogonFailures))
+	{
+		SetLastError(s_dwLogonError);
+		return FALSE;
+	}
+
+	LPMOCKTOKEN pToken = new MOCKTOKEN;
+	pToken->dwMagic = MOCK_TOKEN_MAGIC;
+
+	InterlockedIncrement(&s_counts.nTokens);
+
+	*phToken = static_cast<HANDLE>(pToken);
+	*pbRestrictedToken = FALSE;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WINAPI MockCloseToken(HANDLE hToken)
+{
+	InterlockedIncrement(&s_counts.nCloseToken);
+
+	LPMOCKTOKEN pToken = static_cast<LPMOCKTOKEN>(hToken);
+	if (!pToken || pToken->dwMagic != MOCK_TOKEN_MAGIC)
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	pToken->dwMagic = 0;
+	delete pToken;
+
+	InterlockedDecrement(&s_counts.nTokens);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD WINAPI MockGetTickCount()
+{
+	return static_cast<DWORD>(s_nClock);
+}
+
+const SPOOLERFUNCS g_MockSpoolerFuncs = {
+	MockOpenPrinter,
+	MockClosePrinter,
+	MockGetJob,
+	MockSetJob,
+	MockGetTickCount
+};
+
+const TOKENFUNCS g_MockTokenFuncs = {
+	MockLogon,
+	MockCloseToken,
+	MockGetTickCount
+};
+
+//-------------------------------------------------------------------------------------
+void MockReset()
+{
+	//counts, failures and clock; handles and tokens still open stay counted
+	LONG nPrinters = s_counts.nPrinters;
+	LONG nTokens = s_counts.nTokens;
+
+	ZeroMemory(&s_counts, sizeof(s_counts));
+	s_counts.nPrinters = nPrinters;
+	s_counts.nTokens = nTokens;
+
+	s_nSpoolerFailures = 0;
+	s_nLogonFailures = 0;
+	s_nClock = static_cast<LONG>(MOCK_CLOCK_START);
+}
+
+//-------------------------------------------------------------------------------------
+void MockGetCounts(LPMOCKCOUNTS pCounts)
+{
+	CopyMemory(pCounts, &s_counts, sizeof(*pCounts));
+}
+
+//-------------------------------------------------------------------------------------
+void MockSetJobInfo(LPCWSTR szUser, LPCWSTR szMachine, LPCWSTR szDocument)
+{
+	if (szUser)
+		wcscpy_s(s_szUser, LENGTHOF(s_szUser), szUser);
+	if (szMachine)
+		wcscpy_s(s_szMachine, LENGTHOF(s_szMachine), szMachine);
+	if (szDocument)
+		wcscpy_s(s_szDocument, LENGTHOF(s_szDocument), szDocument);
+}
+
+//-------------------------------------------------------------------------------------
+void MockFailSpooler(DWORD dwError, LONG nCalls)
+{
+	//the next nCalls GetJob and SetJob fail with dwError
+	s_dwSpoolerError = dwError;
+	s_nSpoolerFailures = nCalls;
+}
+
+//-------------------------------------------------------------------------------------
+void MockFailLogon(DWORD dwError, LONG nCalls)
+{
+	s_dwLogonError = dwError;
+	s_nLogonFailures = nCalls;
+}
+
+//-------------------------------------------------------------------------------------
+void MockClockAdvance(DWORD dwMilliseconds)
+{
+	InterlockedExchangeAdd(&s_nClock, static_cast<LONG>(dwMilliseconds));
+}
+
+//-------------------------------------------------------------------------------------
+LPMONITOR2 MockMonitorStart(CMockRegistry* pRegistry)
+{
+	//spoolsv loads the DLL, then hands it the registry
+	if (!DllMain(NULL, DLL_PROCESS_ATTACH, NULL))
+		return NULL;
+
+	//the caches DllMain made talk to the real spooler and LSA
+	delete g_pPrinterCache;
+	g_pPrinterCache = new CPrinterCache(&g_MockSpoolerFuncs);
+	delete g_pTokenCache;
+	g_pTokenCache = new CTokenCache(&g_MockTokenFuncs);
+
+	pRegistry->MonitorInit(&s_init);
+
+	HANDLE hMonitor = NULL;
+	LPMONITOR2 pMonitor = InitializePrintMonitor2(&s_init, &hMonitor);
+	if (!pMonitor)
+		MfmShutdown(NULL);
+
+	return pMonitor;
+}
+
+//-------------------------------------------------------------------------------------
+void MockMonitorStop(LPMONITOR2 pMonitor)
+{
+	pMonitor->pfnShutdown(NULL);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD MockAddPort(LPMONITOR2 pMonitor, const PORTCONFIG* pConfig)
+{
+	//what the port UI does: AddPort on the monitor, then SetConfig on the new port
+	HANDLE hXcv;
+	DWORD cbNeeded = 0;
+
+	if (!pMonitor->pfnXcvOpenPort(NULL, NULL, SERVER_ACCESS_ADMINISTER, &hXcv))
+		return GetLastError();
+
+	LPCWSTR szPortName = pConfig->szPortName;
+	DWORD dwRet = pMonitor->pfnXcvDataPort(hXcv, L"AddPort",
+		reinterpret_cast<PBYTE>(const_cast<LPWSTR>(szPortName)),
+		static_cast<DWORD>((wcslen(szPortName) + 1) * sizeof(WCHAR)), NULL, 0, &cbNeeded);
+
+	if (dwRet == ERROR_SUCCESS)
+	{
+		dwRet = pMonitor->pfnXcvDataPort(hXcv, L"SetConfig",
+			reinterpret_cast<PBYTE>(const_cast<LPPORTCONFIG>(pConfig)), sizeof(*pConfig), NULL, 0, &cbNeeded);
+	}
+
+	pMonitor->pfnXcvClosePort(hXcv);
+
+	return dwRet;
+}
+
+//-------------------------------------------------------------------------------------
+LPSTR MockGetStats(LPMONITOR2 pMonitor, LPCWSTR szPortName)
+{
+	//OpenMetrics text of a port, or of all of them; the caller deletes it
+	HANDLE hXcv;
+
+	if (!pMonitor->pfnXcvOpenPort(NULL, szPortName, 0, &hXcv))
+		return NULL;
+
+	LPSTR szText = NULL;
+	DWORD cbText = 0;
+	DWORD cbNeeded = 0;
+	DWORD dwRet;
+
+	//the counters move between the two calls, the text may grow
+	while ((dwRet = pMonitor->pfnXcvDataPort(hXcv, L"GetStats", NULL, 0,
+		reinterpret_cast<PBYTE>(szText), cbText, &cbNeeded)) == ERROR_INSUFFICIENT_BUFFER)
+	{
+		delete[] szText;
+		cbText = cbNeeded + 256;
+		szText = new CHAR[cbText];
+	}
+
+	pMonitor->pfnXcvClosePort(hXcv);
+
+	if (dwRet != ERROR_SUCCESS)
+	{
+		delete[] szText;
+		return NULL;
+	}
+
+	return szText;
+}
@@ -0,0 +1,68 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#include "mockreg.h"
+#include "../monitor/printercache.h"
+#include "../monitor/tokencache.h"
+#include "../common/config.h"
+
+/*
+*  mockspl - the spooler around the monitor, for the tools and the tests.
+*  MockMonitorStart loads the real monitor the way spoolsv does (DllMain,
+*  then InitializePrintMonitor2 on a CMockRegistry), with its printer and
+*  token caches bound to the mock spooler and logon provider below, so that
+*  jobs run through the real MfmStartDocPort/MfmWritePort/MfmEndDocPort
+*  without a print server or a domain.
+*  The spooler knows every job: GetJob describes it with the properties set
+*  by MockSetJobInfo, whatever its id. The logon provider accepts every
+*  account. Both can be made to fail the next calls, and count what they do.
+*  Their clock only moves with MockClockAdvance, and starts a few seconds
+*  before GetTickCount wraps around, so that idle times and token ages are
+*  exact and cross the wrap.
+*/
+
+typedef struct tagMOCKCOUNTS
+{
+	LONG nOpenPrinter;
+	LONG nClosePrinter;
+	LONG nPrinters;			//printer handles open now
+	LONG nGetJob;
+	LONG nSetJob;
+	LONG nLogon;
+	LONG nCloseToken;
+	LONG nTokens;			//tokens not closed yet
+} MOCKCOUNTS, *LPMOCKCOUNTS;
+
+extern const SPOOLERFUNCS g_MockSpoolerFuncs;
+extern const TOKENFUNCS g_MockTokenFuncs;
+
+void MockReset();
+void MockGetCounts(LPMOCKCOUNTS pCounts);
+void MockSetJobInfo(LPCWSTR szUser, LPCWSTR szMachine, LPCWSTR szDocument);
+void MockFailSpooler(DWORD dwError, LONG nCalls);
+void MockFailLogon(DWORD dwError, LONG nCalls);
+void MockClockAdvance(DWORD dwMilliseconds);
+
+LPMONITOR2 MockMonitorStart(CMockRegistry* pRegistry);
+void MockMonitorStop(LPMONITOR2 pMonitor);
+DWORD MockAddPort(LPMONITOR2 pMonitor, const PORTCONFIG* pConfig);
+LPSTR MockGetStats(LPMONITOR2 pMonitor, LPCWSTR szPortName);
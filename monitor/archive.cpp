@@ -0,0 +1,281 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "archive.h"
+#include "log.h"
+
+#define TARBLOCK 512
+
+//tar (ustar) header layout
+typedef struct tagTARHEADER
+{
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+} TARHEADER, *LPTARHEADER;
+
+static const BYTE ZeroBlock[TARBLOCK * 2] = { 0 };
+
+//-------------------------------------------------------------------------------------
+static void FormatOctal(char* pBuf, size_t count, ULONGLONG value)
+{
+	//right aligned, zero padded, NUL terminated
+	pBuf[count - 1] = '\0';
+	for (size_t i = count - 1; i > 0; i--)
+	{
+		pBuf[i - 1] = static_cast<char>('0' + (value & 7));
+		value >>= 3;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG UnixTime()
+{
+	FILETIME ft;
+	ULARGE_INTEGER uli;
+
+	GetSystemTimeAsFileTime(&ft);
+	uli.LowPart = ft.dwLowDateTime;
+	uli.HighPart = ft.dwHighDateTime;
+
+	//100ns intervals since 1601-01-01 to seconds since 1970-01-01
+	return (uli.QuadPart - 116444736000000000ULL) / 10000000ULL;
+}
+
+//-------------------------------------------------------------------------------------
+static void Untab(LPWSTR szString)
+{
+	//index fields are separated by tabs, one member per line
+	for (; *szString; szString++)
+		if (*szString == L'\t' || *szString == L'\r' || *szString == L'\n')
+			*szString = L' ';
+}
+
+//-------------------------------------------------------------------------------------
+CArchive::CArchive()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hIndex = INVALID_HANDLE_VALUE;
+	m_szPath = NULL;
+	*m_szMemberName = '\0';
+	m_ullSize = 0;
+	m_ullHeaderOffset = 0;
+	m_nMembers = 0;
+	m_dwOpenTick = 0;
+	m_bInMember = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+CArchive::~CArchive()
+{
+	Close();
+	delete[] m_szPath;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CArchive::Open(HANDLE hFile, LPCWSTR szPath)
+{
+	_ASSERTE(!IsOpen());
+
+	m_hFile = hFile;
+	//a port that never archives doesn't carry the path
+	if (!m_szPath)
+		m_szPath = new WCHAR[MAX_PATH + 1];
+	wcscpy_s(m_szPath, MAX_PATH + 1, szPath);
+	m_ullSize = 0;
+	m_nMembers = 0;
+	m_dwOpenTick = GetTickCount();
+	m_bInMember = FALSE;
+
+	//the index lives next to the archive
+	WCHAR szIndex[MAX_PATH + 1];
+	swprintf_s(szIndex, LENGTHOF(szIndex), L"%s.idx", m_szPath);
+
+	m_hIndex = CreateFileW(szIndex, GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (m_hIndex == INVALID_HANDLE_VALUE)
+	{
+		g_pLog->Error(L"CArchive::Open: can't create index %s (%i)", szIndex, GetLastError());
+		return TRUE;
+	}
+
+	WriteIndexLine(L"#member\toffset\tsize\tjobid\tuser\tcomputer\ttitle");
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CArchive::BeginMember(DWORD nJobId)
+{
+	_ASSERTE(IsOpen() && !m_bInMember);
+
+	DWORD wri;
+
+	sprintf_s(m_szMemberName, LENGTHOF(m_szMemberName), "%08u-job%u.prn", m_nMembers + 1, nJobId);
+
+	//reserve room for the header, we'll fill it when we know the member size
+	m_ullHeaderOffset = m_ullSize;
+	if (!WriteFile(m_hFile, ZeroBlock, TARBLOCK, &wri, NULL) || wri != TARBLOCK)
+		return FALSE;
+
+	m_ullSize += TARBLOCK;
+	m_bInMember = TRUE;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CArchive::EndMember(DWORD nJobId, LPCWSTR szUser, LPCWSTR szComputer, LPCWSTR szTitle)
+{
+	if (!m_bInMember)
+		return FALSE;
+
+	m_bInMember = FALSE;
+
+	LARGE_INTEGER liZero = { 0 };
+	LARGE_INTEGER liPos;
+	DWORD wri;
+
+	//the writer appended job data after the blank header
+	if (!SetFilePointerEx(m_hFile, liZero, &liPos, FILE_CURRENT))
+		return FALSE;
+
+	ULONGLONG ullDataOffset = m_ullHeaderOffset + TARBLOCK;
+	ULONGLONG ullDataSize = static_cast<ULONGLONG>(liPos.QuadPart) - ullDataOffset;
+	DWORD cbPad = static_cast<DWORD>((TARBLOCK - ullDataSize % TARBLOCK) % TARBLOCK);
+
+	if (cbPad > 0 && (!WriteFile(m_hFile, ZeroBlock, cbPad, &wri, NULL) || wri != cbPad))
+		return FALSE;
+
+	//compose and patch the header
+	TARHEADER hdr;
+	ZeroMemory(&hdr, sizeof(hdr));
+	strcpy_s(hdr.name, sizeof(hdr.name), m_szMemberName);
+	strcpy_s(hdr.mode, sizeof(hdr.mode), "0000644");
+	strcpy_s(hdr.uid, sizeof(hdr.uid), "0000000");
+	strcpy_s(hdr.gid, sizeof(hdr.gid), "0000000");
+	FormatOctal(hdr.size, sizeof(hdr.size), ullDataSize);
+	FormatOctal(hdr.mtime, sizeof(hdr.mtime), UnixTime());
+	hdr.typeflag = '0';
+	memcpy(hdr.magic, "ustar", 6);
+	memcpy(hdr.version, "00", 2);
+
+	//checksum is computed with the checksum field filled with spaces
+	memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+	unsigned int sum = 0;
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(&hdr);
+	for (size_t i = 0; i < sizeof(hdr); i++)
+		sum += p[i];
+	FormatOctal(hdr.chksum, 7, sum);
+	hdr.chksum[7] = ' ';
+
+	LARGE_INTEGER liHeader;
+	liHeader.QuadPart = static_cast<LONGLONG>(m_ullHeaderOffset);
+
+	if (!SetFilePointerEx(m_hFile, liHeader, NULL, FILE_BEGIN) ||
+		!WriteFile(m_hFile, &hdr, sizeof(hdr), &wri, NULL) ||
+		!SetFilePointerEx(m_hFile, liZero, NULL, FILE_END))
+	{
+		return FALSE;
+	}
+
+	m_ullSize = ullDataOffset + ullDataSize + cbPad;
+	m_nMembers++;
+
+	//index entry
+	WCHAR szLine[1024];
+	WCHAR szSafeTitle[MAX_PATH + 1];
+	wcsncpy_s(szSafeTitle, LENGTHOF(szSafeTitle), szTitle, _TRUNCATE);
+	Untab(szSafeTitle);
+
+	swprintf_s(szLine, LENGTHOF(szLine), L"%S\t%I64u\t%I64u\t%u\t%s\t%s\t%s",
+		m_szMemberName, ullDataOffset, ullDataSize, nJobId, szUser, szComputer, szSafeTitle);
+
+	WriteIndexLine(szLine);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CArchive::Close()
+{
+	BOOL bRet = TRUE;
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		DWORD wri;
+
+		if (m_bInMember)
+			EndMember(0, L"", L"", L"");
+
+		//end of archive marker: two zero blocks
+		bRet = WriteFile(m_hFile, ZeroBlock, sizeof(ZeroBlock), &wri, NULL);
+
+		FlushFileBuffers(m_hFile);
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	if (m_hIndex != INVALID_HANDLE_VALUE)
+	{
+		FlushFileBuffers(m_hIndex);
+		CloseHandle(m_hIndex);
+		m_hIndex = INVALID_HANDLE_VALUE;
+	}
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CArchive::WriteIndexLine(LPCWSTR szLine)
+{
+	if (m_hIndex == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	//index is plain UTF-8 so that it can be consumed by any tool
+	char szBuf[4096];
+	int len = WideCharToMultiByte(CP_UTF8, 0, szLine, -1, szBuf, sizeof(szBuf) - 2, NULL, NULL);
+
+	if (len <= 0)
+		return FALSE;
+
+	//replace terminating NUL with CR LF
+	len--;
+	szBuf[len++] = '\r';
+	szBuf[len++] = '\n';
+
+	DWORD wri;
+	return WriteFile(m_hIndex, szBuf, len, &wri, NULL);
+}
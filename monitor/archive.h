@@ -0,0 +1,69 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#define ARCHIVEMODE_NONE	0
+#define ARCHIVEMODE_TAR		1
+#define ARCHIVEMODE_MIN		ARCHIVEMODE_NONE
+#define ARCHIVEMODE_MAX		ARCHIVEMODE_TAR
+
+/*
+*  CArchive
+*  a rolling container where each print job is appended as a member of a tar
+*  (ustar) archive. The archive file stays open between jobs, so only one
+*  handle per port is needed and no directory entry is created per job.
+*  Since the job size is not known in advance, a blank header is written when
+*  the member starts and patched in place when the member ends.
+*  An index (one line per member) is appended to a companion <archive>.idx file.
+*/
+
+class CArchive
+{
+public:
+	CArchive();
+	virtual ~CArchive();
+
+public:
+	BOOL Open(HANDLE hFile, LPCWSTR szPath);
+	BOOL BeginMember(DWORD nJobId);
+	BOOL EndMember(DWORD nJobId, LPCWSTR szUser, LPCWSTR szComputer, LPCWSTR szTitle);
+	BOOL Close();
+	BOOL IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; }
+	BOOL InMember() const { return m_bInMember; }
+	HANDLE Handle() const { return m_hFile; }
+	LPCWSTR Path() const { return m_szPath ? m_szPath : L""; }
+	ULONGLONG Size() const { return m_ullSize; }
+	DWORD Members() const { return m_nMembers; }
+	DWORD AgeMinutes() const { return (GetTickCount() - m_dwOpenTick) / 60000; }
+
+private:
+	BOOL WriteIndexLine(LPCWSTR szLine);
+
+private:
+	HANDLE m_hFile;
+	HANDLE m_hIndex;
+	LPWSTR m_szPath;
+	char m_szMemberName[100];
+	ULONGLONG m_ullSize;
+	ULONGLONG m_ullHeaderOffset;
+	DWORD m_nMembers;
+	DWORD m_dwOpenTick;
+	BOOL m_bInMember;
+};
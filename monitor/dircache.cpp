@@ -0,0 +1,200 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "dircache.h"
+#include "../common/autoclean.h"
+#include "../common/monutils.h"
+
+//-------------------------------------------------------------------------------------
+CDirCache::CDirCache()
+{
+	m_pBuckets = NULL;
+	m_nEntries = 0;
+	InitializeCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+CDirCache::~CDirCache()
+{
+	Clear();
+	DeleteCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CDirCache::Hash(LPCWSTR szPath)
+{
+	//FNV-1a over upper-cased characters
+	DWORD dwHash = 2166136261U;
+
+	for (; *szPath; szPath++)
+	{
+		dwHash ^= static_cast<DWORD>(towupper(*szPath));
+		dwHash *= 16777619U;
+	}
+
+	return dwHash;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CDirCache::IsSameOrParent(LPCWSTR szParent, LPCWSTR szPath)
+{
+	size_t len = wcslen(szParent);
+
+	return _wcsnicmp(szParent, szPath, len) == 0 &&
+		(szPath[len] == L'\0' || ISSLASH(szPath[len]));
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CDirCache::Lookup(LPCWSTR szPath, LPDWORD pdwError)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	if (!m_pBuckets)
+		return FALSE;
+
+	DWORD dwHash = Hash(szPath);
+	LPDIRENTRY* ppEntry = &m_pBuckets[dwHash % DIRCACHE_BUCKETS];
+
+	while (*ppEntry)
+	{
+		LPDIRENTRY pEntry = *ppEntry;
+
+		if (pEntry->dwHash == dwHash && _wcsicmp(pEntry->szPath, szPath) == 0)
+		{
+			//failures are remembered only for a short while
+			if (pEntry->dwError != ERROR_SUCCESS &&
+				GetTickCount() - pEntry->dwTick >= DIRCACHE_NEGATIVE_TTL)
+			{
+				Unlink(ppEntry);
+				return FALSE;
+			}
+
+			*pdwError = pEntry->dwError;
+			return TRUE;
+		}
+
+		ppEntry = &pEntry->pNext;
+	}
+
+	return FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+void CDirCache::Add(LPCWSTR szPath, DWORD dwError)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	DWORD dwHash = Hash(szPath);
+
+	for (LPDIRENTRY pEntry = m_pBuckets ? m_pBuckets[dwHash % DIRCACHE_BUCKETS] : NULL; pEntry; pEntry = pEntry->pNext)
+	{
+		if (pEntry->dwHash == dwHash && _wcsicmp(pEntry->szPath, szPath) == 0)
+		{
+			pEntry->dwError = dwError;
+			pEntry->dwTick = GetTickCount();
+			return;
+		}
+	}
+
+	//a port writes to a bounded set of directories; if the pattern spreads
+	//output over more than that, just start over
+	if (m_nEntries >= DIRCACHE_MAXENTRIES)
+		Clear();
+
+	//the table comes with the first directory, ports that never print don't carry it
+	if (!m_pBuckets)
+	{
+		m_pBuckets = new LPDIRENTRY[DIRCACHE_BUCKETS];
+		ZeroMemory(m_pBuckets, DIRCACHE_BUCKETS * sizeof(LPDIRENTRY));
+	}
+
+	LPDIRENTRY* ppBucket = &m_pBuckets[dwHash % DIRCACHE_BUCKETS];
+	size_t len = wcslen(szPath) + 1;
+
+	LPDIRENTRY pEntry = new DIRENTRY;
+	pEntry->szPath = new WCHAR[len];
+	wcscpy_s(pEntry->szPath, len, szPath);
+	pEntry->dwHash = dwHash;
+	pEntry->dwError = dwError;
+	pEntry->dwTick = GetTickCount();
+	pEntry->pNext = *ppBucket;
+	*ppBucket = pEntry;
+
+	m_nEntries++;
+}
+
+//-------------------------------------------------------------------------------------
+void CDirCache::Invalidate(LPCWSTR szPath)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	if (!m_pBuckets)
+		return;
+
+	//if a directory vanished, its subdirectories are gone too, and any of its
+	//ancestors may have been removed along with it
+	for (int i = 0; i < DIRCACHE_BUCKETS; i++)
+	{
+		LPDIRENTRY* ppEntry = &m_pBuckets[i];
+
+		while (*ppEntry)
+		{
+			if (IsSameOrParent(szPath, (*ppEntry)->szPath) ||
+				IsSameOrParent((*ppEntry)->szPath, szPath))
+			{
+				Unlink(ppEntry);
+			}
+			else
+				ppEntry = &(*ppEntry)->pNext;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CDirCache::Clear()
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	if (!m_pBuckets)
+		return;
+
+	for (int i = 0; i < DIRCACHE_BUCKETS; i++)
+	{
+		while (m_pBuckets[i])
+			Unlink(&m_pBuckets[i]);
+	}
+
+	//an evicted port gives the table back too
+	delete[] m_pBuckets;
+	m_pBuckets = NULL;
+}
+
+//-------------------------------------------------------------------------------------
+void CDirCache::Unlink(LPDIRENTRY* ppEntry)
+{
+	LPDIRENTRY pEntry = *ppEntry;
+
+	*ppEntry = pEntry->pNext;
+
+	delete[] pEntry->szPath;
+	delete pEntry;
+
+	m_nEntries--;
+}
@@ -0,0 +1,69 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#define DIRCACHE_BUCKETS		64
+#define DIRCACHE_MAXENTRIES		1024
+#define DIRCACHE_NEGATIVE_TTL	30000	//ms
+
+/*
+*  CDirCache
+*  remembers the directories a port already found or created, so that
+*  RecursiveCreateFolder does not have to query the file system for every
+*  path component on every job (several round trips on deep UNC paths).
+*  Positive entries live until invalidated; failed creates are remembered
+*  for DIRCACHE_NEGATIVE_TTL ms so that a missing share isn't hammered.
+*  Paths are compared case-insensitively and must not end with a backslash.
+*/
+
+class CDirCache
+{
+private:
+	typedef struct tagDIRENTRY
+	{
+		LPWSTR szPath;
+		DWORD dwHash;
+		DWORD dwError;		//ERROR_SUCCESS for directories known to exist
+		DWORD dwTick;		//when a negative entry was recorded
+		tagDIRENTRY* pNext;
+	} DIRENTRY, *LPDIRENTRY;
+
+public:
+	CDirCache();
+	virtual ~CDirCache();
+
+public:
+	BOOL Lookup(LPCWSTR szPath, LPDWORD pdwError);
+	void AddExisting(LPCWSTR szPath) { Add(szPath, ERROR_SUCCESS); }
+	void AddFailed(LPCWSTR szPath, DWORD dwError) { Add(szPath, dwError); }
+	void Invalidate(LPCWSTR szPath);
+	void Clear();
+
+private:
+	static DWORD Hash(LPCWSTR szPath);
+	static BOOL IsSameOrParent(LPCWSTR szParent, LPCWSTR szPath);
+	void Add(LPCWSTR szPath, DWORD dwError);
+	void Unlink(LPDIRENTRY* ppEntry);
+
+private:
+	LPDIRENTRY* m_pBuckets;		//DIRCACHE_BUCKETS, allocated with the first entry
+	DWORD m_nEntries;
+	CRITICAL_SECTION m_CSCache;
+};
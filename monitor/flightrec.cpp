@@ -0,0 +1,97 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "flightrec.h"
+#include "log.h"
+#include "../common/autoclean.h"
+
+//-------------------------------------------------------------------------------------
+CFlightRecorder::CFlightRecorder()
+{
+	InitializeCriticalSection(&m_cs);
+	m_pRecords = NULL;
+	m_nNext = 0;
+	m_nCount = 0;
+}
+
+//-------------------------------------------------------------------------------------
+CFlightRecorder::~CFlightRecorder()
+{
+	delete[] m_pRecords;
+	DeleteCriticalSection(&m_cs);
+}
+
+//-------------------------------------------------------------------------------------
+void CFlightRecorder::Record(LPCWSTR szFormat, va_list args)
+{
+	CAutoCriticalSection acs(&m_cs);
+
+	//ports that never print don't pay for the ring
+	if (!m_pRecords)
+		m_pRecords = new FLIGHTRECORD[FLIGHTRECORDS];
+
+	LPFLIGHTRECORD pRecord = &m_pRecords[m_nNext];
+	FILETIME ft;
+	ULARGE_INTEGER uli;
+
+	GetSystemTimeAsFileTime(&ft);
+	uli.LowPart = ft.dwLowDateTime;
+	uli.HighPart = ft.dwHighDateTime;
+
+	pRecord->ullTime = uli.QuadPart;
+	pRecord->szFormat = szFormat;
+	pRecord->cbArgs = static_cast<DWORD>(BlogPackArgs(pRecord->args, sizeof(pRecord->args), szFormat, args));
+
+	m_nNext = (m_nNext + 1) % FLIGHTRECORDS;
+	if (m_nCount < FLIGHTRECORDS)
+		m_nCount++;
+}
+
+//-------------------------------------------------------------------------------------
+void CFlightRecorder::Reset()
+{
+	CAutoCriticalSection acs(&m_cs);
+
+	m_nNext = 0;
+	m_nCount = 0;
+}
+
+//-------------------------------------------------------------------------------------
+void CFlightRecorder::Dump(CPort* pPort, LPCWSTR szReason)
+{
+	CAutoCriticalSection acs(&m_cs);
+
+	if (m_nCount == 0)
+		return;
+
+	g_pLog->Error(pPort, L"%s, last %u debug events follow", szReason, m_nCount);
+
+	//oldest first
+	DWORD n = (m_nNext + FLIGHTRECORDS - m_nCount) % FLIGHTRECORDS;
+
+	for (DWORD i = 0; i < m_nCount; i++, n = (n + 1) % FLIGHTRECORDS)
+	{
+		LPFLIGHTRECORD pRecord = &m_pRecords[n];
+		g_pLog->Replay(pPort, pRecord->ullTime, pRecord->szFormat, pRecord->args, pRecord->cbArgs);
+	}
+
+	//each event is reported once
+	m_nCount = 0;
+}
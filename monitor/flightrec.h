@@ -0,0 +1,64 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include "../common/blog.h"
+
+#define FLIGHTRECORDS	64		//events kept per port, the oldest are overwritten
+#define FLIGHTARGSIZE	232		//room for the packed arguments of one event
+
+class CPort;
+
+/*
+*  CFlightRecorder
+*  keeps the last debug events of a port when the log level is below debug.
+*  Recording an event only packs its arguments into a fixed slot (no string
+*  formatting, no allocation after the first event); the events reach the log
+*  only when a job fails, so that the failure comes with its debug trace.
+*  Format strings must be literals, as for the binary log.
+*/
+
+class CFlightRecorder
+{
+private:
+	typedef struct tagFLIGHTRECORD
+	{
+		ULONGLONG ullTime;
+		LPCWSTR szFormat;
+		DWORD cbArgs;
+		BYTE args[FLIGHTARGSIZE];
+	} FLIGHTRECORD, *LPFLIGHTRECORD;
+
+public:
+	CFlightRecorder();
+	virtual ~CFlightRecorder();
+
+public:
+	void Record(LPCWSTR szFormat, va_list args);
+	void Reset();
+	void Dump(CPort* pPort, LPCWSTR szReason);
+	size_t HeapUsage() const { return m_pRecords ? FLIGHTRECORDS * sizeof(FLIGHTRECORD) : 0; }
+
+private:
+	CRITICAL_SECTION m_cs;
+	LPFLIGHTRECORD m_pRecords;
+	DWORD m_nNext;
+	DWORD m_nCount;
+};
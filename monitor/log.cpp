@@ -22,30 +22,56 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "port.h"
 #include <string.h>
 #include <stdarg.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 //---------------------------------------------------------------------------
 
 static const unsigned short int BOM = 0xFEFF;
 
+//indexed by BLOG_TYPE_xxx
+static LPCWSTR szTypeNames[BLOG_TYPE_MAX + 1] =
+{
+	L"NONE",
+	L"DEBUG",
+	L"INFO",
+	L"DONE",
+	L"WARN",
+	L"ERROR",
+	L"CRITICAL"
+};
+
 CMfmLog* g_pLog = NULL;
 //---------------------------------------------------------------------------
 
-#define CHECK_LEVEL(lev) do { if (m_hLogFile == INVALID_HANDLE_VALUE || m_nLogLevel < lev) return; } while (0)
+#define CHECK_LEVEL(lev) do { if (m_hThread == NULL || m_nLogLevel < lev) return; } while (0)
 //---------------------------------------------------------------------------
 
 CMfmLog::CMfmLog()
-: m_nLogLevel(LOGLEVEL_NONE), m_bFlushNeeded(FALSE)
+: m_nLogLevel(LOGLEVEL_NONE), m_nLogFormat(LOGFORMAT_TEXT), m_hThread(NULL), m_ullLogSize(0),
+  m_cbBatch(0), m_bFlushNeeded(FALSE), m_nFileFormat(LOGFORMAT_TEXT), m_nFormats(0), m_pPortDefs(NULL)
 {
-	m_szBuffer[0] = L'\0';
+	InitializeSListHead(&m_pending);
+	InitializeSListHead(&m_free);
 
-	m_hStop = CreateEvent(NULL, FALSE, FALSE, NULL);
-	m_hThread = CreateThread(NULL, 0, FlushThread, this, CREATE_SUSPENDED, NULL);
+	ZeroMemory(m_formatKeys, sizeof(m_formatKeys));
 
-	CreateLogFile();
+	m_pBatch = new BYTE[LOGBATCHSIZE];
 
-	InitializeCriticalSection(&m_CSLog);
+	//a few records ready to use, the pool grows on demand up to LOGPOOLSIZE
+	for (int i = 0; i < LOGPOOLSIZE / 4; i++)
+	{
+		LPLOGRECORD pRecord = static_cast<LPLOGRECORD>(_aligned_malloc(sizeof(LOGRECORD), MEMORY_ALLOCATION_ALIGNMENT));
+		if (pRecord)
+			InterlockedPushEntrySList(&m_free, &pRecord->entry);
+	}
 
-	if (m_hThread)
-		ResumeThread(m_hThread);
+	m_hStop = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hWork = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	//logging stays disabled if we can't write anywhere
+	if (CreateLogFile())
+		m_hThread = CreateThread(NULL, 0, WriterThread, this, 0, NULL);
 }
 //---------------------------------------------------------------------------
 
@@ -59,50 +85,87 @@ CMfmLog::~CMfmLog()
 			TerminateThread(m_hThread, 255);
 
 		CloseHandle(m_hThread);
+		m_hThread = NULL;
 	}
 
 	CloseHandle(m_hStop);
+	CloseHandle(m_hWork);
 
 	if (m_hLogFile != INVALID_HANDLE_VALUE)
 		CloseHandle(m_hLogFile);
 
-	DeleteCriticalSection(&m_CSLog);
+	PSLIST_ENTRY pEntry;
+
+	while ((pEntry = InterlockedPopEntrySList(&m_pending)) != NULL)
+		_aligned_free(pEntry);
+
+	while ((pEntry = InterlockedPopEntrySList(&m_free)) != NULL)
+		_aligned_free(pEntry);
+
+	while (m_pPortDefs)
+	{
+		LPLOGPORTDEF pNext = m_pPortDefs->pNext;
+		delete[] m_pPortDefs->szName;
+		delete m_pPortDefs;
+		m_pPortDefs = pNext;
+	}
+
+	delete[] m_pBatch;
 }
 //---------------------------------------------------------------------------
 
-DWORD WINAPI CMfmLog::FlushThread(LPVOID pParam)
+DWORD WINAPI CMfmLog::WriterThread(LPVOID pParam)
 {
 	CMfmLog* pLog = static_cast<CMfmLog*>(pParam);
+	HANDLE hEvents[2] = { pLog->m_hStop, pLog->m_hWork };
 
 	while (TRUE)
 	{
-		switch (WaitForSingleObject(pLog->m_hStop, 10000))
+		DWORD dwWait = WaitForMultipleObjects(2, hEvents, FALSE, 10000);
+
+		//take everything queued so far; on stop too, so that the last lines are not lost
+		pLog->WriteRecords(InterlockedFlushSList(&pLog->m_pending));
+
+		switch (dwWait)
 		{
 		case WAIT_OBJECT_0:
 			return 0;
 			break;
 
 		case WAIT_TIMEOUT:
-			EnterCriticalSection(&pLog->m_CSLog);
-
 			if (pLog->m_bFlushNeeded && pLog->m_hLogFile != INVALID_HANDLE_VALUE)
+			{
 				FlushFileBuffers(pLog->m_hLogFile);
-
-			LeaveCriticalSection(&pLog->m_CSLog);
+				pLog->m_bFlushNeeded = FALSE;
+			}
 			break;
 		}
 	}
 }
 //---------------------------------------------------------------------------
 
+LPCWSTR CMfmLog::FileName(int n, LPWSTR szPath, size_t cchPath) const
+{
+	WCHAR szName[32];
+	LPCWSTR szExt = (m_nFileFormat == LOGFORMAT_BINARY) ? L"blog" : L"log";
+
+	if (n == 0)
+		swprintf_s(szName, LENGTHOF(szName), L"\\mfilemon.%s", szExt);
+	else
+		swprintf_s(szName, LENGTHOF(szName), L"\\mfilemon.%i.%s", n, szExt);
+
+	GetSystemDirectoryW(szPath, static_cast<UINT>(cchPath));
+	wcscat_s(szPath, cchPath, szName);
+
+	return szPath;
+}
+//---------------------------------------------------------------------------
+
 BOOL CMfmLog::CreateLogFile()
 {
 	WCHAR szPath[MAX_PATH + 1];
 
-	GetSystemDirectoryW(szPath, LENGTHOF(szPath));
-	wcscat_s(szPath, LENGTHOF(szPath), L"\\mfilemon.log");
-
-	m_hLogFile = CreateFileW(szPath, GENERIC_READ | GENERIC_WRITE,
+	m_hLogFile = CreateFileW(FileName(0, szPath, LENGTHOF(szPath)), GENERIC_READ | GENERIC_WRITE,
 		FILE_SHARE_READ, NULL, OPEN_ALWAYS, 0, NULL);
 
 	if (m_hLogFile == INVALID_HANDLE_VALUE)
@@ -110,12 +173,27 @@ BOOL CMfmLog::CreateLogFile()
 
 	if (GetLastError() == ERROR_ALREADY_EXISTS)
 	{
+		//from now on the size is tracked in memory
+		LARGE_INTEGER liSize;
+		m_ullLogSize = GetFileSizeEx(m_hLogFile, &liSize) ? liSize.QuadPart : 0;
+
 		SetFilePointer(m_hLogFile, 0, NULL, FILE_END);
 	}
 	else
 	{
 		DWORD wri;
-		WriteFile(m_hLogFile, &BOM, sizeof(BOM), &wri, NULL);
+
+		if (m_nFileFormat == LOGFORMAT_BINARY)
+		{
+			WriteFile(m_hLogFile, BLOG_MAGIC, BLOG_MAGICLEN, &wri, NULL);
+			m_ullLogSize = BLOG_MAGICLEN;
+		}
+		else
+		{
+			WriteFile(m_hLogFile, &BOM, sizeof(BOM), &wri, NULL);
+			m_ullLogSize = sizeof(BOM);
+		}
+
 		m_bFlushNeeded = TRUE;
 	}
 
@@ -133,23 +211,10 @@ void CMfmLog::RotateLogs()
 
 	for (int n = 9; n >= 0; n--)
 	{
-		WCHAR szOldFname[32];
-		WCHAR szNewFname[32];
-
 		WCHAR szOldPath[MAX_PATH + 1];
 		WCHAR szNewPath[MAX_PATH + 1];
 
-		GetSystemDirectoryW(szOldPath, LENGTHOF(szOldPath));
-
-		if (n == 0)
-		{
-			wcscat_s(szOldPath, LENGTHOF(szOldPath), L"\\mfilemon.log");
-		}
-		else
-		{
-			swprintf_s(szOldFname, LENGTHOF(szOldFname), L"\\mfilemon.%i.log", n);
-			wcscat_s(szOldPath, LENGTHOF(szOldPath), szOldFname);
-		}
+		FileName(n, szOldPath, LENGTHOF(szOldPath));
 
 		if (n == 9)
 		{
@@ -157,11 +222,7 @@ void CMfmLog::RotateLogs()
 		}
 		else
 		{
-			GetSystemDirectoryW(szNewPath, LENGTHOF(szNewPath));
-
-			swprintf_s(szNewFname, LENGTHOF(szNewFname), L"\\mfilemon.%i.log", n + 1);
-			wcscat_s(szNewPath, LENGTHOF(szNewPath), szNewFname);
-
+			FileName(n + 1, szNewPath, LENGTHOF(szNewPath));
 			MoveFileW(szOldPath, szNewPath);
 		}
 	}
@@ -179,6 +240,16 @@ void CMfmLog::SetLogLevel(DWORD nLevel)
 }
 //---------------------------------------------------------------------------
 
+void CMfmLog::SetLogFormat(DWORD nFormat)
+{
+	if (nFormat > LOGFORMAT_MAX)
+		nFormat = LOGFORMAT_TEXT;
+
+	//the writer switches file when it gets the first record in the new format
+	m_nLogFormat = nFormat;
+}
+//---------------------------------------------------------------------------
+
 void CMfmLog::Always(LPCWSTR szFormat, ...)
 {
 	CHECK_LEVEL(LOGLEVEL_NONE);
@@ -186,7 +257,7 @@ void CMfmLog::Always(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"NONE", args);
+	LogArgs(szFormat, BLOG_TYPE_NONE, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -198,7 +269,7 @@ void CMfmLog::Debug(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"DEBUG", args);
+	LogArgs(szFormat, BLOG_TYPE_DEBUG, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -210,7 +281,7 @@ void CMfmLog::Info(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"INFO", args);
+	LogArgs(szFormat, BLOG_TYPE_INFO, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -222,7 +293,7 @@ void CMfmLog::Done(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"DONE", args);
+	LogArgs(szFormat, BLOG_TYPE_DONE, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -234,7 +305,7 @@ void CMfmLog::Warn(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"WARN", args);
+	LogArgs(szFormat, BLOG_TYPE_WARN, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -246,7 +317,7 @@ void CMfmLog::Error(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"ERROR", args);
+	LogArgs(szFormat, BLOG_TYPE_ERROR, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -258,7 +329,7 @@ void CMfmLog::Critical(LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(szFormat, L"CRITICAL", args);
+	LogArgs(szFormat, BLOG_TYPE_CRITICAL, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -270,19 +341,23 @@ void CMfmLog::Always(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"NONE", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_NONE, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
 
 void CMfmLog::Debug(CPort* pPort, LPCWSTR szFormat, ...)
 {
-	CHECK_LEVEL(LOGLEVEL_DEBUG);
+	//below debug level the event is kept by the port, in case the job fails
+	CHECK_LEVEL(LOGLEVEL_ERRORS);
 
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"DEBUG", args);
+	if (m_nLogLevel >= LOGLEVEL_DEBUG)
+		LogArgs(pPort, szFormat, BLOG_TYPE_DEBUG, args);
+	else if (pPort)
+		pPort->FlightRecorder().Record(szFormat, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -294,7 +369,7 @@ void CMfmLog::Info(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"INFO", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_INFO, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -306,7 +381,7 @@ void CMfmLog::Done(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"DONE", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_DONE, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -318,7 +393,7 @@ void CMfmLog::Warn(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"WARN", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_WARN, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -330,7 +405,7 @@ void CMfmLog::Error(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"ERROR", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_ERROR, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
@@ -342,71 +417,381 @@ void CMfmLog::Critical(CPort* pPort, LPCWSTR szFormat, ...)
 	va_list args;
 
 	va_start(args, szFormat);
-	LogArgs(pPort, szFormat, L"CRITICAL", args);
+	LogArgs(pPort, szFormat, BLOG_TYPE_CRITICAL, args);
 	va_end(args);
 }
 //---------------------------------------------------------------------------
 
-void CMfmLog::LogArgs(CPort* pPort, LPCWSTR szFormat, LPCWSTR szType, va_list args)
+void CMfmLog::LogArgs(CPort* pPort, LPCWSTR szFormat, int nType, va_list args)
 {
-	WCHAR* szBuf1 = new WCHAR[MAXLOGLINE];
-	WCHAR* szBuf2 = new WCHAR[MAXLOGLINE];
-
-	vswprintf_s(szBuf1, MAXLOGLINE, szFormat, args);
-	swprintf_s(szBuf2, MAXLOGLINE, L"%s: %s", pPort->PortName(), szBuf1);
-
-	Log(szType, szBuf2);
+	if (m_nLogFormat == LOGFORMAT_BINARY)
+		PostBinary(pPort, szFormat, nType, args);
+	else
+		PostText(pPort, szFormat, nType, args);
+}
+//---------------------------------------------------------------------------
 
-	delete[] szBuf1;
-	delete[] szBuf2;
+void CMfmLog::LogArgs(LPCWSTR szFormat, int nType, va_list args)
+{
+	LogArgs(NULL, szFormat, nType, args);
 }
 //---------------------------------------------------------------------------
 
-void CMfmLog::LogArgs(LPCWSTR szFormat, LPCWSTR szType, va_list args)
+void CMfmLog::Replay(CPort* pPort, ULONGLONG ullTime, LPCWSTR szFormat, const BYTE* pArgs, DWORD cbArgs)
 {
-	WCHAR* szMessage = new WCHAR[MAXLOGLINE];
+	CHECK_LEVEL(LOGLEVEL_ERRORS);
+
+	LPLOGRECORD pRecord;
+
+	if (m_nLogFormat == LOGFORMAT_BINARY)
+	{
+		DefinePort(pPort);
+
+		if ((pRecord = AllocRecord()) == NULL)
+			return;
+
+		//arguments are already packed
+		LPBYTE pData = reinterpret_cast<LPBYTE>(pRecord->szText);
+		size_t cb = BLOG_MSGHDRLEN - 1;
 
-	vswprintf_s(szMessage, MAXLOGLINE, szFormat, args);
-	Log(szType, szMessage);
+		if (cbArgs > sizeof(pRecord->szText) - cb)
+			cbArgs = 0;
 
-	delete[] szMessage;
+		memcpy(pData + cb, pArgs, cbArgs);
+		PostBinary(pRecord, pPort, ullTime, szFormat, BLOG_TYPE_DEBUG, cb + cbArgs);
+	}
+	else
+	{
+		if ((pRecord = AllocRecord()) == NULL)
+			return;
+
+		//the line shows when the event happened, not when it is written
+		FILETIME ft;
+		FILETIME ftLocal;
+		SYSTEMTIME st;
+		ULARGE_INTEGER uli;
+
+		uli.QuadPart = ullTime;
+		ft.dwLowDateTime = uli.LowPart;
+		ft.dwHighDateTime = uli.HighPart;
+		FileTimeToLocalFileTime(&ft, &ftLocal);
+		FileTimeToSystemTime(&ftLocal, &st);
+
+		int len = TextPrefix(pRecord->szText, &st, pPort, BLOG_TYPE_DEBUG);
+		len += static_cast<int>(BlogFormat(pRecord->szText + len, MAXLOGLINE - 2 - len, szFormat, pArgs, cbArgs));
+
+		PostText(pRecord, len);
+	}
 }
 //---------------------------------------------------------------------------
 
-void CMfmLog::Log(LPCWSTR szType, LPCWSTR szMessage)
+void CMfmLog::PostText(CPort* pPort, LPCWSTR szFormat, int nType, va_list args)
 {
+	LPLOGRECORD pRecord = AllocRecord();
+
+	if (!pRecord)
+		return;
+
 	SYSTEMTIME st;
-	DWORD wri;
-	const DWORD MAXLOGSIZE = 10 * 1024 * 1024;
+	LPWSTR szText = pRecord->szText;
+	const int cchMax = MAXLOGLINE - 2; //room for CR LF
 
 	GetLocalTime(&st);
 
-	int len = swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer),
-		L"%02i-%02i-%04i %02i:%02i:%02i.%03i  [%s] %s\r\n",
-		st.wDay, st.wMonth, st.wYear,
-		st.wHour, st.wMinute, st.wSecond, st.wMilliseconds,
-		szType,
-		szMessage
+	//the whole line is composed straight into the record
+	int len = TextPrefix(szText, &st, pPort, nType);
+
+	if (_vsnwprintf_s(szText + len, cchMax - len, _TRUNCATE, szFormat, args) < 0)
+		len = cchMax - 1; //truncated
+	else
+		len += static_cast<int>(wcslen(szText + len));
+
+	PostText(pRecord, len);
+}
+//---------------------------------------------------------------------------
+
+int CMfmLog::TextPrefix(LPWSTR szText, const SYSTEMTIME* pst, CPort* pPort, int nType)
+{
+	const int cchMax = MAXLOGLINE - 2;
+
+	int len = swprintf_s(szText, cchMax,
+		L"%02i-%02i-%04i %02i:%02i:%02i.%03i  [%s] ",
+		pst->wDay, pst->wMonth, pst->wYear,
+		pst->wHour, pst->wMinute, pst->wSecond, pst->wMilliseconds,
+		szTypeNames[nType]
 	);
 
-	if (len > 0)
+	if (pPort)
+		len += swprintf_s(szText + len, cchMax - len, L"%s: ", pPort->PortName());
+
+	return len;
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::PostText(LPLOGRECORD pRecord, int len)
+{
+	pRecord->szText[len++] = L'\r';
+	pRecord->szText[len++] = L'\n';
+
+	pRecord->nFormat = LOGFORMAT_TEXT;
+	pRecord->cbData = len * sizeof(WCHAR);
+	pRecord->szFormat = NULL;
+
+	Post(pRecord);
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::PostBinary(CPort* pPort, LPCWSTR szFormat, int nType, va_list args)
+{
+	DefinePort(pPort);
+
+	LPLOGRECORD pRecord = AllocRecord();
+
+	if (!pRecord)
+		return;
+
+	//no formatting here: timestamp, ids and raw arguments
+	LPBYTE pData = reinterpret_cast<LPBYTE>(pRecord->szText);
+	ULARGE_INTEGER uli;
+	FILETIME ft;
+
+	GetSystemTimeAsFileTime(&ft);
+	uli.LowPart = ft.dwLowDateTime;
+	uli.HighPart = ft.dwHighDateTime;
+
+	size_t cb = BLOG_MSGHDRLEN - 1;
+	cb += BlogPackArgs(pData + cb, sizeof(pRecord->szText) - cb, szFormat, args);
+
+	PostBinary(pRecord, pPort, uli.QuadPart, szFormat, nType, cb);
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::PostBinary(LPLOGRECORD pRecord, CPort* pPort, ULONGLONG ullTime, LPCWSTR szFormat, int nType, size_t cb)
+{
+	LPBYTE pData = reinterpret_cast<LPBYTE>(pRecord->szText);
+
+	BlogPutU16(pData, static_cast<unsigned int>(cb));
+	pData[2] = BLOG_REC_MESSAGE;
+	pData[3] = static_cast<BYTE>(nType);
+	BlogPutU64(pData + BLOG_HDRLEN, ullTime);
+	BlogPutU16(pData + BLOG_HDRLEN + 8, pPort ? pPort->LogId() : 0);
+	BlogPutU16(pData + BLOG_FORMATOFFSET, 0);
+
+	pRecord->nFormat = LOGFORMAT_BINARY;
+	pRecord->cbData = static_cast<DWORD>(cb);
+	pRecord->szFormat = szFormat;
+
+	Post(pRecord);
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::DefinePort(CPort* pPort)
+{
+	LPLOGRECORD pRecord;
+
+	//the first message of a port tells the writer its name
+	if (pPort && pPort->ClaimLogDefinition() && (pRecord = AllocRecord()) != NULL)
+	{
+		pRecord->nFormat = LOGFORMAT_BINARY;
+		pRecord->cbData = static_cast<DWORD>(BlogDefinition(reinterpret_cast<LPBYTE>(pRecord->szText),
+			sizeof(pRecord->szText), BLOG_REC_PORT, pPort->LogId(), pPort->PortName()));
+		pRecord->szFormat = NULL;
+
+		Post(pRecord);
+	}
+}
+//---------------------------------------------------------------------------
+
+CMfmLog::LPLOGRECORD CMfmLog::AllocRecord()
+{
+	PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&m_free);
+
+	if (pEntry)
+		return reinterpret_cast<LPLOGRECORD>(pEntry);
+
+	//pool exhausted by a burst: extra records are given back by the writer
+	return static_cast<LPLOGRECORD>(_aligned_malloc(sizeof(LOGRECORD), MEMORY_ALLOCATION_ALIGNMENT));
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::FreeRecord(LPLOGRECORD pRecord)
+{
+	if (QueryDepthSList(&m_free) < LOGPOOLSIZE)
+		InterlockedPushEntrySList(&m_free, &pRecord->entry);
+	else
+		_aligned_free(pRecord);
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::Post(LPLOGRECORD pRecord)
+{
+	//the writer empties the list every time it wakes up, so it needs
+	//a signal only when the first record of a new batch comes in
+	if (InterlockedPushEntrySList(&m_pending, &pRecord->entry) == NULL)
+		SetEvent(m_hWork);
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::WriteRecords(PSLIST_ENTRY pList)
+{
+	//the list comes newest first, put it back in chronological order
+	PSLIST_ENTRY pFirst = NULL;
+
+	while (pList)
+	{
+		PSLIST_ENTRY pNext = pList->Next;
+		pList->Next = pFirst;
+		pFirst = pList;
+		pList = pNext;
+	}
+
+	while (pFirst)
 	{
-		EnterCriticalSection(&m_CSLog);
+		LPLOGRECORD pRecord = reinterpret_cast<LPLOGRECORD>(pFirst);
+		LPBYTE pData = reinterpret_cast<LPBYTE>(pRecord->szText);
+
+		pFirst = pFirst->Next;
 
-		DWORD dwSize, dwSizeHigh;
-		dwSize = GetFileSize(m_hLogFile, &dwSizeHigh);
-		if (dwSize >= MAXLOGSIZE || dwSizeHigh > 0)
+		if (pRecord->nFormat == LOGFORMAT_BINARY && pData[2] == BLOG_REC_PORT)
+			RememberPort(pData);
+
+		//only the writer thread touches the file, no lock needed
+		if (EnsureFile(pRecord->nFormat))
 		{
-			RotateLogs();
-			if (!CreateLogFile())
-				goto LExit;
+			if (pRecord->szFormat)
+				BlogPutU16(pData + BLOG_FORMATOFFSET, FormatId(pRecord->szFormat));
+
+			Append(pData, pRecord->cbData);
 		}
 
-		WriteFile(m_hLogFile, m_szBuffer, len * sizeof(WCHAR), &wri, NULL);
+		FreeRecord(pRecord);
+	}
+
+	FlushBatch();
+}
+//---------------------------------------------------------------------------
+
+BOOL CMfmLog::EnsureFile(DWORD nFormat)
+{
+	if (m_hLogFile != INVALID_HANDLE_VALUE &&
+		nFormat == m_nFileFormat &&
+		m_ullLogSize + m_cbBatch < LOGMAXSIZE)
+	{
+		return TRUE;
+	}
+
+	FlushBatch();
+
+	if (nFormat != m_nFileFormat)
+	{
+		//format changed: go on with the other file
+		if (m_hLogFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hLogFile);
+			m_hLogFile = INVALID_HANDLE_VALUE;
+		}
+
+		m_nFileFormat = nFormat;
+	}
+	else if (m_hLogFile != INVALID_HANDLE_VALUE)
+		RotateLogs();
+
+	if (!CreateLogFile())
+		return FALSE;
+
+	if (m_nFileFormat == LOGFORMAT_BINARY)
+	{
+		//every file must be readable on its own: define again what we know
+		ZeroMemory(m_formatKeys, sizeof(m_formatKeys));
+		m_nFormats = 0;
+
+		for (LPLOGPORTDEF pDef = m_pPortDefs; pDef; pDef = pDef->pNext)
+			Append(m_scratch, static_cast<DWORD>(BlogDefinition(m_scratch, sizeof(m_scratch),
+				BLOG_REC_PORT, pDef->nId, pDef->szName)));
+	}
+
+	return TRUE;
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::Append(LPCVOID pData, DWORD cbData)
+{
+	if (m_cbBatch + cbData > LOGBATCHSIZE)
+		FlushBatch();
+
+	memcpy(m_pBatch + m_cbBatch, pData, cbData);
+	m_cbBatch += cbData;
+}
+//---------------------------------------------------------------------------
+
+void CMfmLog::FlushBatch()
+{
+	DWORD wri;
+
+	if (m_cbBatch == 0)
+		return;
+
+	if (m_hLogFile != INVALID_HANDLE_VALUE &&
+		WriteFile(m_hLogFile, m_pBatch, m_cbBatch, &wri, NULL))
+	{
+		m_ullLogSize += wri;
 		m_bFlushNeeded = TRUE;
+	}
+
+	m_cbBatch = 0;
+}
+//---------------------------------------------------------------------------
+
+WORD CMfmLog::FormatId(LPCWSTR szFormat)
+{
+	//format strings are literals: their address identifies them
+	if (m_nFormats >= LOGFORMATSLOTS / 2)
+	{
+		//too many, start over; new definitions replace the old ones
+		ZeroMemory(m_formatKeys, sizeof(m_formatKeys));
+		m_nFormats = 0;
+	}
+
+	size_t slot = (reinterpret_cast<ULONG_PTR>(szFormat) >> 1) % LOGFORMATSLOTS;
+
+	while (m_formatKeys[slot] && m_formatKeys[slot] != szFormat)
+		slot = (slot + 1) % LOGFORMATSLOTS;
+
+	if (!m_formatKeys[slot])
+	{
+		m_formatKeys[slot] = szFormat;
+		m_formatIds[slot] = ++m_nFormats;
+
+		Append(m_scratch, static_cast<DWORD>(BlogDefinition(m_scratch, sizeof(m_scratch),
+			BLOG_REC_FORMAT, m_nFormats, szFormat)));
+	}
+
+	return m_formatIds[slot];
+}
+//---------------------------------------------------------------------------
 
-	LExit:
-		LeaveCriticalSection(&m_CSLog);
+void CMfmLog::RememberPort(const BYTE* pRecord)
+{
+	WORD nId = static_cast<WORD>(BlogGetU16(pRecord + BLOG_HDRLEN));
+	DWORD cch = BlogGetU16(pRecord + BLOG_HDRLEN + 2);
+	LPLOGPORTDEF pDef;
+
+	for (pDef = m_pPortDefs; pDef; pDef = pDef->pNext)
+		if (pDef->nId == nId)
+			break;
+
+	if (!pDef)
+	{
+		pDef = new LOGPORTDEF;
+		pDef->nId = nId;
+		pDef->szName = NULL;
+		pDef->pNext = m_pPortDefs;
+		m_pPortDefs = pDef;
 	}
+
+	delete[] pDef->szName;
+	pDef->szName = new WCHAR[cch + 1];
+	memcpy(pDef->szName, pRecord + BLOG_HDRLEN + 4, cch * sizeof(WCHAR));
+	pDef->szName[cch] = L'\0';
 }
 //---------------------------------------------------------------------------
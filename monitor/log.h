@@ -19,9 +19,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#include "../common/blog.h"
 
 #define MAXLOGLINE 8192
+#define LOGMAXSIZE (10 * 1024 * 1024)	//rotate when the log grows past this
+#define LOGBATCHSIZE (64 * 1024)		//bytes written at once by the writer thread
+#define LOGPOOLSIZE 32					//records kept for reuse
+#define LOGFORMATSLOTS 1024				//format strings known to the current binary log
+
+#define LOGFORMAT_TEXT		0	//UTF-16 text, mfilemon.log
+#define LOGFORMAT_BINARY	1	//packed records, mfilemon.blog, see common\blog.h
+#define LOGFORMAT_MIN		LOGFORMAT_TEXT
+#define LOGFORMAT_MAX		LOGFORMAT_BINARY
 
 #define LOGLEVEL_NONE		0
 #define LOGLEVEL_ERRORS		1
@@ -32,22 +44,69 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 class CPort;
 
+/*
+*  CMfmLog
+*  callers format their line into a pooled record and push it on a lock-free
+*  list; a single writer thread collects the records, batches them into large
+*  writes and takes care of rotation. No lock is taken and no system call is
+*  made on the logging thread (but for the occasional wake up of the writer).
+*  In binary format the caller doesn't even format the line: it stores the
+*  raw arguments, and the format string is written once per file, so format
+*  strings must be literals (they are referenced until the writer gets to them).
+*/
+
 class CMfmLog
 {
+private:
+	typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) tagLOGRECORD
+	{
+		SLIST_ENTRY entry;	//must be first
+		DWORD nFormat;		//LOGFORMAT_xxx
+		DWORD cbData;
+		LPCWSTR szFormat;	//binary messages: format string, the id is assigned by the writer
+		WCHAR szText[MAXLOGLINE];
+	} LOGRECORD, *LPLOGRECORD;
+
+	typedef struct tagLOGPORTDEF
+	{
+		WORD nId;
+		LPWSTR szName;
+		tagLOGPORTDEF* pNext;
+	} LOGPORTDEF, *LPLOGPORTDEF;
+
 public:
 	CMfmLog();
 	virtual ~CMfmLog();
 
 protected:
-	void LogArgs(CPort* pPort, LPCWSTR szFormat, LPCWSTR szType, va_list args);
-	void LogArgs(LPCWSTR szFormat, LPCWSTR szType, va_list args);
-	void Log(LPCWSTR szType, LPCWSTR szMessage);
+	void LogArgs(CPort* pPort, LPCWSTR szFormat, int nType, va_list args);
+	void LogArgs(LPCWSTR szFormat, int nType, va_list args);
 	BOOL CreateLogFile();
 	void RotateLogs();
 
+private:
+	LPLOGRECORD AllocRecord();
+	void FreeRecord(LPLOGRECORD pRecord);
+	void Post(LPLOGRECORD pRecord);
+	void PostText(CPort* pPort, LPCWSTR szFormat, int nType, va_list args);
+	void PostText(LPLOGRECORD pRecord, int len);
+	int TextPrefix(LPWSTR szText, const SYSTEMTIME* pst, CPort* pPort, int nType);
+	void PostBinary(CPort* pPort, LPCWSTR szFormat, int nType, va_list args);
+	void PostBinary(LPLOGRECORD pRecord, CPort* pPort, ULONGLONG ullTime, LPCWSTR szFormat, int nType, size_t cb);
+	void DefinePort(CPort* pPort);
+	void WriteRecords(PSLIST_ENTRY pList);
+	BOOL EnsureFile(DWORD nFormat);
+	void Append(LPCVOID pData, DWORD cbData);
+	void FlushBatch();
+	WORD FormatId(LPCWSTR szFormat);
+	void RememberPort(const BYTE* pRecord);
+	LPCWSTR FileName(int n, LPWSTR szPath, size_t cchPath) const;
+
 public:
 	void SetLogLevel(DWORD nLevel);
 	DWORD GetLogLevel() const { return m_nLogLevel; }
+	void SetLogFormat(DWORD nFormat);
+	DWORD GetLogFormat() const { return m_nLogFormat; }
 
 	void Always(LPCWSTR szFormat, ...);
 	void Debug(LPCWSTR szFormat, ...);
@@ -65,16 +124,30 @@ public:
 	void Error(CPort* pPort, LPCWSTR szFormat, ...);
 	void Critical(CPort* pPort, LPCWSTR szFormat, ...);
 
+	void Replay(CPort* pPort, ULONGLONG ullTime, LPCWSTR szFormat, const BYTE* pArgs, DWORD cbArgs);
+
 private:
+	SLIST_HEADER m_pending;
+	SLIST_HEADER m_free;
 	DWORD m_nLogLevel;
+	DWORD m_nLogFormat;
 	HANDLE m_hLogFile;
 	HANDLE m_hStop;
+	HANDLE m_hWork;
 	HANDLE m_hThread;
-	WCHAR m_szBuffer[MAXLOGLINE];
-	CRITICAL_SECTION m_CSLog;
+	ULONGLONG m_ullLogSize;
+	LPBYTE m_pBatch;
+	DWORD m_cbBatch;
 	BOOL m_bFlushNeeded;
-
-	static DWORD WINAPI FlushThread(LPVOID pParam);
+	//the following are owned by the writer thread
+	DWORD m_nFileFormat;
+	LPCWSTR m_formatKeys[LOGFORMATSLOTS];
+	WORD m_formatIds[LOGFORMATSLOTS];
+	WORD m_nFormats;
+	LPLOGPORTDEF m_pPortDefs;
+	BYTE m_scratch[BLOG_MAXRECORD];
+
+	static DWORD WINAPI WriterThread(LPVOID pParam);
 };
 
 extern CMfmLog* g_pLog;
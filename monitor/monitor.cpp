@@ -22,11 +22,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "pattern.h"
 #include "portlist.h"
 #include "log.h"
-#include "..\common\autoclean.h"
-#include "..\common\monutils.h"
-#include "..\common\config.h"
-#include "..\common\defs.h"
+#include "printercache.h"
+#include "strtable.h"
+#include "tokencache.h"
+#include "trace.h"
+#include "writerpool.h"
+#include "../common/autoclean.h"
+#include "../common/cfgtlv.h"
+#include "../common/monutils.h"
+#include "../common/config.h"
+#include "../common/defs.h"
+#ifdef _WIN32
 #include <VersionHelpers.h>
+#endif
 
 //-------------------------------------------------------------------------------------
 typedef struct tagXCVDATA
@@ -37,6 +45,11 @@ typedef struct tagXCVDATA
 		bDeleting = FALSE;
 		GrantedAccess = 0;
 	}
+	~tagXCVDATA()
+	{
+		if (pPort)
+			pPort->Release();
+	}
 	CPort* pPort;
 	BOOL bDeleting;
 	ACCESS_MASK GrantedAccess;
@@ -57,7 +70,8 @@ BOOL WINAPI MfmOpenPort(HANDLE hMonitor, LPWSTR pName, PHANDLE pHandle)
 
 	g_pLog->Debug(L"MfmOpenPort called (%s)", pName);
 
-	CPort* pPort = g_pPortList->FindPort(pName);
+	//the handle pins the port: a DeletePort while jobs run on it frees it at MfmClosePort
+	CPort* pPort = g_pPortList->PinPort(pName);
 	*pHandle = static_cast<HANDLE>(pPort);
 	if (!pPort)
 	{
@@ -66,23 +80,8 @@ BOOL WINAPI MfmOpenPort(HANDLE hMonitor, LPWSTR pName, PHANDLE pHandle)
 		return FALSE;
 	}
 
-	DWORD dwErr;
-	if ((dwErr = pPort->Logon()) != ERROR_SUCCESS)
-	{
-		g_pLog->Critical(L"MfmOpenPort: can't logon user");
-		SetLastError(dwErr);
-		return FALSE;
-	}
-
-	//2009-05-14 we'd better create missing directories rather than giving up..
-	//	else if (!DirectoryExists(pPort->szOutputPath))
-	DWORD dwRet;
-	if ((dwRet = pPort->CreateOutputPath()) != ERROR_SUCCESS)
-	{
-		g_pLog->Critical(L"MfmOpenPort: can't create output directory (%i)", dwRet);
-		SetLastError(ERROR_DIRECTORY);
-		return FALSE;
-	}
+	//a port may be opened long before it prints: logon, output path and
+	//patterns wait for the first job (see CPort::Materialize)
 
 	g_pLog->Debug(L"MfmOpenPort returning TRUE (%s)", pName);
 
@@ -105,14 +104,25 @@ BOOL WINAPI MfmStartDocPort(HANDLE hPort, LPWSTR pPrinterName, DWORD JobId,
 	CPort* pPort = static_cast<CPort*>(hPort);
 	DOC_INFO_1W* pdi = reinterpret_cast<DOC_INFO_1W*>(pDocInfo);
 
-	g_pLog->Debug(L"MfmStartDocPort called (%s)", pPort->PortName());
+	g_pLog->Debug(pPort, L"MfmStartDocPort called");
+
+	//spans and timings of the three job calls include the wait for the job lock
+	CTraceSpan span("StartDocPort", pPort);
+	ULONGLONG ullStart = CPortStats::Now();
+
+	CAutoCriticalSection acs(pPort->GetJobCriticalSection());
 
-	CAutoCriticalSection acs(g_pPortList->GetCriticalSection());
+	//a new job starts with an empty trace
+	pPort->FlightRecorder().Reset();
+	pPort->Stats().Count(STAT_JOBS);
 
 	/*set initial job data*/
 	if (!pPort->StartJob(JobId, pdi->pDocName, pPrinterName))
 	{
 		g_pLog->Critical(L"MfmStartDocPort: can't start print job");
+		pPort->FlightRecorder().Dump(pPort, L"job not started");
+		pPort->Stats().Count(STAT_FAILURES);
+		pPort->Stats().Time(HIST_STARTDOC, ullStart);
 		SetLastError(ERROR_CAN_NOT_COMPLETE);
 		return FALSE;
 	}
@@ -122,11 +132,16 @@ BOOL WINAPI MfmStartDocPort(HANDLE hPort, LPWSTR pPrinterName, DWORD JobId,
 	if ((res = pPort->CreateOutputFile()) != 0)
 	{
 		g_pLog->Critical(L"MfmStartDocPort: can't create output file");
+		pPort->FlightRecorder().Dump(pPort, L"output file not created");
+		pPort->Stats().Count(STAT_FAILURES);
+		pPort->Stats().Time(HIST_STARTDOC, ullStart);
 		SetLastError(res);
 		return FALSE;
 	}
 	
-	g_pLog->Debug(L"MfmStartDocPort returning TRUE (%s)", pPort->PortName());
+	pPort->Stats().Time(HIST_STARTDOC, ullStart);
+
+	g_pLog->Debug(pPort, L"MfmStartDocPort returning TRUE");
 
 	return TRUE;
 }
@@ -144,24 +159,28 @@ BOOL WINAPI MfmWritePort(HANDLE hPort, LPBYTE pBuffer,
 
 	CPort* pPort = static_cast<CPort*>(hPort);
 
-	g_pLog->Debug(L"MfmWritePort called (%s)", pPort->PortName());
+	g_pLog->Debug(pPort, L"MfmWritePort called (%u bytes)", cbBuf);
+
+	CTraceSpan span("WritePort", pPort, cbBuf);
+	ULONGLONG ullStart = CPortStats::Now();
 
-	CAutoCriticalSection acs(g_pPortList->GetCriticalSection());
+	CAutoCriticalSection acs(pPort->GetJobCriticalSection());
 
 	/*write was unsuccessful, tell the spooler to restart and pause job*/
 	if (!pPort->WriteToFile(pBuffer, cbBuf, pcbWritten))
 	{
 		g_pLog->Error(L"MfmWritePort: can't write to output file");
+		pPort->FlightRecorder().Dump(pPort, L"write failed");
+		pPort->Stats().Count(STAT_FAILURES);
 
-		HANDLE hPrinter;
+		CCachedPrinter printer(pPort->PrinterName());
 
-		if (OpenPrinterW(pPort->PrinterName(), &hPrinter, NULL))
+		if (printer.Handle())
 		{
 			g_pLog->Error(L"MfmWritePort: pausing job %u on %s",
 				pPort->JobId(), pPort->PrinterName());
-			SetJobW(hPrinter, pPort->JobId(), 0, NULL, JOB_CONTROL_RESTART);
-			SetJobW(hPrinter, pPort->JobId(), 0, NULL, JOB_CONTROL_PAUSE);
-			ClosePrinter(hPrinter);
+			printer.SetJob(pPort->JobId(), JOB_CONTROL_RESTART);
+			printer.SetJob(pPort->JobId(), JOB_CONTROL_PAUSE);
 		}
 		else
 		{
@@ -169,10 +188,15 @@ BOOL WINAPI MfmWritePort(HANDLE hPort, LPBYTE pBuffer,
 				pPort->JobId(), pPort->PrinterName());
 		}
 
+		pPort->Stats().Time(HIST_WRITE, ullStart);
+
 		return FALSE;
 	}
 
-	g_pLog->Debug(L"MfmWritePort returning TRUE (%s)", pPort->PortName());
+	pPort->Stats().Count(STAT_BYTES, *pcbWritten);
+	pPort->Stats().Time(HIST_WRITE, ullStart);
+
+	g_pLog->Debug(pPort, L"MfmWritePort returning TRUE");
 
 	return TRUE;
 }
@@ -203,13 +227,24 @@ BOOL WINAPI MfmEndDocPort(HANDLE hPort)
 
 	CPort* pPort = static_cast<CPort*>(hPort);
 
-	g_pLog->Debug(L"MfmEndDocPort called (%s)", pPort->PortName());
+	g_pLog->Debug(pPort, L"MfmEndDocPort called");
+
+	CTraceSpan span("EndDocPort", pPort);
+	ULONGLONG ullStart = CPortStats::Now();
 
-	CAutoCriticalSection acs(g_pPortList->GetCriticalSection());
+	CAutoCriticalSection acs(pPort->GetJobCriticalSection());
 
 	BOOL bRet = pPort->EndJob();
 
-	g_pLog->Debug(L"MfmEndDocPort returning %s (%s)", bRet ? L"TRUE" : L"FALSE", pPort->PortName());
+	pPort->Stats().Time(HIST_ENDDOC, ullStart);
+
+	g_pLog->Debug(pPort, L"MfmEndDocPort returning %s", bRet ? L"TRUE" : L"FALSE");
+
+	if (!bRet)
+	{
+		pPort->FlightRecorder().Dump(pPort, L"job not completed");
+		pPort->Stats().Count(STAT_FAILURES);
+	}
 
 	return bRet;
 }
@@ -217,7 +252,22 @@ BOOL WINAPI MfmEndDocPort(HANDLE hPort)
 //-------------------------------------------------------------------------------------
 BOOL WINAPI MfmClosePort(HANDLE hPort)
 {
-	UNREFERENCED_PARAMETER(hPort);
+	CPort* pPort = static_cast<CPort*>(hPort);
+
+	if (!pPort)
+		return TRUE;
+
+	{
+		//the printer name belongs to the job, StartJob replaces it
+		CAutoCriticalSection acs(pPort->GetJobCriticalSection());
+
+		//the printer may be going away, don't keep it open on its behalf
+		if (pPort->PrinterName())
+			g_pPrinterCache->Discard(pPort->PrinterName());
+	}
+
+	//the reference taken by MfmOpenPort
+	pPort->Release();
 
 	return TRUE;
 }
@@ -236,7 +286,7 @@ BOOL WINAPI MfmXcvOpenPort(HANDLE hMonitor, LPCWSTR pszObject,
 	*phXcv = static_cast<HANDLE>(pXCVDATA);
 
 	if (pszObject)
-		pXCVDATA->pPort = g_pPortList->FindPort(pszObject);
+		pXCVDATA->pPort = g_pPortList->PinPort(pszObject);
 
 	pXCVDATA->GrantedAccess = GrantedAccess;
 
@@ -264,8 +314,13 @@ DWORD WINAPI MfmXcvDataPort(HANDLE hXcv, LPCWSTR pszDataName, PBYTE pInputData,
 					pXCVDATA->GrantedAccess);
 				return ERROR_ACCESS_DENIED;
 			}
-			pXCVDATA->pPort = new CPort(reinterpret_cast<LPCWSTR>(pInputData));
-			g_pPortList->AddMfmPort(pXCVDATA->pPort);
+			//one reference for the list, one for this handle
+			CPort* pPort = new CPort(reinterpret_cast<LPCWSTR>(pInputData));
+			pPort->AddRef();
+			if (pXCVDATA->pPort)
+				pXCVDATA->pPort->Release();
+			pXCVDATA->pPort = pPort;
+			g_pPortList->AddMfmPort(pPort);
 			g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
 			return ERROR_SUCCESS;
 		}
@@ -354,9 +409,15 @@ DWORD WINAPI MfmXcvDataPort(HANDLE hXcv, LPCWSTR pszDataName, PBYTE pInputData,
 					pXCVDATA->GrantedAccess);
 				return ERROR_ACCESS_DENIED;
 			}
-			LPPORTCONFIG ppc = reinterpret_cast<LPPORTCONFIG>(pInputData);
+			//the old layout has no archive settings: they keep their value
+			LPPORTCONFIG2 ppc = new PORTCONFIG2;
+			pXCVDATA->pPort->GetConfig(ppc);
+			CopyMemory(ppc, pInputData, sizeof(PORTCONFIG));
 			pXCVDATA->pPort->SetConfig(ppc);
-			g_pPortList->SaveToRegistry();
+			SecureZeroMemory(ppc->szPassword, sizeof(ppc->szPassword));
+			delete ppc;
+			//only what changed, and without holding up the other ports
+			g_pPortList->SaveToRegistry(pXCVDATA->pPort);
 			g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
 			return ERROR_SUCCESS;
 		}
@@ -364,6 +425,93 @@ DWORD WINAPI MfmXcvDataPort(HANDLE hXcv, LPCWSTR pszDataName, PBYTE pInputData,
 			pXCVDATA, (pXCVDATA ? pXCVDATA->pPort : NULL), pInputData);
 		return ERROR_BAD_ARGUMENTS;
 	}
+	else if (wcscmp(pszDataName, L"SetConfigEx") == 0)
+	{
+		//tagged settings (see cfgtlv.h); the ones left out keep their value
+		if (pXCVDATA != NULL && pXCVDATA->pPort != NULL && pInputData != NULL)
+		{
+			if (!(pXCVDATA->GrantedAccess & SERVER_ACCESS_ADMINISTER))
+			{
+				g_pLog->Critical(L"MfmXcvDataPort returning ERROR_ACCESS_DENIED (pXCVDATA->GrantedAccess = %X)",
+					pXCVDATA->GrantedAccess);
+				return ERROR_ACCESS_DENIED;
+			}
+			LPPORTCONFIG2 ppc = new PORTCONFIG2;
+			pXCVDATA->pPort->GetConfig(ppc);
+			DWORD dwRet = ERROR_INVALID_DATA;
+			if (DecodePortConfig(pInputData, cbInputData, ppc))
+			{
+				pXCVDATA->pPort->SetConfig(ppc);
+				g_pPortList->SaveToRegistry(pXCVDATA->pPort);
+				dwRet = ERROR_SUCCESS;
+			}
+			SecureZeroMemory(ppc->szPassword, sizeof(ppc->szPassword));
+			delete ppc;
+			g_pLog->Debug(L"MfmXcvDataPort returning %u", dwRet);
+			return dwRet;
+		}
+		g_pLog->Critical(L"MfmXcvDataPort: bad arguments (pXCVDATA = %X pXCVDATA->pPort = %X pInputData = %X)",
+			pXCVDATA, (pXCVDATA ? pXCVDATA->pPort : NULL), pInputData);
+		return ERROR_BAD_ARGUMENTS;
+	}
+	else if (wcscmp(pszDataName, L"GetConfigEx") == 0)
+	{
+		if (pXCVDATA != NULL && pXCVDATA->pPort != NULL && pcbOutputNeeded != NULL)
+		{
+			LPPORTCONFIG2 ppc = new PORTCONFIG2;
+			pXCVDATA->pPort->GetConfig(ppc);
+			*pcbOutputNeeded = EncodePortConfig(ppc, pOutputData, cbOutputData);
+			SecureZeroMemory(ppc->szPassword, sizeof(ppc->szPassword));
+			delete ppc;
+			if (pOutputData == NULL || *pcbOutputNeeded > cbOutputData)
+			{
+				g_pLog->Warn(L"MfmXcvDataPort returning ERROR_INSUFFICIENT_BUFFER");
+				return ERROR_INSUFFICIENT_BUFFER;
+			}
+			g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
+			return ERROR_SUCCESS;
+		}
+		g_pLog->Critical(L"MfmXcvDataPort: bad arguments (pXCVDATA = %X pXCVDATA->pPort = %X)",
+			pXCVDATA, (pXCVDATA ? pXCVDATA->pPort : NULL));
+		return ERROR_BAD_ARGUMENTS;
+	}
+	else if (wcscmp(pszDataName, L"AddPorts") == 0 || wcscmp(pszDataName, L"SetConfigs") == 0)
+	{
+		//a whole batch of ports (see cfgsnap.h), validated first and saved at once
+		if (pXCVDATA != NULL && pInputData != NULL)
+		{
+			if (!(pXCVDATA->GrantedAccess & SERVER_ACCESS_ADMINISTER))
+			{
+				g_pLog->Critical(L"MfmXcvDataPort returning ERROR_ACCESS_DENIED (pXCVDATA->GrantedAccess = %X)",
+					pXCVDATA->GrantedAccess);
+				return ERROR_ACCESS_DENIED;
+			}
+			DWORD dwRet = g_pPortList->ApplyConfigs(pInputData, cbInputData,
+				wcscmp(pszDataName, L"AddPorts") == 0);
+			g_pLog->Debug(L"MfmXcvDataPort returning %u", dwRet);
+			return dwRet;
+		}
+		g_pLog->Critical(L"MfmXcvDataPort: bad arguments (pXCVDATA = %X pInputData = %X)", pXCVDATA, pInputData);
+		return ERROR_BAD_ARGUMENTS;
+	}
+	else if (wcscmp(pszDataName, L"GetConfigs") == 0)
+	{
+		//every port in one batch; passwords are in it, so administrators only
+		if (pXCVDATA != NULL && pcbOutputNeeded != NULL)
+		{
+			if (!(pXCVDATA->GrantedAccess & SERVER_ACCESS_ADMINISTER))
+			{
+				g_pLog->Critical(L"MfmXcvDataPort returning ERROR_ACCESS_DENIED (pXCVDATA->GrantedAccess = %X)",
+					pXCVDATA->GrantedAccess);
+				return ERROR_ACCESS_DENIED;
+			}
+			DWORD dwRet = g_pPortList->GetConfigs(pOutputData, cbOutputData, pcbOutputNeeded);
+			g_pLog->Debug(L"MfmXcvDataPort returning %u", dwRet);
+			return dwRet;
+		}
+		g_pLog->Critical(L"MfmXcvDataPort: bad arguments (pXCVDATA = %X)", pXCVDATA);
+		return ERROR_BAD_ARGUMENTS;
+	}
 	else if (wcscmp(pszDataName, L"GetConfig") == 0)
 	{
 		*pcbOutputNeeded = sizeof(PORTCONFIG);
@@ -374,21 +522,11 @@ DWORD WINAPI MfmXcvDataPort(HANDLE hXcv, LPCWSTR pszDataName, PBYTE pInputData,
 		}
 		if (pXCVDATA != NULL && pXCVDATA->pPort != NULL && pOutputData != NULL)
 		{
-			LPPORTCONFIG ppc = reinterpret_cast<LPPORTCONFIG>(pOutputData);
-			wcscpy_s(ppc->szPortName, LENGTHOF(ppc->szPortName), pXCVDATA->pPort->PortName());
-			wcscpy_s(ppc->szOutputPath, LENGTHOF(ppc->szOutputPath), pXCVDATA->pPort->OutputPath());
-			wcscpy_s(ppc->szFilePattern, LENGTHOF(ppc->szFilePattern), pXCVDATA->pPort->FilePattern());
-			ppc->bOverwrite = pXCVDATA->pPort->Overwrite();
-			wcscpy_s(ppc->szUserCommandPattern, LENGTHOF(ppc->szUserCommandPattern), pXCVDATA->pPort->UserCommandPattern());
-			wcscpy_s(ppc->szExecPath, LENGTHOF(ppc->szExecPath), pXCVDATA->pPort->ExecPath());
-			ppc->bWaitTermination = pXCVDATA->pPort->WaitTermination();
-			ppc->dwWaitTimeout = pXCVDATA->pPort->WaitTimeout();
-			ppc->bPipeData = pXCVDATA->pPort->PipeData();
-			ppc->bHideProcess = pXCVDATA->pPort->HideProcess();
-			ppc->nLogLevel = g_pLog->GetLogLevel();
-			wcscpy_s(ppc->szUser, LENGTHOF(ppc->szUser), pXCVDATA->pPort->User());
-			wcscpy_s(ppc->szDomain, LENGTHOF(ppc->szDomain), pXCVDATA->pPort->Domain());
-			wcscpy_s(ppc->szPassword, LENGTHOF(ppc->szPassword), pXCVDATA->pPort->Password());
+			LPPORTCONFIG2 ppc = new PORTCONFIG2;
+			pXCVDATA->pPort->GetConfig(ppc);
+			CopyMemory(pOutputData, ppc, sizeof(PORTCONFIG));
+			SecureZeroMemory(ppc->szPassword, sizeof(ppc->szPassword));
+			delete ppc;
 			g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
 			return ERROR_SUCCESS;
 		}
@@ -396,6 +534,59 @@ DWORD WINAPI MfmXcvDataPort(HANDLE hXcv, LPCWSTR pszDataName, PBYTE pInputData,
 			pXCVDATA, (pXCVDATA ? pXCVDATA->pPort : NULL), pOutputData);
 		return ERROR_BAD_ARGUMENTS;
 	}
+	else if (wcscmp(pszDataName, L"GetStats") == 0)
+	{
+		//OpenMetrics text (UTF-8, NUL terminated) for the port, or for all ports
+		//when the handle was opened on the monitor
+		CStatsText text;
+
+		g_pPortList->FormatStats(&text, pXCVDATA ? pXCVDATA->pPort : NULL);
+
+		*pcbOutputNeeded = text.Length() + 1;
+		if (*pcbOutputNeeded > cbOutputData || pOutputData == NULL)
+		{
+			g_pLog->Warn(L"MfmXcvDataPort returning ERROR_INSUFFICIENT_BUFFER");
+			return ERROR_INSUFFICIENT_BUFFER;
+		}
+		CopyMemory(pOutputData, text.Text(), *pcbOutputNeeded);
+		g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
+		return ERROR_SUCCESS;
+	}
+	else if (wcscmp(pszDataName, L"SetTrace") == 0)
+	{
+		if (cbInputData < sizeof(DWORD) || pInputData == NULL)
+		{
+			g_pLog->Warn(L"MfmXcvDataPort returning ERROR_INSUFFICIENT_BUFFER");
+			return ERROR_INSUFFICIENT_BUFFER;
+		}
+		if (pXCVDATA == NULL || !(pXCVDATA->GrantedAccess & SERVER_ACCESS_ADMINISTER))
+		{
+			g_pLog->Critical(L"MfmXcvDataPort returning ERROR_ACCESS_DENIED (pXCVDATA->GrantedAccess = %X)",
+				pXCVDATA ? pXCVDATA->GrantedAccess : 0);
+			return ERROR_ACCESS_DENIED;
+		}
+		//nonzero starts a new trace session, zero stops recording (events are kept)
+		g_pTracer->Enable(*reinterpret_cast<LPDWORD>(pInputData) != 0);
+		g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
+		return ERROR_SUCCESS;
+	}
+	else if (wcscmp(pszDataName, L"GetTrace") == 0)
+	{
+		//Chrome trace JSON (UTF-8, NUL terminated)
+		CStatsText text;
+
+		g_pTracer->Format(&text);
+
+		*pcbOutputNeeded = text.Length() + 1;
+		if (*pcbOutputNeeded > cbOutputData || pOutputData == NULL)
+		{
+			g_pLog->Warn(L"MfmXcvDataPort returning ERROR_INSUFFICIENT_BUFFER");
+			return ERROR_INSUFFICIENT_BUFFER;
+		}
+		CopyMemory(pOutputData, text.Text(), *pcbOutputNeeded);
+		g_pLog->Debug(L"MfmXcvDataPort returning ERROR_SUCCESS");
+		return ERROR_SUCCESS;
+	}
 	else if (wcscmp(pszDataName, L"MonitorUI") == 0)
 	{
 		static WCHAR szUIDLL[] = L"mfilemonui.dll";
@@ -438,7 +629,28 @@ VOID WINAPI MfmShutdown(HANDLE hMonitor)
 	UNREFERENCED_PARAMETER(hMonitor);
 
 	if (g_pPortList)
+	{
+		//settings changed while we ran: make the next start quick
+		g_pPortList->WriteSnapshot();
 		delete g_pPortList;
+	}
+
+	//after the ports, whose write items it may still hold
+	if (g_pWriterPool)
+		delete g_pWriterPool;
+
+	if (g_pPrinterCache)
+		delete g_pPrinterCache;
+
+	if (g_pTokenCache)
+		delete g_pTokenCache;
+
+	if (g_pTracer)
+		delete g_pTracer;
+
+	//the ports released their settings with them
+	if (g_pStrings)
+		delete g_pStrings;
 
 	if (g_pLog)
 	{
@@ -486,6 +698,11 @@ LPMONITOR2 WINAPI InitializePrintMonitor2(_In_ PMONITORINIT pMonitorInit, _Out_
 
 	g_pMonitorInit = pMonitorInit;
 
+	//used to tell local jobs from remote ones, it won't change while we're loaded
+	DWORD nSize = LENGTHOF(g_szComputerName);
+	if (!GetComputerNameW(g_szComputerName, &nSize))
+		g_pLog->Error(L"InitializePrintMonitor2: GetComputerNameW failed (%i)", GetLastError());
+
 	_ASSERTE(g_pPortList != NULL);
 
 	g_pPortList->LoadFromRegistry();
@@ -520,7 +737,18 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD dwReason, LPVOID lpvReserved)
 		//Show only errors by default. We'll load the desired log level from the registry
 		g_pLog->SetLogLevel(LOGLEVEL_ERRORS);
 #endif
+		g_pStrings = new CStringTable();
 		g_pPortList = new CPortList(szMonitorName, szDescription);
+		g_pPrinterCache = new CPrinterCache();
+		g_pTokenCache = new CTokenCache();
+		g_pTracer = new CTracer();
+		g_pWriterPool = new CWriterPool();
+		break;
+
+	case DLL_THREAD_DETACH:
+		//a spooler thread is gone, another one can take its trace buffer
+		if (g_pTracer)
+			g_pTracer->ThreadDetach();
 		break;
 
 	case DLL_PROCESS_DETACH:
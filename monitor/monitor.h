@@ -50,6 +50,11 @@ BOOL WINAPI MfmXcvClosePort(HANDLE hXcv);
 
 VOID WINAPI MfmShutdown(HANDLE hMonitor);
 
+#ifndef _WIN32
+//winsplp.h declares it on Windows
+LPMONITOR2 WINAPI InitializePrintMonitor2(PMONITORINIT pMonitorInit, PHANDLE phMonitor);
+#endif
+
 extern "C"
 {
 	BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD dwReason, LPVOID lpvReserved);
@@ -0,0 +1,45 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+/*
+*  CPatternContext
+*  the job properties the pattern segments render (%t, %j, %u, %c, %r, %f, %p, %b).
+*  CPort provides them for the job being printed; tools that drive the pattern
+*  engine outside the spooler provide their own, so the engine doesn't depend on
+*  the port or the spooler API.
+*/
+
+class CPatternContext
+{
+public:
+	virtual ~CPatternContext() { }
+
+public:
+	virtual LPCWSTR JobTitle() const = 0;
+	virtual DWORD JobId() const = 0;
+	virtual LPCWSTR UserName() const = 0;
+	virtual LPCWSTR ComputerName() const = 0;
+	virtual LPCWSTR PrinterName() const = 0;
+	virtual LPCWSTR FileName() const = 0;
+	virtual LPCWSTR Path() const = 0;
+	virtual LPCWSTR Bin() const = 0;
+};
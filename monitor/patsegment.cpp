@@ -19,7 +19,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include "stdafx.h"
 #include "patsegment.h"
-#include "port.h"
+#include "pattern.h"
+#include "patcontext.h"
+#include "../common/monutils.h"
 
 #define IMPLEMENT_DATEPART_SEGMENT(classname, minwidth, datepart) \
 classname::classname(int nWidth) \
@@ -88,17 +90,14 @@ LPCWSTR CDatePartSegment::m_szMonthNames[12] = {
 #endif
 
 //-------------------------------------------------------------------------------------
-LPWSTR Sanitize(LPWSTR szString, WCHAR cReplace = L'-')
+LPWSTR Sanitize(LPWSTR szString, WCHAR cReplace)
 {
-	//strip off invalid characters for a filename
-	static LPCWSTR szInvalidCharacters = L"\\/:*?\"<>|";
-	LPWSTR pPos;
-	while ((pPos = wcspbrk(szString, szInvalidCharacters)) != NULL)
-		*pPos = cReplace;
+	//strip off invalid characters for a filename, the same pass gives us the length
+	LPWSTR pPos = szString + ReplaceInvalidFileChars(szString, cReplace);
 	//trim trailing spaces
-	pPos = szString + wcslen(szString) - 1;
-	while (pPos >= szString && (*pPos == L' ' || *pPos == L'\t'))
-		*pPos-- = L'\0';
+	while (pPos > szString && (pPos[-1] == L' ' || pPos[-1] == L'\t'))
+		pPos--;
+	*pPos = L'\0';
 	//trim leading spaces
 	pPos = szString;
 	while (*pPos == L' ' || *pPos == L'\t')
@@ -138,10 +137,10 @@ CAutoIncrementSegment::CAutoIncrementSegment(int nWidth, UINT nStart)
 		m_nWidth = -9;
 	else if (m_nWidth > 9)
 		m_nWidth = 9;
-	m_nStart = m_nNumber = nStart;
+	m_nStart = m_nFirst = m_nNumber = nStart;
 }
 
-BOOL CAutoIncrementSegment::NextValue()
+UINT CAutoIncrementSegment::MaxNumber() const
 {
 	static UINT max[] = {
 		9,
@@ -164,9 +163,33 @@ BOOL CAutoIncrementSegment::NextValue()
 	else
 		index = m_nWidth - 1;
 
-	if (m_nNumber == max[index])
+	return max[index];
+}
+
+BOOL CAutoIncrementSegment::Seek(UINT nNumber)
+{
+	//start this round from a shared counter rather than from the bottom
+	if (nNumber < m_nStart || nNumber > MaxNumber())
+		return FALSE;
+
+	m_nFirst = m_nNumber = nNumber;
+
+	return TRUE;
+}
+
+BOOL CAutoIncrementSegment::NextValue()
+{
+	if (m_nNumber == MaxNumber())
 	{
 		m_nNumber = m_nStart;
+
+		//a round started by Seek still has the bottom to try
+		if (m_nFirst != m_nStart)
+		{
+			m_nFirst = m_nStart;
+			return TRUE;
+		}
+
 		return FALSE;
 	}
 
@@ -215,9 +238,9 @@ LPCWSTR CMonthNameSegment::GetDatePart()
 LPCWSTR CJobTitleSegment::Value()
 {
 	WCHAR szTemp[MAXBUF];
-	_ASSERTE(m_pPort != NULL);
+	_ASSERTE(m_pContext != NULL);
 	//copy title because we must sanitize string
-	wcscpy_s(szTemp, LENGTHOF(szTemp), m_pPort->JobTitle());
+	wcsncpy_s(szTemp, LENGTHOF(szTemp), m_pContext->JobTitle(), _TRUNCATE);
 	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, Sanitize(szTemp));
 	return m_szBuffer;
 }
@@ -225,24 +248,24 @@ LPCWSTR CJobTitleSegment::Value()
 /* CJobIdSegment */
 LPCWSTR CJobIdSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), (m_nWidth > 0) ? L"%0*i" : L"%*i", m_nWidth, m_pPort->JobId());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), (m_nWidth > 0) ? L"%0*i" : L"%*i", m_nWidth, m_pContext->JobId());
 	return m_szBuffer;
 }
 
 /* CUserNameSegment */
 LPCWSTR CUserNameSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, m_pPort->UserName());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*.*s", m_nWidth, MAXBUF - 1, m_pContext->UserName());
 	return m_szBuffer;
 }
 
 /* CComputerNameSegment */
 LPCWSTR CComputerNameSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, m_pPort->ComputerName());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*.*s", m_nWidth, MAXBUF - 1, m_pContext->ComputerName());
 	return m_szBuffer;
 }
 
@@ -250,9 +273,9 @@ LPCWSTR CComputerNameSegment::Value()
 LPCWSTR CPrinterNameSegment::Value()
 {
 	WCHAR szTemp[MAXBUF];
-	_ASSERTE(m_pPort != NULL);
+	_ASSERTE(m_pContext != NULL);
 	//copy printer name because we must sanitize string
-	wcscpy_s(szTemp, LENGTHOF(szTemp), m_pPort->PrinterName());
+	wcsncpy_s(szTemp, LENGTHOF(szTemp), m_pContext->PrinterName(), _TRUNCATE);
 	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, Sanitize(szTemp));
 	return m_szBuffer;
 }
@@ -260,16 +283,44 @@ LPCWSTR CPrinterNameSegment::Value()
 /* CFileNameSegment */
 LPCWSTR CFileNameSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, m_pPort->FileName());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*.*s", m_nWidth, MAXBUF - 1, m_pContext->FileName());
 	return m_szBuffer;
 }
 
 /* CPathSegment */
 LPCWSTR CPathSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, m_pPort->Path());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*.*s", m_nWidth, MAXBUF - 1, m_pContext->Path());
+	return m_szBuffer;
+}
+
+/* CShardSegment */
+CShardSegment::CShardSegment(int nWidth, CPattern* pPattern, CPatternContext* pContext)
+: CPatternSegment(nWidth, pContext)
+{
+	//width is the number of hex digits, i.e. 16, 256, 4096 or 65536 subdirectories
+	if (m_nWidth < 0)
+		m_nWidth = -m_nWidth;
+	if (m_nWidth == 0)
+		m_nWidth = 2;
+	else if (m_nWidth > 4)
+		m_nWidth = 4;
+	m_pPattern = pPattern;
+}
+
+LPCWSTR CShardSegment::Value()
+{
+	_ASSERTE(m_pPattern != NULL);
+	_ASSERTE(m_pContext != NULL);
+	CAutoIncrementSegment* pCounter = m_pPattern->Counter();
+	//a given counter value always falls into the same shard, so probing
+	//the candidate's own shard is enough to keep the numbering unique
+	UINT nKey = pCounter ? pCounter->Number() : m_pContext->JobId();
+	//multiplicative hash spreads consecutive values across the shards
+	UINT nShard = (nKey * 2654435761U) >> (32 - 4 * m_nWidth);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%0*X", m_nWidth, nShard);
 	return m_szBuffer;
 }
 
@@ -283,8 +334,8 @@ CSearchSegment::CSearchSegment(LPCWSTR szString, LPCWSTR szSearch)
 /* CPrinterBinSegment */
 LPCWSTR CPrinterBinSegment::Value()
 {
-	_ASSERTE(m_pPort != NULL);
-	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*s", m_nWidth, m_pPort->Bin());
+	_ASSERTE(m_pContext != NULL);
+	swprintf_s(m_szBuffer, LENGTHOF(m_szBuffer), L"%*.*s", m_nWidth, MAXBUF - 1, m_pContext->Bin());
 	return m_szBuffer;
 }
 
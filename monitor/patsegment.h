@@ -31,14 +31,18 @@ protected: \
 
 #define MAXBUF 2048
 
-class CPort;
+class CPatternContext;
+class CPattern;
+
+//strips characters not allowed in a file name and trims blanks; returns the new start
+LPWSTR Sanitize(LPWSTR szString, WCHAR cReplace = L'-');
 
 class CPatternSegment
 {
 public:
-	CPatternSegment(int nWidth = 0, CPort* pPort = NULL)
+	CPatternSegment(int nWidth = 0, CPatternContext* pContext = NULL)
 	{
-		m_pPort = pPort;
+		m_pContext = pContext;
 		m_pNext = m_pPrevious = NULL;
 		m_szBuffer[0] = L'\0';
 		m_nWidth = nWidth;
@@ -59,7 +63,7 @@ private:
 	CPatternSegment* m_pPrevious;
 
 protected:
-	CPort* m_pPort;
+	CPatternContext* m_pContext;
 	WCHAR m_szBuffer[MAXBUF];
 	int m_nWidth;
 };
@@ -102,10 +106,16 @@ public:
 public:
 	virtual BOOL NextValue();
 	virtual LPCWSTR Value();
-	virtual void Reset() { m_nNumber = m_nStart; }
+	virtual void Reset() { m_nNumber = m_nFirst = m_nStart; }
+	BOOL Seek(UINT nNumber);
+	UINT Number() const { return m_nNumber; }
+
+protected:
+	UINT MaxNumber() const;
 
 protected:
 	UINT m_nStart;
+	UINT m_nFirst;
 	UINT m_nNumber;
 };
 
@@ -147,8 +157,8 @@ protected:
 class CJobTitleSegment : public CPatternSegment
 {
 public:
-	CJobTitleSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CJobTitleSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -159,8 +169,8 @@ public:
 class CJobIdSegment : public CPatternSegment
 {
 public:
-	CJobIdSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CJobIdSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -171,8 +181,8 @@ public:
 class CUserNameSegment : public CPatternSegment
 {
 public:
-	CUserNameSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CUserNameSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -183,8 +193,8 @@ public:
 class CComputerNameSegment : public CPatternSegment
 {
 public:
-	CComputerNameSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CComputerNameSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -195,8 +205,8 @@ public:
 class CPrinterNameSegment : public CPatternSegment
 {
 public:
-	CPrinterNameSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CPrinterNameSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -207,8 +217,8 @@ public:
 class CFileNameSegment : public CPatternSegment
 {
 public:
-	CFileNameSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CFileNameSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -219,8 +229,8 @@ public:
 class CPathSegment : public CPatternSegment
 {
 public:
-	CPathSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CPathSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
@@ -244,14 +254,28 @@ protected:
 class CPrinterBinSegment : public CPatternSegment
 {
 public:
-	CPrinterBinSegment(int nWidth, CPort* pPort)
-		: CPatternSegment(nWidth, pPort)
+	CPrinterBinSegment(int nWidth, CPatternContext* pContext)
+		: CPatternSegment(nWidth, pContext)
 	{ }
 
 public:
 	virtual LPCWSTR Value();
 };
 
+/* shard segment: a fixed fan-out of subdirectories derived from the auto increment
+   counter (or from the job id when the pattern has no counter) */
+class CShardSegment : public CPatternSegment
+{
+public:
+	CShardSegment(int nWidth, CPattern* pPattern, CPatternContext* pContext);
+
+public:
+	virtual LPCWSTR Value();
+
+protected:
+	CPattern* m_pPattern;
+};
+
 /* temp dir segment */
 class CTempDirSegment : public CPatternSegment
 {
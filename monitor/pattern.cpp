@@ -20,23 +20,31 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "stdafx.h"
 #include "pattern.h"
 #include "patsegment.h"
-#include "port.h"
+#include "patcontext.h"
+#include "../common/defs.h"
 
 LPCWSTR CPattern::szDefaultFilePattern = L"file%i.prn";
 LPCWSTR CPattern::szDefaultUserCommand = L"";
 
 //-------------------------------------------------------------------------------------
-CPattern::CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand)
+CPattern::CPattern(LPCWSTR szPattern, CPatternContext* pContext, BOOL bUserCommand)
 {
-	m_szBuffer = new WCHAR[MAX_COMMAND];
-	m_szSearchBuffer = new WCHAR[MAX_COMMAND];
+	//most values are file names: the buffers grow when a longer one comes
+	m_cchBuffer = m_cchSearchBuffer = PATTERN_INITIALBUF;
+	m_szBuffer = new WCHAR[m_cchBuffer];
+	m_szSearchBuffer = new WCHAR[m_cchSearchBuffer];
 
 	//initialization
-	m_pPort = pPort;
+	m_pContext = pContext;
 	m_pFirstSegment = m_pLastSegment = NULL;
+	m_pCounter = NULL;
 	m_szBuffer[0] = L'\0';
 	m_szSearchBuffer[0] = L'\0';
-	wcscpy_s(m_szPattern, LENGTHOF(m_szPattern), szPattern);
+
+	//user commands can be longer than MAX_PATH
+	size_t cchPattern = wcslen(szPattern) + 1;
+	m_szPattern = new WCHAR[cchPattern];
+	wcscpy_s(m_szPattern, cchPattern, szPattern);
 
 	//buffers for search fields
 	WCHAR szBuf[3][MAX_PATH + 1] = { 0 };
@@ -136,7 +144,12 @@ CPattern::CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand)
 					{
 						case L'i':
 							if (!bUserCommand)
+							{
 								pNewSeg = new CAutoIncrementSegment(nWidth, nStart);
+								//the first counter drives the shard fields
+								if (!m_pCounter)
+									m_pCounter = static_cast<CAutoIncrementSegment*>(pNewSeg);
+							}
 							else
 								while (pTemp <= szPattern)
 								{
@@ -149,7 +162,7 @@ CPattern::CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand)
 							break;
 						case L'f':
 							if (bUserCommand)
-								pNewSeg = new CFileNameSegment(nWidth, m_pPort);
+								pNewSeg = new CFileNameSegment(nWidth, m_pContext);
 							else
 								while (pTemp <= szPattern)
 								{
@@ -162,7 +175,20 @@ CPattern::CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand)
 							break;
 						case L'p':
 							if (bUserCommand)
-								pNewSeg = new CPathSegment(nWidth, m_pPort);
+								pNewSeg = new CPathSegment(nWidth, m_pContext);
+							else
+								while (pTemp <= szPattern)
+								{
+									//check buffer overflow
+									if ((pBuf[0] - szBuf[0]) < (LENGTHOF(szBuf[0]) - 1))
+										*pBuf[0]++ = *pTemp++;
+									else
+										pTemp++;
+								}
+							break;
+						case L'S':
+							if (!bUserCommand)
+								pNewSeg = new CShardSegment(nWidth, this, m_pContext);
 							else
 								while (pTemp <= szPattern)
 								{
@@ -204,25 +230,25 @@ CPattern::CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand)
 							pNewSeg = new CSecondSegment(nWidth);
 							break;
 						case L't':
-							pNewSeg = new CJobTitleSegment(nWidth, m_pPort);
+							pNewSeg = new CJobTitleSegment(nWidth, m_pContext);
 							break;
 						case L'T':
 							pNewSeg = new CTempDirSegment(nWidth);
 							break;
 						case L'j':
-							pNewSeg = new CJobIdSegment(nWidth, m_pPort);
+							pNewSeg = new CJobIdSegment(nWidth, m_pContext);
 							break;
 						case L'u':
-							pNewSeg = new CUserNameSegment(nWidth, m_pPort);
+							pNewSeg = new CUserNameSegment(nWidth, m_pContext);
 							break;
 						case L'c':
-							pNewSeg = new CComputerNameSegment(nWidth, m_pPort);
+							pNewSeg = new CComputerNameSegment(nWidth, m_pContext);
 							break;
 						case L'r':
-							pNewSeg = new CPrinterNameSegment(nWidth, m_pPort);
+							pNewSeg = new CPrinterNameSegment(nWidth, m_pContext);
 							break;
 						case L'b':
-							pNewSeg = new CPrinterBinSegment(nWidth, m_pPort);
+							pNewSeg = new CPrinterBinSegment(nWidth, m_pContext);
 							break;
 						default:
 							//not a valid field, get here from where we started parsing
@@ -325,6 +351,7 @@ CPattern::~CPattern()
 
 	delete[] m_szBuffer;
 	delete[] m_szSearchBuffer;
+	delete[] m_szPattern;
 }
 
 //-------------------------------------------------------------------------------------
@@ -353,33 +380,69 @@ BOOL CPattern::NextValue()
 }
 
 //-------------------------------------------------------------------------------------
-LPWSTR CPattern::Value()
+void CPattern::Reserve(LPWSTR* pszBuffer, size_t* pcchBuffer, size_t cchNeeded)
 {
-	m_szBuffer[0] = L'\0';
+	if (cchNeeded <= *pcchBuffer || *pcchBuffer >= MAX_COMMAND)
+		return;
+
+	size_t cchBuffer = *pcchBuffer;
+	while (cchBuffer < cchNeeded && cchBuffer < MAX_COMMAND)
+		cchBuffer *= 2;
+	if (cchBuffer > MAX_COMMAND)
+		cchBuffer = MAX_COMMAND;
+
+	LPWSTR szBuffer = new WCHAR[cchBuffer];
+	wcscpy_s(szBuffer, cchBuffer, *pszBuffer);
+
+	delete[] *pszBuffer;
+	*pszBuffer = szBuffer;
+	*pcchBuffer = cchBuffer;
+}
+
+//-------------------------------------------------------------------------------------
+LPWSTR CPattern::Compose(LPWSTR* pszBuffer, size_t* pcchBuffer, BOOL bSearch)
+{
+	(*pszBuffer)[0] = L'\0';
+	size_t len = 0;
 	CPatternSegment* pSeg = m_pFirstSegment;
-	while (pSeg)
+	while (pSeg && len < MAX_COMMAND - 1)
 	{
-		LPCWSTR szVal = pSeg->Value();
+		//a long job title repeated many times is cut, not an overflow
+		LPCWSTR szVal = bSearch ? pSeg->SearchValue() : pSeg->Value();
 		if (szVal)
-			wcscat_s(m_szBuffer, MAX_COMMAND, szVal);
+		{
+			Reserve(pszBuffer, pcchBuffer, len + wcslen(szVal) + 1);
+			wcsncpy_s(*pszBuffer + len, *pcchBuffer - len, szVal, _TRUNCATE);
+			len += wcslen(*pszBuffer + len);
+		}
 		pSeg = pSeg->GetNext();
 	}
-	return m_szBuffer;
+	return *pszBuffer;
+}
+
+//-------------------------------------------------------------------------------------
+LPWSTR CPattern::Value()
+{
+	return Compose(&m_szBuffer, &m_cchBuffer, FALSE);
 }
 
 //-------------------------------------------------------------------------------------
 LPWSTR CPattern::SearchValue()
 {
-	m_szSearchBuffer[0] = L'\0';
-	CPatternSegment* pSeg = m_pFirstSegment;
-	while (pSeg)
-	{
-		LPCWSTR szVal = pSeg->SearchValue();
-		if (szVal)
-			wcscat_s(m_szSearchBuffer, MAX_COMMAND, szVal);
-		pSeg = pSeg->GetNext();
-	}
-	return m_szSearchBuffer;
+	return Compose(&m_szSearchBuffer, &m_cchSearchBuffer, TRUE);
+}
+
+//-------------------------------------------------------------------------------------
+size_t CPattern::MemoryUsage() const
+{
+	//segments are counted at their base size, near enough for the statistics
+	size_t cb = sizeof(*this) +
+		(m_cchBuffer + m_cchSearchBuffer + wcslen(m_szPattern) + 1) * sizeof(WCHAR);
+
+	for (CPatternSegment* pSeg = m_pFirstSegment; pSeg; pSeg = pSeg->GetNext())
+		cb += sizeof(CPatternSegment);
+
+	return cb;
 }
 
 //-------------------------------------------------------------------------------------
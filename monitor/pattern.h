@@ -31,13 +31,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 *    .pdf		-> statico
 */
 
+#define PATTERN_INITIALBUF	(MAX_PATH + 1)
+
 class CPatternSegment;
-class CPort;
+class CAutoIncrementSegment;
+class CPatternContext;
 
 class CPattern
 {
 public:
-	CPattern(LPCWSTR szPattern, CPort* pPort, BOOL bUserCommand);
+	CPattern(LPCWSTR szPattern, CPatternContext* pContext, BOOL bUserCommand);
 	virtual ~CPattern();
 
 public:
@@ -46,15 +49,22 @@ public:
 	LPWSTR SearchValue();
 	LPWSTR PatternString() { return m_szPattern; }
 	void Reset();
+	size_t MemoryUsage() const;
+	CAutoIncrementSegment* Counter() const { return m_pCounter; }
 	static LPCWSTR szDefaultFilePattern;
 	static LPCWSTR szDefaultUserCommand;
 
 private:
 	CPatternSegment* m_pFirstSegment;
 	CPatternSegment* m_pLastSegment;
+	CAutoIncrementSegment* m_pCounter;
 	LPWSTR m_szBuffer;
 	LPWSTR m_szSearchBuffer;
-	WCHAR m_szPattern[MAX_PATH + 1];
-	CPort* m_pPort;
+	size_t m_cchBuffer;
+	size_t m_cchSearchBuffer;
+	LPWSTR m_szPattern;
+	CPatternContext* m_pContext;
 	void AddSegment(CPatternSegment* pSegment);
+	LPWSTR Compose(LPWSTR* pszBuffer, size_t* pcchBuffer, BOOL bSearch);
+	static void Reserve(LPWSTR* pszBuffer, size_t* pcchBuffer, size_t cchNeeded);
 };
@@ -20,299 +20,155 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "stdafx.h"
 #include "port.h"
 #include "log.h"
-#include "..\common\autoclean.h"
-#include "..\common\defs.h"
-#include "..\common\monutils.h"
-#include <VersionHelpers.h>
+#include "patsegment.h"
+#include "printercache.h"
+#include "strtable.h"
+#include "trace.h"
+#include "../common/autoclean.h"
+#include "../common/defs.h"
+#include "../common/monutils.h"
 
-//-------------------------------------------------------------------------------------
-static BOOL EnablePrivilege(
-	HANDLE hToken,                      // access token handle
-	LPCWSTR lpszPrivilege,              // name of privilege to enable/disable
-	BOOL bEnablePrivilege,              // to enable or disable privilege
-	PTOKEN_PRIVILEGES PreviousState		// previous state
-)
-{
-	TOKEN_PRIVILEGES tp = { 0 };
-	LUID luid;
-
-	if (!LookupPrivilegeValueW(NULL, lpszPrivilege, &luid))
-	{
-		return FALSE; 
-	}
-
-	tp.PrivilegeCount = 1;
-	tp.Privileges[0].Luid = luid;
-	if (bEnablePrivilege)
-		tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
-	else
-		tp.Privileges[0].Attributes = 0;
-
-	DWORD Size = sizeof(TOKEN_PRIVILEGES);
-	// Enable the privilege or disable all privileges.
-	if (!AdjustTokenPrivileges(hToken, FALSE, &tp, sizeof(TOKEN_PRIVILEGES),
-		PreviousState, &Size))
-	{ 
-		return FALSE; 
-	} 
-
-	if (GetLastError() == ERROR_NOT_ALL_ASSIGNED)
-	{
-		return FALSE;
-	} 
-
-	return TRUE;
-}
-
-//-------------------------------------------------------------------------------------
-static BOOL GetPrimaryToken(LPWSTR lpszUsername, LPWSTR lpszDomain, LPWSTR lpszPassword,
-	PHANDLE phToken, BOOL *bRestrictedToken)
-{
-	DWORD dwLength;
-	*bRestrictedToken = FALSE;
-	BOOL bIsWindowsVistaOrLater = IsWindowsVistaOrGreater();
-
-	if (!bIsWindowsVistaOrLater)
-	{
-		return LogonUserW(lpszUsername, lpszDomain, lpszPassword, LOGON32_LOGON_INTERACTIVE,
-			LOGON32_PROVIDER_DEFAULT, phToken);
-	}
-	else
-	{
-		/*
-		* Assume activated User Account Control.
-		* To retrieve user primary token, it is better to avoid LOGON32_LOGON_INTERACTIVE logon type,
-		* for LogonUser, otherwise we'll get the filtered token with missing privileges.
-		*
-		* Thus I'll try first to logon as batch or service.
-		* If it works, I've got user token with his highest privileges,
-		* done.
-		*
-		* Otherwise,
-		* - logon with interactive logon type and get possibly filtered token.
-		* - Try to enable TCB privilege.
-		* - Retrieve linked token via GetTokenInformation().
-		* If an error or linked token is NULL, then either UAC is not active or we
-		* got a standard user, return logon token, done.
-		* If linked token is not NULL and TCB privilege was enabled,
-		* return linked token (it is primary due to TCB held).
-		*
-		* If linked token is not NULL and TCB was NOT enabled,
-		* returned token is restricted (filtered). This should not happen often,
-		* because there is a fair number of conditions that must hold true,
-		* 1) User is an Admin
-		* 2) User has no batch neither service logon privileges
-		* 3) Caller has no TCB privilege
-		* 4) UAC is enabled.
-		*/
-
-		int i;
-		HANDLE hMyToken;
-		HANDLE hLinkedToken;
-		DWORD logonType = LOGON32_LOGON_BATCH;
-		BOOL bSuccess = FALSE;
-		DWORD dwLastError;
-		BOOL bGotTcbPriv;
-		TOKEN_PRIVILEGES TcbPrevState;
-		DWORD allLogonTypes [] = {
-			LOGON32_LOGON_BATCH,
-			LOGON32_LOGON_SERVICE,
-			LOGON32_LOGON_INTERACTIVE /* intentionally put last, as most restrictive logon */
-		};
-
-		/* Try all logon types */
-		for (i = 0; i < LENGTHOF(allLogonTypes); i++)
-		{
-			logonType = allLogonTypes[i];
-			bSuccess = LogonUserW(lpszUsername, lpszDomain, lpszPassword, logonType,
-				LOGON32_PROVIDER_DEFAULT, phToken);
-
-			if (bSuccess)
-				break;
-
-			dwLastError = GetLastError();
-
-			if (dwLastError != ERROR_LOGON_TYPE_NOT_GRANTED &&
-				dwLastError != ERROR_LOGON_NOT_GRANTED)
-			{
-				return FALSE;
-			}
-		}
-
-		if (!bSuccess)
-		{
-			/* User could not logon with any logon type? */
-			return FALSE;
-		}
-
-		if (logonType != LOGON32_LOGON_INTERACTIVE)
-		{
-			/* Non-interactive logon, no UAC, no token restrictions */
-			return TRUE;
-		}
-
-		/* Try to get the highest privileged token */
-		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ALL_ACCESS, &hMyToken))
-		{
-			return FALSE;
-		}
-
-		/* Enable TCB temporarily to get primary "linked" token .
-		* Without TCB GetTokenInformation() would return
-		* Identity token, unusable for CreateProcessAsUser()
-		*/
-
-		bGotTcbPriv = EnablePrivilege(hMyToken, SE_TCB_NAME, TRUE, &TcbPrevState);
-		bSuccess = GetTokenInformation(*phToken, TokenLinkedToken, (VOID*)&hLinkedToken,
-			sizeof(HANDLE), &dwLength);
-
-		if (bGotTcbPriv)
-		{
-			/* Reset TCB privilege, if was set previously */
-			AdjustTokenPrivileges(hMyToken, FALSE, &TcbPrevState, sizeof(TcbPrevState), NULL, NULL);
-		}
-
-		CloseHandle(hMyToken);
-
-		if (!bSuccess)
-		{
-			if ((dwLastError = GetLastError()) == ERROR_NO_SUCH_LOGON_SESSION)
-			{
-				/* Can happend if we have standard user/UAC switched off */
-				SetLastError(ERROR_SUCCESS);
-				hLinkedToken = NULL;
-			}
-			else
-			{
-				return FALSE;
-			}
-		}
+//JOB_INFO_2 size hint, grows to the biggest job info seen by any port;
+//ports print in parallel, so it is only ever raised with a compare-exchange
+static volatile LONG s_cbJobInfo2Hint = 1024;
 
-		if (!hLinkedToken)
-		{
-			/* No UAC or standard user */
-			return TRUE;
-		}
-
-		if (!bGotTcbPriv)
-		{
-			/* Could not enable TCB , *phToken is restricted */
-			*bRestrictedToken = TRUE;
-			return TRUE;
-		}
-
-		CloseHandle(*phToken);
-
-		/* primary linked token */
-		*phToken = hLinkedToken;
-		return TRUE;
-	}
-}
+//ids given to ports in the binary log
+static volatile LONG s_nNextLogId = 0;
 
 //-------------------------------------------------------------------------------------
 CPort::CPort()
 {
+	InitializeCriticalSection(&m_CSConfig);
+	InitializeCriticalSection(&m_CSJob);
 	Initialize();
+	m_dwDirtyFields = PORTFIELD_ALL;
 }
 
 //-------------------------------------------------------------------------------------
 CPort::CPort(LPCWSTR szPortName)
 {
+	InitializeCriticalSection(&m_CSConfig);
+	InitializeCriticalSection(&m_CSJob);
 	Initialize(szPortName);
+	//a new port: its registry key doesn't exist yet
+	m_dwDirtyFields = PORTFIELD_ALL;
 }
 
 //-------------------------------------------------------------------------------------
-CPort::CPort(LPPORTCONFIG pPortConfig)
+CPort::CPort(LPPORTCONFIG2 pPortConfig)
 {
+	InitializeCriticalSection(&m_CSConfig);
+	InitializeCriticalSection(&m_CSJob);
 	Initialize(pPortConfig);
+	//loaded from the registry, nothing to write back
+	m_dwDirtyFields = 0;
 }
 
 //-------------------------------------------------------------------------------------
 void CPort::Initialize()
 {
-	*m_szPortName = L'\0';
-	*m_szOutputPath = L'\0';
+	m_szPortName = g_pStrings->Intern(NULL);
+	m_pSettings = new CPortSettings();
+	m_pActive = NULL;
 	m_szPrinterName = NULL;
 	m_cchPrinterName = 0;
 	m_pPattern = NULL;
-	m_bOverwrite = FALSE;
 	m_pUserCommand = NULL;
-	*m_szExecPath = L'\0';
-	m_bWaitTermination = FALSE;
-	m_dwWaitTimeout = 0;
-	m_bPipeData = FALSE;
-	m_bHideProcess = TRUE;
-	*m_szFileName = L'\0';
+	m_cbJobMemory = 0;
+	m_szFileName = NULL;
+	m_szParent = NULL;
+	*m_szBinName = L'\0';
 	m_hFile = INVALID_HANDLE_VALUE;
-	m_hWriteThread = NULL;
-	m_hWorkEvt = NULL;
-	m_hDoneEvt = NULL;
+	ZeroMemory(&m_writeItem, sizeof(m_writeItem));
 	m_nJobId = 0;
 	m_pJobInfo2 = NULL;
 	m_cbJobInfo2 = 0;
 	m_bPipeActive = FALSE;
-	InitializeCriticalSection(&m_threadData.csBuffer);
-	*m_szUser = L'\0';
-	wcscpy_s(m_szDomain, LENGTHOF(m_szDomain), L".");
-	*m_szPassword = L'\0';
 	m_hToken = NULL;
+	m_pTokenEntry = NULL;
 	m_bRestrictedToken = FALSE;
 	m_bLogonInvalidated = TRUE;
+	ZeroMemory(&m_procInfo, sizeof(m_procInfo));
+	m_ullCommandStart = 0;
+	m_bMaterialized = FALSE;
+	m_bOutputPathReady = FALSE;
+	m_dwLastUsed = 0;
+	m_nRefs = 1;
+	m_bDeleted = FALSE;
+
+	//0 stands for "no port" in the binary log
+	do
+	{
+		m_nLogId = static_cast<WORD>(InterlockedIncrement(&s_nNextLogId) & 0xFFFF);
+	} while (m_nLogId == 0);
+	m_nLogDefined = 0;
 }
 
 //-------------------------------------------------------------------------------------
 void CPort::Initialize(LPCWSTR szPortName)
 {
 	Initialize();
-	wcscpy_s(m_szPortName, LENGTHOF(m_szPortName), szPortName);
+	m_szPortName = g_pStrings->Intern(szPortName);
 }
 
 //-------------------------------------------------------------------------------------
-void CPort::Initialize(LPPORTCONFIG pConfig)
+void CPort::Initialize(LPPORTCONFIG2 pConfig)
 {
 	Initialize(pConfig->szPortName);
-	wcscpy_s(m_szOutputPath, LENGTHOF(m_szOutputPath), pConfig->szOutputPath);
-	SetFilePatternString(pConfig->szFilePattern);
-	m_bOverwrite = pConfig->bOverwrite;
-	SetUserCommandString(pConfig->szUserCommandPattern);
-	wcscpy_s(m_szExecPath, LENGTHOF(m_szExecPath), pConfig->szExecPath);
-	m_bWaitTermination = pConfig->bWaitTermination;
-	m_dwWaitTimeout = pConfig->dwWaitTimeout;
-	if (m_dwWaitTimeout > 4294967)
-		m_dwWaitTimeout = 4294967;
-	m_bPipeData = pConfig->bPipeData;
-	m_bHideProcess = pConfig->bHideProcess;
-	wcscpy_s(m_szUser, LENGTHOF(m_szUser), pConfig->szUser);
-	Trim(m_szUser);
-	wcscpy_s(m_szDomain, LENGTHOF(m_szDomain), pConfig->szDomain);
-	Trim(m_szDomain);
-	if (!*m_szDomain)
-		wcscpy_s(m_szDomain, LENGTHOF(m_szDomain), L".");
-	wcscpy_s(m_szPassword, LENGTHOF(m_szPassword), pConfig->szPassword);
+	m_pSettings->Release();
+	m_pSettings = new CPortSettings(pConfig);
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::Release()
+{
+	if (InterlockedDecrement(&m_nRefs) == 0)
+		delete this;
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::LogConfig()
+{
+	CPortSettings* pSettings = m_pActive;
 
 	g_pLog->Info(L"Initializing port %s", m_szPortName);
-	g_pLog->Info(L" Output path:         %s", m_szOutputPath);
-	g_pLog->Info(L" File pattern:        %s", pConfig->szFilePattern);
-	g_pLog->Info(L" Overwrite:           %s", (m_bOverwrite ? szTrue : szFalse));
-	g_pLog->Info(L" User command:        %s", pConfig->szUserCommandPattern);
-	g_pLog->Info(L" Execute from:        %s", m_szExecPath);
-	g_pLog->Info(L" Wait termination:    %s", (m_bWaitTermination ? szTrue : szFalse));
-	g_pLog->Info(L" Wait timeout:        %u", m_dwWaitTimeout);
-	g_pLog->Info(L" Use pipe:            %s", (m_bPipeData ? szTrue : szFalse));
-	if (wcschr(m_szUser, L'@') != NULL)
-		g_pLog->Info(L" Run as:              %s", m_szUser);
+	g_pLog->Info(L" Output path:         %s", pSettings->OutputPath());
+	g_pLog->Info(L" File pattern:        %s", pSettings->FilePattern());
+	g_pLog->Info(L" Overwrite:           %s", (pSettings->Overwrite() ? szTrue : szFalse));
+	g_pLog->Info(L" User command:        %s", pSettings->UserCommandPattern());
+	g_pLog->Info(L" Execute from:        %s", pSettings->ExecPath());
+	g_pLog->Info(L" Wait termination:    %s", (pSettings->WaitTermination() ? szTrue : szFalse));
+	g_pLog->Info(L" Wait timeout:        %u", pSettings->WaitTimeout());
+	g_pLog->Info(L" Use pipe:            %s", (pSettings->PipeData() ? szTrue : szFalse));
+	if (wcschr(pSettings->User(), L'@') != NULL)
+		g_pLog->Info(L" Run as:              %s", pSettings->User());
 	else
-		g_pLog->Info(L" Run as:              %s\\%s", m_szDomain, m_szUser);
+		g_pLog->Info(L" Run as:              %s\\%s", pSettings->Domain(), pSettings->User());
+	if (pSettings->ArchiveMode() != ARCHIVEMODE_NONE)
+		g_pLog->Info(L" Archive:             tar, roll over at %u MB / %u min / %u jobs",
+			pSettings->ArchiveMaxSize(), pSettings->ArchiveMaxAge(), pSettings->ArchiveMaxJobs());
 }
 
 //-------------------------------------------------------------------------------------
 CPort::~CPort()
 {
-	if (m_pPattern)
-		delete m_pPattern;
+	//the last archive is completed and handed to the user command like the others
+	CloseArchive();
 
-	if (m_pUserCommand)
-		delete m_pUserCommand;
+	DeletePatterns();
+
+	if (m_pActive)
+		m_pActive->Release();
+
+	m_pSettings->Release();
+
+	g_pStrings->Release(m_szPortName);
+
+	if (m_szFileName)
+		delete[] m_szFileName;
+
+	if (m_szParent)
+		delete[] m_szParent;
 
 	if (m_szPrinterName)
 		delete[] m_szPrinterName;
@@ -320,60 +176,230 @@ CPort::~CPort()
 	if (m_pJobInfo2)
 		delete[] m_pJobInfo2;
 
-	if (m_hWriteThread)
+	ReleaseToken();
+
+	CloseWriteEvent();
+
+	DeleteCriticalSection(&m_CSJob);
+	DeleteCriticalSection(&m_CSConfig);
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::DeletePatterns()
+{
+	if (m_pPattern)
+	{
+		delete m_pPattern;
+		m_pPattern = NULL;
+	}
+
+	if (m_pUserCommand)
 	{
-		EnterCriticalSection(&m_threadData.csBuffer);
-		m_threadData.lpBuffer = NULL;
-		LeaveCriticalSection(&m_threadData.csBuffer);
-		SetEvent(m_hWorkEvt);
-		WaitForSingleObject(m_hDoneEvt, INFINITE);
-		CloseHandle(m_hWriteThread);
-		m_hWriteThread = NULL;
+		delete m_pUserCommand;
+		m_pUserCommand = NULL;
 	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::ActivateSettings()
+{
+	//pin the configured settings; the port lock guards the pointer only
+	CPortSettings* pSettings;
+	{
+		CAutoCriticalSection acs(&m_CSConfig);
+		pSettings = m_pSettings;
+		pSettings->AddRef();
+	}
+
+	if (pSettings == m_pActive)
+	{
+		pSettings->Release();
+		return;
+	}
+
+	if (m_pActive)
+	{
+		//reconfigured since the last job: what was started with the old
+		//settings is completed with them
+		CloseArchive();
+		DeletePatterns();
+		ReleaseToken();
+		m_dirCache.Clear();
+		m_counter.Detach();
+		m_pActive->Release();
+	}
+
+	m_pActive = pSettings;
+	m_bLogonInvalidated = TRUE;
+	m_bOutputPathReady = FALSE;
+
+	if (m_pActive->HasFilePattern())
+		m_pPattern = new CPattern(m_pActive->FilePattern(), this, FALSE);
 
-	if (m_hWorkEvt)
-		CloseHandle(m_hWorkEvt);
+	if (m_pActive->HasUserCommand())
+		m_pUserCommand = new CPattern(m_pActive->UserCommandPattern(), this, TRUE);
 
-	if (m_hDoneEvt)
-		CloseHandle(m_hDoneEvt);
+	UpdateJobMemory();
 
-	DeleteCriticalSection(&m_threadData.csBuffer);
+	LogConfig();
 }
 
 //-------------------------------------------------------------------------------------
-void CPort::SetFilePatternString(LPCWSTR szPattern)
+DWORD CPort::Materialize()
 {
-	if (m_pPattern)
-		delete m_pPattern;
+	//called by StartJob under the job lock: the job state is ours
+	m_dwLastUsed = GetTickCount();
+
+	//first job since startup, or since the port was evicted
+	if (!m_bMaterialized)
+	{
+		m_bMaterialized = TRUE;
 
-	m_pPattern = new CPattern(szPattern, this, FALSE);
+		//room for the job's file names, idle ports don't carry it
+		m_szFileName = new WCHAR[MAX_PATH + 1];
+		*m_szFileName = L'\0';
+		m_szParent = new WCHAR[MAX_PATH + 1];
+		*m_szParent = L'\0';
+	}
+
+	//a configuration change takes effect here, between two jobs
+	ActivateSettings();
+
+	//switch to a renewed token, if any (it's already there, no logon takes place)
+	DWORD dwErr = Logon();
+	if (dwErr != ERROR_SUCCESS)
+	{
+		g_pLog->Critical(this, L"CPort::Materialize: can't logon user (%i)", dwErr);
+		return dwErr;
+	}
+
+	//2009-05-14 we'd better create missing directories rather than giving up..
+	if (!m_bOutputPathReady)
+	{
+		if ((dwErr = CreateOutputPath()) != ERROR_SUCCESS)
+		{
+			g_pLog->Critical(this, L"CPort::Materialize: can't create output directory (%i)", dwErr);
+			return ERROR_DIRECTORY;
+		}
+
+		m_bOutputPathReady = TRUE;
+	}
+
+	return ERROR_SUCCESS;
 }
 
 //-------------------------------------------------------------------------------------
-void CPort::SetUserCommandString(LPCWSTR szPattern)
+void CPort::UpdateJobMemory()
 {
+	//the job state belongs to the job thread, the statistics read this instead
+	size_t cb = m_cchPrinterName * sizeof(WCHAR) + m_cbJobInfo2;
+
+	if (m_pPattern)
+		cb += m_pPattern->MemoryUsage();
+
 	if (m_pUserCommand)
-		delete m_pUserCommand;
+		cb += m_pUserCommand->MemoryUsage();
+
+	if (m_szFileName)
+		cb += 2 * (MAX_PATH + 1) * sizeof(WCHAR);
+
+	if (m_pActive)
+		cb += m_pActive->MemoryUsage();
 
-	m_pUserCommand = new CPattern(szPattern, this, TRUE);
+	m_cbJobMemory = cb;
 }
 
 //-------------------------------------------------------------------------------------
-LPCWSTR CPort::FilePattern() const
+size_t CPort::MemoryUsage()
 {
-	if (m_pPattern)
-		return m_pPattern->PatternString();
-	else
-		return CPattern::szDefaultFilePattern;
+	CAutoCriticalSection acs(&m_CSConfig);
+
+	//what the port owns; interned settings are accounted to the string table
+	size_t cb = sizeof(*this) + m_stats.HeapUsage() + m_flightRec.HeapUsage() + m_cbJobMemory;
+
+	//the pointers are only compared: the job thread may be switching m_pActive
+	if (m_pSettings != m_pActive)
+		cb += m_pSettings->MemoryUsage();
+
+	return cb;
 }
 
 //-------------------------------------------------------------------------------------
-LPCWSTR CPort::UserCommandPattern() const
+BOOL CPort::EvictIfIdle(DWORD dwIdleTicks)
 {
-	if (m_pUserCommand)
-		return m_pUserCommand->PatternString();
-	else
-		return CPattern::szDefaultUserCommand;
+	//a port in the middle of a job call is not idle: don't wait for it
+	if (!TryEnterCriticalSection(&m_CSJob))
+		return FALSE;
+
+	//a job in progress, or an archive waiting for the next one, keeps the port as it is
+	BOOL bEvict = m_bMaterialized &&
+		m_hFile == INVALID_HANDLE_VALUE &&
+		!m_archive.IsOpen() &&
+		GetTickCount() - m_dwLastUsed >= dwIdleTicks;
+
+	if (bEvict)
+	{
+		//back to the settings alone: statistics and flight recorder stay
+		DeletePatterns();
+
+		if (m_pActive)
+		{
+			m_pActive->Release();
+			m_pActive = NULL;
+		}
+
+		if (m_pJobInfo2)
+		{
+			delete[] m_pJobInfo2;
+			m_pJobInfo2 = NULL;
+			m_cbJobInfo2 = 0;
+		}
+
+		delete[] m_szFileName;
+		m_szFileName = NULL;
+		delete[] m_szParent;
+		m_szParent = NULL;
+
+		ReleaseToken();
+		m_bLogonInvalidated = TRUE;
+
+		CloseWriteEvent();
+
+		m_dirCache.Clear();
+		m_counter.Detach();
+
+		m_bOutputPathReady = FALSE;
+		m_bMaterialized = FALSE;
+
+		UpdateJobMemory();
+
+		g_pLog->Debug(this, L"CPort::EvictIfIdle: %s idle for %u seconds, evicted",
+			m_szPortName, (GetTickCount() - m_dwLastUsed) / 1000);
+	}
+
+	LeaveCriticalSection(&m_CSJob);
+
+	return bEvict;
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::CloseExpiredArchive()
+{
+	//on a port that goes quiet no job would ever see the archive expire
+	CAutoCriticalSection acs(&m_CSJob);
+
+	if (m_archive.IsOpen() && !m_archive.InMember() && ArchiveExpired())
+		CloseArchive();
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::CloseWriteEvent()
+{
+	if (m_writeItem.hDoneEvt)
+	{
+		CloseHandle(m_writeItem.hDoneEvt);
+		m_writeItem.hDoneEvt = NULL;
+	}
 }
 
 //-------------------------------------------------------------------------------------
@@ -381,6 +407,10 @@ BOOL CPort::StartJob(DWORD nJobId, LPWSTR szJobTitle, LPWSTR szPrinterName)
 {
 	UNREFERENCED_PARAMETER(szJobTitle);
 
+	//patterns, token and output path are made ready by the first job
+	if (Materialize() != ERROR_SUCCESS)
+		return FALSE;
+
 	_ASSERTE(m_pPattern != NULL);
 
 	if (!m_pPattern)
@@ -390,10 +420,13 @@ BOOL CPort::StartJob(DWORD nJobId, LPWSTR szJobTitle, LPWSTR szPrinterName)
 
 	m_pPattern->Reset();
 
+	g_pLog->Debug(this, L"CPort::StartJob: job %u on %s", nJobId, szPrinterName);
+
 	//retrieve job info
-	DWORD cbNeeded;
+	CTraceSpan spanJob("GetJob", this);
+	DWORD cbNeeded = 0;
 
-	CPrinterHandle printer(szPrinterName);
+	CCachedPrinter printer(szPrinterName);
 
 	if (!printer.Handle())
 	{
@@ -401,30 +434,43 @@ BOOL CPort::StartJob(DWORD nJobId, LPWSTR szJobTitle, LPWSTR szPrinterName)
 		return FALSE;
 	}
 
-	//JOB_INFO_2
-	GetJobW(printer, nJobId, 2, NULL, 0, &cbNeeded);
+	//JOB_INFO_2 - start with the biggest size seen so far, so that
+	//a single call is enough most of the time
+	if (!m_pJobInfo2)
+	{
+		m_cbJobInfo2 = static_cast<DWORD>(s_cbJobInfo2Hint);
+		m_pJobInfo2 = reinterpret_cast<JOB_INFO_2W*>(new BYTE[m_cbJobInfo2]);
+	}
+
+	BOOL bRet = printer.GetJob(nJobId, 2, reinterpret_cast<LPBYTE>(m_pJobInfo2), m_cbJobInfo2, &cbNeeded);
 
-	if (!m_pJobInfo2 || m_cbJobInfo2 < cbNeeded)
+	if (!bRet && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
 	{
-		if (m_pJobInfo2)
-			delete[] m_pJobInfo2;
+		delete[] m_pJobInfo2;
 
 		m_cbJobInfo2 = cbNeeded;
 		m_pJobInfo2 = reinterpret_cast<JOB_INFO_2W*>(new BYTE[cbNeeded]);
+
+		LONG cbHint;
+		while ((cbHint = s_cbJobInfo2Hint) < static_cast<LONG>(cbNeeded) &&
+			InterlockedCompareExchange(&s_cbJobInfo2Hint, static_cast<LONG>(cbNeeded), cbHint) != cbHint)
+			;
+
+		bRet = printer.GetJob(nJobId, 2, reinterpret_cast<LPBYTE>(m_pJobInfo2), m_cbJobInfo2, &cbNeeded);
 	}
 
-	if (!GetJobW(printer, nJobId, 2, reinterpret_cast<LPBYTE>(m_pJobInfo2), m_cbJobInfo2, &cbNeeded))
+	if (!bRet)
 	{
 		g_pLog->Critical(this, L"CPort::StartJob: GetJobW failed (%i)", GetLastError());
 		return FALSE;
 	}
 
-	//determine if a job was submitted locally by comparing local netbios name
-	//with that stored into m_pJobInfo
-	WCHAR szComputerName[256];
-	DWORD nSize = LENGTHOF(szComputerName);
+	g_pLog->Debug(this, L"CPort::StartJob: \"%s\" from %s on %s (%u bytes)",
+		m_pJobInfo2->pDocument, m_pJobInfo2->pUserName, m_pJobInfo2->pMachineName, m_pJobInfo2->Size);
 
-	GetComputerNameW(szComputerName, &nSize);
+	//determine if a job was submitted locally by comparing local netbios name
+	//(resolved once at startup) with that stored into m_pJobInfo
+	LPCWSTR szComputerName = g_szComputerName;
 
 	m_bJobIsLocal = (
 		m_pJobInfo2 &&
@@ -455,34 +501,15 @@ BOOL CPort::StartJob(DWORD nJobId, LPWSTR szJobTitle, LPWSTR szPrinterName)
 
 	wcscpy_s(m_szPrinterName, m_cchPrinterName, szPrinterName);
 
-	//event to signal work to be done
-	if (!m_hWorkEvt)
-		if ((m_hWorkEvt = CreateEventW(NULL, FALSE, FALSE, NULL)) == NULL)
+	//event to signal a write has been done, kept for this job only;
+	//the writes themselves run on the shared writer pool
+	if (!m_writeItem.hDoneEvt)
+		if ((m_writeItem.hDoneEvt = CreateEventW(NULL, FALSE, FALSE, NULL)) == NULL)
 		{
 			g_pLog->Critical(this, L"CPort::StartJob: CreateEventW failed (%i)", GetLastError());
 			return FALSE;
 		}
 
-	//event to signal work has been done
-	if (!m_hDoneEvt)
-		if ((m_hDoneEvt = CreateEventW(NULL, FALSE, FALSE, NULL)) == NULL)
-		{
-			g_pLog->Critical(this, L"CPort::StartJob: CreateEventW failed (%i)", GetLastError());
-			return FALSE;
-		}
-
-	//the writing thread - since we can't create an "overlapped pipe"
-	//we use threads to mimick overlapped I/O, to avoid "waiting forever"
-	//on a write to a broken pipe
-	if (!m_hWriteThread)
-	{
-		DWORD dwId = 0;
-		m_threadData.pPort = this;
-		if ((m_hWriteThread = CreateThread(NULL, 0, WriteThreadProc, (LPVOID)&m_threadData, 0, &dwId)) == NULL)
-			return FALSE;
-		g_pLog->Debug(L"Worker thread started (id: 0x%0.8X)", dwId);
-	}
-
 	return TRUE;
 }
 
@@ -494,14 +521,39 @@ DWORD CPort::CreateOutputFile()
 	if (!m_pPattern)
 		return ERROR_CAN_NOT_COMPLETE;
 
+	/*container mode: jobs are appended to the current archive (not available when piping)*/
+	BOOL bArchive = (m_pActive->ArchiveMode() != ARCHIVEMODE_NONE && !m_pActive->PipeData());
+
+	if (bArchive && m_archive.IsOpen())
+	{
+		if (!ArchiveExpired())
+		{
+			if (!m_archive.BeginMember(m_nJobId))
+			{
+				g_pLog->Critical(this, L"CPort::CreateOutputFile: can't append to archive %s (%i)",
+					m_archive.Path(), GetLastError());
+				return ERROR_FILE_INVALID;
+			}
+
+			m_hFile = m_archive.Handle();
+			g_pLog->Debug(this, L"CPort::CreateOutputFile: member %u of %s", m_archive.Members() + 1, m_archive.Path());
+			return ERROR_SUCCESS;
+		}
+
+		CloseArchive();
+	}
+
+	CTraceSpan span("CreateOutputFile", this);
+	ULONGLONG ullStart = CPortStats::Now();
+
 	/*start composing the output filename*/
-	wcscpy_s(m_szFileName, LENGTHOF(m_szFileName), m_szOutputPath);
+	wcscpy_s(m_szFileName, MAX_PATH + 1, m_pActive->OutputPath());
 
 	/*append a backslash*/
 	size_t pos = wcslen(m_szFileName);
 	if (pos == 0 || m_szFileName[pos - 1] != L'\\')
 	{
-		wcscat_s(m_szFileName, LENGTHOF(m_szFileName), L"\\");
+		wcscat_s(m_szFileName, MAX_PATH + 1, L"\\");
 		pos++;
 	}
 
@@ -522,44 +574,91 @@ DWORD CPort::CreateOutputFile()
 	DWORD dwRet = ERROR_SUCCESS;
 	DWORD dwCreationDisposition;
 
-	if (m_bOverwrite)
+	if (m_pActive->Overwrite())
 		dwCreationDisposition = CREATE_ALWAYS; // request that a new file be created
 	else
 		dwCreationDisposition = CREATE_NEW; // request that we're also the creators of the file
 
+	/*ports and monitors sharing the output directory may share the counter too:
+	  start from the number it hands out instead of probing the names they took*/
+	CAutoIncrementSegment* pCounter = m_pActive->Overwrite() ? NULL : m_pPattern->Counter();
+	DWORD dwTaken = 0;
+	BOOL bTaken = FALSE;
+	BOOL bSeek = FALSE;
+
+	if (pCounter)
+	{
+		BOOL bAttached = m_counter.IsAttached();
+
+		if (m_counter.Attach(m_pActive->OutputPath()))
+		{
+			if (!bAttached)
+				g_pLog->Info(this, L"numbering from %s\\%s", m_pActive->OutputPath(), CTRFILE_NAME);
+
+			DWORD dwErr = m_counter.Take(&dwTaken);
+			if (dwErr == ERROR_SUCCESS)
+			{
+				bTaken = TRUE;
+				bSeek = pCounter->Seek(dwTaken);
+			}
+			else
+				g_pLog->Debug(this, L"CPort::CreateOutputFile: counter file not usable (%i), probing", dwErr);
+		}
+	}
+
 	/*start finding a file name*/
 	do
 	{
 		m_szFileName[pos] = L'\0';
 		szSearchPath[pos] = L'\0';
 
+		m_stats.Count(STAT_PROBES);
+
 		/*get current value from pattern*/
 		LPWSTR szFileName = m_pPattern->Value();
 		LPWSTR szSearchName = m_pPattern->SearchValue();
 
+		/*e.g. a very long job title: refuse the job rather than overflow*/
+		if (wcslen(szFileName) >= MAX_PATH + 1 - pos ||
+			wcslen(szSearchName) >= LENGTHOF(szSearchPath) - pos)
+		{
+			g_pLog->Critical(this, L"CPort::CreateOutputFile: file name too long (%s)", szFileName);
+			dwRet = ERROR_FILENAME_EXCED_RANGE;
+			goto cleanup;
+		}
+
 		/*append it to output file name*/
-		wcscat_s(m_szFileName, LENGTHOF(m_szFileName), szFileName);
+		wcscat_s(m_szFileName, MAX_PATH + 1, szFileName);
 		wcscat_s(szSearchPath, LENGTHOF(szSearchPath), szSearchName);
 
-		/*check if parent directory exists*/
-		GetFileParent(m_szFileName, m_szParent, LENGTHOF(m_szParent));
+		//is this file name usable?
+		//2009-08-04 we use search strings
+//		if (!m_pActive->Overwrite() && FileExists(m_szFileName))
+		/* moment A */
+		if (!m_pActive->Overwrite() && FilePatternExists(szSearchPath))
+		{
+			g_pLog->Debug(this, L"CPort::CreateOutputFile: %s exists", szSearchPath);
+			continue;
+		}
+
+		/*check if parent directory exists - only for the candidate we are going to use,
+		  so that probing a sharded (%S) layout doesn't create every shard on the way*/
+		GetFileParent(m_szFileName, m_szParent, MAX_PATH + 1);
 
-		if ((dwRet = RecursiveCreateFolder(m_szParent)) != ERROR_SUCCESS)
+		{
+			CTraceSpan spanFolder("CreateFolder", this);
+			dwRet = RecursiveCreateFolder(m_szParent);
+		}
+
+		if (dwRet != ERROR_SUCCESS)
 		{
 			g_pLog->Critical(this, L"CPort::CreateOutputFile: can't create output directory (%i)", dwRet);
 			dwRet = ERROR_DIRECTORY;
 			goto cleanup;
 		}
 
-		//is this file name usable?
-		//2009-08-04 we use search strings
-//		if (!m_bOverwrite && FileExists(m_szFileName))
-		/* moment A */
-		if (!m_bOverwrite && FilePatternExists(szSearchPath))
-			continue;
-
 		//ok we got a valid filename, create it
-		if (m_bPipeData)
+		if (m_pActive->PipeData())
 		{
 			if (!m_pUserCommand || !*m_pUserCommand->PatternString())
 			{
@@ -595,7 +694,7 @@ DWORD CPort::CreateOutputFile()
 			si.hStdInput = hStdinR;
 			si.hStdOutput = hStdoutW;
 			si.hStdError = hStdoutW;
-			if (m_bHideProcess)
+			if (m_pActive->HideProcess())
 			{
 				si.wShowWindow = SW_HIDE;
 			}
@@ -607,16 +706,19 @@ DWORD CPort::CreateOutputFile()
 			si.dwFlags |= STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
 
 			//create child process - give up in case of failure since we need to write to process
+			CTraceSpan spanSpawn("SpawnCommand", this);
 			BOOL bRes;
 			if (m_hToken)
 				bRes = CreateProcessAsUserW(m_hToken, NULL, m_pUserCommand->Value(), NULL, NULL,
-					TRUE, 0, NULL, (*m_szExecPath) ? m_szExecPath : NULL, &si, &m_procInfo);
+					TRUE, 0, NULL, (*m_pActive->ExecPath()) ? m_pActive->ExecPath() : NULL, &si, &m_procInfo);
 			else
 				bRes = CreateProcessW(NULL, m_pUserCommand->Value(), NULL, NULL,
-					TRUE, 0, NULL, (*m_szExecPath) ? m_szExecPath : NULL, &si, &m_procInfo);
+					TRUE, 0, NULL, (*m_pActive->ExecPath()) ? m_pActive->ExecPath() : NULL, &si, &m_procInfo);
 
 			DWORD dwErr = GetLastError();
 
+			g_pLog->Debug(this, L"CPort::CreateOutputFile: piping to %s (%i)", m_pUserCommand->Value(), bRes ? 0 : dwErr);
+
 			if (si.lpDesktop)
 				free(si.lpDesktop);
 
@@ -628,7 +730,7 @@ DWORD CPort::CreateOutputFile()
 			{
 				g_pLog->Critical(this, L"CPort::CreateOutputFile: CreateProcessW failed (%i)", dwErr);
 				g_pLog->Info(L" User command = %s", m_pUserCommand->Value());
-				g_pLog->Info(L" Execute from = %s", m_szExecPath);
+				g_pLog->Info(L" Execute from = %s", m_pActive->ExecPath());
 
 				WCHAR szBuf[128];
 				DWORD dwCb = LENGTHOF(szBuf);
@@ -642,6 +744,8 @@ DWORD CPort::CreateOutputFile()
 			}
 
 			m_bPipeActive = TRUE;
+			m_ullCommandStart = CPortStats::Now();
+			m_stats.Count(STAT_LAUNCHES);
 
 			//start reading thread - the thread will read and discard anything that comes from
 			//the external program, and finally close handle to our end of stdout
@@ -667,15 +771,52 @@ DWORD CPort::CreateOutputFile()
 			m_hFile = CreateFileW(m_szFileName, GENERIC_WRITE, 0,
 				NULL, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, NULL);
 
+			if (m_hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND)
+			{
+				//the directory was removed behind our back: forget what we knew and retry once
+				g_pLog->Debug(this, L"CPort::CreateOutputFile: %s is gone, creating it again", m_szParent);
+				m_dirCache.Invalidate(m_szParent);
+
+				DWORD dwErr = RecursiveCreateFolder(m_szParent);
+				if (dwErr == ERROR_SUCCESS)
+					m_hFile = CreateFileW(m_szFileName, GENERIC_WRITE, 0,
+						NULL, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, NULL);
+				else
+					SetLastError(dwErr);
+			}
+
 			if (m_hFile == INVALID_HANDLE_VALUE)
 			{
+				DWORD dwErr = GetLastError();
+				g_pLog->Debug(this, L"CPort::CreateOutputFile: CreateFileW failed on %s (%i)", m_szFileName, dwErr);
+				SetLastError(dwErr);
+
 				//did somebody already create the file between moment A and moment B?
-				if (!m_bOverwrite && GetLastError() == ERROR_FILE_EXISTS)
+				if (!m_pActive->Overwrite() && GetLastError() == ERROR_FILE_EXISTS)
 					continue;
 
 				g_pLog->Critical(this, L"CPort::CreateOutputFile: CreateFileW failed (%i)", GetLastError());
 				dwRet = ERROR_FILE_INVALID;
 			}
+			else if (bArchive)
+			{
+				//the file just created becomes the container for this and the next jobs
+				m_archive.Open(m_hFile, m_szFileName);
+
+				if (!m_archive.BeginMember(m_nJobId))
+				{
+					g_pLog->Critical(this, L"CPort::CreateOutputFile: can't append to archive %s (%i)",
+						m_archive.Path(), GetLastError());
+					m_archive.Close();
+					m_hFile = INVALID_HANDLE_VALUE;
+					dwRet = ERROR_FILE_INVALID;
+				}
+				else
+					g_pLog->Info(this, L"new archive %s", m_archive.Path());
+			}
+
+			if (m_hFile != INVALID_HANDLE_VALUE)
+				g_pLog->Debug(this, L"CPort::CreateOutputFile: writing to %s", m_szFileName);
 
 			goto cleanup;
 		}
@@ -686,9 +827,20 @@ DWORD CPort::CreateOutputFile()
 	dwRet = ERROR_FILE_EXISTS;
 
 cleanup:
+	/*the number we took went unused, or was stale: bring the counter up to date*/
+	if (dwRet == ERROR_SUCCESS && pCounter && m_counter.IsAttached() &&
+		!(bSeek && pCounter->Number() == dwTaken))
+	{
+		//the numbering wrapped around: the counter has to come down too
+		BOOL bForce = bTaken && (!bSeek || pCounter->Number() < dwTaken);
+		m_counter.Store(pCounter->Number() + 1, bForce);
+	}
+
 	if (m_hToken)
 		RevertToSelf();
 
+	m_stats.Time(HIST_FILENAME, ullStart);
+
 	return dwRet;
 }
 
@@ -704,74 +856,52 @@ BOOL CPort::WriteToFile(LPCVOID lpBuffer, DWORD cbBuffer, LPDWORD pcbWritten)
 			dwCode != STILL_ACTIVE)
 		{
 			m_bPipeActive = FALSE;
+			g_pLog->Debug(this, L"CPort::WriteToFile: user command is gone (exit code %u)", dwCode);
 			SetLastError(ERROR_CAN_NOT_COMPLETE);
 			return FALSE;
 		}
 	}
 
-	//pass buffer to the write thread
-	m_threadData.lpBuffer = lpBuffer;
-	m_threadData.cbBuffer = cbBuffer;
-	m_threadData.pcbWritten = pcbWritten;
+	//since we can't create an "overlapped pipe" the write runs on a pool
+	//thread, to avoid "waiting forever" on a write to a broken pipe
+	m_writeItem.hFile = m_hFile;
+	m_writeItem.lpBuffer = lpBuffer;
+	m_writeItem.cbBuffer = cbBuffer;
 
-	//wake up thread
-	SetEvent(m_hWorkEvt);
+	if (!g_pWriterPool->Submit(&m_writeItem))
+	{
+		g_pLog->Critical(this, L"CPort::WriteToFile: can't queue the write (%i)", GetLastError());
+		return FALSE;
+	}
+
+	CTraceSpan span("WaitWrite", this);
 
 	for (;;)
 	{
-		switch (WaitForSingleObject(m_hDoneEvt, 10000))
+		switch (WaitForSingleObject(m_writeItem.hDoneEvt, 10000))
 		{
 		case WAIT_OBJECT_0:
+			*pcbWritten = m_writeItem.cbWritten;
 			return TRUE;
 			break;
 		case WAIT_TIMEOUT:
+			g_pLog->Debug(this, L"CPort::WriteToFile: %u bytes still pending after 10 seconds", cbBuffer);
+			m_stats.Count(STAT_TIMEOUTS);
 			if (!m_bJobIsLocal || MessageBoxW(GetDesktopWindow(), szMsgUserCommandLocksSpooler, szAppTitle, MB_YESNO) == IDNO)
 			{
-				TerminateThread(m_hWriteThread, 1);
-				CloseHandle(m_hWriteThread);
-				m_hWriteThread = NULL;
+				g_pWriterPool->Cancel(&m_writeItem);
+				*pcbWritten = m_writeItem.cbWritten;
 				return FALSE;
 			}
 			break;
 		default:
+			//the item must not be in the pool when we return
+			g_pWriterPool->Cancel(&m_writeItem);
 			return FALSE;
 		}
 	}
 }
 
-//-------------------------------------------------------------------------------------
-DWORD WINAPI CPort::WriteThreadProc(LPVOID lpParam)
-{
-	LPTHREADDATA pData = static_cast<LPTHREADDATA>(lpParam);
-
-	_ASSERTE(pData != NULL);
-	_ASSERTE(pData->pPort != NULL);
-
-	for (;;)
-	{
-		//wait signal from main thread
-		if (WaitForSingleObject(pData->pPort->m_hWorkEvt, INFINITE) == WAIT_OBJECT_0)
-		{
-			EnterCriticalSection(&pData->csBuffer);
-
-			if (pData->lpBuffer == NULL)
-			{
-				LeaveCriticalSection(&pData->csBuffer);
-				SetEvent(pData->pPort->m_hDoneEvt);
-				return 0;
-			}
-
-			pData->bStatus = WriteFile(pData->pPort->m_hFile, pData->lpBuffer, pData->cbBuffer,
-				pData->pcbWritten, NULL);
-
-			LeaveCriticalSection(&pData->csBuffer);
-		}
-
-		//signal we're done
-		SetEvent(pData->pPort->m_hDoneEvt);
-	}
-}
-
 //-------------------------------------------------------------------------------------
 DWORD WINAPI CPort::ReadThreadProc(LPVOID lpParam)
 {
@@ -805,20 +935,57 @@ BOOL CPort::EndJob()
 	if (!m_pPattern)
 		return FALSE;
 
-	//done with the file, close it and flush buffers
-	FlushFileBuffers(m_hFile);
-	CloseHandle(m_hFile);
+	if (m_archive.InMember())
+	{
+		//container mode: complete the member, the archive stays open
+		if (!m_archive.EndMember(JobId(), UserName(), ComputerName(), JobTitle()))
+		{
+			g_pLog->Error(this, L"CPort::EndJob: can't complete archive member (%i)", GetLastError());
+			m_flightRec.Dump(this, L"archive member not completed");
+		}
+	}
+	else
+	{
+		//done with the file, close it and flush buffers
+		CTraceSpan span("CloseOutput", this);
+		FlushFileBuffers(m_hFile);
+		CloseHandle(m_hFile);
+	}
 	m_hFile = INVALID_HANDLE_VALUE;
 	m_bPipeActive = FALSE;
 
+	CloseWriteEvent();
+
 	//tell the spooler we are done with the job
-	CPrinterHandle printer(m_szPrinterName);
+	CCachedPrinter printer(m_szPrinterName);
 
 	if (printer.Handle())
-		SetJobW(printer, JobId(), 0, NULL, JOB_CONTROL_DELETE);
+		printer.SetJob(JobId(), JOB_CONTROL_DELETE);
+
+	//in container mode the user command is run when an archive is completed
+	if (m_archive.IsOpen())
+	{
+		if (ArchiveFull())
+			CloseArchive();
+	}
+	else
+		RunUserCommand();
+
+	if (m_szFileName)
+		*m_szFileName = L'\0';
+
+	m_dwLastUsed = GetTickCount();
+
+	UpdateJobMemory();
 
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::RunUserCommand()
+{
 	//start user command
-	if (!m_bPipeData && m_pUserCommand && *m_pUserCommand->PatternString())
+	if (!m_pActive->PipeData() && m_pUserCommand && *m_pUserCommand->PatternString())
 	{
 		STARTUPINFOW si = { 0 };
 
@@ -826,30 +993,44 @@ BOOL CPort::EndJob()
 
 		si.cb = sizeof(si);
 
+		CTraceSpan span("SpawnCommand", this);
+
 		//we're not going to give up in case of failure
 		if (m_hToken)
 			CreateProcessAsUserW(m_hToken, NULL, m_pUserCommand->Value(), NULL, NULL,
-				FALSE, 0, NULL, (*m_szExecPath) ? m_szExecPath : NULL, &si, &m_procInfo);
+				FALSE, 0, NULL, (*m_pActive->ExecPath()) ? m_pActive->ExecPath() : NULL, &si, &m_procInfo);
 		else
 			CreateProcessW(NULL, m_pUserCommand->Value(), NULL, NULL,
-				FALSE, 0, NULL, (*m_szExecPath) ? m_szExecPath : NULL, &si, &m_procInfo);
+				FALSE, 0, NULL, (*m_pActive->ExecPath()) ? m_pActive->ExecPath() : NULL, &si, &m_procInfo);
+
+		if (m_procInfo.hProcess)
+		{
+			m_ullCommandStart = CPortStats::Now();
+			m_stats.Count(STAT_LAUNCHES);
+		}
 	}
 
 	//maybe wait and close handles to child process
 	if (m_procInfo.hProcess)
 	{
-		if (m_bWaitTermination)
+		if (m_pActive->WaitTermination())
 		{
+			CTraceSpan span("WaitCommand", this);
 			BOOL bDone = FALSE;
 
 			while (!bDone)
 			{
-				switch (WaitForSingleObject(m_procInfo.hProcess, m_dwWaitTimeout ? m_dwWaitTimeout * 1000 : INFINITE))
+				switch (WaitForSingleObject(m_procInfo.hProcess, m_pActive->WaitTimeout() ? m_pActive->WaitTimeout() * 1000 : INFINITE))
 				{
 				case WAIT_OBJECT_0:
+					m_stats.Time(HIST_COMMAND, m_ullCommandStart);
 					bDone = TRUE;
 					break;
 				case WAIT_TIMEOUT:
+					m_stats.Count(STAT_TIMEOUTS);
+					g_pLog->Debug(this, L"CPort::RunUserCommand: process %u still running after %u seconds",
+						m_procInfo.dwProcessId, m_pActive->WaitTimeout());
+					m_flightRec.Dump(this, L"user command timed out");
 					if (!m_bJobIsLocal || MessageBoxW(GetDesktopWindow(), szMsgUserCommandLocksSpooler, szAppTitle, MB_YESNO) == IDNO)
 						bDone = TRUE;
 					break;
@@ -858,31 +1039,82 @@ BOOL CPort::EndJob()
 		}
 		CloseHandle(m_procInfo.hProcess);
 		CloseHandle(m_procInfo.hThread);
+		ZeroMemory(&m_procInfo, sizeof(m_procInfo));
 	}
+}
 
-	*m_szFileName = L'\0';
-
-	return TRUE;
+//-------------------------------------------------------------------------------------
+BOOL CPort::ArchiveExpired() const
+{
+	return m_pActive->ArchiveMaxAge() > 0 && m_archive.AgeMinutes() >= m_pActive->ArchiveMaxAge();
 }
 
 //-------------------------------------------------------------------------------------
-void CPort::SetConfig(LPPORTCONFIG pConfig)
+BOOL CPort::ArchiveFull() const
 {
-	g_pLog->SetLogLevel(pConfig->nLogLevel);
-	
-	if (m_hToken)
+	if (m_pActive->ArchiveMaxSize() > 0 &&
+		m_archive.Size() >= static_cast<ULONGLONG>(m_pActive->ArchiveMaxSize()) * 1024 * 1024)
 	{
-		CloseHandle(m_hToken);
-		m_hToken = NULL;
+		return TRUE;
 	}
-	
-	Initialize(pConfig);
-	m_bLogonInvalidated = TRUE;
 
-	if (Logon() != ERROR_SUCCESS)
+	if (m_pActive->ArchiveMaxJobs() > 0 && m_archive.Members() >= m_pActive->ArchiveMaxJobs())
+		return TRUE;
+
+	return ArchiveExpired();
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::CloseArchive()
+{
+	if (!m_archive.IsOpen())
+		return;
+
+	//%f and %p in the user command refer to the archive just completed
+	wcscpy_s(m_szFileName, MAX_PATH + 1, m_archive.Path());
+	GetFileParent(m_szFileName, m_szParent, MAX_PATH + 1);
+
+	g_pLog->Info(this, L"closing archive %s (%u jobs)", m_szFileName, m_archive.Members());
+
+	if (!m_archive.Close())
+		g_pLog->Error(this, L"CPort::CloseArchive: can't finalize archive (%i)", GetLastError());
+
+	RunUserCommand();
+
+	*m_szFileName = L'\0';
+	*m_szParent = L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::SetConfig(LPPORTCONFIG2 pConfig)
+{
+	//copy on write: a job in progress keeps the settings it started with,
+	//the next one picks these up (see ActivateSettings)
+	CPortSettings* pNew = new CPortSettings(pConfig);
+
+	g_pLog->SetLogLevel(pConfig->nLogLevel);
+
 	{
-		g_pLog->Error(this, L"CPort::SetConfig: can't logon user");
+		CAutoCriticalSection acs(&m_CSConfig);
+
+		//tell which values must be written back
+		m_dwDirtyFields |= pNew->ChangedFields(m_pSettings);
+
+		m_pSettings->Release();
+		m_pSettings = pNew;
 	}
+
+	g_pLog->Info(this, L"settings changed, in effect from the next job");
+}
+
+//-------------------------------------------------------------------------------------
+void CPort::GetConfig(LPPORTCONFIG2 pConfig)
+{
+	CAutoCriticalSection acs(&m_CSConfig);
+
+	wcscpy_s(pConfig->szPortName, LENGTHOF(pConfig->szPortName), PortName());
+	m_pSettings->GetConfig(pConfig);
+	pConfig->nLogLevel = g_pLog->GetLogLevel();
 }
 
 //-------------------------------------------------------------------------------------
@@ -905,8 +1137,6 @@ LPCWSTR CPort::ComputerName() const
 //-------------------------------------------------------------------------------------
 LPCWSTR CPort::Bin() const
 {
-	static WCHAR szBinName[16];
-
 	if (!m_pJobInfo2 || !m_pJobInfo2->pDevMode || (m_pJobInfo2->pDevMode->dmFields & DM_DEFAULTSOURCE) == 0)
 		return L"";
 
@@ -947,54 +1177,68 @@ LPCWSTR CPort::Bin() const
 	default:
 		if (m_pJobInfo2->pDevMode->dmDefaultSource >= DMBIN_USER)
 		{
-			swprintf_s(szBinName, LENGTHOF(szBinName), L"USER%hi", m_pJobInfo2->pDevMode->dmDefaultSource);
+			swprintf_s(m_szBinName, LENGTHOF(m_szBinName), L"USER%hi", m_pJobInfo2->pDevMode->dmDefaultSource);
 		}
 		else
 		{
-			swprintf_s(szBinName, LENGTHOF(szBinName), L"%hi", m_pJobInfo2->pDevMode->dmDefaultSource);
+			swprintf_s(m_szBinName, LENGTHOF(m_szBinName), L"%hi", m_pJobInfo2->pDevMode->dmDefaultSource);
 		}
-		return szBinName;
+		return m_szBinName;
 	}
 }
 
 //-------------------------------------------------------------------------------------
 DWORD CPort::Logon()
 {
-	if (!m_bLogonInvalidated)
+	if (!m_bLogonInvalidated && !(m_pTokenEntry && m_pTokenEntry->bSuperseded))
 		return ERROR_SUCCESS;
 
-	if (m_hToken)
-	{
-		CloseHandle(m_hToken);
-		m_hToken = NULL;
-	}
+	ReleaseToken();
 
-	if (!*m_szUser)
+	if (!*m_pActive->User())
 		return ERROR_SUCCESS;
 
-	BOOL bUNC = wcschr(m_szUser, L'@') != NULL;
+	BOOL bUNC = wcschr(m_pActive->User(), L'@') != NULL;
 
-	if (!bUNC && !*m_szDomain)
+	if (!bUNC && !*m_pActive->Domain())
 	{
 		g_pLog->Error(this, L"CPort::Logon: empty domain");
 		return ERROR_BAD_ARGUMENTS;
 	}
 
-	if (!GetPrimaryToken(m_szUser, bUNC ? NULL : m_szDomain, m_szPassword, &m_hToken, &m_bRestrictedToken))
+	CTraceSpan span("Logon", this);
+
+	//ports running as the same user share the token
+	DWORD dwErr = g_pTokenCache->Acquire(m_pActive->User(), bUNC ? NULL : m_pActive->Domain(), m_pActive->Password(), &m_pTokenEntry);
+	if (dwErr != ERROR_SUCCESS)
 	{
-		DWORD dwErr = GetLastError();
 		g_pLog->Error(this, L"CPort::Logon: GetPrimaryToken failed - user = \"%s\", domain = \"%s\" (%i)",
-			m_szUser,
-			bUNC ? m_szDomain : L"<empty>",
+			m_pActive->User(),
+			bUNC ? m_pActive->Domain() : L"<empty>",
 			dwErr);
 		return dwErr;
 	}
 
+	m_hToken = m_pTokenEntry->hToken;
+	m_bRestrictedToken = m_pTokenEntry->bRestrictedToken;
 	m_bLogonInvalidated = FALSE;
 
 	return ERROR_SUCCESS;
 }
 
+//-------------------------------------------------------------------------------------
+void CPort::ReleaseToken()
+{
+	//the token belongs to the cache, we just drop our reference
+	if (m_pTokenEntry)
+	{
+		g_pTokenCache->Release(m_pTokenEntry);
+		m_pTokenEntry = NULL;
+	}
+
+	m_hToken = NULL;
+}
+
 //-------------------------------------------------------------------------------------
 DWORD CPort::RecursiveCreateFolder(LPCWSTR szPath)
 {
@@ -1016,20 +1260,37 @@ DWORD CPort::RecursiveCreateFolder(LPCWSTR szPath)
 			len--;
 		}
 	}
-	/*only drive letter left or the directory already exists*/
-	if (len < 3 || DirectoryExists(pPath))
+	/*only drive letter left*/
+	if (len < 3)
 		return ERROR_SUCCESS;
+
+	/*we already know this one: no need to ask the file system*/
+	DWORD dwRet;
+	if (m_dirCache.Lookup(pPath, &dwRet))
+		return dwRet;
+
+	if (DirectoryExists(pPath))
+	{
+		m_dirCache.AddExisting(pPath);
+		return ERROR_SUCCESS;
+	}
 	else
 	{
 		GetFileParent(pPath, szParent, LENGTHOF(szParent));
 		if (wcscmp(pPath, szParent) == 0)
 			return ERROR_SUCCESS;
 		/*our parent must exist before we can get created*/
-		DWORD dwRet = RecursiveCreateFolder(szParent);
+		dwRet = RecursiveCreateFolder(szParent);
 		if (dwRet != ERROR_SUCCESS)
 			return dwRet;
-		if (!CreateDirectoryW(pPath, NULL))
-			return GetLastError();
+		/*somebody else may have created it in the meantime*/
+		if (!CreateDirectoryW(pPath, NULL) &&
+			(dwRet = GetLastError()) != ERROR_ALREADY_EXISTS)
+		{
+			m_dirCache.AddFailed(pPath, dwRet);
+			return dwRet;
+		}
+		m_dirCache.AddExisting(pPath);
 		return ERROR_SUCCESS;
 	}
 }
@@ -1047,7 +1308,7 @@ DWORD CPort::CreateOutputPath()
 		}
 	}
 
-	DWORD dwRet = RecursiveCreateFolder(m_szOutputPath);
+	DWORD dwRet = RecursiveCreateFolder(m_pActive->OutputPath());
 
 	if (m_hToken)
 		RevertToSelf();
@@ -19,92 +19,119 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
 #include <LMCons.h>
+#endif
 #include "pattern.h"
-#include "..\common\config.h"
-#include "..\common\defs.h"
+#include "patcontext.h"
+#include "archive.h"
+#include "dircache.h"
+#include "flightrec.h"
+#include "portsettings.h"
+#include "stats.h"
+#include "tokencache.h"
+#include "writerpool.h"
+#include "../common/config.h"
+#include "../common/ctrfile.h"
+#include "../common/defs.h"
 
-class CPort
+class CPort : public CPatternContext
 {
 private:
 	void Initialize();
 	void Initialize(LPCWSTR szPortName);
-	void Initialize(LPPORTCONFIG pConfig);
+	void Initialize(LPPORTCONFIG2 pConfig);
 
 public:
 	CPort();
 	explicit CPort(LPCWSTR szPortName);
-	explicit CPort(LPPORTCONFIG pPortConfig);
+	explicit CPort(LPPORTCONFIG2 pPortConfig);
 	virtual ~CPort();
 	CPattern* GetPattern() const { return m_pPattern; }
-	void SetFilePatternString(LPCWSTR szPattern);
-	void SetUserCommandString(LPCWSTR szPattern);
 	BOOL StartJob(DWORD nJobId, LPWSTR szJobTitle, LPWSTR szPrinterName);
 	DWORD CreateOutputFile();
 	BOOL WriteToFile(LPCVOID lpBuffer, DWORD cbBuffer,
 		LPDWORD pcbWritten);
 	BOOL EndJob();
-	void SetConfig(LPPORTCONFIG pConfig);
+	void SetConfig(LPPORTCONFIG2 pConfig);
+	void GetConfig(LPPORTCONFIG2 pConfig);
 	DWORD Logon();
 	DWORD CreateOutputPath();
+	DWORD Materialize();
+	BOOL EvictIfIdle(DWORD dwIdleTicks);
+	void CloseExpiredArchive();
+	//the port list owns the port; the handles the spooler opens on it, and a save
+	//that runs without the list lock, pin it
+	void AddRef() { InterlockedIncrement(&m_nRefs); }
+	void Release();
+	void MarkDeleted() { m_bDeleted = TRUE; }
 
 public:
 	LPCWSTR PortName() const { return m_szPortName; }
-	LPCWSTR OutputPath() const { return m_szOutputPath; }
-	LPCWSTR ExecPath() const { return m_szExecPath; }
-	LPCWSTR FilePattern() const;
-	LPCWSTR UserCommandPattern() const;
-	BOOL Overwrite() const { return m_bOverwrite; }
-	BOOL WaitTermination() const { return m_bWaitTermination; }
-	DWORD WaitTimeout() const { return m_dwWaitTimeout; }
-	BOOL PipeData() const { return m_bPipeData; }
-	BOOL HideProcess() const { return m_bHideProcess; }
-	LPWSTR PrinterName() const { return m_szPrinterName; }
+	//the configured settings, which the next job will use: hold the config lock
+	LPCWSTR OutputPath() const { return m_pSettings->OutputPath(); }
+	LPCWSTR ExecPath() const { return m_pSettings->ExecPath(); }
+	LPCWSTR FilePattern() const { return m_pSettings->FilePattern(); }
+	LPCWSTR UserCommandPattern() const { return m_pSettings->UserCommandPattern(); }
+	BOOL Overwrite() const { return m_pSettings->Overwrite(); }
+	BOOL WaitTermination() const { return m_pSettings->WaitTermination(); }
+	DWORD WaitTimeout() const { return m_pSettings->WaitTimeout(); }
+	BOOL PipeData() const { return m_pSettings->PipeData(); }
+	BOOL HideProcess() const { return m_pSettings->HideProcess(); }
+	DWORD ArchiveMode() const { return m_pSettings->ArchiveMode(); }
+	DWORD ArchiveMaxSize() const { return m_pSettings->ArchiveMaxSize(); }
+	DWORD ArchiveMaxAge() const { return m_pSettings->ArchiveMaxAge(); }
+	DWORD ArchiveMaxJobs() const { return m_pSettings->ArchiveMaxJobs(); }
+	LPCWSTR User() const { return m_pSettings->User(); }
+	LPCWSTR Domain() const { return m_pSettings->Domain(); }
+	LPCWSTR Password() const { return m_pSettings->Password(); }
+	LPCWSTR PrinterName() const { return m_szPrinterName; }
 	DWORD JobId() const { return m_nJobId; }
 	LPCWSTR JobTitle() const { return m_pJobInfo2 ? m_pJobInfo2->pDocument : (LPWSTR)L""; }
 	LPCWSTR UserName() const { return m_pJobInfo2 ? m_pJobInfo2->pUserName : (LPWSTR)L""; }
 	LPCWSTR ComputerName() const;
-	LPCWSTR FileName() const { return m_szFileName; }
-	LPCWSTR Path() const { return m_szParent; }
+	LPCWSTR FileName() const { return m_szFileName ? m_szFileName : L""; }
+	LPCWSTR Path() const { return m_szParent ? m_szParent : L""; }
 	LPCWSTR Bin() const;
-	LPCWSTR User() const { return m_szUser; }
-	LPCWSTR Domain() const { return m_szDomain; }
-	LPCWSTR Password() const { return m_szPassword; }
+	WORD LogId() const { return m_nLogId; }
+	BOOL ClaimLogDefinition() { return InterlockedExchange(&m_nLogDefined, 1) == 0; }
+	CFlightRecorder& FlightRecorder() { return m_flightRec; }
+	CPortStats& Stats() { return m_stats; }
+	LPCRITICAL_SECTION GetConfigCriticalSection() { return &m_CSConfig; }
+	LPCRITICAL_SECTION GetJobCriticalSection() { return &m_CSJob; }
+	DWORD DirtyFields() const { return m_dwDirtyFields; }
+	void SetDirtyFields(DWORD dwFields) { m_dwDirtyFields = dwFields; }
+	BOOL IsMaterialized() const { return m_bMaterialized; }
+	BOOL IsDeleted() const { return m_bDeleted; }
+	size_t MemoryUsage();
 
 private:
-	typedef struct tagTHREADDATA
-	{
-		CPort* pPort;
-		LPCVOID lpBuffer;
-		DWORD cbBuffer;
-		LPDWORD pcbWritten;
-		BOOL bStatus;
-		CRITICAL_SECTION csBuffer;
-	} THREADDATA, *LPTHREADDATA;
-	static DWORD WINAPI WriteThreadProc(LPVOID lpParam);
 	static DWORD WINAPI ReadThreadProc(LPVOID lpParam);
 	DWORD RecursiveCreateFolder(LPCWSTR szPath);
+	void ReleaseToken();
+	void RunUserCommand();
+	BOOL ArchiveExpired() const;
+	BOOL ArchiveFull() const;
+	void CloseArchive();
+	void CloseWriteEvent();
+	void LogConfig();
+	void ActivateSettings();
+	void DeletePatterns();
+	void UpdateJobMemory();
 
 private:
-	THREADDATA m_threadData;
-	HANDLE m_hWriteThread;
-	HANDLE m_hWorkEvt;
-	HANDLE m_hDoneEvt;
-	WCHAR m_szPortName[MAX_PATH + 1];
-	WCHAR m_szOutputPath[MAX_PATH + 1];
-	WCHAR m_szExecPath[MAX_PATH + 1];
+	CWriterPool::WRITEITEM m_writeItem;
+	LPCWSTR m_szPortName;		//interned in g_pStrings
+	CPortSettings* m_pSettings;	//configured, swapped by SetConfig under m_CSConfig
+	CPortSettings* m_pActive;	//pinned by the job thread, what patterns and token were made for
 	LPWSTR m_szPrinterName;
 	DWORD m_cchPrinterName;
 	CPattern* m_pPattern;
 	CPattern* m_pUserCommand;
-	BOOL m_bOverwrite;
+	size_t m_cbJobMemory;		//see UpdateJobMemory
 //	WCHAR m_szUserCommand[MAXUSERCOMMMAND];
-	BOOL m_bWaitTermination;
-	DWORD m_dwWaitTimeout;
-	BOOL m_bPipeData;
 	BOOL m_bPipeActive;
-	BOOL m_bHideProcess;
-	WCHAR m_szFileName[MAX_PATH + 1];
+	LPWSTR m_szFileName;		//MAX_PATH + 1, allocated while materialized
 	HANDLE m_hFile;
 	PROCESS_INFORMATION m_procInfo;
 //	LPWSTR m_szCommandLine;
@@ -112,11 +139,26 @@ private:
 	JOB_INFO_2W* m_pJobInfo2;
 	DWORD m_cbJobInfo2;
 	BOOL m_bJobIsLocal;
-	WCHAR m_szParent[MAX_PATH + 1];
-	WCHAR m_szUser[MAX_USER];
-	WCHAR m_szDomain[MAX_DOMAIN];
-	WCHAR m_szPassword[MAX_PASSWORD];
+	LPWSTR m_szParent;			//MAX_PATH + 1, allocated while materialized
+	mutable WCHAR m_szBinName[16];
 	HANDLE m_hToken;
+	CTokenCache::LPTOKENENTRY m_pTokenEntry;
 	BOOL m_bRestrictedToken;
 	BOOL m_bLogonInvalidated;
+	CArchive m_archive;
+	CDirCache m_dirCache;
+	CCounterFile m_counter;		//%i shared through the output directory, if it has one
+	WORD m_nLogId;
+	volatile LONG m_nLogDefined;
+	CFlightRecorder m_flightRec;
+	CPortStats m_stats;
+	ULONGLONG m_ullCommandStart;
+	CRITICAL_SECTION m_CSConfig;
+	CRITICAL_SECTION m_CSJob;
+	DWORD m_dwDirtyFields;
+	volatile LONG m_nRefs;
+	BOOL m_bDeleted;			//removed from the list and the registry, under m_CSConfig
+	BOOL m_bMaterialized;
+	BOOL m_bOutputPathReady;
+	DWORD m_dwLastUsed;
 };
@@ -21,11 +21,16 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "portlist.h"
 #include "pattern.h"
 #include "log.h"
-#include "..\common\autoclean.h"
-#include "..\common\monutils.h"
+#include "strtable.h"
+#include "writerpool.h"
+#include "../common/autoclean.h"
+#include "../common/cfgsnap.h"
+#include "../common/monutils.h"
+#ifdef _WIN32
 #include <winsplp.h>
-#include <openssl\evp.h>
-#include <openssl\rand.h>
+#endif
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 
 CPortList* g_pPortList = NULL;
 LPCWSTR CPortList::szOutputPathKey = L"OutputPath";
@@ -37,16 +42,143 @@ LPCWSTR CPortList::szWaitTerminationKey = L"WaitTermination";
 LPCWSTR CPortList::szWaitTimeoutKey = L"WaitTimeout";
 LPCWSTR CPortList::szPipeDataKey = L"PipeData";
 LPCWSTR CPortList::szLogLevelKey = L"LogLevel";
+LPCWSTR CPortList::szLogFormatKey = L"LogFormat";
+LPCWSTR CPortList::szStatsIntervalKey = L"StatsInterval";
 LPCWSTR CPortList::szUserKey = L"User";
 LPCWSTR CPortList::szDomainKey = L"Domain";
 LPCWSTR CPortList::szPasswordKey = L"Password";
 LPCWSTR CPortList::szHideProcessKey = L"HideProcess";
+LPCWSTR CPortList::szArchiveModeKey = L"ArchiveMode";
+LPCWSTR CPortList::szArchiveMaxSizeKey = L"ArchiveMaxSize";
+LPCWSTR CPortList::szArchiveMaxAgeKey = L"ArchiveMaxAge";
+LPCWSTR CPortList::szArchiveMaxJobsKey = L"ArchiveMaxJobs";
+LPCWSTR CPortList::szGenerationKey = L"ConfigGeneration";
+LPCWSTR CPortList::szPortIdleTimeoutKey = L"PortIdleTimeout";
 
 static BYTE aeskey[] = {
 	0x73, 0xb6, 0x45, 0x0c, 0x24, 0xc9, 0xfe, 0x6b, 0x74, 0xf8, 0xc2, 0xbe, 0x94, 0xd4, 0xdf, 0xd4,
 	0x40, 0xd3, 0xdd, 0xdd, 0x8e, 0xa3, 0x2a, 0x56, 0x89, 0x3c, 0x75, 0xd8, 0x45, 0xb7, 0xb9, 0x34,
 };
 
+//-------------------------------------------------------------------------------------
+static HANDLE SwitchToLocalSystem(LPCWSTR szCaller)
+{
+	//If we're on an UAC enabled system, we're running under unprivileged
+	//user account. Let's revert to ourselves for a while...
+	HANDLE hToken = NULL;
+	if (IsUACEnabled())
+	{
+		g_pLog->Debug(L"%s: running on UAC enabled OS, switching to local system", szCaller);
+		OpenThreadToken(GetCurrentThread(), TOKEN_IMPERSONATE, TRUE, &hToken);
+		RevertToSelf();
+	}
+	return hToken;
+}
+
+//-------------------------------------------------------------------------------------
+static void SwitchBackToUser(HANDLE hToken, LPCWSTR szCaller)
+{
+	//let's revert to unprivileged user
+	if (hToken)
+	{
+		if (!SetThreadToken(NULL, hToken))
+			g_pLog->Error(L"%s: SetThreadToken failed (%i)", szCaller, GetLastError());
+		CloseHandle(hToken);
+		g_pLog->Debug(L"%s: back to unprivileged user", szCaller);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL SetStringValue(HANDLE hKey, LPCWSTR szName, LPCWSTR szValue)
+{
+	PMONITORREG pReg = g_pMonitorInit->pMonitorReg;
+	return pReg->fpSetValue(hKey, szName, REG_SZ, reinterpret_cast<LPBYTE>(const_cast<LPWSTR>(szValue)),
+		static_cast<DWORD>(wcslen(szValue) * sizeof(WCHAR)), g_pMonitorInit->hSpooler) == ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL SetDwordValue(HANDLE hKey, LPCWSTR szName, DWORD dwValue)
+{
+	PMONITORREG pReg = g_pMonitorInit->pMonitorReg;
+	return pReg->fpSetValue(hKey, szName, REG_DWORD, reinterpret_cast<LPBYTE>(&dwValue),
+		sizeof(dwValue), g_pMonitorInit->hSpooler) == ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD EncryptPassword(LPCWSTR szPassword, LPBYTE pwBlob)
+{
+	//16 bytes of IV, then the password (terminator included) in AES-256-CBC
+	LPBYTE iv = pwBlob;
+	LPBYTE pData = pwBlob + 16;
+
+	int outlen1 = 0, outlen2 = 0;
+	int len = static_cast<int>((wcslen(szPassword) + 1) * sizeof(WCHAR));
+	DWORD cbBlob = 0;
+
+	RAND_bytes(iv, 16);
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (ctx &&
+		EVP_EncryptInit(ctx, EVP_aes_256_cbc(), aeskey, iv) &&
+		EVP_EncryptUpdate(ctx, pData, &outlen1, reinterpret_cast<const BYTE*>(szPassword), len) &&
+		EVP_EncryptFinal(ctx, pData + outlen1, &outlen2) &&
+		EVP_CIPHER_CTX_cleanup(ctx))
+	{
+		cbBlob = 16 + outlen1 + outlen2;
+	}
+
+	if (ctx)
+		EVP_CIPHER_CTX_free(ctx);
+
+	return cbBlob;
+}
+
+//-------------------------------------------------------------------------------------
+static void DecryptPassword(LPBYTE pwBlob, DWORD cbBlob, LPWSTR szPassword)
+{
+	*szPassword = L'\0';
+
+	//IV and at least one block
+	if (cbBlob < 32)
+		return;
+
+	LPBYTE iv = pwBlob;
+	LPBYTE pwData = pwBlob + 16;
+	int outlen1, outlen2;
+
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (ctx &&
+		EVP_DecryptInit(ctx, EVP_aes_256_cbc(), aeskey, iv) &&
+		EVP_DecryptUpdate(ctx, reinterpret_cast<LPBYTE>(szPassword), &outlen1, pwData, cbBlob - 16) &&
+		EVP_DecryptFinal(ctx, reinterpret_cast<LPBYTE>(szPassword) + outlen1, &outlen2) &&
+		EVP_CIPHER_CTX_cleanup(ctx))
+	{
+		int len = (static_cast<unsigned long long>(outlen1) + outlen2) / sizeof(WCHAR);
+
+		if (len == 0)
+			len = 1;
+
+		szPassword[len - 1] = L'\0';
+	}
+	else
+	{
+		*szPassword = L'\0';
+	}
+
+	if (ctx)
+		EVP_CIPHER_CTX_free(ctx);
+}
+
+//-------------------------------------------------------------------------------------
+static LPCWSTR SnapshotFileName(LPWSTR szPath, size_t cchPath)
+{
+	GetSystemDirectoryW(szPath, static_cast<UINT>(cchPath));
+	wcscat_s(szPath, cchPath, L"\\mfilemon.snap");
+	return szPath;
+}
+
 //-------------------------------------------------------------------------------------
 CPortList::CPortList(LPCWSTR szPortMonitorName, LPCWSTR szPortDesc)
 {
@@ -54,6 +186,16 @@ CPortList::CPortList(LPCWSTR szPortMonitorName, LPCWSTR szPortDesc)
 	wcscpy_s(m_szMonitorName, LENGTHOF(m_szMonitorName), szPortMonitorName);
 	wcscpy_s(m_szPortDesc, LENGTHOF(m_szPortDesc), szPortDesc);
 	m_pFirstPortRec = NULL;
+	m_nUpdates = 0;
+	m_nSavedLogLevel = static_cast<DWORD>(-1);
+	m_nGeneration = 0;
+	m_bSnapshotStale = FALSE;
+	m_hSweepThread = NULL;
+	m_hStopSweepEvt = NULL;
+	m_nIdleMinutes = 0;
+	m_pEnumImages[0] = NULL;
+	m_pEnumImages[1] = NULL;
+	InitializeCriticalSection(&m_CSEnum);
 	RAND_poll();
 }
 
@@ -62,6 +204,10 @@ CPortList::~CPortList()
 {
 	LPPORTREC pNext = NULL;
 
+	//the dumper and the sweeper walk the list
+	m_statsDumper.Stop();
+	StopSweeper();
+
 	while (m_pFirstPortRec)
 	{
 		pNext = m_pFirstPortRec->m_pNext;
@@ -69,6 +215,9 @@ CPortList::~CPortList()
 		m_pFirstPortRec = pNext;
 	}
 
+	InvalidateEnumImages();
+
+	DeleteCriticalSection(&m_CSEnum);
 	DeleteCriticalSection(&m_CSPortList);
 }
 
@@ -91,6 +240,77 @@ CPort* CPortList::FindPort(LPCWSTR szPortName)
 		: NULL;
 }
 
+//-------------------------------------------------------------------------------------
+CPort* CPortList::PinPort(LPCWSTR szPortName)
+{
+	//FindPort, with a reference for the caller, who releases it
+	CAutoCriticalSection acs(GetCriticalSection());
+
+	CPort* pPort = FindPort(szPortName);
+
+	if (pPort)
+		pPort->AddRef();
+
+	return pPort;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::FormatStats(CStatsText* pText, CPort* pPort)
+{
+	//one metric family at a time, with a sample per port
+	CAutoCriticalSection acs(GetCriticalSection());
+
+	for (int nFamily = 0; nFamily < STATS_FAMILIES; nFamily++)
+	{
+		CPortStats::FormatHeader(pText, nFamily);
+
+		if (pPort)
+		{
+			pPort->Stats().Format(pText, nFamily, pPort->PortName());
+			continue;
+		}
+
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+			pPortRec->m_pPort->Stats().Format(pText, nFamily, pPortRec->m_pPort->PortName());
+	}
+
+	pText->Printf("# TYPE mfilemon_port_memory_bytes gauge\n"
+		"# HELP mfilemon_port_memory_bytes Memory held by a port, shared settings excluded.\n");
+
+	if (pPort)
+		CPortStats::FormatGauge(pText, "mfilemon_port_memory_bytes", pPort->PortName(), pPort->MemoryUsage());
+	else
+	{
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+		{
+			CPortStats::FormatGauge(pText, "mfilemon_port_memory_bytes",
+				pPortRec->m_pPort->PortName(), pPortRec->m_pPort->MemoryUsage());
+		}
+	}
+
+	//shared by all ports
+	if (!pPort && g_pWriterPool)
+	{
+		pText->Printf("# TYPE mfilemon_writer_threads gauge\n# HELP mfilemon_writer_threads Writer pool threads.\n");
+		pText->Printf("mfilemon_writer_threads %u\n", g_pWriterPool->Workers());
+		pText->Printf("# TYPE mfilemon_writer_threads_peak gauge\n"
+			"# HELP mfilemon_writer_threads_peak Most writer pool threads at the same time.\n");
+		pText->Printf("mfilemon_writer_threads_peak %u\n", g_pWriterPool->PeakWorkers());
+	}
+
+	if (!pPort && g_pStrings)
+	{
+		pText->Printf("# TYPE mfilemon_string_table_strings gauge\n"
+			"# HELP mfilemon_string_table_strings Distinct settings shared by the ports.\n");
+		pText->Printf("mfilemon_string_table_strings %u\n", g_pStrings->Strings());
+		pText->Printf("# TYPE mfilemon_string_table_bytes gauge\n"
+			"# HELP mfilemon_string_table_bytes Memory held by the shared settings.\n");
+		pText->Printf("mfilemon_string_table_bytes %I64u\n", g_pStrings->Bytes());
+	}
+
+	pText->Printf("# EOF\n");
+}
+
 //-------------------------------------------------------------------------------------
 DWORD CPortList::GetPortSize(LPCWSTR szPortName, DWORD dwLevel)
 {
@@ -174,55 +394,176 @@ BOOL CPortList::EnumPorts(HANDLE hMonitor, LPCWSTR pName, DWORD Level, LPBYTE pP
 	UNREFERENCED_PARAMETER(pName);
 	UNREFERENCED_PARAMETER(hMonitor);
 
-	CAutoCriticalSection acs(GetCriticalSection());
-
-	LPPORTREC pPortRec = m_pFirstPortRec;
-
-	DWORD cb = 0;
-	while (pPortRec)
+	if (Level != 1 && Level != 2)
 	{
-		cb += GetPortSize(pPortRec->m_pPort->PortName(), Level);
-		pPortRec = pPortRec->m_pNext;
+		SetLastError(ERROR_INVALID_LEVEL);
+		return FALSE;
 	}
 
-	*pcbNeeded = cb;
+	LPENUMIMAGE pImage = AcquireEnumImage(Level);
+
+	*pcbNeeded = pImage->cbData;
 
 	if (cbBuf < *pcbNeeded)
 	{
+		ReleaseEnumImage(pImage);
 		SetLastError(ERROR_INSUFFICIENT_BUFFER);
 		return FALSE;
 	}
 
-	LPBYTE pEnd = pPorts + cbBuf;
-	*pcReturned = 0;
-	pPortRec = m_pFirstPortRec;
-	while (pPortRec)
+	if (pImage->cbData > 0)
+		memcpy(pPorts, pImage->pData, pImage->cbData);
+
+	//offsets from the start of the image become pointers into the caller's buffer
+	ULONG_PTR nBase = reinterpret_cast<ULONG_PTR>(pPorts);
+
+	if (Level == 1)
 	{
-		pEnd = CopyPortToBuffer(pPortRec->m_pPort, Level, pPorts, pEnd);
-		switch (Level)
+		PORT_INFO_1W* pPortInfo = reinterpret_cast<PORT_INFO_1W*>(pPorts);
+
+		for (DWORD n = 0; n < pImage->nPorts; n++, pPortInfo++)
+			pPortInfo->pName = reinterpret_cast<LPWSTR>(nBase + reinterpret_cast<ULONG_PTR>(pPortInfo->pName));
+	}
+	else
+	{
+		PORT_INFO_2W* pPortInfo = reinterpret_cast<PORT_INFO_2W*>(pPorts);
+
+		for (DWORD n = 0; n < pImage->nPorts; n++, pPortInfo++)
 		{
-		case 1:
-			pPorts += sizeof(PORT_INFO_1W);
-			break;
-		case 2:
-			pPorts += sizeof(PORT_INFO_2W);
-			break;
-		default:
-			{
-				SetLastError(ERROR_INVALID_LEVEL);
-				return FALSE;
-			}
+			pPortInfo->pPortName = reinterpret_cast<LPWSTR>(nBase + reinterpret_cast<ULONG_PTR>(pPortInfo->pPortName));
+			pPortInfo->pMonitorName = reinterpret_cast<LPWSTR>(nBase + reinterpret_cast<ULONG_PTR>(pPortInfo->pMonitorName));
+			pPortInfo->pDescription = reinterpret_cast<LPWSTR>(nBase + reinterpret_cast<ULONG_PTR>(pPortInfo->pDescription));
 		}
-		(*pcReturned)++;
-
-		pPortRec = pPortRec->m_pNext;
 	}
 
+	*pcReturned = pImage->nPorts;
+
+	ReleaseEnumImage(pImage);
+
 	return TRUE;
 }
 
 //-------------------------------------------------------------------------------------
-void CPortList::AddMfmPort(LPPORTCONFIG pConfig)
+CPortList::LPENUMIMAGE CPortList::BuildEnumImage(DWORD dwLevel)
+{
+	//called with the list lock held
+	LPENUMIMAGE pImage = new ENUMIMAGE;
+	LPPORTREC pPortRec;
+
+	pImage->cbData = 0;
+	pImage->nPorts = 0;
+	pImage->nRefs = 0;
+
+	for (pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+	{
+		pImage->cbData += GetPortSize(pPortRec->m_pPort->PortName(), dwLevel);
+		pImage->nPorts++;
+	}
+
+	pImage->pData = new BYTE[pImage->cbData ? pImage->cbData : 1];
+
+	//laid out as in the caller's buffer, the structures first and the
+	//strings packed backwards from the end
+	LPBYTE pStart = pImage->pData;
+	LPBYTE pEnd = pImage->pData + pImage->cbData;
+	DWORD cbInfo = (dwLevel == 1) ? sizeof(PORT_INFO_1W) : sizeof(PORT_INFO_2W);
+
+	for (pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+	{
+		pEnd = CopyPortToBuffer(pPortRec->m_pPort, dwLevel, pStart, pEnd);
+		pStart += cbInfo;
+	}
+
+	ULONG_PTR nBase = reinterpret_cast<ULONG_PTR>(pImage->pData);
+
+	if (dwLevel == 1)
+	{
+		PORT_INFO_1W* pPortInfo = reinterpret_cast<PORT_INFO_1W*>(pImage->pData);
+
+		for (DWORD n = 0; n < pImage->nPorts; n++, pPortInfo++)
+			pPortInfo->pName = reinterpret_cast<LPWSTR>(reinterpret_cast<ULONG_PTR>(pPortInfo->pName) - nBase);
+	}
+	else
+	{
+		PORT_INFO_2W* pPortInfo = reinterpret_cast<PORT_INFO_2W*>(pImage->pData);
+
+		for (DWORD n = 0; n < pImage->nPorts; n++, pPortInfo++)
+		{
+			pPortInfo->pPortName = reinterpret_cast<LPWSTR>(reinterpret_cast<ULONG_PTR>(pPortInfo->pPortName) - nBase);
+			pPortInfo->pMonitorName = reinterpret_cast<LPWSTR>(reinterpret_cast<ULONG_PTR>(pPortInfo->pMonitorName) - nBase);
+			pPortInfo->pDescription = reinterpret_cast<LPWSTR>(reinterpret_cast<ULONG_PTR>(pPortInfo->pDescription) - nBase);
+		}
+	}
+
+	return pImage;
+}
+
+//-------------------------------------------------------------------------------------
+CPortList::LPENUMIMAGE CPortList::AcquireEnumImage(DWORD dwLevel)
+{
+	//usually the image is there: the list lock, which jobs hold while they
+	//write, is not needed
+	{
+		CAutoCriticalSection acs(&m_CSEnum);
+
+		LPENUMIMAGE pImage = m_pEnumImages[dwLevel - 1];
+
+		if (pImage)
+		{
+			pImage->nRefs++;
+			return pImage;
+		}
+	}
+
+	//the port set has changed: build it again, holding the list lock until
+	//the image is stored, so that a port added meanwhile can't be missed
+	CAutoCriticalSection acsList(GetCriticalSection());
+	CAutoCriticalSection acs(&m_CSEnum);
+
+	LPENUMIMAGE pImage = m_pEnumImages[dwLevel - 1];
+
+	if (!pImage)
+	{
+		pImage = BuildEnumImage(dwLevel);
+		pImage->nRefs = 1;
+		m_pEnumImages[dwLevel - 1] = pImage;
+	}
+
+	pImage->nRefs++;
+
+	return pImage;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::ReleaseEnumImage(LPENUMIMAGE pImage)
+{
+	CAutoCriticalSection acs(&m_CSEnum);
+
+	if (--pImage->nRefs == 0)
+	{
+		delete[] pImage->pData;
+		delete pImage;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::InvalidateEnumImages()
+{
+	//callers still copying from an image keep it alive until they are done
+	CAutoCriticalSection acs(&m_CSEnum);
+
+	for (size_t n = 0; n < LENGTHOF(m_pEnumImages); n++)
+	{
+		if (m_pEnumImages[n])
+		{
+			ReleaseEnumImage(m_pEnumImages[n]);
+			m_pEnumImages[n] = NULL;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::AddMfmPort(LPPORTCONFIG2 pConfig)
 {
 	//alloc port on the heap
 	CPort* pNewPort = new CPort(pConfig);
@@ -242,7 +583,9 @@ void CPortList::AddMfmPort(CPort* pNewPort)
 	pPortRec->m_pNext = m_pFirstPortRec;
 	m_pFirstPortRec = pPortRec;
 
-	g_pLog->Info(L"CPortList::AddMfmPort: port %s up and running", pNewPort->PortName());
+	InvalidateEnumImages();
+
+	g_pLog->Debug(L"CPortList::AddMfmPort: port %s added", pNewPort->PortName());
 }
 
 //-------------------------------------------------------------------------------------
@@ -263,8 +606,16 @@ void CPortList::DeletePort(CPort* pPortToDelete)
 			else
 				m_pFirstPortRec = pPortRec->m_pNext;
 
+			//a save in progress finishes first, a later one leaves the key alone
+			{
+				CAutoCriticalSection acsConfig(pPortToDelete->GetConfigCriticalSection());
+				pPortToDelete->MarkDeleted();
+			}
+
 			RemoveFromRegistry(pPortToDelete);
 
+			InvalidateEnumImages();
+
 			delete pPortRec;
 
 			break;
@@ -281,32 +632,19 @@ void CPortList::RemoveFromRegistry(CPort* pPort)
 	PMONITORREG pReg = g_pMonitorInit->pMonitorReg;
 	HKEY hRoot = static_cast<HKEY>(g_pMonitorInit->hckRegistryRoot);
 
-	//If we're on an UAC enabled system, we're running under unprivileged
-	//user account. Let's revert to ourselves for a while...
-	HANDLE hToken = NULL;
-	if (IsUACEnabled())
-	{
-		g_pLog->Debug(L"running on UAC enabled OS, reverting to local system");
-		OpenThreadToken(GetCurrentThread(), TOKEN_IMPERSONATE, TRUE, &hToken);
-		RevertToSelf();
-	}
+	HANDLE hToken = SwitchToLocalSystem(L"CPortList::RemoveFromRegistry");
+
+	BumpGeneration();
 
 	pReg->fpDeleteKey(hRoot, pPort->PortName(), g_pMonitorInit->hSpooler);
 
-	//let's revert to unprivileged user
-	if (hToken)
-	{
-		if (!SetThreadToken(NULL, hToken))
-			g_pLog->Error(L"CPortList::RemoveFromRegistry: SetThreadToken failed (%i)", GetLastError());
-		CloseHandle(hToken);
-		g_pLog->Debug(L"back to unprivileged user");
-	}
+	SwitchBackToUser(hToken, L"CPortList::RemoveFromRegistry");
 }
 
 //-------------------------------------------------------------------------------------
 void CPortList::LoadFromRegistry()
 {
-	LPPORTCONFIG pConfig = new PORTCONFIG;
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
 	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
 
 #ifdef __GNUC__
@@ -331,8 +669,63 @@ void CPortList::LoadFromRegistry()
 	}
 
 	g_pLog->SetLogLevel(nLogLevel);
+	m_nSavedLogLevel = nLogLevel;
 #endif
 
+	//set by hand only, never written back
+	DWORD nLogFormat = LOGFORMAT_TEXT;
+
+	cbData = sizeof(nLogFormat);
+	if (pReg->fpQueryValue(hRoot, szLogFormatKey, NULL, reinterpret_cast<LPBYTE>(&nLogFormat), &cbData,
+		g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+	{
+		nLogFormat = LOGFORMAT_TEXT;
+	}
+
+	g_pLog->SetLogFormat(nLogFormat);
+
+	//periodic statistics file, seconds between dumps (0 = off)
+	DWORD nStatsInterval = 0;
+
+	cbData = sizeof(nStatsInterval);
+	if (pReg->fpQueryValue(hRoot, szStatsIntervalKey, NULL, reinterpret_cast<LPBYTE>(&nStatsInterval), &cbData,
+		g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+	{
+		nStatsInterval = 0;
+	}
+
+	m_statsDumper.Start(nStatsInterval);
+
+	//minutes without jobs after which a port goes back to its settings alone (0 = never)
+	DWORD nIdleMinutes = 60;
+
+	cbData = sizeof(nIdleMinutes);
+	if (pReg->fpQueryValue(hRoot, szPortIdleTimeoutKey, NULL, reinterpret_cast<LPBYTE>(&nIdleMinutes), &cbData,
+		g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+	{
+		nIdleMinutes = 60;
+	}
+
+	StartSweeper(nIdleMinutes);
+
+	//bumped before every change to the port keys, tells whether the snapshot
+	//still matches the registry; when it's missing (e.g. the key has been
+	//created anew) the snapshot can't be trusted
+	DWORD dwGeneration = 0;
+
+	cbData = sizeof(dwGeneration);
+	BOOL bGeneration = pReg->fpQueryValue(hRoot, szGenerationKey, NULL, reinterpret_cast<LPBYTE>(&dwGeneration),
+		&cbData, g_pMonitorInit->hSpooler) == ERROR_SUCCESS;
+
+	m_nGeneration = dwGeneration;
+
+	if (bGeneration && LoadFromSnapshot(dwGeneration))
+	{
+		delete[] pwBlob;
+		delete pConfig;
+		return;
+	}
+
 	for (;;)
 	{
 		//read port name
@@ -411,6 +804,28 @@ void CPortList::LoadFromRegistry()
 			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
 			pConfig->bHideProcess = TRUE;
 
+		//read Archive mode
+		cbData = sizeof(pConfig->dwArchiveMode);
+		if (pReg->fpQueryValue(hKey, szArchiveModeKey, NULL, reinterpret_cast<LPBYTE>(&pConfig->dwArchiveMode),
+			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+			pConfig->dwArchiveMode = ARCHIVEMODE_NONE;
+
+		//read Archive roll over limits
+		cbData = sizeof(pConfig->dwArchiveMaxSize);
+		if (pReg->fpQueryValue(hKey, szArchiveMaxSizeKey, NULL, reinterpret_cast<LPBYTE>(&pConfig->dwArchiveMaxSize),
+			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+			pConfig->dwArchiveMaxSize = 0;
+
+		cbData = sizeof(pConfig->dwArchiveMaxAge);
+		if (pReg->fpQueryValue(hKey, szArchiveMaxAgeKey, NULL, reinterpret_cast<LPBYTE>(&pConfig->dwArchiveMaxAge),
+			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+			pConfig->dwArchiveMaxAge = 0;
+
+		cbData = sizeof(pConfig->dwArchiveMaxJobs);
+		if (pReg->fpQueryValue(hKey, szArchiveMaxJobsKey, NULL, reinterpret_cast<LPBYTE>(&pConfig->dwArchiveMaxJobs),
+			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+			pConfig->dwArchiveMaxJobs = 0;
+
 		//read User
 		cbData = sizeof(pConfig->szUser);
 		if (pReg->fpQueryValue(hKey, szUserKey, NULL, reinterpret_cast<LPBYTE>(pConfig->szUser),
@@ -434,37 +849,10 @@ void CPortList::LoadFromRegistry()
 		//read Password
 		cbData = MAX_PWBLOB;
 		if (pReg->fpQueryValue(hKey, szPasswordKey, NULL, reinterpret_cast<LPBYTE>(pwBlob),
-			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS || cbData < 32)
+			&cbData, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
 			*pConfig->szPassword = L'\0';
 		else
-		{
-			LPBYTE iv = pwBlob;
-			LPBYTE pwData = pwBlob + 16;
-			int outlen1, outlen2;
-
-			EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-
-			if (ctx &&
-				EVP_DecryptInit(ctx, EVP_aes_256_cbc(), aeskey, iv) &&
-				EVP_DecryptUpdate(ctx, reinterpret_cast<LPBYTE>(pConfig->szPassword), &outlen1, pwData, cbData - 16) &&
-				EVP_DecryptFinal(ctx, reinterpret_cast<LPBYTE>(pConfig->szPassword + outlen1), &outlen2) &&
-				EVP_CIPHER_CTX_cleanup(ctx))
-			{
-				int len = (static_cast<unsigned long long>(outlen1) + outlen2) / sizeof(WCHAR);
-
-				if (len == 0)
-					len = 1;
-
-				pConfig->szPassword[len - 1] = L'\0';
-			}
-			else
-			{
-				*pConfig->szPassword = L'\0';
-			}
-
-			if (ctx)
-				EVP_CIPHER_CTX_free(ctx);
-		}
+			DecryptPassword(pwBlob, cbData, pConfig->szPassword);
 
 		//close registry
 		pReg->fpCloseKey(hKey, g_pMonitorInit->hSpooler);
@@ -473,155 +861,594 @@ void CPortList::LoadFromRegistry()
 		AddMfmPort(pConfig);
 	}
 
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
 	delete[] pwBlob;
 	delete pConfig;
+
+	//next time, the short way
+	if (!bGeneration)
+	{
+		HANDLE hToken = SwitchToLocalSystem(L"CPortList::LoadFromRegistry");
+		BumpGeneration();
+		SwitchBackToUser(hToken, L"CPortList::LoadFromRegistry");
+	}
+
+	m_bSnapshotStale = TRUE;
+	WriteSnapshot();
 }
 
 //-------------------------------------------------------------------------------------
-void CPortList::SaveToRegistry()
+BOOL CPortList::LoadFromSnapshot(DWORD dwGeneration)
 {
-#ifdef __GNUC__
-	HANDLE hKey;
-#else
-	HKEY hKey;
-#endif
-	PMONITORREG pReg = g_pMonitorInit->pMonitorReg;
-	HKEY hRoot = static_cast<HKEY>(g_pMonitorInit->hckRegistryRoot);
+	WCHAR szFileName[MAX_PATH + 1];
+	CConfigSnapshot snapshot;
+
+	if (!snapshot.ReadFromFile(SnapshotFileName(szFileName, LENGTHOF(szFileName))))
+	{
+		g_pLog->Info(L"CPortList::LoadFromSnapshot: no valid snapshot in %s, reading the registry", szFileName);
+		return FALSE;
+	}
+
+	if (snapshot.Generation() != dwGeneration)
+	{
+		g_pLog->Info(L"CPortList::LoadFromSnapshot: snapshot out of date (generation %u, registry %u)",
+			snapshot.Generation(), dwGeneration);
+		return FALSE;
+	}
+
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	DWORD cbBlob;
+
+	while (snapshot.Next(pConfig, pwBlob, &cbBlob))
+	{
+		DecryptPassword(pwBlob, cbBlob, pConfig->szPassword);
+		AddMfmPort(pConfig);
+	}
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	delete[] pwBlob;
+	delete pConfig;
+
+	g_pLog->Info(L"CPortList::LoadFromSnapshot: %u ports loaded from snapshot, generation %u",
+		snapshot.Ports(), dwGeneration);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::WriteSnapshot()
+{
+	if (!m_bSnapshotStale)
+		return;
+
+	CConfigSnapshot snapshot;
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
 	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	DWORD dwGeneration = static_cast<DWORD>(m_nGeneration);
+	BOOL bComplete = TRUE;
+
+	{
+		CAutoCriticalSection acs(GetCriticalSection());
+
+		snapshot.Begin(dwGeneration);
 
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec && bComplete; pPortRec = pPortRec->m_pNext)
+		{
+			CPort* pPort = pPortRec->m_pPort;
+			CAutoCriticalSection acsPort(pPort->GetConfigCriticalSection());
+
+			//a setting not in the registry yet must not get into the snapshot
+			if (pPort->DirtyFields() != 0)
+			{
+				bComplete = FALSE;
+				break;
+			}
+
+			pPort->GetConfig(pConfig);
+
+			DWORD cbBlob = *pConfig->szPassword ? EncryptPassword(pConfig->szPassword, pwBlob) : 0;
+			snapshot.Add(pConfig, pwBlob, cbBlob);
+		}
+	}
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	delete[] pwBlob;
+	delete pConfig;
+
+	if (!bComplete)
+	{
+		g_pLog->Debug(L"CPortList::WriteSnapshot: unsaved settings, snapshot not written");
+		return;
+	}
+
+	WCHAR szFileName[MAX_PATH + 1];
+	HANDLE hToken = SwitchToLocalSystem(L"CPortList::WriteSnapshot");
+
+	if (snapshot.WriteToFile(SnapshotFileName(szFileName, LENGTHOF(szFileName))))
+	{
+		//a change meanwhile has made it old already
+		m_bSnapshotStale = (static_cast<DWORD>(m_nGeneration) != dwGeneration);
+		g_pLog->Debug(L"CPortList::WriteSnapshot: %u ports, generation %u", snapshot.Ports(), dwGeneration);
+	}
+	else
+		g_pLog->Error(L"CPortList::WriteSnapshot: can't write %s (%i)", szFileName, GetLastError());
+
+	SwitchBackToUser(hToken, L"CPortList::WriteSnapshot");
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::BumpGeneration()
+{
+	//called before the port keys are touched: if we stop halfway,
+	//the snapshot is void already
+	DWORD dwGeneration = static_cast<DWORD>(InterlockedIncrement(&m_nGeneration));
+
+	m_bSnapshotStale = TRUE;
+
+	if (!SetDwordValue(g_pMonitorInit->hckRegistryRoot, szGenerationKey, dwGeneration))
+	{
+		WCHAR szFileName[MAX_PATH + 1];
+
+		g_pLog->Error(L"CPortList::BumpGeneration: can't write %s, dropping the snapshot", szGenerationKey);
+		DeleteFileW(SnapshotFileName(szFileName, LENGTHOF(szFileName)));
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::StartSweeper(DWORD nIdleMinutes)
+{
+	StopSweeper();
+
+	//idle times are told apart with GetTickCount, which wraps after 49 days
+	if (nIdleMinutes > 40 * 24 * 60)
+		nIdleMinutes = 40 * 24 * 60;
+
+	m_nIdleMinutes = nIdleMinutes;
+
+	if ((m_hStopSweepEvt = CreateEventW(NULL, TRUE, FALSE, NULL)) == NULL)
+		return;
+
+	DWORD dwId;
+	if ((m_hSweepThread = CreateThread(NULL, 0, SweepThreadProc, this, 0, &dwId)) == NULL)
+	{
+		g_pLog->Error(L"CPortList::StartSweeper: CreateThread failed (%i)", GetLastError());
+		CloseHandle(m_hStopSweepEvt);
+		m_hStopSweepEvt = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::StopSweeper()
+{
+	if (m_hSweepThread)
+	{
+		SetEvent(m_hStopSweepEvt);
+		WaitForSingleObject(m_hSweepThread, INFINITE);
+		CloseHandle(m_hSweepThread);
+		m_hSweepThread = NULL;
+	}
+
+	if (m_hStopSweepEvt)
+	{
+		CloseHandle(m_hStopSweepEvt);
+		m_hStopSweepEvt = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WINAPI CPortList::SweepThreadProc(LPVOID lpParam)
+{
+	CPortList* pList = static_cast<CPortList*>(lpParam);
+
+	//once a minute is fine grained enough for timeouts given in minutes
+	while (WaitForSingleObject(pList->m_hStopSweepEvt, 60000) == WAIT_TIMEOUT)
+	{
+		pList->EvictIdlePorts();
+		pList->CloseExpiredArchives();
+	}
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::EvictIdlePorts()
+{
+	//no idle timeout: ports stay materialized
+	if (m_nIdleMinutes == 0)
+		return;
+
+	//the list lock keeps ports from being deleted under us; a port that is
+	//half way through StartDocPort, WritePort or EndDocPort is skipped
 	CAutoCriticalSection acs(GetCriticalSection());
 
-	LPPORTREC pPortRec = m_pFirstPortRec;
+	DWORD nEvicted = 0;
+	DWORD nActive = 0;
 
-	//If we're on an UAC enabled system, we're running under unprivileged
-	//user account. Let's revert to ourselves for a while...
-	HANDLE hToken = NULL;
-	if (IsUACEnabled())
+	for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
 	{
-		g_pLog->Debug(L"CPortList::SaveToRegistry: running on UAC enabled OS, switching to local system");
-		OpenThreadToken(GetCurrentThread(), TOKEN_IMPERSONATE, TRUE, &hToken);
-		RevertToSelf();
+		if (pPortRec->m_pPort->EvictIfIdle(m_nIdleMinutes * 60000))
+			nEvicted++;
+		else if (pPortRec->m_pPort->IsMaterialized())
+			nActive++;
 	}
 
-#ifndef _DEBUG
-	DWORD nLogLevel = g_pLog->GetLogLevel();
-	pReg->fpSetValue(hRoot, szLogLevelKey, REG_DWORD, (LPBYTE)&nLogLevel, sizeof(nLogLevel),
-		g_pMonitorInit->hSpooler);
-#endif
+	if (nEvicted > 0)
+		g_pLog->Info(L"CPortList::EvictIdlePorts: %u idle ports evicted, %u active", nEvicted, nActive);
+}
 
-	while (pPortRec)
+//-------------------------------------------------------------------------------------
+void CPortList::CloseExpiredArchives()
+{
+	CPort** pPorts = NULL;
+	DWORD nPorts = 0;
+
+	//only a materialized port can have an archive open; pin them, then close
+	//without the list lock, since the user command may take a while
 	{
-		if (pReg->fpCreateKey(hRoot, pPortRec->m_pPort->PortName(), 0, KEY_WRITE,
-			NULL, &hKey, NULL, g_pMonitorInit->hSpooler) == ERROR_SUCCESS)
+		CAutoCriticalSection acs(GetCriticalSection());
+
+		DWORD nCount = 0;
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+			nCount++;
+
+		pPorts = new CPort*[nCount + 1];
+
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+		{
+			if (pPortRec->m_pPort->IsMaterialized())
+			{
+				pPortRec->m_pPort->AddRef();
+				pPorts[nPorts++] = pPortRec->m_pPort;
+			}
+		}
+	}
+
+	for (DWORD n = 0; n < nPorts; n++)
+	{
+		pPorts[n]->CloseExpiredArchive();
+		pPorts[n]->Release();
+	}
+
+	delete[] pPorts;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::BeginUpdate()
+{
+	//saves are held back until the outermost EndUpdate, which writes
+	//all the changes with a single switch to local system
+	InterlockedIncrement(&m_nUpdates);
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::EndUpdate()
+{
+	if (InterlockedDecrement(&m_nUpdates) == 0)
+		SaveToRegistry();
+}
+
+//-------------------------------------------------------------------------------------
+void CPortList::SaveToRegistry()
+{
+	CPort** pPorts = NULL;
+	DWORD nPorts = 0;
+
+	//collect and pin the dirty ports, then write them without holding the list lock
+	{
+		CAutoCriticalSection acs(GetCriticalSection());
+
+		DWORD nCount = 0;
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+			nCount++;
+
+		pPorts = new CPort*[nCount + 1];
+
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
 		{
-			LPWSTR szBuf;
-
-			//OutputPath
-			szBuf = _wcsdup(pPortRec->m_pPort->OutputPath());
-			pReg->fpSetValue(hKey, szOutputPathKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//FilePattern
-			szBuf = _wcsdup(pPortRec->m_pPort->FilePattern());
-			pReg->fpSetValue(hKey, szFilePatternKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//Overwrite
-			BOOL bOverwrite = pPortRec->m_pPort->Overwrite();
-			pReg->fpSetValue(hKey, szOverwriteKey, REG_DWORD, reinterpret_cast<LPBYTE>(&bOverwrite),
-				sizeof(bOverwrite), g_pMonitorInit->hSpooler);
-
-			//UserCommand
-			szBuf = _wcsdup(pPortRec->m_pPort->UserCommandPattern());
-			pReg->fpSetValue(hKey, szUserCommandPatternKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//OutputPath
-			szBuf = _wcsdup(pPortRec->m_pPort->ExecPath());
-			pReg->fpSetValue(hKey, szExecPathKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//Wait termination
-			BOOL bWaitTermination = pPortRec->m_pPort->WaitTermination();
-			pReg->fpSetValue(hKey, szWaitTerminationKey, REG_DWORD, reinterpret_cast<LPBYTE>(&bWaitTermination),
-				sizeof(bWaitTermination), g_pMonitorInit->hSpooler);
-
-			//Wait timeout
-			DWORD dwWaitTimeout = pPortRec->m_pPort->WaitTimeout();
-			pReg->fpSetValue(hKey, szWaitTimeoutKey, REG_DWORD, reinterpret_cast<LPBYTE>(&dwWaitTimeout),
-				sizeof(dwWaitTimeout), g_pMonitorInit->hSpooler);
-
-			//Pipe data
-			BOOL bPipeData = pPortRec->m_pPort->PipeData();
-			pReg->fpSetValue(hKey, szPipeDataKey, REG_DWORD, reinterpret_cast<LPBYTE>(&bPipeData),
-				sizeof(bPipeData), g_pMonitorInit->hSpooler);
-
-			//Hide process
-			BOOL bHideProcess = pPortRec->m_pPort->HideProcess();
-			pReg->fpSetValue(hKey, szHideProcessKey, REG_DWORD, reinterpret_cast<LPBYTE>(&bHideProcess),
-				sizeof(bHideProcess), g_pMonitorInit->hSpooler);
-
-			//User
-			szBuf = _wcsdup(pPortRec->m_pPort->User());
-			pReg->fpSetValue(hKey, szUserKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//Domain
-			szBuf = _wcsdup(pPortRec->m_pPort->Domain());
-			pReg->fpSetValue(hKey, szDomainKey, REG_SZ, reinterpret_cast<LPBYTE>(szBuf),
-				static_cast<DWORD>(wcslen(szBuf) * sizeof(WCHAR)), g_pMonitorInit->hSpooler);
-			free(szBuf);
-
-			//Password
-			LPBYTE iv = pwBlob;
-			LPBYTE pData = pwBlob + 16;
-
-			int outlen1 = 0, outlen2 = 0;
-			int len = static_cast<int>((wcslen(pPortRec->m_pPort->Password()) + 1) * sizeof(WCHAR));
-
-			RAND_bytes(iv, 16);
-
-			EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-
-			szBuf = _wcsdup(pPortRec->m_pPort->Password());
-			if (ctx &&
-				EVP_EncryptInit(ctx, EVP_aes_256_cbc(), aeskey, iv) &&
-				EVP_EncryptUpdate(ctx, pData, &outlen1, reinterpret_cast<LPBYTE>(szBuf), len) &&
-				EVP_EncryptFinal(ctx, pData + outlen1, &outlen2) &&
-				EVP_CIPHER_CTX_cleanup(ctx))
+			if (pPortRec->m_pPort->DirtyFields() != 0)
 			{
-				int len1 = 16 + outlen1 + outlen2;
+				pPortRec->m_pPort->AddRef();
+				pPorts[nPorts++] = pPortRec->m_pPort;
+			}
+		}
+	}
+
+	HANDLE hToken = SwitchToLocalSystem(L"CPortList::SaveToRegistry");
+
+	SaveLogLevel();
+
+	//one generation for the whole lot
+	if (nPorts > 0)
+		BumpGeneration();
+
+	for (DWORD n = 0; n < nPorts; n++)
+		SavePort(pPorts[n], FALSE);
+
+	SwitchBackToUser(hToken, L"CPortList::SaveToRegistry");
+
+	for (DWORD n = 0; n < nPorts; n++)
+		pPorts[n]->Release();
+
+	delete[] pPorts;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CPortList::SaveToRegistry(CPort* pPort)
+{
+	//inside BeginUpdate/EndUpdate: the port stays dirty and is written with the others
+	if (m_nUpdates > 0)
+		return TRUE;
+
+	HANDLE hToken = SwitchToLocalSystem(L"CPortList::SaveToRegistry");
+
+	SaveLogLevel();
+
+	BOOL bRet = SavePort(pPort, TRUE);
+
+	SwitchBackToUser(hToken, L"CPortList::SaveToRegistry");
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+static int __cdecl ComparePortNames(const void* p1, const void* p2)
+{
+	return _wcsicmp(static_cast<LPCWSTR>(p1), static_cast<LPCWSTR>(p2));
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CPortList::ApplyConfigs(LPBYTE pData, DWORD cbData, BOOL bCreate)
+{
+	CConfigSnapshot batch;
+
+	if (!batch.Open(pData, cbData))
+	{
+		g_pLog->Error(L"CPortList::ApplyConfigs: malformed batch (%u bytes)", cbData);
+		return ERROR_INVALID_DATA;
+	}
+
+	DWORD nPorts = batch.Ports();
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	LPWSTR pNames = new WCHAR[(nPorts + 1) * (MAX_PATH + 1)];
+	DWORD cbBlob;
+	DWORD dwRet = ERROR_SUCCESS;
+	DWORD n;
 
-				pReg->fpSetValue(hKey, szPasswordKey, REG_BINARY, pwBlob, len1, g_pMonitorInit->hSpooler);
+	//all the settings are written with a single save at EndUpdate
+	BeginUpdate();
+
+	{
+		CAutoCriticalSection acs(GetCriticalSection());
+
+		//the whole batch is checked before a single port is touched
+		for (n = 0; dwRet == ERROR_SUCCESS && batch.Next(pConfig, pwBlob, &cbBlob); n++)
+		{
+			wcscpy_s(pNames + n * (MAX_PATH + 1), MAX_PATH + 1, pConfig->szPortName);
+
+			if (!*pConfig->szPortName || pConfig->dwArchiveMode > ARCHIVEMODE_MAX ||
+				cbBlob % sizeof(WCHAR) != 0 || cbBlob / sizeof(WCHAR) >= MAX_PASSWORD)
+			{
+				g_pLog->Error(L"CPortList::ApplyConfigs: bad settings for port %s", pConfig->szPortName);
+				dwRet = ERROR_INVALID_PARAMETER;
 			}
-			else
-				pReg->fpSetValue(hKey, szPasswordKey, REG_BINARY, pwBlob, 0, g_pMonitorInit->hSpooler);
-			free(szBuf);
+			else if (bCreate && FindPort(pConfig->szPortName) != NULL)
+			{
+				g_pLog->Error(L"CPortList::ApplyConfigs: port %s already exists", pConfig->szPortName);
+				dwRet = ERROR_ALREADY_EXISTS;
+			}
+			else if (!bCreate && FindPort(pConfig->szPortName) == NULL)
+			{
+				g_pLog->Error(L"CPortList::ApplyConfigs: port %s not found", pConfig->szPortName);
+				dwRet = ERROR_UNKNOWN_PORT;
+			}
+		}
 
-			if (ctx)
-				EVP_CIPHER_CTX_free(ctx);
+		//a port named twice would be created twice
+		if (dwRet == ERROR_SUCCESS)
+		{
+			qsort(pNames, nPorts, (MAX_PATH + 1) * sizeof(WCHAR), ComparePortNames);
 
-			//close registry
-			pReg->fpCloseKey(hKey, g_pMonitorInit->hSpooler);
+			for (n = 1; n < nPorts && dwRet == ERROR_SUCCESS; n++)
+			{
+				if (ComparePortNames(pNames + (n - 1) * (MAX_PATH + 1), pNames + n * (MAX_PATH + 1)) == 0)
+				{
+					g_pLog->Error(L"CPortList::ApplyConfigs: port %s given twice", pNames + n * (MAX_PATH + 1));
+					dwRet = ERROR_DUP_NAME;
+				}
+			}
 		}
 
-		pPortRec = pPortRec->m_pNext;
+		if (dwRet == ERROR_SUCCESS && batch.Open(pData, cbData))
+		{
+			while (batch.Next(pConfig, pwBlob, &cbBlob))
+			{
+				//a batch carries the password in clear, like SetConfig does
+				memcpy(pConfig->szPassword, pwBlob, cbBlob);
+				pConfig->szPassword[cbBlob / sizeof(WCHAR)] = L'\0';
+				pConfig->nLogLevel = g_pLog->GetLogLevel();
+
+				if (bCreate)
+				{
+					CPort* pPort = new CPort(pConfig);
+					pPort->SetDirtyFields(PORTFIELD_ALL);
+					AddMfmPort(pPort);
+				}
+				else
+				{
+					FindPort(pConfig->szPortName)->SetConfig(pConfig);
+				}
+			}
+
+			g_pLog->Info(L"CPortList::ApplyConfigs: %u ports %s", nPorts, bCreate ? L"created" : L"configured");
+		}
 	}
 
+	EndUpdate();
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	SecureZeroMemory(pwBlob, MAX_PWBLOB);
+	delete[] pNames;
 	delete[] pwBlob;
+	delete pConfig;
+
+	return dwRet;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CPortList::GetConfigs(LPBYTE pData, DWORD cbData, LPDWORD pcbNeeded)
+{
+	CConfigSnapshot batch;
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+
+	batch.Begin(0);
 
-	//let's revert to unprivileged user
-	if (hToken)
 	{
-		if (!SetThreadToken(NULL, hToken))
-			g_pLog->Error(L"CPortList::SaveToRegistry: SetThreadToken failed (%i)", GetLastError());
-		CloseHandle(hToken);
-		g_pLog->Debug(L"CPortList::SaveToRegistry: back to unprivileged user");
+		CAutoCriticalSection acs(GetCriticalSection());
+
+		for (LPPORTREC pPortRec = m_pFirstPortRec; pPortRec; pPortRec = pPortRec->m_pNext)
+		{
+			pPortRec->m_pPort->GetConfig(pConfig);
+
+			DWORD cbPassword = static_cast<DWORD>(wcslen(pConfig->szPassword) * sizeof(WCHAR));
+			if (cbPassword > MAX_PWBLOB)
+			{
+				g_pLog->Warn(L"CPortList::GetConfigs: password of port %s too long for a batch, left out",
+					pConfig->szPortName);
+				cbPassword = 0;
+			}
+
+			batch.Add(pConfig, reinterpret_cast<LPBYTE>(pConfig->szPassword), cbPassword);
+		}
 	}
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	delete pConfig;
+
+	*pcbNeeded = batch.Size();
+
+	if (pData == NULL || cbData < batch.Size())
+		return ERROR_INSUFFICIENT_BUFFER;
+
+	memcpy(pData, batch.Data(), batch.Size());
+
+	return ERROR_SUCCESS;
 }
 
+//-------------------------------------------------------------------------------------
+void CPortList::SaveLogLevel()
+{
+#ifndef _DEBUG
+	DWORD nLogLevel = g_pLog->GetLogLevel();
+
+	if (nLogLevel == m_nSavedLogLevel)
+		return;
+
+	if (SetDwordValue(g_pMonitorInit->hckRegistryRoot, szLogLevelKey, nLogLevel))
+		m_nSavedLogLevel = nLogLevel;
+#endif
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CPortList::SavePort(CPort* pPort, BOOL bBumpGeneration)
+{
+	//the port lock only holds up a configuration change of this same port,
+	//jobs and other ports go on while we write
+	CAutoCriticalSection acs(pPort->GetConfigCriticalSection());
+
+	DWORD dwDirty = pPort->DirtyFields();
+
+	//deleted since it was collected: writing now would bring its key back
+	if (dwDirty == 0 || pPort->IsDeleted())
+		return TRUE;
+
+#ifdef __GNUC__
+	HANDLE hKey;
+#else
+	HKEY hKey;
+#endif
+	PMONITORREG pReg = g_pMonitorInit->pMonitorReg;
+	HKEY hRoot = static_cast<HKEY>(g_pMonitorInit->hckRegistryRoot);
+
+	//creating the key of a new port is a change too
+	if (bBumpGeneration)
+		BumpGeneration();
+
+	LONG res = pReg->fpCreateKey(hRoot, pPort->PortName(), 0, KEY_WRITE,
+		NULL, &hKey, NULL, g_pMonitorInit->hSpooler);
+
+	if (res != ERROR_SUCCESS)
+	{
+		g_pLog->Error(pPort, L"CPortList::SavePort: can't create registry key (%i)", res);
+		return FALSE;
+	}
+
+	DWORD dwFailed = 0;
+
+	if ((dwDirty & PORTFIELD_OUTPUTPATH) && !SetStringValue(hKey, szOutputPathKey, pPort->OutputPath()))
+		dwFailed |= PORTFIELD_OUTPUTPATH;
+
+	if ((dwDirty & PORTFIELD_FILEPATTERN) && !SetStringValue(hKey, szFilePatternKey, pPort->FilePattern()))
+		dwFailed |= PORTFIELD_FILEPATTERN;
+
+	if ((dwDirty & PORTFIELD_OVERWRITE) && !SetDwordValue(hKey, szOverwriteKey, pPort->Overwrite()))
+		dwFailed |= PORTFIELD_OVERWRITE;
+
+	if ((dwDirty & PORTFIELD_USERCOMMAND) && !SetStringValue(hKey, szUserCommandPatternKey, pPort->UserCommandPattern()))
+		dwFailed |= PORTFIELD_USERCOMMAND;
+
+	if ((dwDirty & PORTFIELD_EXECPATH) && !SetStringValue(hKey, szExecPathKey, pPort->ExecPath()))
+		dwFailed |= PORTFIELD_EXECPATH;
+
+	if ((dwDirty & PORTFIELD_WAITTERMINATION) && !SetDwordValue(hKey, szWaitTerminationKey, pPort->WaitTermination()))
+		dwFailed |= PORTFIELD_WAITTERMINATION;
+
+	if ((dwDirty & PORTFIELD_WAITTIMEOUT) && !SetDwordValue(hKey, szWaitTimeoutKey, pPort->WaitTimeout()))
+		dwFailed |= PORTFIELD_WAITTIMEOUT;
+
+	if ((dwDirty & PORTFIELD_PIPEDATA) && !SetDwordValue(hKey, szPipeDataKey, pPort->PipeData()))
+		dwFailed |= PORTFIELD_PIPEDATA;
+
+	if ((dwDirty & PORTFIELD_HIDEPROCESS) && !SetDwordValue(hKey, szHideProcessKey, pPort->HideProcess()))
+		dwFailed |= PORTFIELD_HIDEPROCESS;
+
+	if ((dwDirty & PORTFIELD_ARCHIVEMODE) && !SetDwordValue(hKey, szArchiveModeKey, pPort->ArchiveMode()))
+		dwFailed |= PORTFIELD_ARCHIVEMODE;
+
+	if ((dwDirty & PORTFIELD_ARCHIVEMAXSIZE) && !SetDwordValue(hKey, szArchiveMaxSizeKey, pPort->ArchiveMaxSize()))
+		dwFailed |= PORTFIELD_ARCHIVEMAXSIZE;
+
+	if ((dwDirty & PORTFIELD_ARCHIVEMAXAGE) && !SetDwordValue(hKey, szArchiveMaxAgeKey, pPort->ArchiveMaxAge()))
+		dwFailed |= PORTFIELD_ARCHIVEMAXAGE;
+
+	if ((dwDirty & PORTFIELD_ARCHIVEMAXJOBS) && !SetDwordValue(hKey, szArchiveMaxJobsKey, pPort->ArchiveMaxJobs()))
+		dwFailed |= PORTFIELD_ARCHIVEMAXJOBS;
+
+	if ((dwDirty & PORTFIELD_USER) && !SetStringValue(hKey, szUserKey, pPort->User()))
+		dwFailed |= PORTFIELD_USER;
+
+	if ((dwDirty & PORTFIELD_DOMAIN) && !SetStringValue(hKey, szDomainKey, pPort->Domain()))
+		dwFailed |= PORTFIELD_DOMAIN;
+
+	if (dwDirty & PORTFIELD_PASSWORD)
+	{
+		LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+		DWORD cbBlob = EncryptPassword(pPort->Password(), pwBlob);
+
+		if (pReg->fpSetValue(hKey, szPasswordKey, REG_BINARY, pwBlob, cbBlob, g_pMonitorInit->hSpooler) != ERROR_SUCCESS)
+			dwFailed |= PORTFIELD_PASSWORD;
+
+		delete[] pwBlob;
+	}
+
+	//close registry
+	pReg->fpCloseKey(hKey, g_pMonitorInit->hSpooler);
+
+	//what could not be written is tried again at the next save
+	pPort->SetDirtyFields(dwFailed);
+
+	g_pLog->Debug(pPort, L"settings saved (fields %X, failed %X)", dwDirty, dwFailed);
+
+	return dwFailed == 0;
+}
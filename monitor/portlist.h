@@ -20,7 +20,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #pragma once
 
 #include "port.h"
-#include "..\common\config.h"
+#include "stats.h"
+#include "../common/config.h"
 
 class CPortList
 {
@@ -35,12 +36,21 @@ private:
 		~tagPORTREC()
 		{
 			if (m_pPort)
-				delete m_pPort;
+				m_pPort->Release();
 		}
 		CPort* m_pPort;
 		tagPORTREC* m_pNext;
 	} PORTREC, *LPPORTREC;
 
+	//an EnumPorts answer for one level, with string offsets in place of pointers
+	typedef struct tagENUMIMAGE
+	{
+		LPBYTE pData;
+		DWORD cbData;
+		DWORD nPorts;
+		LONG nRefs;
+	} ENUMIMAGE, *LPENUMIMAGE;
+
 private:
 	static LPCWSTR szOutputPathKey;
 	static LPCWSTR szFilePatternKey;
@@ -51,34 +61,73 @@ private:
 	static LPCWSTR szWaitTimeoutKey;
 	static LPCWSTR szPipeDataKey;
 	static LPCWSTR szLogLevelKey;
+	static LPCWSTR szLogFormatKey;
+	static LPCWSTR szStatsIntervalKey;
 	static LPCWSTR szUserKey;
 	static LPCWSTR szDomainKey;
 	static LPCWSTR szPasswordKey;
 	static LPCWSTR szHideProcessKey;
+	static LPCWSTR szArchiveModeKey;
+	static LPCWSTR szArchiveMaxSizeKey;
+	static LPCWSTR szArchiveMaxAgeKey;
+	static LPCWSTR szArchiveMaxJobsKey;
+	static LPCWSTR szGenerationKey;
+	static LPCWSTR szPortIdleTimeoutKey;
 	LPPORTREC m_pFirstPortRec;
 	WCHAR m_szMonitorName[MAX_PATH + 1];
 	WCHAR m_szPortDesc[MAX_PATH + 1];
 	CRITICAL_SECTION m_CSPortList;
+	CStatsDumper m_statsDumper;
+	volatile LONG m_nUpdates;
+	DWORD m_nSavedLogLevel;
+	volatile LONG m_nGeneration;
+	volatile BOOL m_bSnapshotStale;
+	HANDLE m_hSweepThread;
+	HANDLE m_hStopSweepEvt;
+	DWORD m_nIdleMinutes;
+	LPENUMIMAGE m_pEnumImages[2];
+	CRITICAL_SECTION m_CSEnum;
 
 public:
 	CPortList(LPCWSTR szPortMonitorName, LPCWSTR szPortDesc);
 	virtual ~CPortList();
 
 public:
-	void AddMfmPort(LPPORTCONFIG pConfig);
+	void AddMfmPort(LPPORTCONFIG2 pConfig);
 	void AddMfmPort(CPort* pNewPort);
 	void DeletePort(CPort* pPortToDelete);
 	CPort* FindPort(LPCWSTR szPortName);
+	CPort* PinPort(LPCWSTR szPortName);
 	BOOL EnumPorts(HANDLE hMonitor, LPCWSTR pName, DWORD Level, LPBYTE pPorts,
 		DWORD cbBuf, LPDWORD pcbNeeded, LPDWORD pcReturned);
 	void LoadFromRegistry();
 	void SaveToRegistry();
+	BOOL SaveToRegistry(CPort* pPort);
+	void BeginUpdate();
+	void EndUpdate();
+	DWORD ApplyConfigs(LPBYTE pData, DWORD cbData, BOOL bCreate);
+	DWORD GetConfigs(LPBYTE pData, DWORD cbData, LPDWORD pcbNeeded);
+	void WriteSnapshot();
+	void FormatStats(CStatsText* pText, CPort* pPort);
 	LPCRITICAL_SECTION GetCriticalSection() { return &m_CSPortList; }
 
 private:
 	DWORD GetPortSize(LPCWSTR szPortName, DWORD dwLevel);
 	LPBYTE CopyPortToBuffer(CPort* pPort, DWORD dwLevel, LPBYTE pStart, LPBYTE pEnd);
+	LPENUMIMAGE BuildEnumImage(DWORD dwLevel);
+	LPENUMIMAGE AcquireEnumImage(DWORD dwLevel);
+	void ReleaseEnumImage(LPENUMIMAGE pImage);
+	void InvalidateEnumImages();
 	void RemoveFromRegistry(CPort* pPort);
+	BOOL SavePort(CPort* pPort, BOOL bBumpGeneration);
+	void SaveLogLevel();
+	BOOL LoadFromSnapshot(DWORD dwGeneration);
+	void BumpGeneration();
+	void StartSweeper(DWORD nIdleMinutes);
+	void StopSweeper();
+	static DWORD WINAPI SweepThreadProc(LPVOID lpParam);
+	void EvictIdlePorts();
+	void CloseExpiredArchives();
 };
 
 extern CPortList* g_pPortList;
@@ -0,0 +1,210 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "portsettings.h"
+#include "archive.h"
+#include "pattern.h"
+#include "strtable.h"
+#include "../common/defs.h"
+#include "../common/monutils.h"
+
+//-------------------------------------------------------------------------------------
+CPortSettings::CPortSettings()
+{
+	Initialize();
+}
+
+//-------------------------------------------------------------------------------------
+CPortSettings::CPortSettings(LPPORTCONFIG2 pConfig)
+{
+	Initialize();
+
+	m_szOutputPath = g_pStrings->Intern(pConfig->szOutputPath);
+	m_szFilePattern = g_pStrings->Intern(pConfig->szFilePattern);
+	m_bOverwrite = pConfig->bOverwrite;
+	m_szUserCommand = g_pStrings->Intern(pConfig->szUserCommandPattern);
+	m_szExecPath = g_pStrings->Intern(pConfig->szExecPath);
+	m_bWaitTermination = pConfig->bWaitTermination;
+	m_dwWaitTimeout = pConfig->dwWaitTimeout;
+	if (m_dwWaitTimeout > 4294967)
+		m_dwWaitTimeout = 4294967;
+	m_bPipeData = pConfig->bPipeData;
+	m_bHideProcess = pConfig->bHideProcess;
+	m_dwArchiveMode = pConfig->dwArchiveMode;
+	if (m_dwArchiveMode > ARCHIVEMODE_MAX)
+		m_dwArchiveMode = ARCHIVEMODE_NONE;
+	m_dwArchiveMaxSize = pConfig->dwArchiveMaxSize;
+	m_dwArchiveMaxAge = pConfig->dwArchiveMaxAge;
+	m_dwArchiveMaxJobs = pConfig->dwArchiveMaxJobs;
+
+	WCHAR szUser[MAX_USER];
+	wcscpy_s(szUser, LENGTHOF(szUser), pConfig->szUser);
+	Trim(szUser);
+	m_szUser = g_pStrings->Intern(szUser);
+
+	WCHAR szDomain[MAX_DOMAIN];
+	wcscpy_s(szDomain, LENGTHOF(szDomain), pConfig->szDomain);
+	Trim(szDomain);
+	g_pStrings->Release(m_szDomain);
+	m_szDomain = g_pStrings->Intern(*szDomain ? szDomain : L".");
+
+	//most ports run as the spooler: no password, no allocation
+	if (*pConfig->szPassword)
+	{
+		size_t cch = wcslen(pConfig->szPassword) + 1;
+		m_szPassword = new WCHAR[cch];
+		wcscpy_s(m_szPassword, cch, pConfig->szPassword);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortSettings::Initialize()
+{
+	m_nRefs = 1;
+	m_szOutputPath = g_pStrings->Intern(NULL);
+	m_szFilePattern = NULL;
+	m_szUserCommand = NULL;
+	m_szExecPath = g_pStrings->Intern(NULL);
+	m_bOverwrite = FALSE;
+	m_bWaitTermination = FALSE;
+	m_dwWaitTimeout = 0;
+	m_bPipeData = FALSE;
+	m_bHideProcess = TRUE;
+	m_dwArchiveMode = ARCHIVEMODE_NONE;
+	m_dwArchiveMaxSize = 0;
+	m_dwArchiveMaxAge = 0;
+	m_dwArchiveMaxJobs = 0;
+	m_szUser = g_pStrings->Intern(NULL);
+	m_szDomain = g_pStrings->Intern(L".");
+	m_szPassword = NULL;
+}
+
+//-------------------------------------------------------------------------------------
+CPortSettings::~CPortSettings()
+{
+	g_pStrings->Release(m_szOutputPath);
+	g_pStrings->Release(m_szFilePattern);
+	g_pStrings->Release(m_szUserCommand);
+	g_pStrings->Release(m_szExecPath);
+	g_pStrings->Release(m_szUser);
+	g_pStrings->Release(m_szDomain);
+
+	if (m_szPassword)
+	{
+		SecureZeroMemory(m_szPassword, wcslen(m_szPassword) * sizeof(WCHAR));
+		delete[] m_szPassword;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPortSettings::Release()
+{
+	//the last of the port and the jobs that pinned it
+	if (InterlockedDecrement(&m_nRefs) == 0)
+		delete this;
+}
+
+//-------------------------------------------------------------------------------------
+LPCWSTR CPortSettings::FilePattern() const
+{
+	if (m_szFilePattern)
+		return m_szFilePattern;
+	else
+		return CPattern::szDefaultFilePattern;
+}
+
+//-------------------------------------------------------------------------------------
+LPCWSTR CPortSettings::UserCommandPattern() const
+{
+	if (m_szUserCommand)
+		return m_szUserCommand;
+	else
+		return CPattern::szDefaultUserCommand;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortSettings::GetConfig(LPPORTCONFIG2 pConfig) const
+{
+	wcscpy_s(pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath), OutputPath());
+	wcscpy_s(pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern), FilePattern());
+	pConfig->bOverwrite = Overwrite();
+	wcscpy_s(pConfig->szUserCommandPattern, LENGTHOF(pConfig->szUserCommandPattern), UserCommandPattern());
+	wcscpy_s(pConfig->szExecPath, LENGTHOF(pConfig->szExecPath), ExecPath());
+	pConfig->bWaitTermination = WaitTermination();
+	pConfig->dwWaitTimeout = WaitTimeout();
+	pConfig->bPipeData = PipeData();
+	pConfig->bHideProcess = HideProcess();
+	wcscpy_s(pConfig->szUser, LENGTHOF(pConfig->szUser), User());
+	wcscpy_s(pConfig->szDomain, LENGTHOF(pConfig->szDomain), Domain());
+	wcscpy_s(pConfig->szPassword, LENGTHOF(pConfig->szPassword), Password());
+	pConfig->dwArchiveMode = ArchiveMode();
+	pConfig->dwArchiveMaxSize = ArchiveMaxSize();
+	pConfig->dwArchiveMaxAge = ArchiveMaxAge();
+	pConfig->dwArchiveMaxJobs = ArchiveMaxJobs();
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CPortSettings::ChangedFields(const CPortSettings* pOld) const
+{
+	DWORD dwChanged = 0;
+
+	if (wcscmp(pOld->OutputPath(), OutputPath()) != 0)
+		dwChanged |= PORTFIELD_OUTPUTPATH;
+	if (wcscmp(pOld->FilePattern(), FilePattern()) != 0)
+		dwChanged |= PORTFIELD_FILEPATTERN;
+	if (pOld->Overwrite() != Overwrite())
+		dwChanged |= PORTFIELD_OVERWRITE;
+	if (wcscmp(pOld->UserCommandPattern(), UserCommandPattern()) != 0)
+		dwChanged |= PORTFIELD_USERCOMMAND;
+	if (wcscmp(pOld->ExecPath(), ExecPath()) != 0)
+		dwChanged |= PORTFIELD_EXECPATH;
+	if (pOld->WaitTermination() != WaitTermination())
+		dwChanged |= PORTFIELD_WAITTERMINATION;
+	if (pOld->WaitTimeout() != WaitTimeout())
+		dwChanged |= PORTFIELD_WAITTIMEOUT;
+	if (pOld->PipeData() != PipeData())
+		dwChanged |= PORTFIELD_PIPEDATA;
+	if (pOld->HideProcess() != HideProcess())
+		dwChanged |= PORTFIELD_HIDEPROCESS;
+	if (pOld->ArchiveMode() != ArchiveMode())
+		dwChanged |= PORTFIELD_ARCHIVEMODE;
+	if (pOld->ArchiveMaxSize() != ArchiveMaxSize())
+		dwChanged |= PORTFIELD_ARCHIVEMAXSIZE;
+	if (pOld->ArchiveMaxAge() != ArchiveMaxAge())
+		dwChanged |= PORTFIELD_ARCHIVEMAXAGE;
+	if (pOld->ArchiveMaxJobs() != ArchiveMaxJobs())
+		dwChanged |= PORTFIELD_ARCHIVEMAXJOBS;
+	if (wcscmp(pOld->User(), User()) != 0)
+		dwChanged |= PORTFIELD_USER;
+	if (wcscmp(pOld->Domain(), Domain()) != 0)
+		dwChanged |= PORTFIELD_DOMAIN;
+	//the password is encrypted with a fresh IV at every write, only when it changes
+	if (wcscmp(pOld->Password(), Password()) != 0)
+		dwChanged |= PORTFIELD_PASSWORD;
+
+	return dwChanged;
+}
+
+//-------------------------------------------------------------------------------------
+size_t CPortSettings::MemoryUsage() const
+{
+	//interned strings are accounted to the string table
+	return sizeof(*this) + (m_szPassword ? (wcslen(m_szPassword) + 1) * sizeof(WCHAR) : 0);
+}
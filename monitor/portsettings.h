@@ -0,0 +1,110 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include "../common/config.h"
+
+//port settings as persisted by CPortList, one bit per registry value
+#define PORTFIELD_OUTPUTPATH		0x00000001
+#define PORTFIELD_FILEPATTERN		0x00000002
+#define PORTFIELD_OVERWRITE			0x00000004
+#define PORTFIELD_USERCOMMAND		0x00000008
+#define PORTFIELD_EXECPATH			0x00000010
+#define PORTFIELD_WAITTERMINATION	0x00000020
+#define PORTFIELD_WAITTIMEOUT		0x00000040
+#define PORTFIELD_PIPEDATA			0x00000080
+#define PORTFIELD_HIDEPROCESS		0x00000100
+#define PORTFIELD_ARCHIVEMODE		0x00000200
+#define PORTFIELD_ARCHIVEMAXSIZE	0x00000400
+#define PORTFIELD_ARCHIVEMAXAGE		0x00000800
+#define PORTFIELD_ARCHIVEMAXJOBS	0x00001000
+#define PORTFIELD_USER				0x00002000
+#define PORTFIELD_DOMAIN			0x00004000
+#define PORTFIELD_PASSWORD			0x00008000
+#define PORTFIELD_ALL				0x0000FFFF
+
+/*
+*  CPortSettings
+*  the settings of a port as an immutable, reference counted snapshot.
+*  A configuration change builds a new snapshot and swaps it in; a job pins
+*  the snapshot that was current when it started and uses it to the end, so
+*  that paths, patterns and credentials never change under a running job.
+*  Strings are interned in g_pStrings, the password is kept apart.
+*/
+
+class CPortSettings
+{
+public:
+	CPortSettings();
+	explicit CPortSettings(LPPORTCONFIG2 pConfig);
+
+private:
+	//snapshots are shared: Release deletes them
+	virtual ~CPortSettings();
+
+public:
+	void AddRef() { InterlockedIncrement(&m_nRefs); }
+	void Release();
+	void GetConfig(LPPORTCONFIG2 pConfig) const;
+	DWORD ChangedFields(const CPortSettings* pOld) const;
+	size_t MemoryUsage() const;
+
+public:
+	LPCWSTR OutputPath() const { return m_szOutputPath; }
+	LPCWSTR FilePattern() const;
+	LPCWSTR UserCommandPattern() const;
+	BOOL HasFilePattern() const { return m_szFilePattern != NULL; }
+	BOOL HasUserCommand() const { return m_szUserCommand != NULL; }
+	LPCWSTR ExecPath() const { return m_szExecPath; }
+	BOOL Overwrite() const { return m_bOverwrite; }
+	BOOL WaitTermination() const { return m_bWaitTermination; }
+	DWORD WaitTimeout() const { return m_dwWaitTimeout; }
+	BOOL PipeData() const { return m_bPipeData; }
+	BOOL HideProcess() const { return m_bHideProcess; }
+	DWORD ArchiveMode() const { return m_dwArchiveMode; }
+	DWORD ArchiveMaxSize() const { return m_dwArchiveMaxSize; }
+	DWORD ArchiveMaxAge() const { return m_dwArchiveMaxAge; }
+	DWORD ArchiveMaxJobs() const { return m_dwArchiveMaxJobs; }
+	LPCWSTR User() const { return m_szUser; }
+	LPCWSTR Domain() const { return m_szDomain; }
+	LPCWSTR Password() const { return m_szPassword ? m_szPassword : L""; }
+
+private:
+	void Initialize();
+
+private:
+	volatile LONG m_nRefs;
+	LPCWSTR m_szOutputPath;
+	LPCWSTR m_szFilePattern;	//NULL until configured
+	LPCWSTR m_szUserCommand;	//NULL until configured
+	LPCWSTR m_szExecPath;
+	BOOL m_bOverwrite;
+	BOOL m_bWaitTermination;
+	DWORD m_dwWaitTimeout;
+	BOOL m_bPipeData;
+	BOOL m_bHideProcess;
+	DWORD m_dwArchiveMode;
+	DWORD m_dwArchiveMaxSize;
+	DWORD m_dwArchiveMaxAge;
+	DWORD m_dwArchiveMaxJobs;
+	LPCWSTR m_szUser;
+	LPCWSTR m_szDomain;
+	LPWSTR m_szPassword;
+};
@@ -0,0 +1,215 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "printercache.h"
+#include "../common/autoclean.h"
+
+const SPOOLERFUNCS g_SpoolerFuncs =
+{
+	OpenPrinterW,
+	ClosePrinter,
+	GetJobW,
+	SetJobW,
+	GetTickCount
+};
+
+CPrinterCache* g_pPrinterCache = NULL;
+
+//-------------------------------------------------------------------------------------
+CPrinterCache::CPrinterCache(const SPOOLERFUNCS* pFuncs)
+{
+	m_pFuncs = pFuncs;
+	m_pFirst = NULL;
+	InitializeCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+CPrinterCache::~CPrinterCache()
+{
+	while (m_pFirst)
+		Unlink(&m_pFirst);
+
+	DeleteCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+HANDLE CPrinterCache::Acquire(LPCWSTR szPrinterName)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	Sweep();
+
+	for (LPPRINTERENTRY pEntry = m_pFirst; pEntry; pEntry = pEntry->pNext)
+	{
+		if (!pEntry->bDiscarded && _wcsicmp(pEntry->szPrinterName, szPrinterName) == 0)
+		{
+			pEntry->nRefs++;
+			pEntry->dwLastUsed = m_pFuncs->pfnGetTickCount();
+			return pEntry->hPrinter;
+		}
+	}
+
+	size_t len = wcslen(szPrinterName) + 1;
+	LPWSTR szName = new WCHAR[len];
+	wcscpy_s(szName, len, szPrinterName);
+
+	HANDLE hPrinter;
+
+	if (!m_pFuncs->pfnOpenPrinter(szName, &hPrinter, NULL))
+	{
+		DWORD dwErr = GetLastError();
+		delete[] szName;
+		SetLastError(dwErr);
+		return NULL;
+	}
+
+	LPPRINTERENTRY pEntry = new PRINTERENTRY;
+	pEntry->szPrinterName = szName;
+	pEntry->hPrinter = hPrinter;
+	pEntry->nRefs = 1;
+	pEntry->dwLastUsed = m_pFuncs->pfnGetTickCount();
+	pEntry->bDiscarded = FALSE;
+	pEntry->pNext = m_pFirst;
+	m_pFirst = pEntry;
+
+	return hPrinter;
+}
+
+//-------------------------------------------------------------------------------------
+void CPrinterCache::Release(HANDLE hPrinter, BOOL bDiscard)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	for (LPPRINTERENTRY* ppEntry = &m_pFirst; *ppEntry; ppEntry = &(*ppEntry)->pNext)
+	{
+		LPPRINTERENTRY pEntry = *ppEntry;
+
+		if (pEntry->hPrinter == hPrinter)
+		{
+			pEntry->nRefs--;
+			pEntry->dwLastUsed = m_pFuncs->pfnGetTickCount();
+
+			if (bDiscard)
+				pEntry->bDiscarded = TRUE;
+
+			if (pEntry->bDiscarded && pEntry->nRefs == 0)
+				Unlink(ppEntry);
+
+			return;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPrinterCache::Discard(LPCWSTR szPrinterName)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	LPPRINTERENTRY* ppEntry = &m_pFirst;
+
+	while (*ppEntry)
+	{
+		LPPRINTERENTRY pEntry = *ppEntry;
+
+		if (_wcsicmp(pEntry->szPrinterName, szPrinterName) == 0)
+		{
+			//handles still in use are closed by the last Release
+			pEntry->bDiscarded = TRUE;
+
+			if (pEntry->nRefs == 0)
+			{
+				Unlink(ppEntry);
+				continue;
+			}
+		}
+
+		ppEntry = &pEntry->pNext;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPrinterCache::Sweep()
+{
+	DWORD dwNow = m_pFuncs->pfnGetTickCount();
+	LPPRINTERENTRY* ppEntry = &m_pFirst;
+
+	while (*ppEntry)
+	{
+		LPPRINTERENTRY pEntry = *ppEntry;
+
+		if (pEntry->nRefs == 0 && dwNow - pEntry->dwLastUsed >= PRINTERCACHE_IDLE)
+			Unlink(ppEntry);
+		else
+			ppEntry = &pEntry->pNext;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CPrinterCache::Unlink(LPPRINTERENTRY* ppEntry)
+{
+	LPPRINTERENTRY pEntry = *ppEntry;
+
+	*ppEntry = pEntry->pNext;
+
+	DWORD dwLastErr = GetLastError();
+	m_pFuncs->pfnClosePrinter(pEntry->hPrinter);
+	SetLastError(dwLastErr);
+
+	delete[] pEntry->szPrinterName;
+	delete pEntry;
+}
+
+//-------------------------------------------------------------------------------------
+CCachedPrinter::CCachedPrinter(LPCWSTR szPrinterName)
+{
+	_ASSERTE(g_pPrinterCache != NULL);
+
+	m_hHandle = (szPrinterName && *szPrinterName) ? g_pPrinterCache->Acquire(szPrinterName) : NULL;
+	m_bDiscard = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+CCachedPrinter::~CCachedPrinter()
+{
+	if (m_hHandle)
+		g_pPrinterCache->Release(m_hHandle, m_bDiscard);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCachedPrinter::CheckHandle(BOOL bRet)
+{
+	//the printer went away (deleted or renamed): don't hand this handle out again
+	if (!bRet && GetLastError() == ERROR_INVALID_HANDLE)
+		m_bDiscard = TRUE;
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCachedPrinter::GetJob(DWORD JobId, DWORD Level, LPBYTE pJob, DWORD cbBuf, LPDWORD pcbNeeded)
+{
+	return CheckHandle(g_pPrinterCache->Funcs()->pfnGetJob(m_hHandle, JobId, Level, pJob, cbBuf, pcbNeeded));
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CCachedPrinter::SetJob(DWORD JobId, DWORD Command)
+{
+	return CheckHandle(g_pPrinterCache->Funcs()->pfnSetJob(m_hHandle, JobId, 0, NULL, Command));
+}
@@ -0,0 +1,106 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#define PRINTERCACHE_IDLE	60000	//ms
+
+/*
+*  spooler entry points used for jobs, and the clock the idle timeout is
+*  measured on. Everything goes through this table so that the printer cache
+*  can be exercised against a fake spooler
+*/
+
+typedef struct tagSPOOLERFUNCS
+{
+	BOOL (WINAPI *pfnOpenPrinter)(LPWSTR pPrinterName, LPHANDLE phPrinter, LPPRINTER_DEFAULTSW pDefault);
+	BOOL (WINAPI *pfnClosePrinter)(HANDLE hPrinter);
+	BOOL (WINAPI *pfnGetJob)(HANDLE hPrinter, DWORD JobId, DWORD Level, LPBYTE pJob, DWORD cbBuf, LPDWORD pcbNeeded);
+	BOOL (WINAPI *pfnSetJob)(HANDLE hPrinter, DWORD JobId, DWORD Level, LPBYTE pJob, DWORD Command);
+	DWORD (WINAPI *pfnGetTickCount)();
+} SPOOLERFUNCS, *LPSPOOLERFUNCS;
+
+extern const SPOOLERFUNCS g_SpoolerFuncs;
+
+/*
+*  CPrinterCache
+*  printer handles shared by all ports. StartDoc, EndDoc and a failing WritePort
+*  all need a handle to the same printer: instead of opening it three times per
+*  job, handles are kept open and closed after PRINTERCACHE_IDLE ms of inactivity,
+*  when the spooler closes a port printing to them, or when a call on them fails
+*  with ERROR_INVALID_HANDLE.
+*/
+
+class CPrinterCache
+{
+private:
+	typedef struct tagPRINTERENTRY
+	{
+		LPWSTR szPrinterName;
+		HANDLE hPrinter;
+		LONG nRefs;
+		DWORD dwLastUsed;
+		BOOL bDiscarded;
+		tagPRINTERENTRY* pNext;
+	} PRINTERENTRY, *LPPRINTERENTRY;
+
+public:
+	explicit CPrinterCache(const SPOOLERFUNCS* pFuncs = &g_SpoolerFuncs);
+	virtual ~CPrinterCache();
+
+public:
+	HANDLE Acquire(LPCWSTR szPrinterName);
+	void Release(HANDLE hPrinter, BOOL bDiscard);
+	void Discard(LPCWSTR szPrinterName);
+	const SPOOLERFUNCS* Funcs() const { return m_pFuncs; }
+
+private:
+	void Sweep();
+	void Unlink(LPPRINTERENTRY* ppEntry);
+
+private:
+	const SPOOLERFUNCS* m_pFuncs;
+	LPPRINTERENTRY m_pFirst;
+	CRITICAL_SECTION m_CSCache;
+};
+
+extern CPrinterCache* g_pPrinterCache;
+
+/*
+*  CCachedPrinter
+*  scoped use of a cached printer handle, in the spirit of CPrinterHandle
+*/
+
+class CCachedPrinter
+{
+public:
+	explicit CCachedPrinter(LPCWSTR szPrinterName);
+	virtual ~CCachedPrinter();
+	operator HANDLE() const { return m_hHandle; }
+	HANDLE Handle() const { return m_hHandle; }
+	BOOL GetJob(DWORD JobId, DWORD Level, LPBYTE pJob, DWORD cbBuf, LPDWORD pcbNeeded);
+	BOOL SetJob(DWORD JobId, DWORD Command);
+
+private:
+	BOOL CheckHandle(BOOL bRet);
+
+private:
+	HANDLE m_hHandle;
+	BOOL m_bDiscard;
+};
@@ -0,0 +1,381 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "stats.h"
+#include "portlist.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+typedef struct tagSTATSFAMILY
+{
+	LPCSTR szName;
+	LPCSTR szHelp;
+} STATSFAMILY;
+
+//counters first, then histograms, in the order of STAT_xxx and HIST_xxx
+static const STATSFAMILY Families[STATS_FAMILIES] =
+{
+	{ "mfilemon_jobs", "Print jobs started" },
+	{ "mfilemon_written_bytes", "Bytes written to output files or user commands" },
+	{ "mfilemon_failures", "Print jobs that failed to start, write or end" },
+	{ "mfilemon_filename_probes", "File names tried while looking for a free one" },
+	{ "mfilemon_command_launches", "User commands started" },
+	{ "mfilemon_timeouts", "Writes and user commands that timed out" },
+	{ "mfilemon_startdoc_seconds", "StartDocPort duration" },
+	{ "mfilemon_write_seconds", "WritePort duration" },
+	{ "mfilemon_enddoc_seconds", "EndDocPort duration" },
+	{ "mfilemon_filename_seconds", "Time spent finding and creating the output file" },
+	{ "mfilemon_command_seconds", "User command run time" },
+};
+
+//-------------------------------------------------------------------------------------
+static void EscapeLabel(LPCWSTR szValue, LPSTR szOut, int cbOut)
+{
+	//label values are UTF-8 with \ " and newline escaped
+	char szUtf8[(MAX_PATH + 1) * 3];
+	int j = 0;
+
+	if (WideCharToMultiByte(CP_UTF8, 0, szValue, -1, szUtf8, sizeof(szUtf8), NULL, NULL) == 0)
+		*szUtf8 = '\0';
+
+	for (int i = 0; szUtf8[i] && j < cbOut - 3; i++)
+	{
+		switch (szUtf8[i])
+		{
+		case '\\':
+		case '"':
+			szOut[j++] = '\\';
+			szOut[j++] = szUtf8[i];
+			break;
+		case '\n':
+			szOut[j++] = '\\';
+			szOut[j++] = 'n';
+			break;
+		default:
+			szOut[j++] = szUtf8[i];
+			break;
+		}
+	}
+
+	szOut[j] = '\0';
+}
+
+//-------------------------------------------------------------------------------------
+CStatsText::CStatsText()
+{
+	m_pBuf = NULL;
+	m_cb = 0;
+	m_cbAlloc = 0;
+}
+
+//-------------------------------------------------------------------------------------
+CStatsText::~CStatsText()
+{
+	delete[] m_pBuf;
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CStatsText::Reserve(DWORD cb)
+{
+	if (m_cb + cb + 1 <= m_cbAlloc)
+		return TRUE;
+
+	DWORD cbAlloc = m_cbAlloc ? m_cbAlloc : 4096;
+
+	while (cbAlloc < m_cb + cb + 1)
+		cbAlloc *= 2;
+
+	LPSTR pBuf = new char[cbAlloc];
+
+	if (m_pBuf)
+	{
+		memcpy(pBuf, m_pBuf, m_cb + 1);
+		delete[] m_pBuf;
+	}
+
+	m_pBuf = pBuf;
+	m_cbAlloc = cbAlloc;
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CStatsText::Printf(LPCSTR szFormat, ...)
+{
+	va_list args;
+
+	va_start(args, szFormat);
+	int len = _vscprintf(szFormat, args);
+	va_end(args);
+
+	if (len <= 0 || !Reserve(len))
+		return;
+
+	va_start(args, szFormat);
+	vsprintf_s(m_pBuf + m_cb, m_cbAlloc - m_cb, szFormat, args);
+	va_end(args);
+
+	m_cb += len;
+}
+
+//-------------------------------------------------------------------------------------
+CPortStats::CPortStats()
+{
+	ZeroMemory(const_cast<LONG64*>(m_counters), sizeof(m_counters));
+	m_pHists = NULL;
+}
+
+//-------------------------------------------------------------------------------------
+CPortStats::~CPortStats()
+{
+	delete m_pHists;
+}
+
+//-------------------------------------------------------------------------------------
+ULONGLONG CPortStats::Now()
+{
+	//microseconds from an arbitrary origin
+	static LONGLONG s_llFreq = 0;
+	LARGE_INTEGER li;
+
+	if (s_llFreq == 0)
+	{
+		QueryPerformanceFrequency(&li);
+		s_llFreq = li.QuadPart;
+	}
+
+	QueryPerformanceCounter(&li);
+
+	return static_cast<ULONGLONG>(li.QuadPart / s_llFreq) * 1000000ULL +
+		static_cast<ULONGLONG>(li.QuadPart % s_llFreq) * 1000000ULL / s_llFreq;
+}
+
+//-------------------------------------------------------------------------------------
+int CPortStats::Bucket(ULONGLONG ullValue)
+{
+	//small values have a bucket of their own
+	if (ullValue < (1 << HIST_SUBBITS))
+		return static_cast<int>(ullValue);
+
+	if (ullValue > 0xFFFFFFFFULL)
+		return HIST_BUCKETS - 1;
+
+	unsigned long nMsb;
+	_BitScanReverse(&nMsb, static_cast<unsigned long>(ullValue));
+
+	int nShift = nMsb - HIST_SUBBITS;
+
+	return ((nShift + 1) << HIST_SUBBITS) +
+		static_cast<int>((ullValue >> nShift) & ((1 << HIST_SUBBITS) - 1));
+}
+
+//-------------------------------------------------------------------------------------
+ULONGLONG CPortStats::BucketMax(int nBucket)
+{
+	//the largest value that falls in the bucket
+	if (nBucket < (1 << HIST_SUBBITS))
+		return nBucket;
+
+	int nShift = (nBucket >> HIST_SUBBITS) - 1;
+	ULONGLONG ullLow = static_cast<ULONGLONG>((1 << HIST_SUBBITS) + (nBucket & ((1 << HIST_SUBBITS) - 1))) << nShift;
+
+	return ullLow + (1ULL << nShift) - 1;
+}
+
+//-------------------------------------------------------------------------------------
+void CPortStats::Add(int nHist, ULONGLONG ullMicroseconds)
+{
+	LPHISTOGRAMS pHists = m_pHists;
+
+	if (!pHists)
+	{
+		//two threads may race for the first sample: one allocation wins
+		LPHISTOGRAMS pNew = new HISTOGRAMS;
+		ZeroMemory(pNew, sizeof(HISTOGRAMS));
+
+		pHists = static_cast<LPHISTOGRAMS>(InterlockedCompareExchangePointer(
+			reinterpret_cast<PVOID volatile*>(&m_pHists), pNew, NULL));
+
+		if (pHists)
+			delete pNew;
+		else
+			pHists = pNew;
+	}
+
+	InterlockedIncrement64(&pHists->buckets[nHist][Bucket(ullMicroseconds)]);
+	InterlockedExchangeAdd64(&pHists->sums[nHist], static_cast<LONG64>(ullMicroseconds));
+}
+
+//-------------------------------------------------------------------------------------
+void CPortStats::FormatHeader(CStatsText* pText, int nFamily)
+{
+	pText->Printf("# TYPE %s %s\n# HELP %s %s.\n",
+		Families[nFamily].szName, nFamily < STAT_COUNTERS ? "counter" : "histogram",
+		Families[nFamily].szName, Families[nFamily].szHelp);
+}
+
+//-------------------------------------------------------------------------------------
+void CPortStats::FormatGauge(CStatsText* pText, LPCSTR szName, LPCWSTR szPort, ULONGLONG ullValue)
+{
+	char szLabel[(MAX_PATH + 1) * 6];
+
+	EscapeLabel(szPort, szLabel, sizeof(szLabel));
+
+	pText->Printf("%s{port=\"%s\"} %I64u\n", szName, szLabel, ullValue);
+}
+
+//-------------------------------------------------------------------------------------
+void CPortStats::Format(CStatsText* pText, int nFamily, LPCWSTR szPort) const
+{
+	char szLabel[(MAX_PATH + 1) * 6];
+	LPCSTR szName = Families[nFamily].szName;
+
+	EscapeLabel(szPort, szLabel, sizeof(szLabel));
+
+	if (nFamily < STAT_COUNTERS)
+	{
+		pText->Printf("%s_total{port=\"%s\"} %I64d\n", szName, szLabel, m_counters[nFamily]);
+		return;
+	}
+
+	int nHist = nFamily - STAT_COUNTERS;
+	LONG64 llCount = 0;
+	LPHISTOGRAMS pHists = m_pHists;
+
+	//buckets are cumulative; empty ones add nothing and are left out
+	for (int i = 0; pHists && i < HIST_BUCKETS; i++)
+	{
+		LONG64 n = pHists->buckets[nHist][i];
+
+		if (n == 0)
+			continue;
+
+		llCount += n;
+
+		ULONGLONG ullMax = BucketMax(i);
+		pText->Printf("%s_bucket{port=\"%s\",le=\"%I64u.%06I64u\"} %I64d\n",
+			szName, szLabel, ullMax / 1000000, ullMax % 1000000, llCount);
+	}
+
+	ULONGLONG ullSum = pHists ? static_cast<ULONGLONG>(pHists->sums[nHist]) : 0;
+
+	pText->Printf("%s_bucket{port=\"%s\",le=\"+Inf\"} %I64d\n", szName, szLabel, llCount);
+	pText->Printf("%s_sum{port=\"%s\"} %I64u.%06I64u\n", szName, szLabel, ullSum / 1000000, ullSum % 1000000);
+	pText->Printf("%s_count{port=\"%s\"} %I64d\n", szName, szLabel, llCount);
+}
+
+//-------------------------------------------------------------------------------------
+CStatsDumper::CStatsDumper()
+{
+	m_hThread = NULL;
+	m_hStopEvt = NULL;
+	m_nSeconds = 0;
+}
+
+//-------------------------------------------------------------------------------------
+CStatsDumper::~CStatsDumper()
+{
+	Stop();
+}
+
+//-------------------------------------------------------------------------------------
+void CStatsDumper::Start(DWORD nSeconds)
+{
+	Stop();
+
+	if (nSeconds == 0)
+		return;
+
+	m_nSeconds = nSeconds;
+
+	if ((m_hStopEvt = CreateEventW(NULL, TRUE, FALSE, NULL)) == NULL)
+		return;
+
+	DWORD dwId;
+	if ((m_hThread = CreateThread(NULL, 0, DumpThreadProc, this, 0, &dwId)) == NULL)
+	{
+		g_pLog->Error(L"CStatsDumper::Start: CreateThread failed (%i)", GetLastError());
+		CloseHandle(m_hStopEvt);
+		m_hStopEvt = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CStatsDumper::Stop()
+{
+	if (m_hThread)
+	{
+		SetEvent(m_hStopEvt);
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+	}
+
+	if (m_hStopEvt)
+	{
+		CloseHandle(m_hStopEvt);
+		m_hStopEvt = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WINAPI CStatsDumper::DumpThreadProc(LPVOID lpParam)
+{
+	CStatsDumper* pDumper = static_cast<CStatsDumper*>(lpParam);
+
+	while (WaitForSingleObject(pDumper->m_hStopEvt, pDumper->m_nSeconds * 1000) == WAIT_TIMEOUT)
+		pDumper->Dump();
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------
+void CStatsDumper::Dump()
+{
+	WCHAR szPath[MAX_PATH + 1];
+	WCHAR szTemp[MAX_PATH + 1];
+	CStatsText text;
+	DWORD wri;
+
+	g_pPortList->FormatStats(&text, NULL);
+
+	GetSystemDirectoryW(szPath, LENGTHOF(szPath));
+	wcscat_s(szPath, LENGTHOF(szPath), L"\\mfilemon.prom");
+	swprintf_s(szTemp, LENGTHOF(szTemp), L"%s.tmp", szPath);
+
+	//readers never see a half written file
+	HANDLE hFile = CreateFileW(szTemp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		g_pLog->Error(L"CStatsDumper::Dump: can't create %s (%i)", szTemp, GetLastError());
+		return;
+	}
+
+	BOOL bRet = WriteFile(hFile, text.Text(), text.Length(), &wri, NULL);
+	CloseHandle(hFile);
+
+	if (!bRet || !MoveFileExW(szTemp, szPath, MOVEFILE_REPLACE_EXISTING))
+		g_pLog->Error(L"CStatsDumper::Dump: can't write %s (%i)", szPath, GetLastError());
+}
@@ -0,0 +1,136 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+//counters
+#define STAT_JOBS			0	//jobs started
+#define STAT_BYTES			1	//bytes written
+#define STAT_FAILURES		2	//jobs that failed to start, write or end
+#define STAT_PROBES			3	//file names tried while looking for a free one
+#define STAT_LAUNCHES		4	//user commands started
+#define STAT_TIMEOUTS		5	//writes and user commands that timed out
+#define STAT_COUNTERS		6
+
+//latency histograms
+#define HIST_STARTDOC		0
+#define HIST_WRITE			1
+#define HIST_ENDDOC			2
+#define HIST_FILENAME		3	//finding and creating the output file
+#define HIST_COMMAND		4	//user command run time, when waited for
+#define HIST_COUNT			5
+
+//log-linear buckets over microseconds: 8 sub-buckets per power of two keep the
+//error within 12.5%, and values up to 2^32 us (about 71 minutes) are covered
+#define HIST_SUBBITS		3
+#define HIST_BUCKETS		((32 - HIST_SUBBITS + 1) << HIST_SUBBITS)
+
+#define STATS_FAMILIES		(STAT_COUNTERS + HIST_COUNT)
+
+/*
+*  CStatsText
+*  a growing UTF-8 buffer the OpenMetrics text is composed into.
+*/
+
+class CStatsText
+{
+public:
+	CStatsText();
+	virtual ~CStatsText();
+
+public:
+	void Printf(LPCSTR szFormat, ...);
+	LPCSTR Text() const { return m_pBuf ? m_pBuf : ""; }
+	DWORD Length() const { return m_cb; }
+
+private:
+	BOOL Reserve(DWORD cb);
+
+private:
+	LPSTR m_pBuf;
+	DWORD m_cb;
+	DWORD m_cbAlloc;
+};
+
+/*
+*  CPortStats
+*  runtime counters and latency histograms of a port. Updates are interlocked
+*  adds, so no lock is taken on the printing path; readers may see a histogram
+*  that is a few samples ahead of its sum, which is fine for monitoring.
+*  The histograms are allocated with the first sample: most ports of a large
+*  installation never print, and their buckets would be the bulk of the port.
+*/
+
+class CPortStats
+{
+public:
+	CPortStats();
+	virtual ~CPortStats();
+
+public:
+	void Count(int nCounter, LONGLONG n = 1) { InterlockedExchangeAdd64(&m_counters[nCounter], n); }
+	void Time(int nHist, ULONGLONG ullStart) { Add(nHist, Now() - ullStart); }
+	void Add(int nHist, ULONGLONG ullMicroseconds);
+	void Format(CStatsText* pText, int nFamily, LPCWSTR szPort) const;
+	static void FormatHeader(CStatsText* pText, int nFamily);
+	static void FormatGauge(CStatsText* pText, LPCSTR szName, LPCWSTR szPort, ULONGLONG ullValue);
+	static ULONGLONG Now();
+	size_t HeapUsage() const { return m_pHists ? sizeof(HISTOGRAMS) : 0; }
+
+private:
+	typedef struct tagHISTOGRAMS
+	{
+		LONG64 buckets[HIST_COUNT][HIST_BUCKETS];
+		LONG64 sums[HIST_COUNT];
+	} HISTOGRAMS, *LPHISTOGRAMS;
+
+private:
+	static int Bucket(ULONGLONG ullValue);
+	static ULONGLONG BucketMax(int nBucket);
+
+private:
+	volatile LONG64 m_counters[STAT_COUNTERS];
+	LPHISTOGRAMS volatile m_pHists;
+};
+
+/*
+*  CStatsDumper
+*  writes the statistics of all ports to %SystemRoot%\System32\mfilemon.prom
+*  every few seconds, for collectors that read OpenMetrics text files.
+*/
+
+class CStatsDumper
+{
+public:
+	CStatsDumper();
+	virtual ~CStatsDumper();
+
+public:
+	void Start(DWORD nSeconds);
+	void Stop();
+
+private:
+	static DWORD WINAPI DumpThreadProc(LPVOID lpParam);
+	void Dump();
+
+private:
+	HANDLE m_hThread;
+	HANDLE m_hStopEvt;
+	DWORD m_nSeconds;
+};
@@ -20,3 +20,4 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "stdafx.h"
 
 PMONITORINIT g_pMonitorInit = NULL;
+WCHAR g_szComputerName[MAX_COMPUTERNAME_LENGTH + 1] = { 0 };
@@ -19,9 +19,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #pragma once
 
+#ifdef _WIN32
+
 #ifdef __GNUC__
 #include <sdkddkver.h>
-#include "..\common\sec_api.h"
+#include "../common/sec_api.h"
 #endif
 
 #include <windows.h>
@@ -31,6 +33,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <winsplp.h>
 #include <crtdbg.h>
 
+#else
+
+//the POSIX backend (tools, tests)
+#include "../common/posix.h"
+
+#endif
+
 #define LENGTHOF(x) (sizeof(x)/sizeof((x)[0]))
 
 extern PMONITORINIT g_pMonitorInit;
+extern WCHAR g_szComputerName[MAX_COMPUTERNAME_LENGTH + 1];
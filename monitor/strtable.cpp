@@ -0,0 +1,172 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "strtable.h"
+#include "../common/autoclean.h"
+
+CStringTable* g_pStrings = NULL;
+
+//the empty string is not counted, every unset setting points here
+static const WCHAR s_szEmpty[] = L"";
+
+//-------------------------------------------------------------------------------------
+CStringTable::CStringTable()
+{
+	m_nBuckets = STRTABLE_BUCKETS;
+	m_pBuckets = new LPSTRINGREC[m_nBuckets];
+	ZeroMemory(m_pBuckets, m_nBuckets * sizeof(LPSTRINGREC));
+	m_nStrings = 0;
+	m_ullBytes = 0;
+	InitializeCriticalSection(&m_CSTable);
+}
+
+//-------------------------------------------------------------------------------------
+CStringTable::~CStringTable()
+{
+	//every port released its strings: anything left is a leak
+	_ASSERTE(m_nStrings == 0);
+
+	for (DWORD i = 0; i < m_nBuckets; i++)
+	{
+		while (m_pBuckets[i])
+		{
+			LPSTRINGREC pRec = m_pBuckets[i];
+			m_pBuckets[i] = pRec->pNext;
+			delete[] reinterpret_cast<LPBYTE>(pRec);
+		}
+	}
+
+	delete[] m_pBuckets;
+
+	DeleteCriticalSection(&m_CSTable);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CStringTable::Hash(LPCWSTR szString, size_t cch)
+{
+	//FNV-1a, case sensitive: patterns that differ in case only are different patterns
+	DWORD dwHash = 2166136261U;
+
+	for (size_t i = 0; i < cch; i++)
+	{
+		dwHash ^= static_cast<DWORD>(szString[i]);
+		dwHash *= 16777619U;
+	}
+
+	return dwHash;
+}
+
+//-------------------------------------------------------------------------------------
+void CStringTable::Grow()
+{
+	//twice the buckets; the hash is kept in every record, so strings move without rehashing them
+	DWORD nBuckets = m_nBuckets * 2;
+	LPSTRINGREC* pBuckets = new LPSTRINGREC[nBuckets];
+	ZeroMemory(pBuckets, nBuckets * sizeof(LPSTRINGREC));
+
+	for (DWORD i = 0; i < m_nBuckets; i++)
+	{
+		while (m_pBuckets[i])
+		{
+			LPSTRINGREC pRec = m_pBuckets[i];
+			m_pBuckets[i] = pRec->pNext;
+
+			LPSTRINGREC* ppRec = &pBuckets[pRec->dwHash & (nBuckets - 1)];
+			pRec->pNext = *ppRec;
+			*ppRec = pRec;
+		}
+	}
+
+	delete[] m_pBuckets;
+	m_pBuckets = pBuckets;
+	m_nBuckets = nBuckets;
+}
+
+//-------------------------------------------------------------------------------------
+LPCWSTR CStringTable::Intern(LPCWSTR szString)
+{
+	if (!szString || !*szString)
+		return s_szEmpty;
+
+	size_t cch = wcslen(szString);
+	DWORD dwHash = Hash(szString, cch);
+
+	CAutoCriticalSection acs(&m_CSTable);
+
+	LPSTRINGREC* ppRec = &m_pBuckets[dwHash & (m_nBuckets - 1)];
+
+	for (LPSTRINGREC pRec = *ppRec; pRec; pRec = pRec->pNext)
+	{
+		if (pRec->dwHash == dwHash && pRec->cch == cch &&
+			wmemcmp(pRec->szString, szString, cch) == 0)
+		{
+			pRec->nRefs++;
+			return pRec->szString;
+		}
+	}
+
+	size_t cb = offsetof(STRINGREC, szString) + (cch + 1) * sizeof(WCHAR);
+	LPSTRINGREC pRec = reinterpret_cast<LPSTRINGREC>(new BYTE[cb]);
+
+	pRec->dwHash = dwHash;
+	pRec->nRefs = 1;
+	pRec->cch = cch;
+	wmemcpy(pRec->szString, szString, cch + 1);
+	pRec->pNext = *ppRec;
+	*ppRec = pRec;
+
+	m_nStrings++;
+	m_ullBytes += cb;
+
+	if (m_nStrings > m_nBuckets)
+		Grow();
+
+	return pRec->szString;
+}
+
+//-------------------------------------------------------------------------------------
+void CStringTable::Release(LPCWSTR szString)
+{
+	if (!szString || szString == s_szEmpty)
+		return;
+
+	LPSTRINGREC pTarget = CONTAINING_RECORD(szString, STRINGREC, szString);
+
+	CAutoCriticalSection acs(&m_CSTable);
+
+	_ASSERTE(pTarget->nRefs > 0);
+
+	if (--pTarget->nRefs > 0)
+		return;
+
+	for (LPSTRINGREC* ppRec = &m_pBuckets[pTarget->dwHash & (m_nBuckets - 1)]; *ppRec; ppRec = &(*ppRec)->pNext)
+	{
+		if (*ppRec == pTarget)
+		{
+			*ppRec = pTarget->pNext;
+			break;
+		}
+	}
+
+	m_nStrings--;
+	m_ullBytes -= offsetof(STRINGREC, szString) + (pTarget->cch + 1) * sizeof(WCHAR);
+
+	delete[] reinterpret_cast<LPBYTE>(pTarget);
+}
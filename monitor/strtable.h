@@ -0,0 +1,71 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#define STRTABLE_BUCKETS	1024	//initial bucket count, doubled when there are more strings than buckets
+
+/*
+*  CStringTable
+*  configuration strings shared by all ports. Hundreds of ports usually
+*  differ only in their name, so output paths, patterns, commands and
+*  accounts are kept once, reference counted, instead of in fixed buffers
+*  of every port. Interned strings are immutable: a port that changes a
+*  setting interns the new value and releases the old one.
+*  Passwords are not interned, so that a secret never outlives its port.
+*  Every port name is a string of its own, so the table grows with the
+*  ports: it doubles its buckets and rehashes once it holds more strings
+*  than buckets, keeping chains short at any port count.
+*/
+
+class CStringTable
+{
+private:
+	typedef struct tagSTRINGREC
+	{
+		tagSTRINGREC* pNext;
+		DWORD dwHash;
+		LONG nRefs;
+		size_t cch;
+		WCHAR szString[1];
+	} STRINGREC, *LPSTRINGREC;
+
+public:
+	CStringTable();
+	virtual ~CStringTable();
+
+public:
+	LPCWSTR Intern(LPCWSTR szString);
+	void Release(LPCWSTR szString);
+	DWORD Strings() const { return m_nStrings; }
+	ULONGLONG Bytes() const { return m_ullBytes; }
+
+private:
+	static DWORD Hash(LPCWSTR szString, size_t cch);
+	void Grow();
+
+private:
+	LPSTRINGREC* m_pBuckets;
+	DWORD m_nBuckets;			//a power of two
+	DWORD m_nStrings;
+	ULONGLONG m_ullBytes;
+	CRITICAL_SECTION m_CSTable;
+};
+
+extern CStringTable* g_pStrings;
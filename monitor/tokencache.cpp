@@ -0,0 +1,535 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "tokencache.h"
+#include "log.h"
+#include "../common/autoclean.h"
+#include "../common/defs.h"
+#ifdef _WIN32
+#include <VersionHelpers.h>
+#endif
+#include <openssl/evp.h>
+
+#ifdef _WIN32
+//-------------------------------------------------------------------------------------
+static BOOL EnablePrivilege(
+	HANDLE hToken,                      // access token handle
+	LPCWSTR lpszPrivilege,              // name of privilege to enable/disable
+	BOOL bEnablePrivilege,              // to enable or disable privilege
+	PTOKEN_PRIVILEGES PreviousState		// previous state
+)
+{
+	TOKEN_PRIVILEGES tp = { 0 };
+	LUID luid;
+
+	if (!LookupPrivilegeValueW(NULL, lpszPrivilege, &luid))
+	{
+		return FALSE; 
+	}
+
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Luid = luid;
+	if (bEnablePrivilege)
+		tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	else
+		tp.Privileges[0].Attributes = 0;
+
+	DWORD Size = sizeof(TOKEN_PRIVILEGES);
+	// Enable the privilege or disable all privileges.
+	if (!AdjustTokenPrivileges(hToken, FALSE, &tp, sizeof(TOKEN_PRIVILEGES),
+		PreviousState, &Size))
+	{ 
+		return FALSE; 
+	} 
+
+	if (GetLastError() == ERROR_NOT_ALL_ASSIGNED)
+	{
+		return FALSE;
+	} 
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL GetPrimaryToken(LPWSTR lpszUsername, LPWSTR lpszDomain, LPWSTR lpszPassword,
+	PHANDLE phToken, BOOL *bRestrictedToken)
+{
+	DWORD dwLength;
+	*bRestrictedToken = FALSE;
+	BOOL bIsWindowsVistaOrLater = IsWindowsVistaOrGreater();
+
+	if (!bIsWindowsVistaOrLater)
+	{
+		return LogonUserW(lpszUsername, lpszDomain, lpszPassword, LOGON32_LOGON_INTERACTIVE,
+			LOGON32_PROVIDER_DEFAULT, phToken);
+	}
+	else
+	{
+		/*
+		* Assume activated User Account Control.
+		* To retrieve user primary token, it is better to avoid LOGON32_LOGON_INTERACTIVE logon type,
+		* for LogonUser, otherwise we'll get the filtered token with missing privileges.
+		*
+		* Thus I'll try first to logon as batch or service.
+		* If it works, I've got user token with his highest privileges,
+		* done.
+		*
+		* Otherwise,
+		* - logon with interactive logon type and get possibly filtered token.
+		* - Try to enable TCB privilege.
+		* - Retrieve linked token via GetTokenInformation().
+		* If an error or linked token is NULL, then either UAC is not active or we
+		* got a standard user, return logon token, done.
+		* If linked token is not NULL and TCB privilege was enabled,
+		* return linked token (it is primary due to TCB held).
+		*
+		* If linked token is not NULL and TCB was NOT enabled,
+		* returned token is restricted (filtered). This should not happen often,
+		* because there is a fair number of conditions that must hold true,
+		* 1) User is an Admin
+		* 2) User has no batch neither service logon privileges
+		* 3) Caller has no TCB privilege
+		* 4) UAC is enabled.
+		*/
+
+		int i;
+		HANDLE hMyToken;
+		HANDLE hLinkedToken;
+		DWORD logonType = LOGON32_LOGON_BATCH;
+		BOOL bSuccess = FALSE;
+		DWORD dwLastError;
+		BOOL bGotTcbPriv;
+		TOKEN_PRIVILEGES TcbPrevState;
+		DWORD allLogonTypes [] = {
+			LOGON32_LOGON_BATCH,
+			LOGON32_LOGON_SERVICE,
+			LOGON32_LOGON_INTERACTIVE /* intentionally put last, as most restrictive logon */
+		};
+
+		/* Try all logon types */
+		for (i = 0; i < LENGTHOF(allLogonTypes); i++)
+		{
+			logonType = allLogonTypes[i];
+			bSuccess = LogonUserW(lpszUsername, lpszDomain, lpszPassword, logonType,
+				LOGON32_PROVIDER_DEFAULT, phToken);
+
+			if (bSuccess)
+				break;
+
+			dwLastError = GetLastError();
+
+			if (dwLastError != ERROR_LOGON_TYPE_NOT_GRANTED &&
+				dwLastError != ERROR_LOGON_NOT_GRANTED)
+			{
+				return FALSE;
+			}
+		}
+
+		if (!bSuccess)
+		{
+			/* User could not logon with any logon type? */
+			return FALSE;
+		}
+
+		if (logonType != LOGON32_LOGON_INTERACTIVE)
+		{
+			/* Non-interactive logon, no UAC, no token restrictions */
+			return TRUE;
+		}
+
+		/* Try to get the highest privileged token */
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ALL_ACCESS, &hMyToken))
+		{
+			return FALSE;
+		}
+
+		/* Enable TCB temporarily to get primary "linked" token .
+		* Without TCB GetTokenInformation() would return
+		* Identity token, unusable for CreateProcessAsUser()
+		*/
+
+		bGotTcbPriv = EnablePrivilege(hMyToken, SE_TCB_NAME, TRUE, &TcbPrevState);
+		bSuccess = GetTokenInformation(*phToken, TokenLinkedToken, (VOID*)&hLinkedToken,
+			sizeof(HANDLE), &dwLength);
+
+		if (bGotTcbPriv)
+		{
+			/* Reset TCB privilege, if was set previously */
+			AdjustTokenPrivileges(hMyToken, FALSE, &TcbPrevState, sizeof(TcbPrevState), NULL, NULL);
+		}
+
+		CloseHandle(hMyToken);
+
+		if (!bSuccess)
+		{
+			if ((dwLastError = GetLastError()) == ERROR_NO_SUCH_LOGON_SESSION)
+			{
+				/* Can happend if we have standard user/UAC switched off */
+				SetLastError(ERROR_SUCCESS);
+				hLinkedToken = NULL;
+			}
+			else
+			{
+				return FALSE;
+			}
+		}
+
+		if (!hLinkedToken)
+		{
+			/* No UAC or standard user */
+			return TRUE;
+		}
+
+		if (!bGotTcbPriv)
+		{
+			/* Could not enable TCB , *phToken is restricted */
+			*bRestrictedToken = TRUE;
+			return TRUE;
+		}
+
+		CloseHandle(*phToken);
+
+		/* primary linked token */
+		*phToken = hLinkedToken;
+		return TRUE;
+	}
+}
+#else
+//-------------------------------------------------------------------------------------
+static BOOL GetPrimaryToken(LPWSTR /*lpszUsername*/, LPWSTR /*lpszDomain*/, LPWSTR /*lpszPassword*/,
+	PHANDLE phToken, BOOL *bRestrictedToken)
+{
+	//no logon service: a cache that must log on is given its TOKENFUNCS
+	*phToken = NULL;
+	*bRestrictedToken = FALSE;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return FALSE;
+}
+#endif
+
+//-------------------------------------------------------------------------------------
+const TOKENFUNCS g_TokenFuncs =
+{
+	GetPrimaryToken,
+	CloseHandle,
+	GetTickCount
+};
+
+CTokenCache* g_pTokenCache = NULL;
+
+//-------------------------------------------------------------------------------------
+CTokenCache::CTokenCache(const TOKENFUNCS* pFuncs)
+{
+	m_pFuncs = pFuncs;
+	m_pFirst = NULL;
+	m_hRefreshThread = NULL;
+	m_hStopEvt = CreateEventW(NULL, TRUE, FALSE, NULL);
+	InitializeCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+CTokenCache::~CTokenCache()
+{
+	if (m_hRefreshThread)
+	{
+		SetEvent(m_hStopEvt);
+		WaitForSingleObject(m_hRefreshThread, INFINITE);
+		CloseHandle(m_hRefreshThread);
+	}
+
+	if (m_hStopEvt)
+		CloseHandle(m_hStopEvt);
+
+	while (m_pFirst)
+		Unlink(m_pFirst);
+
+	DeleteCriticalSection(&m_CSCache);
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::Hash(LPCWSTR szPassword, LPBYTE pHash)
+{
+	unsigned int len = TOKENCACHE_HASHLEN;
+
+	//entries are matched on a digest, passwords are never compared directly
+	if (!EVP_Digest(szPassword, wcslen(szPassword) * sizeof(WCHAR), pHash, &len, EVP_sha256(), NULL))
+		ZeroMemory(pHash, TOKENCACHE_HASHLEN);
+}
+
+//-------------------------------------------------------------------------------------
+LPWSTR CTokenCache::Duplicate(LPCWSTR szString)
+{
+	size_t len = wcslen(szString) + 1;
+	LPWSTR szCopy = new WCHAR[len];
+	wcscpy_s(szCopy, len, szString);
+	return szCopy;
+}
+
+//-------------------------------------------------------------------------------------
+CTokenCache::LPTOKENENTRY CTokenCache::Find(LPCWSTR szUser, LPCWSTR szDomain, const BYTE* pHash)
+{
+	for (LPTOKENENTRY pEntry = m_pFirst; pEntry; pEntry = pEntry->pNext)
+	{
+		if (!pEntry->bSuperseded &&
+			_wcsicmp(pEntry->szUser, szUser) == 0 &&
+			_wcsicmp(pEntry->szDomain, szDomain) == 0 &&
+			memcmp(pEntry->hash, pHash, TOKENCACHE_HASHLEN) == 0)
+		{
+			return pEntry;
+		}
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+CTokenCache::LPTOKENENTRY CTokenCache::Insert(LPCWSTR szUser, LPCWSTR szDomain, const BYTE* pHash,
+	HANDLE hToken, BOOL bRestrictedToken)
+{
+	LPTOKENENTRY pEntry = new TOKENENTRY;
+
+	pEntry->szUser = Duplicate(szUser);
+	pEntry->szDomain = Duplicate(szDomain);
+	pEntry->szPassword = NULL;
+	memcpy(pEntry->hash, pHash, TOKENCACHE_HASHLEN);
+	pEntry->hToken = hToken;
+	pEntry->bRestrictedToken = bRestrictedToken;
+	pEntry->nRefs = 0;
+	pEntry->dwLogonTick = m_pFuncs->pfnGetTickCount();
+	pEntry->dwRetryTick = pEntry->dwLogonTick;
+	pEntry->bRefreshing = FALSE;
+	pEntry->bSuperseded = FALSE;
+	pEntry->pNext = m_pFirst;
+	m_pFirst = pEntry;
+
+	return pEntry;
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::ForgetPassword(LPTOKENENTRY pEntry)
+{
+	if (pEntry->szPassword)
+	{
+		SecureZeroMemory(pEntry->szPassword, wcslen(pEntry->szPassword) * sizeof(WCHAR));
+		delete[] pEntry->szPassword;
+		pEntry->szPassword = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::Unlink(LPTOKENENTRY pEntry)
+{
+	for (LPTOKENENTRY* ppEntry = &m_pFirst; *ppEntry; ppEntry = &(*ppEntry)->pNext)
+	{
+		if (*ppEntry == pEntry)
+		{
+			*ppEntry = pEntry->pNext;
+			break;
+		}
+	}
+
+	m_pFuncs->pfnCloseToken(pEntry->hToken);
+
+	ForgetPassword(pEntry);
+
+	delete[] pEntry->szUser;
+	delete[] pEntry->szDomain;
+	delete pEntry;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD CTokenCache::Acquire(LPCWSTR szUser, LPCWSTR szDomain, LPCWSTR szPassword, LPTOKENENTRY* ppEntry)
+{
+	BYTE hash[TOKENCACHE_HASHLEN];
+
+	if (!szDomain)
+		szDomain = L"";
+
+	Hash(szPassword, hash);
+
+	//the lock is held during the logon, so that ports starting together
+	//with the same account wait for a single round trip
+	CAutoCriticalSection acs(&m_CSCache);
+
+	LPTOKENENTRY pEntry = Find(szUser, szDomain, hash);
+
+	if (!pEntry)
+	{
+		WCHAR szUserBuf[MAX_USER];
+		WCHAR szDomainBuf[MAX_DOMAIN];
+		WCHAR szPasswordBuf[MAX_PASSWORD];
+		HANDLE hToken;
+		BOOL bRestrictedToken;
+
+		wcscpy_s(szUserBuf, LENGTHOF(szUserBuf), szUser);
+		wcscpy_s(szDomainBuf, LENGTHOF(szDomainBuf), szDomain);
+		wcscpy_s(szPasswordBuf, LENGTHOF(szPasswordBuf), szPassword);
+
+		BOOL bRet = m_pFuncs->pfnLogon(szUserBuf, *szDomainBuf ? szDomainBuf : NULL, szPasswordBuf,
+			&hToken, &bRestrictedToken);
+		DWORD dwErr = GetLastError();
+
+		SecureZeroMemory(szPasswordBuf, sizeof(szPasswordBuf));
+
+		if (!bRet)
+			return dwErr;
+
+		pEntry = Insert(szUser, szDomain, hash, hToken, bRestrictedToken);
+
+		//the refresh thread is started on first use, not from DllMain
+		if (!m_hRefreshThread && m_hStopEvt)
+		{
+			DWORD dwId;
+			m_hRefreshThread = CreateThread(NULL, 0, RefreshThreadProc, this, 0, &dwId);
+		}
+	}
+
+	//kept for the renewals while the entry is in use (see Release)
+	if (pEntry->nRefs++ == 0)
+		pEntry->szPassword = Duplicate(szPassword);
+
+	*ppEntry = pEntry;
+
+	return ERROR_SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::Release(LPTOKENENTRY pEntry)
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	//nobody needs the entry renewed any more: the digest is enough to find it
+	if (--pEntry->nRefs == 0)
+		ForgetPassword(pEntry);
+
+	//current entries stay around until they expire, so that a port coming back
+	//with the same account (e.g. after SetConfig) does not need a new logon
+	if (pEntry->bSuperseded && pEntry->nRefs == 0)
+		Unlink(pEntry);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CTokenCache::RefreshOne()
+{
+	WCHAR szUser[MAX_USER];
+	WCHAR szDomain[MAX_DOMAIN];
+	WCHAR szPassword[MAX_PASSWORD];
+	LPTOKENENTRY pOld = NULL;
+	DWORD dwNow = m_pFuncs->pfnGetTickCount();
+
+	{
+		CAutoCriticalSection acs(&m_CSCache);
+
+		for (LPTOKENENTRY pEntry = m_pFirst; pEntry; pEntry = pEntry->pNext)
+		{
+			if (!pEntry->bSuperseded && !pEntry->bRefreshing && pEntry->nRefs > 0 &&
+				dwNow - pEntry->dwLogonTick >= TOKENCACHE_REFRESH &&
+				dwNow - pEntry->dwRetryTick >= TOKENCACHE_RETRY)
+			{
+				pOld = pEntry;
+				break;
+			}
+		}
+
+		if (!pOld)
+			return FALSE;
+
+		pOld->bRefreshing = TRUE;
+		pOld->dwRetryTick = dwNow;
+
+		wcscpy_s(szUser, LENGTHOF(szUser), pOld->szUser);
+		wcscpy_s(szDomain, LENGTHOF(szDomain), pOld->szDomain);
+		wcscpy_s(szPassword, LENGTHOF(szPassword), pOld->szPassword);
+	}
+
+	//talk to the domain controller without holding the lock
+	HANDLE hToken;
+	BOOL bRestrictedToken;
+	BOOL bRet = m_pFuncs->pfnLogon(szUser, *szDomain ? szDomain : NULL, szPassword,
+		&hToken, &bRestrictedToken);
+	DWORD dwErr = GetLastError();
+
+	SecureZeroMemory(szPassword, sizeof(szPassword));
+
+	//the ports may have let go of the old entry meanwhile, and its password with it
+	CAutoCriticalSection acs(&m_CSCache);
+
+	pOld->bRefreshing = FALSE;
+
+	if (!bRet)
+	{
+		//keep using the old token, we'll try again later
+		g_pLog->Error(L"CTokenCache::RefreshOne: logon failed - user = \"%s\", domain = \"%s\" (%i)",
+			pOld->szUser, *pOld->szDomain ? pOld->szDomain : L"<empty>", dwErr);
+		return TRUE;
+	}
+
+	Insert(pOld->szUser, pOld->szDomain, pOld->hash, hToken, bRestrictedToken);
+
+	//ports pick up the new entry at their next job
+	pOld->bSuperseded = TRUE;
+	if (pOld->nRefs == 0)
+		Unlink(pOld);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::Evict()
+{
+	CAutoCriticalSection acs(&m_CSCache);
+
+	DWORD dwNow = m_pFuncs->pfnGetTickCount();
+	LPTOKENENTRY pEntry = m_pFirst;
+
+	while (pEntry)
+	{
+		LPTOKENENTRY pNext = pEntry->pNext;
+
+		if (pEntry->nRefs == 0 && !pEntry->bRefreshing &&
+			dwNow - pEntry->dwLogonTick >= TOKENCACHE_TTL)
+		{
+			Unlink(pEntry);
+		}
+
+		pEntry = pNext;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+void CTokenCache::Maintain()
+{
+	Evict();
+
+	//renew one account at a time, checking for shutdown in between
+	while (WaitForSingleObject(m_hStopEvt, 0) == WAIT_TIMEOUT && RefreshOne())
+		;
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WINAPI CTokenCache::RefreshThreadProc(LPVOID lpParam)
+{
+	CTokenCache* pCache = static_cast<CTokenCache*>(lpParam);
+
+	while (WaitForSingleObject(pCache->m_hStopEvt, TOKENCACHE_CHECK) == WAIT_TIMEOUT)
+		pCache->Maintain();
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#define TOKENCACHE_TTL		3600000	//ms, unused tokens are dropped after this
+#define TOKENCACHE_REFRESH	3300000	//ms, tokens in use are renewed after this
+#define TOKENCACHE_RETRY	300000	//ms, wait before retrying a failed renewal
+#define TOKENCACHE_CHECK	60000	//ms, how often the refresh thread wakes up
+#define TOKENCACHE_HASHLEN	32		//SHA-256
+
+/*
+*  logon entry points and the clock token ages are measured on, so that the
+*  cache can be exercised with a fake provider
+*/
+
+typedef struct tagTOKENFUNCS
+{
+	BOOL (*pfnLogon)(LPWSTR lpszUsername, LPWSTR lpszDomain, LPWSTR lpszPassword,
+		PHANDLE phToken, BOOL* pbRestrictedToken);
+	BOOL (WINAPI *pfnCloseToken)(HANDLE hToken);
+	DWORD (WINAPI *pfnGetTickCount)();
+} TOKENFUNCS, *LPTOKENFUNCS;
+
+extern const TOKENFUNCS g_TokenFuncs;
+
+/*
+*  CTokenCache
+*  primary tokens shared by all ports that run as the same user, so that
+*  a domain controller is asked once per account instead of once per port
+*  (and up to three times, one for every logon type tried).
+*  Entries are reference counted. A background thread logs on again the
+*  accounts in use before their token gets too old, so that password or
+*  group changes are picked up without a port ever waiting for it; the old
+*  entry is marked superseded and ports switch to the new one at their next
+*  job. Unused entries are dropped after TOKENCACHE_TTL ms. Both are done
+*  by Maintain, which the thread runs every TOKENCACHE_CHECK ms.
+*  Entries are found by user, domain and a digest of the password. The
+*  password itself is only needed to log on again, which is done for entries
+*  in use: it is kept while the entry has references, and zeroed and freed
+*  by the last Release. An unused entry gets it back from the next Acquire.
+*/
+
+class CTokenCache
+{
+public:
+	typedef struct tagTOKENENTRY
+	{
+		LPWSTR szUser;
+		LPWSTR szDomain;
+		LPWSTR szPassword;		//NULL while nRefs is 0
+		BYTE hash[TOKENCACHE_HASHLEN];
+		HANDLE hToken;
+		BOOL bRestrictedToken;
+		LONG nRefs;
+		DWORD dwLogonTick;
+		DWORD dwRetryTick;
+		BOOL bRefreshing;
+		volatile BOOL bSuperseded;
+		tagTOKENENTRY* pNext;
+	} TOKENENTRY, *LPTOKENENTRY;
+
+public:
+	explicit CTokenCache(const TOKENFUNCS* pFuncs = &g_TokenFuncs);
+	virtual ~CTokenCache();
+
+public:
+	DWORD Acquire(LPCWSTR szUser, LPCWSTR szDomain, LPCWSTR szPassword, LPTOKENENTRY* ppEntry);
+	void Release(LPTOKENENTRY pEntry);
+	void Maintain();
+
+private:
+	static DWORD WINAPI RefreshThreadProc(LPVOID lpParam);
+	static void Hash(LPCWSTR szPassword, LPBYTE pHash);
+	static LPWSTR Duplicate(LPCWSTR szString);
+	LPTOKENENTRY Find(LPCWSTR szUser, LPCWSTR szDomain, const BYTE* pHash);
+	LPTOKENENTRY Insert(LPCWSTR szUser, LPCWSTR szDomain, const BYTE* pHash,
+		HANDLE hToken, BOOL bRestrictedToken);
+	static void ForgetPassword(LPTOKENENTRY pEntry);
+	void Unlink(LPTOKENENTRY pEntry);
+	BOOL RefreshOne();
+	void Evict();
+
+private:
+	const TOKENFUNCS* m_pFuncs;
+	LPTOKENENTRY m_pFirst;
+	HANDLE m_hRefreshThread;
+	HANDLE m_hStopEvt;
+	CRITICAL_SECTION m_CSCache;
+};
+
+extern CTokenCache* g_pTokenCache;
@@ -0,0 +1,260 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "stdafx.h"
+#include "trace.h"
+#include "port.h"
+#include "../common/autoclean.h"
+
+volatile BOOL g_bTraceEnabled = FALSE;
+CTracer* g_pTracer = NULL;
+
+//-------------------------------------------------------------------------------------
+static void JsonString(LPCWSTR szValue, LPSTR szOut, int cbOut)
+{
+	//UTF-8, with quotes, backslashes and control characters escaped
+	char szUtf8[(MAX_PATH + 1) * 3];
+	int j = 0;
+
+	if (WideCharToMultiByte(CP_UTF8, 0, szValue, -1, szUtf8, sizeof(szUtf8), NULL, NULL) == 0)
+		*szUtf8 = '\0';
+
+	for (int i = 0; szUtf8[i] && j < cbOut - 7; i++)
+	{
+		unsigned char ch = static_cast<unsigned char>(szUtf8[i]);
+
+		if (ch == '"' || ch == '\\')
+		{
+			szOut[j++] = '\\';
+			szOut[j++] = ch;
+		}
+		else if (ch < 0x20)
+			j += sprintf_s(szOut + j, cbOut - j, "\\u%04x", ch);
+		else
+			szOut[j++] = ch;
+	}
+
+	szOut[j] = '\0';
+}
+
+//-------------------------------------------------------------------------------------
+CTracer::CTracer()
+{
+	m_dwTlsIndex = TlsAlloc();
+	InitializeCriticalSection(&m_cs);
+	m_pBuffers = NULL;
+	m_pPorts = NULL;
+	ZeroMemory(const_cast<LONG*>(m_named), sizeof(m_named));
+}
+
+//-------------------------------------------------------------------------------------
+CTracer::~CTracer()
+{
+	g_bTraceEnabled = FALSE;
+
+	while (m_pBuffers)
+	{
+		LPTRACEBUFFER pNext = m_pBuffers->pNext;
+		delete m_pBuffers;
+		m_pBuffers = pNext;
+	}
+
+	while (m_pPorts)
+	{
+		LPTRACEPORT pNext = m_pPorts->pNext;
+		delete[] m_pPorts->szName;
+		delete m_pPorts;
+		m_pPorts = pNext;
+	}
+
+	if (m_dwTlsIndex != TLS_OUT_OF_INDEXES)
+		TlsFree(m_dwTlsIndex);
+
+	DeleteCriticalSection(&m_cs);
+}
+
+//-------------------------------------------------------------------------------------
+void CTracer::Enable(BOOL bEnable)
+{
+	CAutoCriticalSection acs(&m_cs);
+
+	if (m_dwTlsIndex == TLS_OUT_OF_INDEXES)
+		return;
+
+	//a new session starts from empty buffers, and only those of live threads
+	if (bEnable && !g_bTraceEnabled)
+	{
+		LPTRACEBUFFER* ppBuffer = &m_pBuffers;
+
+		while (*ppBuffer)
+		{
+			LPTRACEBUFFER pBuffer = *ppBuffer;
+
+			if (pBuffer->bDetached)
+			{
+				*ppBuffer = pBuffer->pNext;
+				delete pBuffer;
+				continue;
+			}
+
+			InterlockedExchange(&pBuffer->nEvents, 0);
+			ppBuffer = &pBuffer->pNext;
+		}
+	}
+
+	g_bTraceEnabled = bEnable;
+}
+
+//-------------------------------------------------------------------------------------
+CTracer::LPTRACEBUFFER CTracer::ThreadBuffer()
+{
+	LPTRACEBUFFER pBuffer = static_cast<LPTRACEBUFFER>(TlsGetValue(m_dwTlsIndex));
+
+	if (pBuffer)
+		return pBuffer;
+
+	//first span on this thread: the buffer of a thread that has exited,
+	//whose events stay in it, or a new one
+	CAutoCriticalSection acs(&m_cs);
+
+	for (pBuffer = m_pBuffers; pBuffer; pBuffer = pBuffer->pNext)
+	{
+		if (pBuffer->bDetached)
+			break;
+	}
+
+	if (!pBuffer)
+	{
+		pBuffer = new TRACEBUFFER;
+		pBuffer->nEvents = 0;
+		pBuffer->pNext = m_pBuffers;
+		m_pBuffers = pBuffer;
+	}
+
+	pBuffer->bDetached = FALSE;
+
+	TlsSetValue(m_dwTlsIndex, pBuffer);
+
+	return pBuffer;
+}
+
+//-------------------------------------------------------------------------------------
+void CTracer::ThreadDetach()
+{
+	if (m_dwTlsIndex == TLS_OUT_OF_INDEXES)
+		return;
+
+	LPTRACEBUFFER pBuffer = static_cast<LPTRACEBUFFER>(TlsGetValue(m_dwTlsIndex));
+
+	if (!pBuffer)
+		return;
+
+	TlsSetValue(m_dwTlsIndex, NULL);
+
+	//the next new thread goes on with it
+	CAutoCriticalSection acs(&m_cs);
+	pBuffer->bDetached = TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CTracer::NamePort(CPort* pPort)
+{
+	WORD nPort = pPort->LogId();
+	LONG nBit = static_cast<LONG>(1UL << (nPort & 31));
+
+	//names are kept, so that ports deleted since are still shown by name
+	if (InterlockedOr(&m_named[nPort >> 5], nBit) & nBit)
+		return;
+
+	char szName[(MAX_PATH + 1) * 6];
+	JsonString(pPort->PortName(), szName, sizeof(szName));
+
+	LPTRACEPORT pEntry = new TRACEPORT;
+	size_t len = strlen(szName) + 1;
+
+	pEntry->nPort = nPort;
+	pEntry->szName = new char[len];
+	strcpy_s(pEntry->szName, len, szName);
+
+	CAutoCriticalSection acs(&m_cs);
+
+	pEntry->pNext = m_pPorts;
+	m_pPorts = pEntry;
+}
+
+//-------------------------------------------------------------------------------------
+void CTracer::Add(LPCSTR szName, CPort* pPort, ULONGLONG ullStart, ULONGLONG ullEnd, DWORD cbData)
+{
+	LPTRACEBUFFER pBuffer = ThreadBuffer();
+
+	if (pPort)
+		NamePort(pPort);
+
+	LPTRACEEVENT pEvent = &pBuffer->events[static_cast<DWORD>(pBuffer->nEvents) % TRACE_THREADEVENTS];
+
+	pEvent->ullStart = ullStart;
+	pEvent->ullDuration = ullEnd - ullStart;
+	pEvent->szName = szName;
+	pEvent->nJobId = pPort ? pPort->JobId() : 0;
+	pEvent->cbData = cbData;
+	pEvent->dwThreadId = GetCurrentThreadId();
+	pEvent->nPort = pPort ? pPort->LogId() : 0;
+
+	//publish the event
+	InterlockedIncrement(&pBuffer->nEvents);
+}
+
+//-------------------------------------------------------------------------------------
+void CTracer::Format(CStatsText* pText)
+{
+	CAutoCriticalSection acs(&m_cs);
+
+	pText->Printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	pText->Printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"mfilemon\"}}");
+
+	for (LPTRACEPORT pEntry = m_pPorts; pEntry; pEntry = pEntry->pNext)
+	{
+		pText->Printf(",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+			pEntry->nPort, pEntry->szName);
+	}
+
+	//a thread still recording may overwrite its oldest events while we read
+	for (LPTRACEBUFFER pBuffer = m_pBuffers; pBuffer; pBuffer = pBuffer->pNext)
+	{
+		DWORD nEvents = static_cast<DWORD>(pBuffer->nEvents);
+		DWORD nFirst = (nEvents > TRACE_THREADEVENTS) ? nEvents - TRACE_THREADEVENTS : 0;
+
+		for (DWORD n = nFirst; n < nEvents; n++)
+		{
+			LPTRACEEVENT pEvent = &pBuffer->events[n % TRACE_THREADEVENTS];
+
+			pText->Printf(",\n{\"name\":\"%s\",\"cat\":\"mfilemon\",\"ph\":\"X\",\"ts\":%I64u,\"dur\":%I64u,"
+				"\"pid\":%u,\"tid\":%u,\"args\":{\"job\":%u",
+				pEvent->szName, pEvent->ullStart, pEvent->ullDuration,
+				pEvent->nPort, pEvent->dwThreadId, pEvent->nJobId);
+
+			if (pEvent->cbData)
+				pText->Printf(",\"bytes\":%u", pEvent->cbData);
+
+			pText->Printf("}}");
+		}
+	}
+
+	pText->Printf("\n]}\n");
+}
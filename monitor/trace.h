@@ -0,0 +1,132 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#pragma once
+
+#include "stats.h"
+
+#define TRACE_THREADEVENTS	4096	//events kept per thread, the oldest are overwritten
+
+class CPort;
+
+extern volatile BOOL g_bTraceEnabled;
+
+/*
+*  CTracer
+*  collects timed spans (a name, a port, a job, start and duration) into
+*  per-thread ring buffers and renders them as Chrome trace JSON, which can be
+*  loaded into Perfetto or chrome://tracing. Each port is shown as a process,
+*  each spooler thread as a thread.
+*  A thread writes only to its own buffer, so recording takes no lock; the
+*  buffer is taken the first time the thread records a span. Spooler threads
+*  come and go: when one exits (DLL_THREAD_DETACH) the next new thread takes
+*  over its buffer and goes on where it stopped, so there are never more
+*  buffers than threads recording at the same time, and every event keeps the
+*  id of its thread. A new session frees the buffers of exited threads.
+*/
+
+class CTracer
+{
+private:
+	typedef struct tagTRACEEVENT
+	{
+		ULONGLONG ullStart;
+		ULONGLONG ullDuration;
+		LPCSTR szName;
+		DWORD nJobId;
+		DWORD cbData;
+		DWORD dwThreadId;
+		WORD nPort;
+	} TRACEEVENT, *LPTRACEEVENT;
+
+	typedef struct tagTRACEBUFFER
+	{
+		BOOL bDetached;			//its thread has exited, under m_cs
+		volatile LONG nEvents;
+		TRACEEVENT events[TRACE_THREADEVENTS];
+		tagTRACEBUFFER* pNext;
+	} TRACEBUFFER, *LPTRACEBUFFER;
+
+	typedef struct tagTRACEPORT
+	{
+		WORD nPort;
+		LPSTR szName;	//JSON escaped UTF-8
+		tagTRACEPORT* pNext;
+	} TRACEPORT, *LPTRACEPORT;
+
+public:
+	CTracer();
+	virtual ~CTracer();
+
+public:
+	void Enable(BOOL bEnable);
+	void ThreadDetach();
+	void Add(LPCSTR szName, CPort* pPort, ULONGLONG ullStart, ULONGLONG ullEnd, DWORD cbData);
+	void Format(CStatsText* pText);
+
+private:
+	LPTRACEBUFFER ThreadBuffer();
+	void NamePort(CPort* pPort);
+
+private:
+	DWORD m_dwTlsIndex;
+	CRITICAL_SECTION m_cs;
+	LPTRACEBUFFER m_pBuffers;
+	LPTRACEPORT m_pPorts;
+	volatile LONG m_named[0x10000 / 32];
+};
+
+extern CTracer* g_pTracer;
+
+/*
+*  CTraceSpan
+*  records the time between its construction and its destruction.
+*  When tracing is off the cost is a test of g_bTraceEnabled.
+*  The name must be a literal. A nonzero cbData is exported as "bytes",
+*  so that the write sizes of real jobs can be replayed by mfmsim.
+*/
+
+class CTraceSpan
+{
+public:
+	CTraceSpan(LPCSTR szName, CPort* pPort, DWORD cbData = 0)
+	{
+		m_szName = NULL;
+
+		if (g_bTraceEnabled)
+		{
+			m_szName = szName;
+			m_pPort = pPort;
+			m_cbData = cbData;
+			m_ullStart = CPortStats::Now();
+		}
+	}
+
+	~CTraceSpan()
+	{
+		if (m_szName)
+			g_pTracer->Add(m_szName, m_pPort, m_ullStart, CPortStats::Now(), m_cbData);
+	}
+
+private:
+	LPCSTR m_szName;
+	CPort* m_pPort;
+	DWORD m_cbData;
+	ULONGLONG m_ullStart;
+};
@@ -0,0 +1,279 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "stdafx.h"
+#include "writerpool.h"
+#include "log.h"
+#include "../common/autoclean.h"
+
+CWriterPool* g_pWriterPool = NULL;
+
+//-------------------------------------------------------------------------------------
+CWriterPool::CWriterPool(DWORD dwIdle)
+{
+	m_pHead = NULL;
+	m_pTail = NULL;
+	m_pWorkers = NULL;
+	m_nWorkers = 0;
+	m_nBusy = 0;
+	m_nQueued = 0;
+	m_nPeakWorkers = 0;
+	m_dwIdle = dwIdle;
+	m_bStopping = FALSE;
+	InitializeCriticalSection(&m_CSPool);
+	m_hWorkSem = CreateSemaphoreW(NULL, 0, MAXLONG, NULL);
+	//signaled while there are no workers
+	m_hNoWorkersEvt = CreateEventW(NULL, TRUE, TRUE, NULL);
+}
+
+//-------------------------------------------------------------------------------------
+CWriterPool::~CWriterPool()
+{
+	{
+		CAutoCriticalSection acs(&m_CSPool);
+
+		m_bStopping = TRUE;
+
+		if (m_nWorkers > 0)
+			ReleaseSemaphore(m_hWorkSem, m_nWorkers, NULL);
+	}
+
+	//a worker stuck in a write would hold the spooler forever: leave it
+	//and what it uses behind
+	if (m_hNoWorkersEvt && WaitForSingleObject(m_hNoWorkersEvt, WRITERPOOL_CANCEL) != WAIT_OBJECT_0)
+	{
+		g_pLog->Error(L"CWriterPool::~CWriterPool: %u workers still busy", m_nWorkers);
+		return;
+	}
+
+	if (m_hWorkSem)
+		CloseHandle(m_hWorkSem);
+
+	if (m_hNoWorkersEvt)
+		CloseHandle(m_hNoWorkersEvt);
+
+	DeleteCriticalSection(&m_CSPool);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CWriterPool::Submit(LPWRITEITEM pItem)
+{
+	CAutoCriticalSection acs(&m_CSPool);
+
+	if (m_bStopping || !m_hWorkSem || !m_hNoWorkersEvt)
+	{
+		SetLastError(ERROR_CAN_NOT_COMPLETE);
+		return FALSE;
+	}
+
+	pItem->cbWritten = 0;
+	pItem->bStatus = FALSE;
+	pItem->dwError = ERROR_SUCCESS;
+	pItem->bDone = FALSE;
+	pItem->pWorker = NULL;
+	pItem->pNext = NULL;
+	ResetEvent(pItem->hDoneEvt);
+
+	//every free worker takes one of the queued items; when none is left
+	//for this one, start another (busy workers will do if that fails)
+	if (m_nWorkers - m_nBusy <= m_nQueued && !StartWorker() && m_nWorkers == 0)
+		return FALSE;
+
+	if (m_pTail)
+		m_pTail->pNext = pItem;
+	else
+		m_pHead = pItem;
+	m_pTail = pItem;
+	m_nQueued++;
+
+	ReleaseSemaphore(m_hWorkSem, 1, NULL);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CWriterPool::Cancel(LPWRITEITEM pItem)
+{
+	{
+		CAutoCriticalSection acs(&m_CSPool);
+
+		if (pItem->bDone)
+			return;
+
+		if (!pItem->pWorker)
+		{
+			//still queued: just take it away
+			LPWRITEITEM pPrevious = NULL;
+
+			for (LPWRITEITEM pQueued = m_pHead; pQueued; pPrevious = pQueued, pQueued = pQueued->pNext)
+			{
+				if (pQueued != pItem)
+					continue;
+
+				if (pPrevious)
+					pPrevious->pNext = pItem->pNext;
+				else
+					m_pHead = pItem->pNext;
+
+				if (m_pTail == pItem)
+					m_pTail = pPrevious;
+
+				m_nQueued--;
+				break;
+			}
+
+			Complete(pItem, FALSE, ERROR_OPERATION_ABORTED);
+			return;
+		}
+
+		//the worker can't move to another item without the lock, so this
+		//is the write of pItem
+		CancelSynchronousIo(pItem->pWorker->hThread);
+	}
+
+	if (WaitForSingleObject(pItem->hDoneEvt, WRITERPOOL_CANCEL) == WAIT_OBJECT_0)
+		return;
+
+	CAutoCriticalSection acs(&m_CSPool);
+
+	if (pItem->bDone)
+		return;
+
+	LPWORKER pWorker = pItem->pWorker;
+
+	g_pLog->Error(L"CWriterPool::Cancel: write not cancelled after %u ms, terminating worker", WRITERPOOL_CANCEL);
+
+	TerminateThread(pWorker->hThread, 1);
+	m_nBusy--;
+	RemoveWorker(pWorker);
+
+	Complete(pItem, FALSE, ERROR_OPERATION_ABORTED);
+}
+
+//-------------------------------------------------------------------------------------
+BOOL CWriterPool::StartWorker()
+{
+	LPWORKER pWorker = new WORKER;
+	DWORD dwId;
+
+	pWorker->pPool = this;
+
+	//the worker needs the lock, held by our caller, before it looks at its record
+	if ((pWorker->hThread = CreateThread(NULL, WRITERPOOL_STACK, WorkerThreadProc, pWorker,
+		STACK_SIZE_PARAM_IS_A_RESERVATION, &dwId)) == NULL)
+	{
+		g_pLog->Error(L"CWriterPool::StartWorker: CreateThread failed (%i)", GetLastError());
+		delete pWorker;
+		return FALSE;
+	}
+
+	pWorker->pNext = m_pWorkers;
+	m_pWorkers = pWorker;
+
+	if (++m_nWorkers > m_nPeakWorkers)
+		m_nPeakWorkers = m_nWorkers;
+
+	ResetEvent(m_hNoWorkersEvt);
+
+	g_pLog->Debug(L"CWriterPool::StartWorker: worker 0x%0.8X started, %u running", dwId, m_nWorkers);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+void CWriterPool::RemoveWorker(LPWORKER pWorker)
+{
+	LPWORKER* ppWorker = &m_pWorkers;
+
+	while (*ppWorker && *ppWorker != pWorker)
+		ppWorker = &(*ppWorker)->pNext;
+
+	if (*ppWorker)
+		*ppWorker = pWorker->pNext;
+
+	CloseHandle(pWorker->hThread);
+	delete pWorker;
+
+	if (--m_nWorkers == 0)
+		SetEvent(m_hNoWorkersEvt);
+}
+
+//-------------------------------------------------------------------------------------
+void CWriterPool::Complete(LPWRITEITEM pItem, BOOL bStatus, DWORD dwError)
+{
+	pItem->bStatus = bStatus;
+	pItem->dwError = dwError;
+	pItem->pWorker = NULL;
+	pItem->bDone = TRUE;
+
+	SetEvent(pItem->hDoneEvt);
+}
+
+//-------------------------------------------------------------------------------------
+DWORD WINAPI CWriterPool::WorkerThreadProc(LPVOID lpParam)
+{
+	LPWORKER pWorker = static_cast<LPWORKER>(lpParam);
+	CWriterPool* pPool = pWorker->pPool;
+
+	for (;;)
+	{
+		DWORD dwWait = WaitForSingleObject(pPool->m_hWorkSem, pPool->m_dwIdle);
+
+		EnterCriticalSection(&pPool->m_CSPool);
+
+		LPWRITEITEM pItem = pPool->m_pHead;
+
+		//nothing to do for a while, or shutting down
+		if (pPool->m_bStopping || (!pItem && dwWait != WAIT_OBJECT_0))
+		{
+			pPool->RemoveWorker(pWorker);
+			LeaveCriticalSection(&pPool->m_CSPool);
+			return 0;
+		}
+
+		//an item taken away by Cancel leaves its count behind
+		if (!pItem)
+		{
+			LeaveCriticalSection(&pPool->m_CSPool);
+			continue;
+		}
+
+		pPool->m_pHead = pItem->pNext;
+		if (!pPool->m_pHead)
+			pPool->m_pTail = NULL;
+		pPool->m_nQueued--;
+		pPool->m_nBusy++;
+		pItem->pWorker = pWorker;
+
+		LeaveCriticalSection(&pPool->m_CSPool);
+
+		DWORD cbWritten = 0;
+		BOOL bStatus = WriteFile(pItem->hFile, pItem->lpBuffer, pItem->cbBuffer, &cbWritten, NULL);
+		DWORD dwError = bStatus ? ERROR_SUCCESS : GetLastError();
+
+		EnterCriticalSection(&pPool->m_CSPool);
+
+		pItem->cbWritten = cbWritten;
+		pPool->Complete(pItem, bStatus, dwError);
+		pPool->m_nBusy--;
+
+		LeaveCriticalSection(&pPool->m_CSPool);
+	}
+}
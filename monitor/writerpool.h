@@ -0,0 +1,100 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#define WRITERPOOL_IDLE		60000		//ms, a worker with nothing to do exits after this
+#define WRITERPOOL_CANCEL	5000		//ms, grace time of a cancelled write before its worker is terminated
+#define WRITERPOOL_STACK	(64 * 1024)	//bytes reserved for a worker's stack, it only calls WriteFile
+
+/*
+*  CWriterPool
+*  the threads that write job data for all ports. A write to a pipe can block
+*  forever when the user command stops reading, so WritePort never writes by
+*  itself: it queues a work item and waits for it with a timeout.
+*  A worker is started when an item is queued and no worker is free, and
+*  exits after the idle time (WRITERPOOL_IDLE ms in the monitor, the tools
+*  measuring the pool use a shorter one) without work, so that the number of threads
+*  follows the jobs writing at the same time instead of the ports that have
+*  ever printed. A write that is given up is cancelled with
+*  CancelSynchronousIo; when that doesn't bring it back, its worker is
+*  terminated, as the port used to do with its own thread.
+*/
+
+class CWriterPool
+{
+private:
+	struct tagWORKER;
+
+public:
+	typedef struct tagWRITEITEM
+	{
+		HANDLE hFile;
+		LPCVOID lpBuffer;
+		DWORD cbBuffer;
+		DWORD cbWritten;
+		BOOL bStatus;
+		DWORD dwError;
+		HANDLE hDoneEvt;
+		BOOL bDone;
+		tagWORKER* pWorker;
+		tagWRITEITEM* pNext;
+	} WRITEITEM, *LPWRITEITEM;
+
+private:
+	typedef struct tagWORKER
+	{
+		CWriterPool* pPool;
+		HANDLE hThread;
+		tagWORKER* pNext;
+	} WORKER, *LPWORKER;
+
+public:
+	explicit CWriterPool(DWORD dwIdle = WRITERPOOL_IDLE);
+	virtual ~CWriterPool();
+
+public:
+	BOOL Submit(LPWRITEITEM pItem);
+	void Cancel(LPWRITEITEM pItem);
+	DWORD Workers() const { return m_nWorkers; }
+	DWORD PeakWorkers() const { return m_nPeakWorkers; }
+
+private:
+	static DWORD WINAPI WorkerThreadProc(LPVOID lpParam);
+	BOOL StartWorker();
+	void RemoveWorker(LPWORKER pWorker);
+	void Complete(LPWRITEITEM pItem, BOOL bStatus, DWORD dwError);
+
+private:
+	LPWRITEITEM m_pHead;
+	LPWRITEITEM m_pTail;
+	LPWORKER m_pWorkers;
+	DWORD m_nWorkers;
+	DWORD m_nBusy;
+	DWORD m_nQueued;
+	DWORD m_nPeakWorkers;
+	DWORD m_dwIdle;
+	BOOL m_bStopping;
+	HANDLE m_hWorkSem;
+	HANDLE m_hNoWorkersEvt;
+	CRITICAL_SECTION m_CSPool;
+};
+
+extern CWriterPool* g_pWriterPool;
@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "..\common\config.h"
 #include "..\common\defs.h"
 #include "..\common\autoclean.h"
+#include "..\common\cfgtlv.h"
 #include "..\common\version.h"
 #include "resource.h"
 
@@ -62,6 +63,8 @@ Field format: %[width][.start]type\n\
     c:  computer name (from which came print job)\n\
     r:  printer name\n\
     b:  output bin\n\
+    S:  shard subdirectory, derived from 'i' (only valid for filename pattern)\n\
+        width = hex digits, 1..4 (default 2 = 256 subdirectories)\n\
 To use the '%' character in a filename or user command, insert sequence '%%'.\n\
 For filename pattern, special \"search fields\" can be specified in this manner:\n\
 |literal|searchstring|\n\
@@ -72,6 +75,7 @@ Examples:\n\
 file%i.pdf -> file0001.pdf, file0002.pdf, ...\n\
 export%Y-%m-%d-%6i.ps -> export2007-04-20-000001.ps, export2007-04-20-000002.ps, ...\n\
 file.%u.%6.0i.prn -> file.Administrator.000000.prn, file.Administrator.000001.prn, ...\n\
+%S\\file%i.pdf -> 9E\\file0001.pdf, 3C\\file0002.pdf, ...\n\
 file%i-page|%d|*|.jpg -> will examine any file in the form file%i-page*.jpg\n\
                          and then use the name file%i-page%d.jpg. Note that\n\
                          %i will be substituted with the first available integer,\n\
@@ -109,6 +113,8 @@ Formato dei campi: %[width][.start]type\n\
     c:  nome computer (da cui  partito il job di stampa)\n\
     r:  nome stampante\n\
     b:  vassoio d'uscita\n\
+    S:  sottodirectory di shard, derivata da 'i' (valido solo per formato nome file)\n\
+        width = cifre esadecimali, 1..4 (default 2 = 256 sottodirectory)\n\
 Per usare il carattere '%' in un nome file o comando utente, inserire la sequenza '%%'.\n\
 Per i nomi file, speciali \"campi di ricerca\" possono essere specificati come segue:\n\
 |stringaletterale|stringaricerca|\n\
@@ -119,6 +125,7 @@ Esempi:\n\
 file%i.pdf -> file0001.pdf, file0002.pdf, ...\n\
 export%Y-%m-%d-%6i.ps -> export2007-04-20-000001.ps, export2007-04-20-000002.ps, ...\n\
 file.%u.%6.0i.prn -> file.Administrator.000000.prn, file.Administrator.000001.prn, ...\n\
+%S\\file%i.pdf -> 9E\\file0001.pdf, 3C\\file0002.pdf, ...\n\
 file%i-page|%d|*|.jpg -> esaminer i file nella forma file%i-page*.jpg, per poi usare\n\
                          il nome file%i-page%d.jpg. NB %i verr sostituito con il primo\n\
                          intero libero, mentre %d verr usato letteralmente.";
@@ -178,14 +185,14 @@ void DoBrowse(HWND hDlg, int nIDDlgItem)
 //-------------------------------------------------------------------------------------
 BOOL CALLBACK AddPortUIDlgProc(HWND hDlg, UINT uMessage, WPARAM wParam, LPARAM lParam)
 {
-	static LPPORTCONFIG ppc = NULL;
+	static LPPORTCONFIG2 ppc = NULL;
 
 	switch (uMessage)
 	{
 	case WM_INITDIALOG:
 		UpdateCaption(hDlg);
 
-		ppc = reinterpret_cast<LPPORTCONFIG>(lParam);
+		ppc = reinterpret_cast<LPPORTCONFIG2>(lParam);
 		//Nome porta
 		SetFocus(GetDlgItem(hDlg, ID_EDTPORTNAME));
 		return TRUE;
@@ -251,14 +258,14 @@ static BOOL CALLBACK MonitorUIDlgProc(HWND hDlg, UINT uMessage, WPARAM wParam, L
 {
 	HWND hWnd, hControl;
 	WCHAR buf[16];
-	static LPPORTCONFIG ppc = NULL;
+	static LPPORTCONFIG2 ppc = NULL;
 
 	switch (uMessage)
 	{
 	case WM_INITDIALOG:
 		UpdateCaption(hDlg);
 
-		ppc = reinterpret_cast<LPPORTCONFIG>(lParam);
+		ppc = reinterpret_cast<LPPORTCONFIG2>(lParam);
 		//Nome porta
 		SetDlgItemTextW(hDlg, ID_EDTPORTNAME, ppc->szPortName);
 		//Output path
@@ -482,6 +489,63 @@ static BOOL CALLBACK MonitorUIDlgProc(HWND hDlg, UINT uMessage, WPARAM wParam, L
 	return FALSE;
 }
 
+//-------------------------------------------------------------------------------------
+static DWORD GetPortConfig(HANDLE hXcv, LPPORTCONFIG2 pc)
+{
+	DWORD cbOutputNeeded = 0, dwStatus = ERROR_SUCCESS;
+	DWORD cbData = 1024;
+	LPBYTE pData = new BYTE[cbData];
+
+	//impostazioni codificate (cfgtlv.h); un monitor che non conosce
+	//GetConfigEx risponde ERROR_CAN_NOT_COMPLETE e usiamo PORTCONFIG,
+	//la parte iniziale di PORTCONFIG2
+	BOOL bRes = XcvDataW(hXcv, L"GetConfigEx", NULL, 0, pData, cbData, &cbOutputNeeded, &dwStatus);
+	if (bRes && dwStatus == ERROR_INSUFFICIENT_BUFFER)
+	{
+		delete[] pData;
+		cbData = cbOutputNeeded;
+		pData = new BYTE[cbData];
+		bRes = XcvDataW(hXcv, L"GetConfigEx", NULL, 0, pData, cbData, &cbOutputNeeded, &dwStatus);
+	}
+
+	if (bRes && dwStatus == ERROR_SUCCESS && !DecodePortConfig(pData, cbOutputNeeded, pc))
+		dwStatus = ERROR_INVALID_DATA;
+
+	SecureZeroMemory(pData, cbData);
+	delete[] pData;
+
+	if (bRes && dwStatus == ERROR_CAN_NOT_COMPLETE)
+	{
+		bRes = XcvDataW(hXcv, L"GetConfig", NULL, 0,
+			reinterpret_cast<PBYTE>(pc), sizeof(PORTCONFIG), &cbOutputNeeded, &dwStatus);
+	}
+
+	return bRes ? dwStatus : GetLastError();
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD SetPortConfig(HANDLE hXcv, LPPORTCONFIG2 pc)
+{
+	DWORD cbOutputNeeded = 0, dwStatus = ERROR_SUCCESS;
+	DWORD cbData = EncodePortConfig(pc, NULL, 0);
+	LPBYTE pData = new BYTE[cbData];
+
+	EncodePortConfig(pc, pData, cbData);
+
+	BOOL bRes = XcvDataW(hXcv, L"SetConfigEx", pData, cbData, NULL, 0, &cbOutputNeeded, &dwStatus);
+
+	SecureZeroMemory(pData, cbData);
+	delete[] pData;
+
+	if (bRes && dwStatus == ERROR_CAN_NOT_COMPLETE)
+	{
+		bRes = XcvDataW(hXcv, L"SetConfig", reinterpret_cast<PBYTE>(pc), sizeof(PORTCONFIG),
+			NULL, 0, &cbOutputNeeded, &dwStatus);
+	}
+
+	return bRes ? dwStatus : GetLastError();
+}
+
 //-------------------------------------------------------------------------------------
 BOOL WINAPI MfmAddPortUI(PCWSTR pszServer, HWND hWnd, PCWSTR pszMonitorNameIn,
 						 PWSTR* ppszPortNameOut)
@@ -517,7 +581,7 @@ BOOL WINAPI MfmAddPortUI(PCWSTR pszServer, HWND hWnd, PCWSTR pszMonitorNameIn,
 	}
 
 	BOOL bRes = FALSE;
-	PORTCONFIG pc = { 0 };
+	PORTCONFIG2 pc = { 0 };
 	DWORD cbOutputNeeded, dwStatus;
 
 	for (;;)
@@ -565,9 +629,8 @@ BOOL WINAPI MfmAddPortUI(PCWSTR pszServer, HWND hWnd, PCWSTR pszMonitorNameIn,
 	}
 
 	//passiamo la configurazione al port monitor
-	bRes = XcvDataW(printer, L"SetConfig", (PBYTE)&pc, sizeof(pc),
-		NULL, 0, &cbOutputNeeded, &dwStatus);
-	if (!bRes || dwStatus != ERROR_SUCCESS)
+	dwStatus = SetPortConfig(printer, &pc);
+	if (dwStatus != ERROR_SUCCESS)
 	{
 		SetLastError(dwStatus);
 		return FALSE;
@@ -618,13 +681,11 @@ BOOL WINAPI MfmConfigurePortUI(PCWSTR pszServer, HWND hWnd, PCWSTR pszPortName)
 		return FALSE;
 	}
 
-	BOOL bRes = FALSE;
-	PORTCONFIG pc = { 0 };
-	DWORD cbOutputNeeded, dwStatus;
+	PORTCONFIG2 pc = { 0 };
+	DWORD dwStatus;
 
-	bRes = XcvDataW(printer, L"GetConfig", NULL, 0,
-		reinterpret_cast<PBYTE>(&pc), sizeof(pc), &cbOutputNeeded, &dwStatus);
-	if (!bRes || dwStatus != ERROR_SUCCESS)
+	dwStatus = GetPortConfig(printer, &pc);
+	if (dwStatus != ERROR_SUCCESS)
 	{
 		SetLastError(dwStatus);
 		return FALSE;
@@ -639,9 +700,8 @@ BOOL WINAPI MfmConfigurePortUI(PCWSTR pszServer, HWND hWnd, PCWSTR pszPortName)
 	}
 
 	//passiamo la configurazione al port monitor
-	bRes = XcvDataW(printer, L"SetConfig", (PBYTE)&pc, sizeof(pc),
-		NULL, 0, &cbOutputNeeded, &dwStatus);
-	if (!bRes || dwStatus != ERROR_SUCCESS)
+	dwStatus = SetPortConfig(printer, &pc);
+	if (dwStatus != ERROR_SUCCESS)
 	{
 		SetLastError(dwStatus);
 		return FALSE;
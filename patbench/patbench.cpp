@@ -0,0 +1,304 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  patbench - microbenchmarks for the pattern engine.
+*  Times CPattern construction, Value, SearchValue and NextValue on realistic
+*  patterns, Sanitize and Trim on long Unicode titles and the formatting of
+*  the auto increment field. Every benchmark is repeated until it has run for the
+*  minimum time; the result is printed as JSON, one benchmark per line, so
+*  that two runs (e.g. before and after a commit) can be compared by a script.
+*  Builds on Windows and, through the POSIX backend, on Linux.
+*
+*  usage: patbench [-t seconds] [filter]
+*    -t seconds   minimum time per benchmark (default 0.2)
+*    filter       run only the benchmarks whose name contains this string
+*/
+
+#include "../common/stdafx.h"
+#include "../common/defs.h"
+#include "../monitor/pattern.h"
+#include "../monitor/patsegment.h"
+#include "../monitor/patcontext.h"
+#include "../common/monutils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct tagBENCHPATTERN
+{
+	const char* szName;
+	LPCWSTR szPattern;
+	BOOL bUserCommand;
+} BENCHPATTERN, *LPBENCHPATTERN;
+
+static const BENCHPATTERN g_patterns[] = {
+	{ "default", L"file%i.prn", FALSE },
+	{ "datefolders", L"%Y_%m_%d\\file%i.pdf", FALSE },
+	{ "jobfields", L"%Y\\%m\\%d\\%H%n%s-%j-%u-%c-%r-%t.pdf", FALSE },
+	{ "searchfield", L"file%i-page|%d|*|.jpg", FALSE },
+	{ "sharded", L"%S\\%Y%m%d-%6i.prn", FALSE },
+	{ "usercommand", L"\"C:\\Program Files\\gs\\gs9.53.3\\bin\\gswin64c.exe\" "
+		L"@\"C:\\Program Files\\mfilemon\\conf\\gspdf.conf\" -sOutputFile=\"%p\\%f.pdf\" -", TRUE },
+};
+
+/* CBenchContext: the job the patterns render */
+class CBenchContext : public CPatternContext
+{
+public:
+	LPCWSTR JobTitle() const
+	{
+		return L"Rechnung Nr. 2024/0815 \x2013 K\x00FCndigungsbest\x00E4tigung f\x00FCr M\x00FCller & S\x00F6hne "
+			L"GmbH: \"Vertrag\" <Entwurf> *vertraulich* \x65E5\x672C\x8A9E\x306E\x6587\x66F8 | Seite 1/12   ";
+	}
+	DWORD JobId() const { return 4711; }
+	LPCWSTR UserName() const { return L"jdoe"; }
+	LPCWSTR ComputerName() const { return L"WS-ACCOUNTING-042"; }
+	LPCWSTR PrinterName() const { return L"PDF Printer (Accounting)"; }
+	LPCWSTR FileName() const { return L"C:\\autopdf\\2024_05_17\\file0042.pdf"; }
+	LPCWSTR Path() const { return L"C:\\autopdf\\2024_05_17"; }
+	LPCWSTR Bin() const { return L"Tray 2"; }
+};
+
+typedef void (*BENCHPROC)(const void* pArg, DWORD nIterations);
+
+static CBenchContext g_context;
+static volatile unsigned int g_nSink = 0;
+static double g_dMinTime = 0.2;
+static const char* g_szFilter = NULL;
+static BOOL g_bFirst = TRUE;
+
+//-------------------------------------------------------------------------------------
+static ULONGLONG Now()
+{
+	static ULONGLONG ullFreq = 0;
+	LARGE_INTEGER li;
+
+	if (ullFreq == 0)
+	{
+		QueryPerformanceFrequency(&li);
+		ullFreq = static_cast<ULONGLONG>(li.QuadPart);
+	}
+	QueryPerformanceCounter(&li);
+
+	//nanoseconds
+	return static_cast<ULONGLONG>(li.QuadPart) / ullFreq * 1000000000ULL +
+		static_cast<ULONGLONG>(li.QuadPart) % ullFreq * 1000000000ULL / ullFreq;
+}
+
+//-------------------------------------------------------------------------------------
+static void Run(const char* szGroup, const char* szName, BENCHPROC pfnProc, const void* pArg)
+{
+	char szFull[128];
+	sprintf(szFull, "%s/%s", szGroup, szName);
+
+	if (g_szFilter && !strstr(szFull, g_szFilter))
+		return;
+
+	//double the batch until it runs long enough to be measured
+	DWORD nIterations = 1;
+	ULONGLONG ullElapsed;
+
+	for (;;)
+	{
+		ULONGLONG ullStart = Now();
+		pfnProc(pArg, nIterations);
+		ullElapsed = Now() - ullStart;
+
+		if (ullElapsed >= g_dMinTime * 1e9 || nIterations >= 0x40000000)
+			break;
+
+		nIterations *= 2;
+	}
+
+	printf("%s{\"name\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f}",
+		g_bFirst ? "" : ",\n", szFull, nIterations, static_cast<double>(ullElapsed) / nIterations);
+	fflush(stdout);
+
+	g_bFirst = FALSE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL IsInvalidBenchChar(WCHAR c)
+{
+	return wcschr(L"\\/:*?\"<>|", c) != NULL;
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchConstruct(const void* pArg, DWORD nIterations)
+{
+	LPBENCHPATTERN pBench = (LPBENCHPATTERN)pArg;
+
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		CPattern pattern(pBench->szPattern, &g_context, pBench->bUserCommand);
+		g_nSink += *pattern.PatternString();
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchValue(const void* pArg, DWORD nIterations)
+{
+	LPBENCHPATTERN pBench = (LPBENCHPATTERN)pArg;
+	CPattern pattern(pBench->szPattern, &g_context, pBench->bUserCommand);
+
+	for (DWORD n = 0; n < nIterations; n++)
+		g_nSink += *pattern.Value();
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchSearchValue(const void* pArg, DWORD nIterations)
+{
+	LPBENCHPATTERN pBench = (LPBENCHPATTERN)pArg;
+	CPattern pattern(pBench->szPattern, &g_context, pBench->bUserCommand);
+
+	for (DWORD n = 0; n < nIterations; n++)
+		g_nSink += *pattern.SearchValue();
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchCollision(const void* pArg, DWORD nIterations)
+{
+	//one pass of the collision loop: next candidate, then its name and search name
+	LPBENCHPATTERN pBench = (LPBENCHPATTERN)pArg;
+	CPattern pattern(pBench->szPattern, &g_context, pBench->bUserCommand);
+
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		if (!pattern.NextValue())
+			pattern.Reset();
+		g_nSink += *pattern.Value();
+		g_nSink += *pattern.SearchValue();
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchSanitize(const void* /*pArg*/, DWORD nIterations)
+{
+	WCHAR szTemp[MAXBUF];
+	LPCWSTR szTitle = g_context.JobTitle();
+
+	//the copy is part of the cost, as in CJobTitleSegment::Value
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		wcscpy_s(szTemp, LENGTHOF(szTemp), szTitle);
+		g_nSink += *Sanitize(szTemp);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchSanitizeLong(const void* pArg, DWORD nIterations)
+{
+	WCHAR szTemp[MAXBUF];
+	LPCWSTR szTitle = static_cast<LPCWSTR>(pArg);
+
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		wcscpy_s(szTemp, LENGTHOF(szTemp), szTitle);
+		g_nSink += *Sanitize(szTemp);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchTrim(const void* pArg, DWORD nIterations)
+{
+	WCHAR szTemp[MAXBUF];
+	LPCWSTR szTitle = static_cast<LPCWSTR>(pArg);
+
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		wcscpy_s(szTemp, LENGTHOF(szTemp), szTitle);
+		Trim(szTemp);
+		g_nSink += *szTemp;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void BenchCounter(const void* pArg, DWORD nIterations)
+{
+	CAutoIncrementSegment segment(*static_cast<const int*>(pArg), 1);
+
+	for (DWORD n = 0; n < nIterations; n++)
+	{
+		segment.NextValue();
+		g_nSink += *segment.Value();
+	}
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			g_dMinTime = atof(argv[++i]);
+		else if (argv[i][0] != '-' && !g_szFilter)
+			g_szFilter = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: patbench [-t seconds] [filter]\n");
+			return 1;
+		}
+	}
+
+	printf("[\n");
+
+	for (size_t n = 0; n < LENGTHOF(g_patterns); n++)
+		Run("construct", g_patterns[n].szName, BenchConstruct, &g_patterns[n]);
+
+	for (size_t n = 0; n < LENGTHOF(g_patterns); n++)
+		Run("value", g_patterns[n].szName, BenchValue, &g_patterns[n]);
+
+	for (size_t n = 0; n < LENGTHOF(g_patterns); n++)
+		if (!g_patterns[n].bUserCommand)
+			Run("searchvalue", g_patterns[n].szName, BenchSearchValue, &g_patterns[n]);
+
+	for (size_t n = 0; n < LENGTHOF(g_patterns); n++)
+		if (!g_patterns[n].bUserCommand)
+			Run("collision", g_patterns[n].szName, BenchCollision, &g_patterns[n]);
+
+	Run("sanitize", "unicodetitle", BenchSanitize, NULL);
+
+	//titles as long as the segment buffer allows: clean, and full of path separators
+	static WCHAR szClean[MAXBUF];
+	static WCHAR szDirty[MAXBUF];
+	static WCHAR szPadded[MAXBUF];
+	LPCWSTR szTitle = g_context.JobTitle();
+	size_t cchTitle = wcslen(szTitle);
+	for (size_t n = 0; n < MAXBUF - 1; n++)
+	{
+		WCHAR c = szTitle[n % cchTitle];
+		szClean[n] = IsInvalidBenchChar(c) ? L'_' : c;
+		szDirty[n] = (n % 4 == 0) ? L'\\' : c;
+		szPadded[n] = (n < 64 || n >= MAXBUF - 65) ? L' ' : szClean[n];
+	}
+	Run("sanitize", "longclean", BenchSanitizeLong, szClean);
+	Run("sanitize", "longdirty", BenchSanitizeLong, szDirty);
+	Run("trim", "longpadded", BenchTrim, szPadded);
+
+	static const int widths[] = { 4, 9, -6 };
+	static const char* const szWidths[] = { "width4", "width9", "width-6" };
+	for (size_t n = 0; n < LENGTHOF(widths); n++)
+		Run("counter", szWidths[n], BenchCounter, &widths[n]);
+
+	printf("\n]\n");
+
+	return 0;
+}
@@ -0,0 +1,362 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  poolbench - threads and memory held by the write path, per port against
+*  pooled.
+*  Plays the spooler for a number of ports that all print at least once and
+*  hands every write to a writer, the way CPort::WriteToFile does:
+*    thread   each port starts its own writer thread at its first job and
+*             keeps it, with its events, until the port goes away (the
+*             monitor up to this change)
+*    pool     writes are submitted to the monitor's CWriterPool, with its
+*             own workers and stacks, and waited for as CPort does
+*  Thread count, virtual size and resident set are read from /proc right
+*  after the last job and again once the pool's idle time has passed. Every
+*  measurement runs in its own process, so that one doesn't inherit the
+*  stacks another has left behind. The per port writers run on std::thread,
+*  with the default stack CreateThread gave them. Linux only.
+*
+*  usage: poolbench [-j jobs] [-s spoolers] [-w writes] [-i idle_ms] [ports...]
+*    -j jobs      jobs per port (default 1)
+*    -s spoolers  spooler threads printing at the same time (default 4)
+*    -w writes    4 KB writes per job (default 16)
+*    -i idle_ms   idle time of a pool worker (default 500)
+*    ports        port counts to measure (default 100 1000 3000)
+*/
+
+#include "../monitor/stdafx.h"
+#include "../monitor/log.h"
+#include "../monitor/writerpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define CHUNK 4096
+
+typedef struct tagWRITEITEM
+{
+	FILE* pFile;
+	const void* pBuffer;
+	size_t cbBuffer;
+	bool bDone;
+	std::condition_variable cvDone;
+	tagWRITEITEM* pNext;
+} WRITEITEM, *LPWRITEITEM;
+
+typedef struct tagMEMINFO
+{
+	unsigned long nThreads;
+	unsigned long nVmKb;
+	unsigned long nRssKb;
+} MEMINFO;
+
+static unsigned int g_nJobsPerPort = 1;
+static unsigned int g_nSpoolers = 4;
+static unsigned int g_nWrites = 16;
+static unsigned int g_nIdleMs = 500;
+
+//-------------------------------------------------------------------------------------
+static void ReadMemInfo(MEMINFO* pInfo)
+{
+	char szLine[256];
+	FILE* pStatus = fopen("/proc/self/status", "r");
+
+	memset(pInfo, 0, sizeof(*pInfo));
+
+	if (!pStatus)
+		return;
+
+	while (fgets(szLine, sizeof(szLine), pStatus))
+	{
+		if (strncmp(szLine, "Threads:", 8) == 0)
+			pInfo->nThreads = strtoul(szLine + 8, NULL, 10);
+		else if (strncmp(szLine, "VmSize:", 7) == 0)
+			pInfo->nVmKb = strtoul(szLine + 7, NULL, 10);
+		else if (strncmp(szLine, "VmRSS:", 6) == 0)
+			pInfo->nRssKb = strtoul(szLine + 6, NULL, 10);
+	}
+
+	fclose(pStatus);
+}
+
+/*
+*  the writer of one port, as CPort had it: a thread and a work/done handshake
+*/
+
+class CPortWriter
+{
+public:
+	CPortWriter() { m_pThread = NULL; m_pItem = NULL; m_bQuit = false; }
+	~CPortWriter()
+	{
+		if (m_pThread)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_bQuit = true;
+			}
+			m_cvWork.notify_one();
+			m_pThread->join();
+			delete m_pThread;
+		}
+	}
+
+	void Write(LPWRITEITEM pItem)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		//started by the first job, kept for good
+		if (!m_pThread)
+			m_pThread = new std::thread(&CPortWriter::ThreadProc, this);
+
+		pItem->bDone = false;
+		m_pItem = pItem;
+		m_cvWork.notify_one();
+		pItem->cvDone.wait(lock, [pItem] { return pItem->bDone; });
+	}
+
+private:
+	void ThreadProc()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		for (;;)
+		{
+			m_cvWork.wait(lock, [this] { return m_pItem != NULL || m_bQuit; });
+
+			if (m_bQuit)
+				return;
+
+			LPWRITEITEM pItem = m_pItem;
+			m_pItem = NULL;
+
+			lock.unlock();
+			fwrite(pItem->pBuffer, 1, pItem->cbBuffer, pItem->pFile);
+			lock.lock();
+
+			pItem->bDone = true;
+			pItem->cvDone.notify_one();
+		}
+	}
+
+private:
+	std::thread* m_pThread;
+	std::mutex m_mutex;
+	std::condition_variable m_cvWork;
+	LPWRITEITEM m_pItem;
+	bool m_bQuit;
+};
+
+static CPortWriter* g_pPortWriters = NULL;
+
+//-------------------------------------------------------------------------------------
+static void ThreadSpooler(unsigned int nPorts, std::atomic<unsigned int>* pNextJob)
+{
+	static char buffer[CHUNK];
+	WRITEITEM item;
+	FILE* pFile = fopen("/dev/null", "wb");
+
+	item.pFile = pFile;
+	item.pBuffer = buffer;
+	item.cbBuffer = sizeof(buffer);
+
+	//one job at a time, every port in turn, so that all of them print
+	for (unsigned int nJob; (nJob = (*pNextJob)++) < nPorts * g_nJobsPerPort; )
+	{
+		CPortWriter* pWriter = &g_pPortWriters[nJob % nPorts];
+
+		for (unsigned int n = 0; n < g_nWrites; n++)
+			pWriter->Write(&item);
+	}
+
+	fclose(pFile);
+}
+
+//-------------------------------------------------------------------------------------
+static void PoolSpooler(unsigned int nPorts, std::atomic<unsigned int>* pNextJob)
+{
+	static char buffer[CHUNK];
+	CWriterPool::WRITEITEM item;
+
+	//what a port keeps for its writes
+	ZeroMemory(&item, sizeof(item));
+	item.hFile = CreateFileW(L"/dev/null", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	item.hDoneEvt = CreateEventW(NULL, FALSE, FALSE, NULL);
+	item.lpBuffer = buffer;
+	item.cbBuffer = sizeof(buffer);
+
+	for (unsigned int nJob; (nJob = (*pNextJob)++) < nPorts * g_nJobsPerPort; )
+	{
+		for (unsigned int n = 0; n < g_nWrites; n++)
+		{
+			if (g_pWriterPool->Submit(&item))
+				WaitForSingleObject(item.hDoneEvt, INFINITE);
+		}
+	}
+
+	CloseHandle(item.hDoneEvt);
+	CloseHandle(item.hFile);
+}
+
+//-------------------------------------------------------------------------------------
+static void Run(void (*pfnSpooler)(unsigned int, std::atomic<unsigned int>*), unsigned int nPorts,
+	MEMINFO* pBusy, MEMINFO* pIdle)
+{
+	std::atomic<unsigned int> nNextJob(0);
+	std::thread** ppSpoolers = new std::thread*[g_nSpoolers];
+
+	for (unsigned int n = 0; n < g_nSpoolers; n++)
+		ppSpoolers[n] = new std::thread(pfnSpooler, nPorts, &nNextJob);
+
+	for (unsigned int n = 0; n < g_nSpoolers; n++)
+	{
+		ppSpoolers[n]->join();
+		delete ppSpoolers[n];
+	}
+
+	delete[] ppSpoolers;
+
+	ReadMemInfo(pBusy);
+
+	//long enough for idle pool workers to go
+	std::this_thread::sleep_for(std::chrono::milliseconds(g_nIdleMs * 2 + 100));
+
+	ReadMemInfo(pIdle);
+}
+
+//-------------------------------------------------------------------------------------
+static void Measure(const char* szModel, unsigned int nPorts)
+{
+	MEMINFO base, busy, idle;
+	unsigned int nPeak;
+
+	//the pool logs its workers; the log's own writer is part of the base
+	g_pLog = new CMfmLog();
+
+	ReadMemInfo(&base);
+
+	if (strcmp(szModel, "thread") == 0)
+	{
+		g_pPortWriters = new CPortWriter[nPorts];
+		Run(ThreadSpooler, nPorts, &busy, &idle);
+		nPeak = nPorts;
+		delete[] g_pPortWriters;
+	}
+	else
+	{
+		g_pWriterPool = new CWriterPool(g_nIdleMs);
+		Run(PoolSpooler, nPorts, &busy, &idle);
+		nPeak = g_pWriterPool->PeakWorkers();
+		delete g_pWriterPool;
+	}
+
+	//the main thread and the process itself are left out
+	printf("{\"name\":\"writers/%s\",\"ports\":%u,\"peak_writers\":%u,"
+		"\"threads\":%lu,\"vm_kb\":%lu,\"rss_kb\":%lu,"
+		"\"idle_threads\":%lu,\"idle_vm_kb\":%lu,\"idle_rss_kb\":%lu}",
+		szModel, nPorts, nPeak,
+		busy.nThreads - base.nThreads, busy.nVmKb - base.nVmKb, busy.nRssKb - base.nRssKb,
+		idle.nThreads - base.nThreads, idle.nVmKb - base.nVmKb, idle.nRssKb - base.nRssKb);
+	fflush(stdout);
+
+	delete g_pLog;
+}
+
+//-------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	static const unsigned int defaultPorts[] = { 100, 1000, 3000 };
+	static const char* models[] = { "thread", "pool" };
+	unsigned int ports[16];
+	unsigned int nPortCounts = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			g_nJobsPerPort = static_cast<unsigned int>(atoi(argv[++i]));
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			g_nSpoolers = static_cast<unsigned int>(atoi(argv[++i]));
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			g_nWrites = static_cast<unsigned int>(atoi(argv[++i]));
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+			g_nIdleMs = static_cast<unsigned int>(atoi(argv[++i]));
+		else if (argv[i][0] != '-' && atoi(argv[i]) > 0 && nPortCounts < sizeof(ports) / sizeof(ports[0]))
+			ports[nPortCounts++] = static_cast<unsigned int>(atoi(argv[i]));
+		else
+		{
+			fprintf(stderr, "usage: poolbench [-j jobs] [-s spoolers] [-w writes] [-i idle_ms] [ports...]\n");
+			return 1;
+		}
+	}
+
+	if (nPortCounts == 0)
+	{
+		for (size_t n = 0; n < sizeof(defaultPorts) / sizeof(defaultPorts[0]); n++)
+			ports[nPortCounts++] = defaultPorts[n];
+	}
+
+	if (g_nSpoolers == 0)
+		g_nSpoolers = 1;
+
+	printf("[\n");
+
+	int nRet = 0;
+	bool bFirst = true;
+
+	for (unsigned int n = 0; n < nPortCounts && nRet == 0; n++)
+	{
+		for (size_t m = 0; m < sizeof(models) / sizeof(models[0]); m++)
+		{
+			printf("%s", bFirst ? "" : ",\n");
+			fflush(stdout);
+			bFirst = false;
+
+			//a fresh process for every measurement
+			pid_t pid = fork();
+
+			if (pid == 0)
+			{
+				Measure(models[m], ports[n]);
+				_exit(0);
+			}
+
+			int nStatus = 0;
+			if (pid < 0 || waitpid(pid, &nStatus, 0) < 0 || !WIFEXITED(nStatus) || WEXITSTATUS(nStatus) != 0)
+			{
+				fprintf(stderr, "poolbench: %s with %u ports failed\n", models[m], ports[n]);
+				nRet = 1;
+				break;
+			}
+		}
+	}
+
+	printf("\n]\n");
+
+	return nRet;
+}
@@ -18,6 +18,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include "stdafx.h"
+#include "..\common\cfgsnap.h"
+#include "..\monitor\archive.h"
 
 static const LPWSTR pMonitorName = L"Multi File Port Monitor";
 
@@ -41,10 +43,12 @@ static LPTSTR szGPL =
 
 static LPTSTR szUsage =
 	_T("**************************************\n")
-	_T("Usage: regmon [-r | -d]\n")
+	_T("Usage: regmon [-r | -d | -l | -e file | -i file]\n")
 	_T("       -r: register monitor\n")
 	_T("       -d: deregister monitor\n")
 	_T("       -l: list registered monitors\n")
+	_T("       -e: export port definitions to file\n")
+	_T("       -i: import port definitions from file\n")
 	_T("**************************************");
 
 static BOOL ListRegisteredMonitors()
@@ -87,6 +91,530 @@ static BOOL ListRegisteredMonitors()
 	return TRUE;
 }
 
+//port definitions file: UTF-8 text, one port per line, fields separated by tabs
+//in this order; missing trailing fields are empty or zero, # starts a comment
+static LPCWSTR szFieldNames =
+	L"#name\toutputpath\tfilepattern\toverwrite\tusercommand\texecpath\twaittermination\t"
+	L"waittimeout\tpipedata\thideprocess\tuser\tdomain\tpassword\tarchivemode\t"
+	L"archivemaxsize\tarchivemaxage\tarchivemaxjobs";
+
+#define PORTFIELDS	17
+#define NAMELEN		(MAX_PATH + 1)
+#define LINELEN		4096
+
+//-------------------------------------------------------------------------------------
+static HANDLE OpenXcvMonitor()
+{
+	WCHAR szPrinter[MAX_PATH + 1];
+	PRINTER_DEFAULTSW pd = { NULL, NULL, SERVER_ACCESS_ADMINISTER };
+	HANDLE hXcv = NULL;
+
+	swprintf_s(szPrinter, LENGTHOF(szPrinter), L",XcvMonitor %ls", pMonitorName);
+
+	if (!OpenPrinterW(szPrinter, &hXcv, &pd))
+		return NULL;
+
+	return hXcv;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL XcvCall(HANDLE hXcv, LPCWSTR szCommand, LPBYTE pInput, DWORD cbInput)
+{
+	DWORD cbNeeded = 0;
+	DWORD dwStatus = ERROR_SUCCESS;
+
+	if (!XcvDataW(hXcv, szCommand, pInput, cbInput, NULL, 0, &cbNeeded, &dwStatus))
+		return FALSE;
+
+	if (dwStatus != ERROR_SUCCESS)
+	{
+		SetLastError(dwStatus);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static LPBYTE GetConfigs(HANDLE hXcv, LPDWORD pcbData)
+{
+	LPBYTE pData = NULL;
+	DWORD cbData = 0;
+	DWORD dwStatus;
+
+	//ports may come and go between the two calls
+	for (;;)
+	{
+		DWORD cbNeeded = 0;
+
+		if (!XcvDataW(hXcv, L"GetConfigs", NULL, 0, pData, cbData, &cbNeeded, &dwStatus))
+			break;
+
+		if (dwStatus == ERROR_SUCCESS)
+		{
+			*pcbData = cbNeeded;
+			return pData;
+		}
+
+		if (dwStatus != ERROR_INSUFFICIENT_BUFFER)
+		{
+			SetLastError(dwStatus);
+			break;
+		}
+
+		delete[] pData;
+		cbData = cbNeeded;
+		pData = new BYTE[cbData];
+	}
+
+	delete[] pData;
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------
+static int __cdecl CompareNames(const void* p1, const void* p2)
+{
+	return _wcsicmp(static_cast<LPCWSTR>(p1), static_cast<LPCWSTR>(p2));
+}
+
+//-------------------------------------------------------------------------------------
+static LPWSTR SortedNames(LPBYTE pData, DWORD cbData, LPDWORD pnNames)
+{
+	//the port names of a batch, NAMELEN characters each
+	CConfigSnapshot batch;
+
+	if (!batch.Open(pData, cbData))
+		return NULL;
+
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	LPWSTR pNames = new WCHAR[(batch.Ports() + 1) * NAMELEN];
+	DWORD cbBlob;
+	DWORD nNames = 0;
+
+	while (batch.Next(pConfig, pwBlob, &cbBlob))
+		wcscpy_s(pNames + nNames++ * NAMELEN, NAMELEN, pConfig->szPortName);
+
+	qsort(pNames, nNames, NAMELEN * sizeof(WCHAR), CompareNames);
+
+	SecureZeroMemory(pwBlob, MAX_PWBLOB);
+	delete[] pwBlob;
+	delete pConfig;
+
+	*pnNames = nNames;
+
+	return pNames;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL WriteLine(HANDLE hFile, LPCWSTR szLine)
+{
+	int cb = WideCharToMultiByte(CP_UTF8, 0, szLine, -1, NULL, 0, NULL, NULL);
+
+	if (cb <= 0)
+		return FALSE;
+
+	//terminating NUL becomes CR LF
+	LPSTR szBuf = new char[cb + 1];
+	WideCharToMultiByte(CP_UTF8, 0, szLine, -1, szBuf, cb, NULL, NULL);
+	szBuf[cb - 1] = '\r';
+	szBuf[cb] = '\n';
+
+	DWORD wri;
+	BOOL bRet = WriteFile(hFile, szBuf, cb + 1, &wri, NULL) && wri == static_cast<DWORD>(cb + 1);
+
+	SecureZeroMemory(szBuf, cb + 1);
+	delete[] szBuf;
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ExportPorts(LPCWSTR szFileName)
+{
+	HANDLE hXcv = OpenXcvMonitor();
+
+	if (!hXcv)
+		return FALSE;
+
+	DWORD cbData = 0;
+	LPBYTE pData = GetConfigs(hXcv, &cbData);
+	DWORD dwErr = GetLastError();
+
+	ClosePrinter(hXcv);
+
+	if (!pData)
+	{
+		SetLastError(dwErr);
+		return FALSE;
+	}
+
+	CConfigSnapshot batch;
+
+	if (!batch.Open(pData, cbData))
+	{
+		delete[] pData;
+		SetLastError(ERROR_INVALID_DATA);
+		return FALSE;
+	}
+
+	HANDLE hFile = CreateFileW(szFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		dwErr = GetLastError();
+		delete[] pData;
+		SetLastError(dwErr);
+		return FALSE;
+	}
+
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	LPWSTR szLine = new WCHAR[LINELEN];
+	DWORD cbBlob;
+	DWORD nPorts = 0;
+
+	BOOL bRet = WriteLine(hFile, szFieldNames);
+
+	while (bRet && batch.Next(pConfig, pwBlob, &cbBlob))
+	{
+		//the batch carries the password in clear
+		memcpy(pConfig->szPassword, pwBlob, cbBlob);
+		pConfig->szPassword[cbBlob / sizeof(WCHAR)] = L'\0';
+
+		swprintf_s(szLine, LINELEN, L"%ls\t%ls\t%ls\t%u\t%ls\t%ls\t%u\t%u\t%u\t%u\t%ls\t%ls\t%ls\t%u\t%u\t%u\t%u",
+			pConfig->szPortName, pConfig->szOutputPath, pConfig->szFilePattern, pConfig->bOverwrite,
+			pConfig->szUserCommandPattern, pConfig->szExecPath, pConfig->bWaitTermination,
+			pConfig->dwWaitTimeout, pConfig->bPipeData, pConfig->bHideProcess, pConfig->szUser,
+			pConfig->szDomain, pConfig->szPassword, pConfig->dwArchiveMode, pConfig->dwArchiveMaxSize,
+			pConfig->dwArchiveMaxAge, pConfig->dwArchiveMaxJobs);
+
+		bRet = WriteLine(hFile, szLine);
+		nPorts++;
+	}
+
+	dwErr = GetLastError();
+
+	CloseHandle(hFile);
+
+	SecureZeroMemory(szLine, LINELEN * sizeof(WCHAR));
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	SecureZeroMemory(pwBlob, MAX_PWBLOB);
+	delete[] szLine;
+	delete[] pwBlob;
+	delete pConfig;
+	delete[] pData;
+
+	if (!bRet)
+	{
+		SetLastError(dwErr);
+		return FALSE;
+	}
+
+	_tprintf(_T("%u ports exported to %s (passwords are in clear, keep the file safe)\n"), nPorts, szFileName);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ParseField(LPCWSTR szField, LPWSTR szValue, size_t cchValue)
+{
+	return wcsncpy_s(szValue, cchValue, szField, _TRUNCATE) == 0;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ParseField(LPCWSTR szField, LPDWORD pdwValue)
+{
+	LPWSTR pEnd;
+
+	*pdwValue = wcstoul(szField, &pEnd, 10);
+
+	return *pEnd == L'\0';
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ParseLine(LPWSTR szLine, LPPORTCONFIG2 pConfig)
+{
+	LPCWSTR pFields[PORTFIELDS];
+	int nFields = 0;
+
+	//split in place, missing fields are empty
+	for (LPWSTR p = szLine; p && nFields < PORTFIELDS; )
+	{
+		pFields[nFields++] = p;
+
+		if ((p = wcschr(p, L'\t')) != NULL)
+			*p++ = L'\0';
+
+		if (p && nFields == PORTFIELDS)
+			return FALSE;
+	}
+
+	while (nFields < PORTFIELDS)
+		pFields[nFields++] = L"";
+
+	ZeroMemory(pConfig, sizeof(*pConfig));
+
+	DWORD dwOverwrite = 0, dwWaitTermination = 0, dwPipeData = 0, dwHideProcess = 0;
+
+	BOOL bRet =
+		*pFields[0] &&
+		ParseField(pFields[0], pConfig->szPortName, LENGTHOF(pConfig->szPortName)) &&
+		ParseField(pFields[1], pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath)) &&
+		ParseField(pFields[2], pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern)) &&
+		ParseField(pFields[3], &dwOverwrite) &&
+		ParseField(pFields[4], pConfig->szUserCommandPattern, LENGTHOF(pConfig->szUserCommandPattern)) &&
+		ParseField(pFields[5], pConfig->szExecPath, LENGTHOF(pConfig->szExecPath)) &&
+		ParseField(pFields[6], &dwWaitTermination) &&
+		ParseField(pFields[7], &pConfig->dwWaitTimeout) &&
+		ParseField(pFields[8], &dwPipeData) &&
+		ParseField(pFields[9], &dwHideProcess) &&
+		ParseField(pFields[10], pConfig->szUser, LENGTHOF(pConfig->szUser)) &&
+		ParseField(pFields[11], pConfig->szDomain, LENGTHOF(pConfig->szDomain)) &&
+		ParseField(pFields[12], pConfig->szPassword, LENGTHOF(pConfig->szPassword)) &&
+		wcslen(pConfig->szPassword) * sizeof(WCHAR) <= MAX_PWBLOB &&
+		ParseField(pFields[13], &pConfig->dwArchiveMode) &&
+		ParseField(pFields[14], &pConfig->dwArchiveMaxSize) &&
+		ParseField(pFields[15], &pConfig->dwArchiveMaxAge) &&
+		ParseField(pFields[16], &pConfig->dwArchiveMaxJobs) &&
+		pConfig->dwArchiveMode <= ARCHIVEMODE_MAX;
+
+	pConfig->bOverwrite = dwOverwrite != 0;
+	pConfig->bWaitTermination = dwWaitTermination != 0;
+	pConfig->bPipeData = dwPipeData != 0;
+	pConfig->bHideProcess = dwHideProcess != 0;
+
+	return bRet;
+}
+
+//-------------------------------------------------------------------------------------
+static LPWSTR ReadTextFile(LPCWSTR szFileName)
+{
+	HANDLE hFile = CreateFileW(szFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER liSize;
+	LPSTR pFile = NULL;
+	DWORD cbFile = 0;
+	BOOL bRet = GetFileSizeEx(hFile, &liSize) && liSize.QuadPart < 0x10000000;
+
+	if (bRet)
+	{
+		DWORD rd;
+
+		cbFile = static_cast<DWORD>(liSize.QuadPart);
+		pFile = new char[cbFile + 1];
+		bRet = ReadFile(hFile, pFile, cbFile, &rd, NULL) && rd == cbFile;
+	}
+	else
+	{
+		SetLastError(ERROR_FILE_TOO_LARGE);
+	}
+
+	DWORD dwErr = GetLastError();
+
+	CloseHandle(hFile);
+
+	if (!bRet)
+	{
+		delete[] pFile;
+		SetLastError(dwErr);
+		return NULL;
+	}
+
+	//skip the byte order mark, if any
+	LPSTR pText = pFile;
+	if (cbFile >= 3 && memcmp(pText, "\xEF\xBB\xBF", 3) == 0)
+	{
+		pText += 3;
+		cbFile -= 3;
+	}
+
+	int cch = cbFile > 0
+		? MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, pText, cbFile, NULL, 0)
+		: 0;
+
+	LPWSTR szText = NULL;
+
+	if (cbFile == 0 || cch > 0)
+	{
+		szText = new WCHAR[cch + 1];
+		if (cch > 0)
+			MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, pText, cbFile, szText, cch);
+		szText[cch] = L'\0';
+	}
+	else
+	{
+		SetLastError(ERROR_NO_UNICODE_TRANSLATION);
+	}
+
+	SecureZeroMemory(pFile, cbFile);
+	delete[] pFile;
+
+	return szText;
+}
+
+//-------------------------------------------------------------------------------------
+static BOOL ImportPorts(LPCWSTR szFileName)
+{
+	LPWSTR szText = ReadTextFile(szFileName);
+
+	if (!szText)
+		return FALSE;
+
+	//the whole file is parsed before the monitor is told anything
+	CConfigSnapshot batch;
+	LPPORTCONFIG2 pConfig = new PORTCONFIG2;
+	DWORD nLine = 0;
+	BOOL bRet = TRUE;
+
+	batch.Begin(0);
+
+	for (LPWSTR szLine = szText; szLine && bRet; )
+	{
+		LPWSTR szNext = wcschr(szLine, L'\n');
+		if (szNext)
+			*szNext++ = L'\0';
+
+		size_t len = wcslen(szLine);
+		if (len > 0 && szLine[len - 1] == L'\r')
+			szLine[len - 1] = L'\0';
+
+		nLine++;
+
+		if (*szLine && *szLine != L'#')
+		{
+			if (ParseLine(szLine, pConfig))
+			{
+				batch.Add(pConfig, reinterpret_cast<LPBYTE>(pConfig->szPassword),
+					static_cast<DWORD>(wcslen(pConfig->szPassword) * sizeof(WCHAR)));
+			}
+			else
+			{
+				_tprintf(_T("%s, line %u: bad port definition\n"), szFileName, nLine);
+				SetLastError(ERROR_INVALID_DATA);
+				bRet = FALSE;
+			}
+		}
+
+		szLine = szNext;
+	}
+
+	SecureZeroMemory(pConfig->szPassword, sizeof(pConfig->szPassword));
+	SecureZeroMemory(szText, wcslen(szText) * sizeof(WCHAR));
+	delete[] szText;
+
+	if (!bRet)
+	{
+		delete pConfig;
+		return FALSE;
+	}
+
+	LPBYTE pData = batch.Data();
+	DWORD cbData = batch.Size();
+	DWORD nNames = 0;
+	LPWSTR pNames = SortedNames(pData, cbData, &nNames);
+
+	for (DWORD n = 1; n < nNames && bRet; n++)
+	{
+		if (CompareNames(pNames + (n - 1) * NAMELEN, pNames + n * NAMELEN) == 0)
+		{
+			_tprintf(_T("%s: port %s defined twice\n"), szFileName, pNames + n * NAMELEN);
+			SetLastError(ERROR_DUP_NAME);
+			bRet = FALSE;
+		}
+	}
+
+	delete[] pNames;
+
+	HANDLE hXcv = bRet ? OpenXcvMonitor() : NULL;
+
+	if (!hXcv)
+	{
+		delete pConfig;
+		return FALSE;
+	}
+
+	//the ports we have already
+	DWORD cbExisting = 0;
+	DWORD nExisting = 0;
+	LPBYTE pExisting = GetConfigs(hXcv, &cbExisting);
+	LPWSTR pExistingNames = pExisting ? SortedNames(pExisting, cbExisting, &nExisting) : NULL;
+	DWORD nAdded = 0;
+
+	bRet = pExistingNames != NULL;
+
+	if (pExisting)
+	{
+		SecureZeroMemory(pExisting, cbExisting);
+		delete[] pExisting;
+	}
+
+	//the file is split in two batches: the new ports are created, with their
+	//settings, by one AddPorts, the others reconfigured by one SetConfigs.
+	//The monitor checks each batch as a whole before it touches a port
+	CConfigSnapshot reader, added, changed;
+	LPBYTE pwBlob = new BYTE[MAX_PWBLOB];
+	DWORD cbBlob;
+	DWORD nChanged = 0;
+
+	added.Begin(0);
+	changed.Begin(0);
+
+	if (bRet && reader.Open(pData, cbData))
+	{
+		while (reader.Next(pConfig, pwBlob, &cbBlob))
+		{
+			if (bsearch(pConfig->szPortName, pExistingNames, nExisting, NAMELEN * sizeof(WCHAR), CompareNames))
+			{
+				changed.Add(pConfig, pwBlob, cbBlob);
+				nChanged++;
+			}
+			else
+			{
+				added.Add(pConfig, pwBlob, cbBlob);
+				nAdded++;
+			}
+		}
+	}
+
+	if (bRet && nAdded > 0 && !(bRet = XcvCall(hXcv, L"AddPorts", added.Data(), added.Size())))
+		_tprintf(_T("can't add the %u new ports\n"), nAdded);
+
+	if (bRet && nChanged > 0 && !(bRet = XcvCall(hXcv, L"SetConfigs", changed.Data(), changed.Size())))
+		_tprintf(_T("can't configure the %u existing ports\n"), nChanged);
+
+	DWORD dwErr = GetLastError();
+
+	//the batches carry the passwords in clear
+	SecureZeroMemory(pData, cbData);
+	SecureZeroMemory(added.Data(), added.Size());
+	SecureZeroMemory(changed.Data(), changed.Size());
+
+	ClosePrinter(hXcv);
+
+	SecureZeroMemory(pwBlob, MAX_PWBLOB);
+	delete[] pwBlob;
+	delete[] pExistingNames;
+	delete pConfig;
+
+	if (!bRet)
+	{
+		SetLastError(dwErr);
+		return FALSE;
+	}
+
+	_tprintf(_T("%u ports imported from %s, %u of them new\n"), nNames, szFileName, nAdded);
+
+	return TRUE;
+}
+
+//-------------------------------------------------------------------------------------
 int _tmain(int argc, _TCHAR* argv[])
 {
 	_tprintf(_T("%s\n\n"), szGPL);
@@ -116,6 +644,16 @@ int _tmain(int argc, _TCHAR* argv[])
 		szAction = _T("ListMonitors");
 		ret = ListRegisteredMonitors();
 	}
+	else if (argc > 2 && _tcsicmp(argv[1], _T("-e")) == 0)
+	{
+		szAction = _T("ExportPorts");
+		ret = ExportPorts(argv[2]);
+	}
+	else if (argc > 2 && _tcsicmp(argv[1], _T("-i")) == 0)
+	{
+		szAction = _T("ImportPorts");
+		ret = ImportPorts(argv[2]);
+	}
 	else
 	{
 		return 1;
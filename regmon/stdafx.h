@@ -20,6 +20,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <tchar.h>
+#include <wchar.h>
 #include <windows.h>
+#include <winspool.h>
+#include <winsplp.h>
+#include <crtdbg.h>
+
+#define LENGTHOF(x) (sizeof(x)/sizeof((x)[0]))
 
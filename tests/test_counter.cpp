@@ -0,0 +1,325 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  The counter file through the real monitor on the mock spooler: ports
+*  writing into one directory with a mfilemon.ctr take their numbers from it
+*  and name every job at the first probe, alongside another monitor that
+*  takes numbers from the same file through its own handle; the numbering
+*  has no gaps and no duplicates. Without the file, or with a corrupt one,
+*  the ports go back to probing and the numbering is the same.
+*  The directories are made under the temporary directory, and emptied.
+*/
+
+#include "../monitor/stdafx.h"
+#include "../common/ctrfile.h"
+#include "../mockspl/mockspl.h"
+#include "testutil.h"
+#include <thread>
+
+#define JOBS		100
+
+static LPMONITOR2 g_pMonitor = NULL;
+static WCHAR g_szBaseDir[MAX_PATH + 1];
+
+//-------------------------------------------------------------------------------------
+static void MakePath(LPWSTR szPath, LPCWSTR szDir, LPCWSTR szName)
+{
+	swprintf_s(szPath, MAX_PATH + 1, L"%s%s%s", szDir, *szName ? L"/" : L"", szName);
+}
+
+//-------------------------------------------------------------------------------------
+static void MakeDir(LPWSTR szDir, LPCWSTR szName)
+{
+	WCHAR szPath[MAX_PATH + 1];
+	WIN32_FIND_DATAW fd;
+
+	MakePath(szDir, g_szBaseDir, szName);
+	CreateDirectoryW(szDir, NULL);
+
+	//left over by an earlier run
+	MakePath(szPath, szDir, L"*");
+	HANDLE hFind = FindFirstFileW(szPath, &fd);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			MakePath(szPath, szDir, fd.cFileName);
+			DeleteFileW(szPath);
+		}
+	} while (FindNextFileW(hFind, &fd));
+
+	FindClose(hFind);
+}
+
+//-------------------------------------------------------------------------------------
+static void WriteCounterFile(LPCWSTR szDir, LPCVOID pData, DWORD cbData)
+{
+	WCHAR szPath[MAX_PATH + 1];
+	DWORD wri;
+
+	MakePath(szPath, szDir, CTRFILE_NAME);
+	HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	CHECK(hFile != INVALID_HANDLE_VALUE);
+	if (cbData)
+		WriteFile(hFile, pData, cbData, &wri, NULL);
+	CloseHandle(hFile);
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD NextCounterValue(LPCWSTR szDir)
+{
+	CCounterFile counter;
+	DWORD dwValue = 0;
+
+	if (!counter.Attach(szDir) || counter.Take(&dwValue) != ERROR_SUCCESS)
+		return 0;
+
+	return dwValue;
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD CountFiles(LPCWSTR szDir)
+{
+	//file0001.prn and up (%i is four digits wide), stopping at the first gap
+	WCHAR szName[MAX_PATH + 1];
+	WCHAR szPath[MAX_PATH + 1];
+	DWORD n = 0;
+
+	for (;;)
+	{
+		swprintf_s(szName, LENGTHOF(szName), L"file%04u.prn", n + 1);
+		MakePath(szPath, szDir, szName);
+		if (GetFileAttributesW(szPath) == INVALID_FILE_ATTRIBUTES)
+			return n;
+		n++;
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static DWORD Probes(LPCWSTR szPortName)
+{
+	LPSTR szStats = MockGetStats(g_pMonitor, szPortName);
+	DWORD nProbes = 0;
+
+	if (!szStats)
+		return 0;
+
+	for (const char* p = strstr(szStats, "mfilemon_filename_probes_total{"); p;
+		p = strstr(p + 1, "mfilemon_filename_probes_total{"))
+	{
+		const char* pEnd = strchr(p, '\n');
+		const char* szValue = strchr(p, ' ');
+		if (szValue && (!pEnd || szValue < pEnd))
+			nProbes += strtoul(szValue + 1, NULL, 10);
+	}
+
+	delete[] szStats;
+
+	return nProbes;
+}
+
+//-------------------------------------------------------------------------------------
+static void AddPort(LPCWSTR szPortName, LPCWSTR szDir)
+{
+	LPPORTCONFIG pConfig = new PORTCONFIG;
+
+	ZeroMemory(pConfig, sizeof(*pConfig));
+	wcscpy_s(pConfig->szPortName, LENGTHOF(pConfig->szPortName), szPortName);
+	wcscpy_s(pConfig->szOutputPath, LENGTHOF(pConfig->szOutputPath), szDir);
+	wcscpy_s(pConfig->szFilePattern, LENGTHOF(pConfig->szFilePattern), L"file%i.prn");
+	pConfig->bHideProcess = TRUE;
+
+	CHECK_EQUAL(MockAddPort(g_pMonitor, pConfig), ERROR_SUCCESS);
+
+	delete pConfig;
+}
+
+//-------------------------------------------------------------------------------------
+static void PrintJobs(LPCWSTR szPortName, DWORD nJobs, LONG* pnFailed)
+{
+	static const char data[] = "%!PS\n";
+	HANDLE hPort;
+	DWORD wri;
+
+	if (!g_pMonitor->pfnOpenPort(NULL, const_cast<LPWSTR>(szPortName), &hPort))
+	{
+		InterlockedIncrement(pnFailed);
+		return;
+	}
+
+	for (DWORD n = 0; n < nJobs; n++)
+	{
+		DOC_INFO_1W di = { const_cast<LPWSTR>(L"Document"), NULL, const_cast<LPWSTR>(L"RAW") };
+
+		if (!g_pMonitor->pfnStartDocPort(hPort, const_cast<LPWSTR>(L"Mock Printer"), n + 1, 1,
+			reinterpret_cast<LPBYTE>(&di)))
+		{
+			InterlockedIncrement(pnFailed);
+			break;
+		}
+
+		if (!g_pMonitor->pfnWritePort(hPort, reinterpret_cast<LPBYTE>(const_cast<char*>(data)),
+			sizeof(data) - 1, &wri) | !g_pMonitor->pfnEndDocPort(hPort))
+		{
+			InterlockedIncrement(pnFailed);
+		}
+	}
+
+	g_pMonitor->pfnClosePort(hPort);
+}
+
+//-------------------------------------------------------------------------------------
+static void OtherMonitor(LPCWSTR szDir, DWORD nJobs, LONG* pnFailed)
+{
+	//a monitor on another node: its own handle on the counter file, and the
+	//files it names from it
+	CCounterFile counter;
+	WCHAR szName[MAX_PATH + 1];
+	WCHAR szPath[MAX_PATH + 1];
+	DWORD dwValue;
+
+	if (!counter.Attach(szDir))
+	{
+		InterlockedIncrement(pnFailed);
+		return;
+	}
+
+	for (DWORD n = 0; n < nJobs; n++)
+	{
+		if (counter.Take(&dwValue) != ERROR_SUCCESS)
+		{
+			InterlockedIncrement(pnFailed);
+			continue;
+		}
+
+		swprintf_s(szName, LENGTHOF(szName), L"file%04u.prn", dwValue);
+		MakePath(szPath, szDir, szName);
+
+		HANDLE hFile = CreateFileW(szPath, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+			InterlockedIncrement(pnFailed);
+		else
+			CloseHandle(hFile);
+	}
+}
+
+//-------------------------------------------------------------------------------------
+static void TestSharedCounter()
+{
+	WCHAR szDir[MAX_PATH + 1];
+	LONG nFailed = 0;
+
+	MakeDir(szDir, L"shared");
+	WriteCounterFile(szDir, NULL, 0);
+
+	AddPort(L"CTR0:", szDir);
+	AddPort(L"CTR1:", szDir);
+
+	//an empty file, as an administrator creates it, is set up by the first job
+	PrintJobs(L"CTR0:", 1, &nFailed);
+	CHECK_EQUAL(Probes(L"CTR0:"), 1);
+
+	std::thread port0(PrintJobs, L"CTR0:", JOBS - 1, &nFailed);
+	std::thread port1(PrintJobs, L"CTR1:", JOBS, &nFailed);
+	std::thread other(OtherMonitor, szDir, JOBS, &nFailed);
+
+	port0.join();
+	port1.join();
+	other.join();
+
+	CHECK_EQUAL(nFailed, 0);
+
+	//one probe per job, and every number handed out once
+	CHECK_EQUAL(Probes(L"CTR0:") + Probes(L"CTR1:"), 2 * JOBS);
+	CHECK_EQUAL(CountFiles(szDir), 3 * JOBS);
+	CHECK_EQUAL(NextCounterValue(szDir), 3 * JOBS + 1);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestNoCounter()
+{
+	WCHAR szDir[MAX_PATH + 1];
+	LONG nFailed = 0;
+
+	MakeDir(szDir, L"probing");
+
+	AddPort(L"PRB0:", szDir);
+	AddPort(L"PRB1:", szDir);
+
+	std::thread port0(PrintJobs, L"PRB0:", JOBS, &nFailed);
+	std::thread port1(PrintJobs, L"PRB1:", JOBS, &nFailed);
+
+	port0.join();
+	port1.join();
+
+	CHECK_EQUAL(nFailed, 0);
+	CHECK(Probes(L"PRB0:") + Probes(L"PRB1:") >= 2 * JOBS);
+	CHECK_EQUAL(CountFiles(szDir), 2 * JOBS);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestCorruptCounter()
+{
+	static const char garbage[] = "not a counter file";
+	WCHAR szDir[MAX_PATH + 1];
+	LONG nFailed = 0;
+
+	MakeDir(szDir, L"corrupt");
+	WriteCounterFile(szDir, garbage, sizeof(garbage));
+
+	AddPort(L"BAD0:", szDir);
+
+	//probes past the files already there, and puts the counter right
+	PrintJobs(L"BAD0:", 1, &nFailed);
+	OtherMonitor(szDir, 1, &nFailed);
+	PrintJobs(L"BAD0:", JOBS - 2, &nFailed);
+
+	CHECK_EQUAL(nFailed, 0);
+	CHECK_EQUAL(Probes(L"BAD0:"), JOBS - 1);
+	CHECK_EQUAL(CountFiles(szDir), JOBS);
+	CHECK_EQUAL(NextCounterValue(szDir), JOBS + 1);
+}
+
+//-------------------------------------------------------------------------------------
+int main()
+{
+	CMockRegistry registry;
+
+	GetTempPathW(LENGTHOF(g_szBaseDir), g_szBaseDir);
+	wcscat_s(g_szBaseDir, LENGTHOF(g_szBaseDir), L"mfmtest_counter");
+	CreateDirectoryW(g_szBaseDir, NULL);
+
+	g_pMonitor = MockMonitorStart(&registry);
+	CHECK(g_pMonitor != NULL);
+	if (!g_pMonitor)
+		return TEST_RESULT();
+
+	TestSharedCounter();
+	TestNoCounter();
+	TestCorruptCounter();
+
+	MockMonitorStop(g_pMonitor);
+
+	return TEST_RESULT();
+}
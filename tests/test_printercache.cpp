@@ -0,0 +1,242 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  CPrinterCache and CCachedPrinter on the mock spooler: ports printing to
+*  the same printer share one handle, idle handles are closed after
+*  PRINTERCACHE_IDLE ms, Discard closes a printer's handles once they are no
+*  longer in use, and a call failing with ERROR_INVALID_HANDLE drops the
+*  handle it was made on.
+*/
+
+#include "../monitor/stdafx.h"
+#include "../mockspl/mockspl.h"
+#include "testutil.h"
+
+//-------------------------------------------------------------------------------------
+static void TestSharing()
+{
+	MOCKCOUNTS counts;
+	CPrinterCache cache(&g_MockSpoolerFuncs);
+
+	MockReset();
+
+	HANDLE h1 = cache.Acquire(L"Printer A");
+	HANDLE h2 = cache.Acquire(L"printer a");
+	HANDLE h3 = cache.Acquire(L"Printer B");
+
+	MockGetCounts(&counts);
+	CHECK(h1 != NULL);
+	CHECK(h1 == h2);
+	CHECK(h3 != NULL && h3 != h1);
+	CHECK_EQUAL(counts.nOpenPrinter, 2);
+	CHECK_EQUAL(counts.nPrinters, 2);
+
+	//released handles stay open for the next job
+	cache.Release(h1, FALSE);
+	cache.Release(h2, FALSE);
+	cache.Release(h3, FALSE);
+	CHECK(cache.Acquire(L"Printer A") == h1);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nOpenPrinter, 2);
+	CHECK_EQUAL(counts.nClosePrinter, 0);
+
+	cache.Release(h1, FALSE);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestOpenFailure()
+{
+	MOCKCOUNTS counts;
+	CPrinterCache cache(&g_MockSpoolerFuncs);
+
+	MockReset();
+
+	//the mock spooler knows no printer without a name
+	CHECK(cache.Acquire(L"") == NULL);
+	CHECK_EQUAL(GetLastError(), ERROR_INVALID_PARAMETER);
+
+	//nothing was cached: the next try opens again
+	CHECK(cache.Acquire(L"") == NULL);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nOpenPrinter, 2);
+	CHECK_EQUAL(counts.nPrinters, 0);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestIdleTimeout()
+{
+	MOCKCOUNTS counts;
+	CPrinterCache cache(&g_MockSpoolerFuncs);
+
+	MockReset();
+
+	HANDLE hA = cache.Acquire(L"Printer A");
+	HANDLE hB = cache.Acquire(L"Printer B");
+	cache.Release(hA, FALSE);
+
+	//idle for one millisecond less than the timeout: kept
+	MockClockAdvance(PRINTERCACHE_IDLE - 1);
+	cache.Release(cache.Acquire(L"Printer C"), FALSE);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 0);
+
+	//the timeout is reached, across the wrap of the tick count: A goes,
+	//B is still in use and stays however long it has been open
+	MockClockAdvance(1);
+	CHECK(cache.Acquire(L"Printer B") == hB);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 1);
+	CHECK_EQUAL(counts.nPrinters, 2);
+
+	//A is opened again on its next use
+	HANDLE hA2 = cache.Acquire(L"Printer A");
+	CHECK(hA2 != NULL);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nOpenPrinter, 4);
+
+	cache.Release(hA2, FALSE);
+	cache.Release(hB, FALSE);
+	cache.Release(hB, FALSE);
+
+	//a timeout later, nothing is in use and everything goes
+	MockClockAdvance(PRINTERCACHE_IDLE);
+	cache.Release(cache.Acquire(L"Printer D"), FALSE);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nPrinters, 1);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestDiscard()
+{
+	MOCKCOUNTS counts;
+	CPrinterCache cache(&g_MockSpoolerFuncs);
+
+	MockReset();
+
+	//not in use: closed at once
+	cache.Release(cache.Acquire(L"Printer A"), FALSE);
+	cache.Discard(L"PRINTER A");
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 1);
+	CHECK_EQUAL(counts.nPrinters, 0);
+
+	//in use: no longer handed out, and closed by the last Release
+	HANDLE h1 = cache.Acquire(L"Printer A");
+	cache.Discard(L"Printer A");
+
+	HANDLE h2 = cache.Acquire(L"Printer A");
+	CHECK(h2 != NULL && h2 != h1);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 1);
+	CHECK_EQUAL(counts.nPrinters, 2);
+
+	cache.Release(h1, FALSE);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 2);
+	CHECK_EQUAL(counts.nPrinters, 1);
+
+	//the new handle is a normal one
+	cache.Release(h2, FALSE);
+	CHECK(cache.Acquire(L"Printer A") == h2);
+	cache.Release(h2, FALSE);
+
+	//a printer nobody opened
+	cache.Discard(L"Printer Z");
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 2);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestInvalidHandle()
+{
+	MOCKCOUNTS counts;
+	BYTE buf[1024];
+	DWORD cbNeeded;
+
+	MockReset();
+
+	g_pPrinterCache = new CPrinterCache(&g_MockSpoolerFuncs);
+
+	//a job call on a printer that went away drops the handle
+	{
+		CCachedPrinter printer(L"Printer A");
+		CHECK(printer.Handle() != NULL);
+		CHECK(printer.GetJob(1, 2, buf, sizeof(buf), &cbNeeded));
+
+		JOB_INFO_2W* pji = reinterpret_cast<JOB_INFO_2W*>(buf);
+		CHECK(wcscmp(pji->pPrinterName, L"Printer A") == 0);
+
+		MockFailSpooler(ERROR_INVALID_HANDLE, 1);
+		CHECK(!printer.SetJob(1, JOB_CONTROL_DELETE));
+	}
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nClosePrinter, 1);
+	CHECK_EQUAL(counts.nPrinters, 0);
+
+	//any other failure keeps it
+	{
+		CCachedPrinter printer(L"Printer A");
+		MockFailSpooler(ERROR_ACCESS_DENIED, 1);
+		CHECK(!printer.GetJob(1, 2, buf, sizeof(buf), &cbNeeded));
+	}
+
+	//and so does a buffer too small
+	{
+		CCachedPrinter printer(L"Printer A");
+		CHECK(!printer.GetJob(1, 2, buf, sizeof(JOB_INFO_2W), &cbNeeded));
+		CHECK_EQUAL(GetLastError(), ERROR_INSUFFICIENT_BUFFER);
+		CHECK(cbNeeded > sizeof(JOB_INFO_2W));
+	}
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nOpenPrinter, 2);
+	CHECK_EQUAL(counts.nPrinters, 1);
+
+	//the cache closes what it still holds
+	delete g_pPrinterCache;
+	g_pPrinterCache = NULL;
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nPrinters, 0);
+}
+
+//-------------------------------------------------------------------------------------
+int main()
+{
+	TestSharing();
+	TestOpenFailure();
+	TestIdleTimeout();
+	TestDiscard();
+	TestInvalidHandle();
+
+	return TEST_RESULT();
+}
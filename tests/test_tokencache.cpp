@@ -0,0 +1,269 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/*
+*  CTokenCache on the mock logon provider: entries are shared by user,
+*  domain and password digest, unused ones expire after TOKENCACHE_TTL ms,
+*  the ones in use are renewed after TOKENCACHE_REFRESH ms (and not again
+*  before TOKENCACHE_RETRY ms when that fails), and passwords are only kept
+*  while an entry is in use.
+*/
+
+#include "../monitor/stdafx.h"
+#include "../monitor/log.h"
+#include "../mockspl/mockspl.h"
+#include "testutil.h"
+
+//-------------------------------------------------------------------------------------
+static void TestSharing()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY p1, p2, p3;
+
+	MockReset();
+
+	CHECK_EQUAL(cache.Acquire(L"alice", L"CORP", L"secret", &p1), ERROR_SUCCESS);
+	CHECK_EQUAL(cache.Acquire(L"ALICE", L"corp", L"secret", &p2), ERROR_SUCCESS);
+	CHECK(p1 == p2);
+	CHECK_EQUAL(p1->nRefs, 2);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 1);
+
+	//released entries stay cached, without their password
+	cache.Release(p1);
+	cache.Release(p2);
+	CHECK(p1->szPassword == NULL);
+
+	CHECK_EQUAL(cache.Acquire(L"alice", L"CORP", L"secret", &p3), ERROR_SUCCESS);
+	CHECK(p3 == p1);
+	CHECK(p3->szPassword != NULL && wcscmp(p3->szPassword, L"secret") == 0);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 1);
+	CHECK_EQUAL(counts.nCloseToken, 0);
+
+	cache.Release(p3);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestKeying()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY p1, p2, p3, p4;
+
+	MockReset();
+
+	//no domain and an empty one are the same account
+	CHECK_EQUAL(cache.Acquire(L"bob", NULL, L"one", &p1), ERROR_SUCCESS);
+	CHECK_EQUAL(cache.Acquire(L"bob", L"", L"one", &p2), ERROR_SUCCESS);
+	CHECK(p1 == p2);
+
+	//a different password is a different entry, and so is another domain
+	CHECK_EQUAL(cache.Acquire(L"bob", NULL, L"two", &p3), ERROR_SUCCESS);
+	CHECK(p3 != p1);
+	CHECK_EQUAL(cache.Acquire(L"bob", L"CORP", L"one", &p4), ERROR_SUCCESS);
+	CHECK(p4 != p1 && p4 != p3);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 3);
+	CHECK_EQUAL(counts.nTokens, 3);
+
+	cache.Release(p1);
+	cache.Release(p2);
+	cache.Release(p3);
+	cache.Release(p4);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestLogonFailure()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY p1;
+
+	MockReset();
+
+	//the error goes back to the port, and nothing is cached
+	MockFailLogon(ERROR_LOGON_FAILURE, 1);
+	CHECK_EQUAL(cache.Acquire(L"carol", NULL, L"wrong", &p1), ERROR_LOGON_FAILURE);
+
+	CHECK_EQUAL(cache.Acquire(L"carol", NULL, L"wrong", &p1), ERROR_SUCCESS);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+	CHECK_EQUAL(counts.nTokens, 1);
+
+	cache.Release(p1);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestExpiry()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY pA, pB, p;
+
+	MockReset();
+
+	cache.Acquire(L"alice", NULL, L"a", &pA);
+	cache.Acquire(L"bob", NULL, L"b", &pB);
+	cache.Release(pA);
+
+	//unused for one millisecond less than the TTL: kept, across the wrap of
+	//the tick count; B is in use and is renewed instead
+	MockClockAdvance(TOKENCACHE_TTL - 1);
+	MockFailLogon(ERROR_LOGON_FAILURE, 1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nCloseToken, 0);
+
+	//the TTL is reached: A goes, B stays however old its token is
+	MockClockAdvance(1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nCloseToken, 1);
+	CHECK_EQUAL(counts.nTokens, 1);
+
+	//A logs on again on its next use
+	CHECK_EQUAL(cache.Acquire(L"alice", NULL, L"a", &p), ERROR_SUCCESS);
+	CHECK(p->szPassword != NULL);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 4);
+
+	cache.Release(p);
+	cache.Release(pB);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestRefresh()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY pOld, pNew;
+
+	MockReset();
+
+	cache.Acquire(L"alice", NULL, L"secret", &pOld);
+
+	//too young to be renewed
+	MockClockAdvance(TOKENCACHE_REFRESH - 1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 1);
+
+	//renewed: the old entry is superseded and ports get the new one
+	MockClockAdvance(1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+	CHECK(pOld->bSuperseded);
+
+	CHECK_EQUAL(cache.Acquire(L"alice", NULL, L"secret", &pNew), ERROR_SUCCESS);
+	CHECK(pNew != pOld);
+	CHECK(!pNew->bSuperseded);
+	CHECK(pNew->szPassword != NULL && wcscmp(pNew->szPassword, L"secret") == 0);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+
+	//the old one goes with its last reference
+	cache.Release(pOld);
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nCloseToken, 1);
+	CHECK_EQUAL(counts.nTokens, 1);
+
+	//an entry nobody uses is not renewed, it expires
+	cache.Release(pNew);
+	MockClockAdvance(TOKENCACHE_REFRESH);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+}
+
+//-------------------------------------------------------------------------------------
+static void TestRetry()
+{
+	MOCKCOUNTS counts;
+	CTokenCache cache(&g_MockTokenFuncs);
+	CTokenCache::LPTOKENENTRY p;
+
+	MockReset();
+
+	cache.Acquire(L"alice", NULL, L"secret", &p);
+
+	//a failed renewal keeps the entry as it is
+	MockClockAdvance(TOKENCACHE_REFRESH);
+	MockFailLogon(ERROR_LOGON_FAILURE, 1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+	CHECK(!p->bSuperseded);
+
+	//and is not tried again before TOKENCACHE_RETRY ms
+	MockClockAdvance(TOKENCACHE_RETRY - 1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 2);
+
+	MockClockAdvance(1);
+	cache.Maintain();
+
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nLogon, 3);
+	CHECK(p->bSuperseded);
+
+	cache.Release(p);
+}
+
+//-------------------------------------------------------------------------------------
+int main()
+{
+	//failed renewals are logged
+	g_pLog = new CMfmLog();
+	g_pLog->SetLogLevel(LOGLEVEL_NONE);
+
+	TestSharing();
+	TestKeying();
+	TestLogonFailure();
+	TestExpiry();
+	TestRefresh();
+	TestRetry();
+
+	MOCKCOUNTS counts;
+	MockGetCounts(&counts);
+	CHECK_EQUAL(counts.nTokens, 0);
+
+	delete g_pLog;
+	g_pLog = NULL;
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,59 @@
+/*
+MFILEMON - print to file with automatic filename assignment
+Copyright (C) 2007-2023 Lorenzo Monti
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#pragma once
+
+#include <stdio.h>
+
+/*
+*  the few checks the tests need. A failed CHECK reports itself and the test
+*  goes on; TEST_RESULT is what main returns, so that ctest sees the failures
+*/
+
+static int g_nChecks = 0;
+static int g_nFailures = 0;
+
+#define CHECK(x) \
+	do \
+	{ \
+		g_nChecks++; \
+		if (!(x)) \
+		{ \
+			g_nFailures++; \
+			fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #x); \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(a, b) \
+	do \
+	{ \
+		g_nChecks++; \
+		long long _a = static_cast<long long>(a); \
+		long long _b = static_cast<long long>(b); \
+		if (_a != _b) \
+		{ \
+			g_nFailures++; \
+			fprintf(stderr, "%s(%d): CHECK_EQUAL(%s, %s) failed: %lld != %lld\n", \
+				__FILE__, __LINE__, #a, #b, _a, _b); \
+		} \
+	} while (0)
+
+#define TEST_RESULT() \
+	(printf("%d checks, %d failed\n", g_nChecks, g_nFailures), g_nFailures ? 1 : 0)